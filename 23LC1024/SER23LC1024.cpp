@@ -54,7 +54,7 @@ bool Ser23LC1024::isRAMBusy()
 bool Ser23LC1024::read(uint32_t startAdr, uint32_t len, uint8_t* data) 
 {
     // assertion
-    if (startAdr+len>0x1F3FF)
+    if (startAdr+len>RAM_USABLE_SIZE)
 		{
         return 0;
 		}
@@ -65,10 +65,18 @@ bool Ser23LC1024::read(uint32_t startAdr, uint32_t len, uint8_t* data)
     _spi->write(HIGH(startAdr));
 		_spi->write(MIDDLE(startAdr));
 		_spi->write(LOW(startAdr));
-    // read data into buffer
-    for (uint32_t i=0;i<len;i++) 
+    // read data into buffer. Long reads from a thread go through DMA so the CPU is free meanwhile
+    if (len >= RAM_DMA_MIN_LENGTH && __get_IPSR() == 0)
 		{
-        data[i]=_spi->write(0);
+        uint8_t fill = 0;
+        _spi->bulkReadWrite(data, &fill, len, false);
+    }
+    else
+		{
+        for (uint32_t i=0;i<len;i++) 
+				{
+            data[i]=_spi->write(0);
+        }
     }
     _enable->write(1);
 		isBusy = false;
@@ -77,7 +85,7 @@ bool Ser23LC1024::read(uint32_t startAdr, uint32_t len, uint8_t* data)
 
 bool Ser23LC1024::write(uint32_t startAdr, uint32_t len, const uint8_t* data) 
 {
-    if (startAdr+len>0x1F3FF)
+    if (startAdr+len>RAM_USABLE_SIZE)
         return false;
 
     uint32_t ofs=0;
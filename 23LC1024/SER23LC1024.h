@@ -34,6 +34,9 @@
 #define RAM_CMD_RDMR    0x05
 #define RAM_CMD_WRMR    0x01
 
+#define RAM_USABLE_SIZE 0x1F400 //read and write reject anything that ends past this, the top 3KB of the chip are not handed out
+#define RAM_DMA_MIN_LENGTH 64 //reads shorter than this are done byte by byte, DMA setup would cost more than it saves
+
 
 /**
 A class to read and write Ser23LC1024 serial SPI RAM devices from Microchip.
@@ -58,8 +61,8 @@ class Ser23LC1024
         /**
             read a part of the RAM memory. The buffer will be allocated here, and must be freed by the user
             @param startAdr the adress where to start reading. Doesn't need to match a page boundary
-            @param len the number of bytes to read (must not exceed the end of memory)
-            @return the number of bytes read
+            @param len the number of bytes to read, startAdr+len must not exceed RAM_USABLE_SIZE
+            @return true if data was read, false if the range is out of bounds
         */
         bool read(uint32_t startAdr, uint32_t len, uint8_t* data);
         
@@ -67,8 +70,8 @@ class Ser23LC1024
             writes the given buffer into the memory. This function handles dividing the write into 
             pages, and waites until the phyiscal write has finished
             @param startAdr the adress where to start writing. Doesn't need to match a page boundary
-            @param len the number of bytes to read (must not exceed the end of memory)
-            @return true if data was read, false if it was not
+            @param len the number of bytes to write, startAdr+len must not exceed RAM_USABLE_SIZE
+            @return true if data was written, false if the range is out of bounds
         */
         bool write(uint32_t startAdr, uint32_t len, const uint8_t* data);
         /**
@@ -25,11 +25,7 @@
 
 /*
 MITM loads rules from /MITM/filename.txt and allocates them in RAM.
-An index is allocated in tmpBuffer (IRAM) containing the offsets in XRAM for the rules.
-The structure is as follows:
-IRAM index:
-	-Target ID (2 bytes)
-	-Rule offset in XRAM (3 bytes)
+An index is allocated in tmpBuffer (IRAM) that finds the XRAM rule block of an ID in constant time, see can_mitm_index.h.
 
 XRAM Rules:
 	-Condition bytes (2 bytes)
@@ -38,13 +34,14 @@ XRAM Rules:
 	-Action payload (8 bytes)
 
 Rules are consecutively stored in XRAM, using 0xFFFF in the Condition bytes to indicate that there are no more rules following.
+When MITM starts they are compiled into IRAM, see can_mitm_rules.h.
 */
 
 
 
 #include "CAN_MITM.h"
 
-CAN_MITM::CAN_MITM(CANbadger *_canbadger, CAN *canbus1, CAN *canbus2, CANFormat format,  uint8_t *BSBuffr, Ser23LC1024 *ram, DigitalIn *backButton)
+CAN_MITM::CAN_MITM(CANbadger *_canbadger, CAN *canbus1, CAN *canbus2, CANFormat format,  uint8_t *BSBuffr, Ser23LC1024 *ram, DigitalIn *backButton) : ruleIndex(BSBuffr)
 {
 	canbadger=_canbadger;
 	_canbus1=canbus1;
@@ -53,21 +50,31 @@ CAN_MITM::CAN_MITM(CANbadger *_canbadger, CAN *canbus1, CAN *canbus2, CANFormat
 	frameFormat = format;
 	_backButton = backButton;
 	BSBuffer = BSBuffr;
+	forwarded = 0;
+	modified = 0;
+	dropped = 0;
+	threadFrames = 0;
+	overflowHead = 0;
+	overflowTail = 0;
+	waiter = NULL;
+	running = false;
+	restoreBridge = false;
 }
 
 CAN_MITM::~CAN_MITM()
 {
+	stop();
 }
 
 void CAN_MITM::doMITM()
 {
-	CANMessage can1_msg(0,CANAny);
-	CANMessage can2_msg(0,CANAny);
-	uint32_t checkTable=0;
 	EthernetManager *ethMan = canbadger->getEthernetManager();
+	waiter = osThreadGetId();
+	start();
 
 	while(1)
 	{
+		handleThreadFrames();
 
 		// run the EthernetManagers Loop
 		ethMan->run();
@@ -84,124 +91,202 @@ void CAN_MITM::doMITM()
 				break;
 			}
 		}
+		Thread::signal_wait(CAN_MITM_SIGNAL, CAN_MITM_POLL_TIME);//the RX interrupt does the forwarding, and wakes us for frames it queued
+	}
+	stop();
+	waiter = NULL;
+	if(canbadger->ethernet_manager != NULL)
+	{
+		char stats[160];
+		snprintf(stats, sizeof(stats), "MITM: %u forwarded, %u modified, %u dropped, %u handled by the thread, latency avg %u us, max %u us, p99 %u us",
+				(unsigned int)forwarded, (unsigned int)modified, (unsigned int)dropped, (unsigned int)threadFrames,
+				(unsigned int)latency.getMean(), (unsigned int)latency.getMax(), (unsigned int)latency.getPercentile(99));
+		ethMan->debugLog(stats);
+	}
+}
 
-/*		if(!uartMode && !settings->currentActionIsRunning)
-			break;*/
+void CAN_MITM::start()
+{
+	if(running)
+	{
+		return;
+	}
+	restoreBridge = canbadger->getCANBadgerStatus(CAN_BRIDGE_ENABLED);
+	if(restoreBridge)
+	{
+		canbadger->CANBridge(0);//it would take the RX interrupt from us
+	}
+	compiledRules.load(_ram, ruleIndex.getCount());//no more SPI reads per frame, unless there are more rules than fit
+	fixups.reset();
+	forwarded = 0;
+	modified = 0;
+	dropped = 0;
+	threadFrames = 0;
+	overflowHead = 0;
+	overflowTail = 0;
+	latency.clear();
+	EthernetManager *ethMan = canbadger->getEthernetManager();
+	if(ethMan != NULL && compiledRules.getOverflowBlocks() != 0)
+	{
+		char note[96];
+		snprintf(note, sizeof(note), "MITM: rules of %u IDs did not fit in IRAM, their frames take the slower thread path",
+				(unsigned int)compiledRules.getOverflowBlocks());
+		ethMan->debugLog(note);
+	}
+	CANTxQueue::getQueue(_canbus1)->start();//the RX interrupt pushes, and a queue cannot be started from there
+	CANTxQueue::getQueue(_canbus2)->start();
+	running = true;
+	_canbus1->attach(this, &CAN_MITM::rxISR, CAN::RxIrq);
+	_canbus2->attach(this, &CAN_MITM::rxISR, CAN::RxIrq);
+}
 
-		if(_canbus1->read(can1_msg) && can1_msg.id != 0 )
+void CAN_MITM::stop()
+{
+	if(!running)
+	{
+		return;
+	}
+	_canbus1->attach(0, CAN::RxIrq);
+	_canbus2->attach(0, CAN::RxIrq);
+	running = false;
+	handleThreadFrames();//what the interrupt left still goes out, the rules are needed for it
+	compiledRules.release();
+	if(restoreBridge)
+	{
+		canbadger->CANBridge(1);
+		restoreBridge = false;
+	}
+}
+
+// both controllers share one interrupt, so whichever bus fired, everything pending on either is handled
+void CAN_MITM::rxISR()
+{
+	CANMessage canMsg(0,CANAny);
+	uint32_t head = overflowHead;
+	while(_canbus1->read(canMsg))
+	{
+		if(canMsg.id != 0)
 		{
-			checkTable=tableLookUp(can1_msg.id);
-			if(checkTable == 0xFFFFFFFF)//if the ID has no rules
-			{
-				uint8_t timeout=0;
-				while(!_canbus2->write(CANMessage(can1_msg.id, reinterpret_cast<char*>(&can1_msg.data), can1_msg.len, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-				{
-					wait(0.0001);
-					timeout++;
-				}//make sure the msg goes out
-			}
-			else
-			{
-				if (!checkRule(1,checkTable,can1_msg.id,can1_msg.data,can1_msg.len))//check for rules
-				{
-					uint8_t timeout=0;
-					while(!_canbus2->write(CANMessage(can1_msg.id, reinterpret_cast<char*>(&can1_msg.data), can1_msg.len, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-					{
-						timeout++;
-						wait(0.0001);
-					}//make sure the msg goes out
-				}
-			}
+			handleFrame(1, canMsg, Timebase::now());
 		}
-		if(_canbus2->read(can2_msg) && can2_msg.id != 0)
+		canMsg.format = CANAny;
+	}
+	while(_canbus2->read(canMsg))
+	{
+		if(canMsg.id != 0)
 		{
-			checkTable=tableLookUp(can2_msg.id);
-			if(checkTable == 0xFFFFFFFF)//if the ID has no rules
-			{
-				uint8_t timeout=0;
-				while(!_canbus1->write(CANMessage(can2_msg.id, reinterpret_cast<char*>(&can2_msg.data), can2_msg.len, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-				{
-					timeout++;
-					wait(0.0001);
-				}//make sure the msg goes out
-			}
-			else
-			{
-				if(!checkRule(2,checkTable,can2_msg.id,can2_msg.data,can2_msg.len))//check for rules
-				{
-					uint8_t timeout=0;
-					while(!_canbus1->write(CANMessage(can2_msg.id, reinterpret_cast<char*>(&can2_msg.data), can2_msg.len, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-					{
-						timeout++;
-						wait(0.0001);
-					}//make sure the msg goes out
-				}
-			}
+			handleFrame(2, canMsg, Timebase::now());
 		}
+		canMsg.format = CANAny;
+	}
+	osThreadId thread = waiter;
+	if(overflowHead != head && thread != NULL)
+	{
+		osSignalSet(thread, CAN_MITM_SIGNAL);
 	}
 }
 
-uint32_t CAN_MITM::allocRAM(uint32_t ttargetID, uint32_t tOffset)
+// the interrupt side of a frame whose rules are in XRAM, the thread picks it up in handleThreadFrames
+void CAN_MITM::queueForThread(uint8_t busno, CANMessage &msg, uint64_t rxTime)
 {
-	if(ttargetID > 0x7FF && frameFormat == CANStandard)//nope, we dont trust the user
+	uint32_t head = overflowHead;
+	if((head - overflowTail) >= CAN_MITM_OVERFLOW_SIZE)
 	{
-		frameFormat = CANExtended;//so we correct stuff for them
+		count(dropped);//the thread is behind, nowhere to keep it
+		return;
+	}
+	CANMITMFrame &frame = overflow[head & CAN_MITM_OVERFLOW_MASK];
+	frame.rxTime = rxTime;
+	frame.id = msg.id;
+	frame.len = (msg.len > 8) ? 8 : msg.len;
+	memcpy(frame.data, msg.data, 8);
+	frame.busno = busno;
+	__DMB();//the frame has to be complete before the thread can see it
+	overflowHead = (head + 1);
+}
+
+void CAN_MITM::handleThreadFrames()
+{
+	if(overflowTail == overflowHead)
+	{
+		return;
 	}
-	uint32_t maddr = 0;
-	if(tOffset != 0)
+	EthernetManager *ethMan = canbadger->getEthernetManager();
+	if(ethMan != NULL)
 	{
-		//_ram->read((tOffset - 7), 7, BSBuffer);
-		maddr = BSBuffer[(tOffset + 4) - 7];
-		maddr = ((maddr << 8) + BSBuffer[(tOffset + 5) - 7]);
-		maddr = ((maddr << 8) + BSBuffer[(tOffset + 6) - 7]);
-		maddr = (maddr + 1024);
-		uint8_t allocdata[7]={(ttargetID >> 24),(ttargetID >> 16),(ttargetID >> 8), ttargetID, (maddr >> 16), (maddr >> 8), maddr};
-		for(uint8_t a = 0; a < 7; a++)
-		{
-			BSBuffer[a + tOffset] = allocdata[a];
-		}
-		//_ram->write(tOffset, 7, allocdata);
+		ethMan->lockRam();//the spool shares XRAM with the rules
 	}
-	else
+	while(overflowTail != overflowHead)
 	{
-		maddr = 0;
-		uint8_t allocdata[7]={(ttargetID >> 24),(ttargetID >> 16),(ttargetID >> 8), ttargetID, (maddr >> 16), (maddr >> 8), maddr};
-		for(uint8_t a = 0; a < 7; a++)
+		__DMB();
+		CANMITMFrame &frame = overflow[overflowTail & CAN_MITM_OVERFLOW_MASK];
+		if(!checkRule(frame.busno, tableLookUp(frame.id), frame.id, frame.data, frame.len, frame.rxTime))
 		{
-			BSBuffer[a + tOffset] = allocdata[a];
+			forward(frame.busno, frame.id, frame.data, frame.len, false, frame.rxTime);
 		}
-		//_ram->write(tOffset, 7, allocdata);
+		latency.record((uint32_t)(Timebase::now() - frame.rxTime));
+		count(threadFrames);
+		overflowTail = (overflowTail + 1);//the slot goes back to the interrupt
+	}
+	if(ethMan != NULL)
+	{
+		ethMan->unlockRam();
 	}
-	return maddr;
 }
 
-uint32_t CAN_MITM::tableLookUp(uint32_t canID)//will return the pointer to the address where the rules are stored.
+void CAN_MITM::count(volatile uint32_t &counter)
 {
-	uint32_t a=0;
-	while(a < 0x800)
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	counter++;
+	__set_PRIMASK(primask);
+}
+
+uint32_t CAN_MITM::getForwardedCount()
+{
+	return forwarded;
+}
+
+uint32_t CAN_MITM::getModifiedCount()
+{
+	return modified;
+}
+
+uint32_t CAN_MITM::getDroppedCount()
+{
+	return dropped;
+}
+
+uint32_t CAN_MITM::getThreadCount()
+{
+	return threadFrames;
+}
+
+LatencyHistogram* CAN_MITM::getLatency()
+{
+	return &latency;
+}
+
+uint32_t CAN_MITM::allocRAM(uint32_t ttargetID)
+{
+	if(ttargetID > 0x7FF && frameFormat == CANStandard)//nope, we dont trust the user
 	{
-		uint32_t checkedID = BSBuffer[a];
-		checkedID = ((checkedID << 8) + BSBuffer[a+1]);
-		checkedID = ((checkedID << 8) + BSBuffer[a+2]);
-		checkedID = ((checkedID << 8) + BSBuffer[a+3]);
-		if(canID == checkedID)
-		{
-			uint32_t b = BSBuffer[a+4];
-			b = ((b << 8) + BSBuffer[a+5]);
-			b = ((b << 8) + BSBuffer[a+6]);
-			return b;
-		}
-		else if(checkedID ==  0xFFFFFFFF)
-		{
-			return 0xFFFFFFFF;//if not found, return this value
-		}
-		a = a + 7;
+		frameFormat = CANExtended;//so we correct stuff for them
 	}
-	return 0xFFFFFFFF;//if not found, return this value
+	return ruleIndex.add(ttargetID);
+}
+
+uint32_t CAN_MITM::tableLookUp(uint32_t canID)//will return the pointer to the address where the rules are stored.
+{
+	return ruleIndex.find(canID);
 }
 
 bool CAN_MITM::addRule(uint32_t offset, uint32_t cType, uint8_t *tPayload, uint32_t Action, uint8_t *aPayload)//checks if rules already exists and adds them if they dont
 {
+	if(!CANMITMFixup::isValid(Action, aPayload))
+	{
+		return false;
+	}
 	uint32_t c=0;
 	while(c < 51)//max number of rules per ID to be able to store them in XRAM when fetching later
 	{
@@ -231,393 +316,105 @@ bool CAN_MITM::addRule(uint32_t offset, uint32_t cType, uint8_t *tPayload, uint3
 	return false;
 }
 
-uint32_t CAN_MITM::getLastIDEntryOffset()
+bool CAN_MITM::checkRule(uint8_t busno, uint32_t offset, uint32_t ID, uint8_t *data, uint8_t leng, uint64_t rxTime)//checks if there are rules for specific payload and checks for condition matches
 {
-	uint32_t a=0;
-	while(a < 0x800)
+	if(leng > 8)
 	{
-		uint32_t checkedID = BSBuffer[a];
-		checkedID = ((checkedID << 8) + BSBuffer[a+1]);
-		checkedID = ((checkedID << 8) + BSBuffer[a+2]);
-		checkedID = ((checkedID << 8) + BSBuffer[a+3]);
-		if(checkedID ==  0xFFFFFFFF)
-		{
-			return a;
-		}
-		a = a + 7;
+		leng = 8;
 	}
-	return 0xFFFFFFFF;//if no more space left, return this value
-}
-
-bool CAN_MITM::checkRule(uint8_t busno, uint32_t offset, uint32_t ID, uint8_t *data, uint8_t leng)//checks if there are rules for specific payload and checks for condition matches
-{
-	uint8_t condType = 0;
-	uint8_t condByteMask=0;
-	uint8_t tmpbf[23]={0};
-	uint16_t cnt=0;//to handle rule
-	while(cnt < 51)//max rule storage offset
+	uint64_t frame = 0;//the payload the same way the rules hold it, byte 0 in the lowest bits
+	for(uint8_t a = 0; a < leng; a++)
+	{
+		frame |= ((uint64_t)data[a] << (a * 8));
+	}
+	uint64_t lenMask = (leng == 8) ? ~(uint64_t)0 : (((uint64_t)1 << (leng * 8)) - 1);//bytes past the frame length never count
+	uint32_t block = (offset / CAN_MITM_RULE_BLOCK);
+	const CANMITMRule *rules;
+	uint32_t ruleCount = compiledRules.getRules(block, rules);
+	CANMITMRule scratch;
+	const CANMITMRule *rule;
+	uint64_t toSend = frame;
+	bool fixupsSeen = false;
+	uint32_t a = 0;
+	for(; (rule = ruleAt(block, a, rules, ruleCount, scratch)) != NULL; a++)//the first matching rule picks the action
 	{
-		_ram->read((offset + (cnt * 20)),20, tmpbf); //Grab the rules from XRAM and store it in IRAM for faster handling
-		if(tmpbf[0] == 0xFF && tmpbf[1] == 0xFF)//if we have reached the end of the rules
+		if(CANMITMFixup::isFixup(rule->action))
 		{
-			return false;
+			fixupsSeen = true;
 		}
-		condByteMask=tmpbf[0];
-		condType=tmpbf[1];
-
-		switch (condType)
+		else if(CANMITMRuleSet::matchRule(*rule, frame, lenMask))
 		{
-			case 0://If entire frame matches
-			{
-				uint8_t ccnt=0;
-				for(uint8_t a=0;a<leng;a++)
-				{
-					if(data[a] != tmpbf[2 + a] )
-					{
-						break;
-					}
-					ccnt++;
-				}
-				if (ccnt == leng) { return applyRule(busno, ID, data, leng, tmpbf); }
-				break;
-			}
-			case 1://check for specific bytes if equal
-			{
-				uint8_t ccnt=0;
-				for(uint8_t a=0;a<leng;a++)
-				{
-					if(converti.getBit(condByteMask,a))
-					{
-						if(data[a] != tmpbf[2 + a] )
-						{
-							break;
-						}
-					}
-					ccnt++;
-				}
-				if (ccnt == leng) { return applyRule(busno, ID, data, leng, tmpbf); }
-				break;
-			}
-			case 2://check for specific bytes if greater
-			{
-				uint8_t ccnt=0;
-				for(uint8_t a=0;a<leng;a++)
-				{
-					if(converti.getBit(condByteMask,a))
-					{
-						if(data[a] <= tmpbf[2 + a] )
-						{
-							break;
-						}
-					}
-					ccnt++;
-				}
-				if (ccnt == leng) { return applyRule(busno, ID, data, leng, tmpbf); }
-				break;
-			}
-			case 3://check for specific bytes if less
+			if(!CANMITMRuleSet::applyRule(*rule, frame, leng, toSend))
 			{
-				uint8_t ccnt=0;
-				for(uint8_t a=0;a<leng;a++)
-				{
-					if(converti.getBit(condByteMask,a))
-					{
-						if(data[a] >= tmpbf[2 + a] )
-						{
-							break;
-						}
-					}
-					ccnt++;
-				}
-				if (ccnt == leng) { return applyRule(busno, ID, data, leng, tmpbf); }
-				break;
+				count(dropped);
+				return true;//do nothing so the frame will be dropped
 			}
-			default:
+			a++;
+			break;
+		}
+	}
+	if(fixupsSeen || rule != NULL)//fix-ups can be anywhere in the list, so only what was not looked at yet can be skipped when none came up
+	{
+		for(uint32_t b = (fixupsSeen ? 0 : a); (rule = ruleAt(block, b, rules, ruleCount, scratch)) != NULL; b++)
+		{
+			if(CANMITMFixup::isFixup(rule->action) && CANMITMRuleSet::matchRule(*rule, frame, lenMask))
 			{
-				return false;//unknown type or the end of the rules, so just forward the frame as it is and dont check for more rules
+				toSend = fixups.apply(*rule, block, toSend, leng);
 			}
 		}
-		cnt++;
 	}
-    return false;
+	if(((toSend ^ frame) & lenMask) == 0)
+	{
+		return false;//nothing changed, so it goes out as it came in
+	}
+	uint8_t out[8];
+	for(uint8_t b = 0; b < 8; b++)
+	{
+		out[b] = (toSend >> (b * 8));
+	}
+	forward(busno, ID, out, leng, true, rxTime);
+	return true;//rule applied, so nothing more to see here
 }
 
+// rule index of block, from the compiled rules if there are any or straight from XRAM into scratch. NULL past the last rule
+const CANMITMRule* CAN_MITM::ruleAt(uint32_t block, uint32_t index, const CANMITMRule *rules, uint32_t ruleCount, CANMITMRule &scratch)
+{
+	if(ruleCount != CAN_MITM_RULES_IN_XRAM)
+	{
+		return (index < ruleCount) ? &rules[index] : NULL;
+	}
+	return compiledRules.readRule(block, index, scratch) ? &scratch : NULL;//not compiled, so go through XRAM rule by rule
+}
 
-// if checkRule() found an applicable rule, this function will be called and the message will be transformed or discarded according to actionType and actionByteMask
-bool CAN_MITM::applyRule(uint8_t busno, uint32_t ID, uint8_t *data, uint8_t leng, uint8_t *tmpbf) {
-	uint8_t actionType = tmpbf[11];
-	uint8_t actionByteMask = tmpbf[10];
+// runs a frame received on busno through its rules and passes on whatever comes out
+void CAN_MITM::handleFrame(uint8_t busno, CANMessage &msg, uint64_t rxTime)
+{
+	uint32_t checkTable = tableLookUp(msg.id);
+	if(checkTable != CAN_MITM_NO_RULES && !compiledRules.isResident(checkTable / CAN_MITM_RULE_BLOCK))
+	{
+		queueForThread(busno, msg, rxTime);//its rules would have to be read from XRAM
+		return;
+	}
+	if(checkTable == CAN_MITM_NO_RULES || !checkRule(busno, checkTable, msg.id, msg.data, msg.len, rxTime))//no rules, or none of them applied
+	{
+		forward(busno, msg.id, msg.data, msg.len, false, rxTime);
+	}
+	latency.record((uint32_t)(Timebase::now() - rxTime));
+}
 
-	switch (actionType)
+// the one place frames leave the MITM, out of the bus they did not come in on
+void CAN_MITM::forward(uint8_t busno, uint32_t ID, const uint8_t *data, uint8_t leng, bool changed, uint64_t rxTime)
+{
+	if(CANTxQueue::getQueue((busno == 1) ? _canbus2 : _canbus1)->push(ID, data, leng, frameFormat, CANData, rxTime) == 0)//queued, the TX interrupt sends it
 	{
-		case 0://Swap an entire frame
-		{
-			uint8_t toSend[8] = {tmpbf[12], tmpbf[13],tmpbf[14],tmpbf[15],tmpbf[16],tmpbf[17],tmpbf[18],tmpbf[19]};
-			if (busno == 1)
-			{
-				uint8_t timeout=0;
-				while(!_canbus2->write(CANMessage(ID, reinterpret_cast<char*>(&toSend), leng, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-				{
-					timeout++;
-					wait(0.0001);
-				}//make sure the msg goes out
-			}
-			else
-			{
-				uint8_t timeout=0;
-				while(!_canbus1->write(CANMessage(ID, reinterpret_cast<char*>(&toSend), leng, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-				{
-					timeout++;
-					wait(0.0001);
-				}//make sure the msg goes out
-			}
-			return true;//rule applied, so nothing more to see here
-		}
-		case 1://Swap specific bytes
-		{
-			uint8_t toSend[8]={0};
-			for(uint8_t a=0;a<leng;a++)
-			{
-				if(converti.getBit(actionByteMask,a))
-				{
-					toSend[a]=tmpbf[12 + a];
-				}
-				else
-				{
-					toSend[a]=data[a];
-				}
-			}
-			if (busno == 1)
-			{
-				uint8_t timeout=0;
-				while(!_canbus2->write(CANMessage(ID, reinterpret_cast<char*>(&toSend), leng, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-				{
-					timeout++;
-					wait(0.0001);
-				}//make sure the msg goes out
-			}
-			else
-			{
-				uint8_t timeout=0;
-				while(!_canbus1->write(CANMessage(ID, reinterpret_cast<char*>(&toSend), leng, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-				{
-					timeout++;
-					wait(0.0001);
-				}//make sure the msg goes out
-			}
-			return true;
-		}
-		case 2://add a fixed value to specific bytes
-		{
-			uint8_t toSend[8]={0};
-			for(uint8_t a=0;a<leng;a++)
-			{
-				if(converti.getBit(actionByteMask,a))
-				{
-					toSend[a]=(data[a] + tmpbf[12 + a]);
-				}
-				else
-				{
-					toSend[a]=data[a];
-				}
-			}
-			if (busno == 1)
-			{
-				uint8_t timeout=0;
-				while(!_canbus2->write(CANMessage(ID, reinterpret_cast<char*>(&toSend), leng, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-				{
-					timeout++;
-					wait(0.0001);
-				}//make sure the msg goes out
-			}
-			else
-			{
-				uint8_t timeout=0;
-				while(!_canbus1->write(CANMessage(ID, reinterpret_cast<char*>(&toSend), leng, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-				{
-					timeout++;
-					wait(0.0001);
-				}//make sure the msg goes out
-			}
-			return true;
-		}
-		case 3://substract a fixed value to specific bytes
-		{
-			uint8_t toSend[8]={0};
-			for(uint8_t a=0;a<leng;a++)
-			{
-				if(converti.getBit(actionByteMask,a))
-				{
-					toSend[a]=(data[a] - tmpbf[12 + a]);
-				}
-				else
-				{
-					toSend[a]=data[a];
-				}
-			}
-			if (busno == 1)
-			{
-				uint8_t timeout=0;
-				while(!_canbus2->write(CANMessage(ID, reinterpret_cast<char*>(&toSend), leng, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-				{
-					timeout++;
-					wait(0.0001);
-				}//make sure the msg goes out
-			}
-			else
-			{
-				uint8_t timeout=0;
-				while(!_canbus1->write(CANMessage(ID, reinterpret_cast<char*>(&toSend), leng, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-				{
-					timeout++;
-					wait(0.0001);
-				}//make sure the msg goes out
-			}
-			return true;
-		}
-		case 4://Multiply specific bytes
-		{
-			uint8_t toSend[8]={0};
-			for(uint8_t a=0;a<leng;a++)
-			{
-				if(converti.getBit(actionByteMask,a))
-				{
-					toSend[a]=(data[a] * tmpbf[12 + a]);
-				}
-				else
-				{
-					toSend[a]=data[a];
-				}
-			}
-			if (busno == 1)
-			{
-				uint8_t timeout=0;
-				while(!_canbus2->write(CANMessage(ID, reinterpret_cast<char*>(&toSend), leng, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-				{
-					timeout++;
-					wait(0.0001);
-				}//make sure the msg goes out
-			}
-			else
-			{
-				uint8_t timeout=0;
-				while(!_canbus1->write(CANMessage(ID, reinterpret_cast<char*>(&toSend), leng, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-				{
-					timeout++;
-					wait(0.0001);
-				}//make sure the msg goes out
-			}
-			return true;
-		}
-		case 5://Divide specific bytes
-		{
-			uint8_t toSend[8]={0};
-			for(uint8_t a=0;a<leng;a++)
-			{
-				if(converti.getBit(actionByteMask,a))
-				{
-					toSend[a]=(data[a] / tmpbf[12 + a]);
-				}
-				else
-				{
-					toSend[a]=data[a];
-				}
-			}
-			if (busno == 1)
-			{
-				uint8_t timeout=0;
-				while(!_canbus2->write(CANMessage(ID, reinterpret_cast<char*>(&toSend), leng, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-				{
-					timeout++;
-					wait(0.0001);
-				}//make sure the msg goes out
-			}
-			else
-			{
-				uint8_t timeout=0;
-				while(!_canbus1->write(CANMessage(ID, reinterpret_cast<char*>(&toSend), leng, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-				{
-					timeout++;
-					wait(0.0001);
-				}//make sure the msg goes out
-			}
-			return true;
-		}
-		case 6://Increase a percent to specific bytes
-		{
-			uint8_t toSend[8]={0};
-			for(uint8_t a=0;a<leng;a++)
-			{
-				if(converti.getBit(actionByteMask,a))
-				{
-					toSend[a]=(data[a] + ((data[a] * tmpbf[12 + a]) / 100));
-				}
-				else
-				{
-					toSend[a]=data[a];
-				}
-			}
-			if (busno == 1)
-			{
-				uint8_t timeout=0;
-				while(!_canbus2->write(CANMessage(ID, reinterpret_cast<char*>(&toSend), leng, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-				{
-					timeout++;
-					wait(0.0001);
-				}//make sure the msg goes out
-			}
-			else
-			{
-				uint8_t timeout=0;
-				while(!_canbus1->write(CANMessage(ID, reinterpret_cast<char*>(&toSend), leng, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-				{
-					timeout++;
-					wait(0.0001);
-				}//make sure the msg goes out
-			}
-			return true;
-		}
-		case 7://Decrease a percent to specific bytes
-		{
-			uint8_t toSend[8]={0};
-			for(uint8_t a=0;a<leng;a++)
-			{
-				if(converti.getBit(actionByteMask,a))
-				{
-					toSend[a]=(data[a] - ((data[a] * tmpbf[12 + a]) / 100));
-				}
-				else
-				{
-					toSend[a]=data[a];
-				}
-			}
-			if (busno == 1)
-			{
-				uint8_t timeout=0;
-				while(!_canbus2->write(CANMessage(ID, reinterpret_cast<char*>(&toSend), leng, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-				{
-					timeout++;
-					wait(0.0001);
-				}//make sure the msg goes out
-			}
-			else
-			{
-				uint8_t timeout=0;
-				while(!_canbus1->write(CANMessage(ID, reinterpret_cast<char*>(&toSend), leng, CANData, frameFormat)) && _backButton->read() != 0 && timeout < 100)
-				{
-					timeout++;
-					wait(0.0001);
-				}//make sure the msg goes out
-			}
-			return true;
-		}
-		case 8://drop the frame
-		{
-			return true;//do nothing so the frame will be dropped
-		}
-		default:
-		{
-			return false;//unknown rule, so just forward the frame as it is and dont check for more rules
-		}
+		count(dropped);
+	}
+	else if(changed)
+	{
+		count(modified);
+	}
+	else
+	{
+		count(forwarded);
 	}
 }
@@ -24,11 +24,7 @@
 
 /*
 MITM loads rules from /MITM/rules.txt and allocates them in RAM.
-An index is allocated in BSBuffer (IRAM) containing the offsets in XRAM for the rules.
-The structure is as follows:
-IRAM index:
-	-Target ID (4 bytes)
-	-Rule offset in XRAM (3 bytes)
+An index is allocated in BSBuffer (IRAM) that finds the XRAM rule block of an ID, see can_mitm_index.h.
 
 XRAM Rules:
 	-Condition bytes (2 bytes)
@@ -37,15 +33,43 @@ XRAM Rules:
 	-Action payload (8 bytes)
 
 Rules are consecutively stored in XRAM, using 0xFFFF in the Condition bytes to indicate that there are no more rules following.
+The action of the first rule whose condition matches is applied, then the fix-ups of the ID, see can_mitm_fixup.h.
+When MITM starts they are compiled into IRAM, see can_mitm_rules.h.
+
+While MITM runs, frames are handled in the CAN RX interrupt: every frame the controllers hold is run through its rules
+and queued on the other bus straight away, so nothing waits in the 2-3 frame hardware buffer. The interrupt never
+touches XRAM, the thread side shares the SPI bus with it. Frames of IDs whose rules did not fit in IRAM go into a queue
+of CAN_MITM_OVERFLOW_SIZE instead, and the thread that called doMITM runs them through their rules while it holds the
+XRAM lock of the EthernetManager. Besides that the thread runs the EthernetManager and watches for the stop condition.
 */
 
 #ifndef __CAN_MITM_H__
 #define __CAN_MITM_H__
 
 #include "mbed.h"
+#include "rtos.h"
 #include "SER23LC1024.h"
-#include "conversions.h"
 #include "canbadger.h"
+#include "can_mitm_index.h"
+#include "can_mitm_rules.h"
+#include "can_mitm_fixup.h"
+#include "latency_histogram.h"
+#include "timebase.h"
+
+#define CAN_MITM_POLL_TIME 5 //ms between checks of the stop condition while the interrupt does the forwarding
+#define CAN_MITM_OVERFLOW_SIZE 64 //frames waiting for the thread because their rules are in XRAM, must be a power of two
+#define CAN_MITM_OVERFLOW_MASK (CAN_MITM_OVERFLOW_SIZE - 1)
+#define CAN_MITM_SIGNAL 0x10 //thread signal used to wake doMITM for queued frames. 0x4 and 0x8 are taken by the RX ring and TX queue
+
+// a frame the RX interrupt left for the thread
+struct CANMITMFrame
+{
+	uint64_t rxTime;
+	uint32_t id;
+	uint8_t data[8];
+	uint8_t len;
+	uint8_t busno;
+};
 
 
 class CANbadger;
@@ -59,22 +83,55 @@ class CAN_MITM
 
 				~CAN_MITM();
 
-				void doMITM();
+				void doMITM();//runs until the back button is pressed or the current action is stopped over Ethernet
+
+				/** Compiles the rules and hands both buses to the RX interrupt. The bridge is switched off while MITM runs
+				*/
+				void start();
+
+				void stop();//detaches the RX interrupt, frees the compiled rules and brings the bridge back if it was on
+
+				uint32_t getForwardedCount();//frames passed on as they came in
+
+				uint32_t getModifiedCount();//frames passed on after a rule changed them
+
+				uint32_t getDroppedCount();//frames dropped by a rule, or because the TX queue of the other bus or the thread queue was full
+
+				uint32_t getThreadCount();//frames handled by the thread because their rules are in XRAM
 
-				uint32_t tableLookUp(uint32_t canID);
+				LatencyHistogram* getLatency();//us from the RX interrupt to the frame being queued or dropped
 
-				uint32_t allocRAM(uint32_t ttargetID, uint32_t tOffset);
+				uint32_t tableLookUp(uint32_t canID);//XRAM offset of the rules of canID, CAN_MITM_NO_RULES if it has none
+
+				uint32_t allocRAM(uint32_t ttargetID);//XRAM offset for the rules of a new ID, CAN_MITM_NO_RULES if there is no room left
 
 				bool addRule(uint32_t offset, uint32_t cType, uint8_t *tPayload, uint32_t Action, uint8_t *aPayload);
 
-				uint32_t getLastIDEntryOffset();
+				/** Runs a frame through the rules at offset and passes it on if one of them changed it. Reads XRAM if the
+					rules are not resident, so from the RX interrupt only for resident ones
 
-				bool checkRule(uint8_t busno, uint32_t offset, uint32_t ID, uint8_t *data, uint8_t leng);
+					@param rxTime when the frame was received, from Timebase::now
 
-				bool applyRule(uint8_t busno, uint32_t ID, uint8_t *data, uint8_t leng, uint8_t *tmpbf);
+					@return true if the frame was passed on or dropped, false if it still has to be forwarded as it came in
+				*/
+				bool checkRule(uint8_t busno, uint32_t offset, uint32_t ID, uint8_t *data, uint8_t leng, uint64_t rxTime);
 
 	private:
 
+	const CANMITMRule* ruleAt(uint32_t block, uint32_t index, const CANMITMRule *rules, uint32_t ruleCount, CANMITMRule &scratch);
+
+	void rxISR();
+
+	void handleFrame(uint8_t busno, CANMessage &msg, uint64_t rxTime);
+
+	void queueForThread(uint8_t busno, CANMessage &msg, uint64_t rxTime);
+
+	void handleThreadFrames();//runs the frames the interrupt queued through their rules, XRAM locked
+
+	void forward(uint8_t busno, uint32_t ID, const uint8_t *data, uint8_t leng, bool changed, uint64_t rxTime);
+
+	void count(volatile uint32_t &counter);//the thread and the interrupt both count, so with interrupts off
+
 	CANbadger* canbadger;
 	CAN* _canbus1;
 	CAN* _canbus2;
@@ -82,7 +139,20 @@ class CAN_MITM
 	CANFormat frameFormat;
 	DigitalIn* _backButton;
 	uint8_t* BSBuffer;
-	Conversions converti;
+	CANMITMIndex ruleIndex;
+	CANMITMRuleSet compiledRules;
+	CANMITMFixup fixups;
+	volatile uint32_t forwarded;
+	volatile uint32_t modified;
+	volatile uint32_t dropped;
+	volatile uint32_t threadFrames;
+	CANMITMFrame overflow[CAN_MITM_OVERFLOW_SIZE];//written by the interrupt, read by the thread
+	volatile uint32_t overflowHead;
+	volatile uint32_t overflowTail;
+	volatile osThreadId waiter;//thread to signal when a frame was queued, NULL if none waits
+	LatencyHistogram latency;
+	bool running;
+	bool restoreBridge;
 
 };
 
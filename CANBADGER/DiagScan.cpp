@@ -70,14 +70,14 @@ uint32_t DiagSCAN::ScanActiveUDSIDsFromLog(uint32_t *IDList, const char *fileNam
 	{
 		return 0xFFFFFFFE;//SD Error
 	}
-	uint16_t IDCount=0;//to keep track of the stored IDs
-    uint32_t IDs[512]={0};//Used to store already found IDs to filter them. Dont expect to find more than 512 IDS in a common-sense bus environment
+	sd->setReadAhead(true);//the log is read a record header at a time, so let the SD stream it in bigger chunks
+    CANIDSet IDs;//Used to store already found IDs to filter them, constant time lookups. Dont expect to find more than 512 IDS in a common-sense bus environment
     CANMessage can_msg(0,CANAny);
     uint32_t channels=0;//to store how many uds channels were detected
     uint32_t arrayPointer = 0;//used to know where the pointer for the array is
 	char ch[100]={0};
 	uint32_t r = 1;
-    while(buttons->isButtonPressed(4) == false && IDCount < 512)//we will do this until the back button is pressed or we run out of space
+    while(buttons->isButtonPressed(4) == false && IDs.getCount() < 512)//we will do this until the back button is pressed or we run out of space
     {
    		r=sd->read(ch, 14);//get the header
    		if(r < 14)
@@ -96,25 +96,17 @@ uint32_t DiagSCAN::ScanActiveUDSIDsFromLog(uint32_t *IDList, const char *fileNam
    			break;
    		}
         uint8_t filtered=0;
-        for (uint32_t a=0;a<IDCount;a++)//make sure the ID we got is not filtered
-        {
-          if(canID == IDs[a])
-          {
-              filtered=1;
-          }
-        }
+        filtered=IDs.contains(canID, (canID > 0x7FF));//make sure the ID we got is not filtered
         if(((payload[0] & 0xF0) != 0 && (payload[0] & 0xF0) != 0x10  && (payload[0] & 0xF0) != 0x20  && (payload[0] & 0xF0) != 0x30) && filtered == 0)//if it is not an ISO-TP frame and was not filtered
         {
-        	IDs[IDCount]=canID;//ad it to the filtered list
-        	IDCount++;
+        	IDs.insert(canID, (canID > 0x7FF));//ad it to the filtered list
         	filtered=1;
         }
         if(filtered==0)//if its not a filtered ID, it already looks like UDS.
         {
             if(canID==0x7DF)//if we just grab a channel broadcast used in diag, there will be multiple replies
             {
-                IDs[IDCount]=canID;//Add the broadcast ID to the filter
-                IDCount++;
+                IDs.insert(canID, (canID > 0x7FF));//Add the broadcast ID to the filter
                 uint32_t currentFilePosition = sd->getFilePosition();
                 uint8_t request=payload[1];
                 if((payload[0] & 0xF0) == 0x10)//if it is a multiframe request, which would be weird
@@ -141,17 +133,10 @@ uint32_t DiagSCAN::ScanActiveUDSIDsFromLog(uint32_t *IDList, const char *fileNam
 					}
 					//add algo to find if same request was made later to avoid false positive replies
 					filtered=false;
-			        for (uint32_t a=0;a<IDCount;a++)//make sure the ID we got is not filtered
-			        {
-			          if(canID == IDs[a])
-			          {
-			              filtered=1;
-			          }
-			        }
+			        filtered=IDs.contains(canID, (canID > 0x7FF));//make sure the ID we got is not filtered
 			        if(((payload[0] & 0xF0) != 0 && (payload[0] & 0xF0) != 0x10  && (payload[0] & 0xF0) != 0x20  && (payload[0] & 0xF0) != 0x30) && filtered == 0)//if it is not an ISO-TP frame and was not filtered
 			        {
-			        	IDs[IDCount]=canID;//add it to the filtered list
-			        	IDCount++;
+			        	IDs.insert(canID, (canID > 0x7FF));//add it to the filtered list
 			        	filtered=1;
 			        }
 			        if (((payload[0] & 0xF0) == 0 && payload[1] == request) || ((payload[0] & 0xF0) == 0x10 && payload[2]  == request))//if we see the same request again, the following responses might not be for this request
@@ -164,8 +149,7 @@ uint32_t DiagSCAN::ScanActiveUDSIDsFromLog(uint32_t *IDList, const char *fileNam
                 		arrayPointer++;
 						IDList[arrayPointer]=canID;//if valid, we add it to the entry
                 		arrayPointer++;
-                		IDs[IDCount]=canID;//we also add it to the filter list
-                		IDCount++;
+                		IDs.insert(canID, (canID > 0x7FF));//we also add it to the filter list
                 		found=true;
 					}
 				}
@@ -187,8 +171,7 @@ uint32_t DiagSCAN::ScanActiveUDSIDsFromLog(uint32_t *IDList, const char *fileNam
                 	{
                 		IDList[arrayPointer]=canID;//if valid, we add it to the entry
                 		arrayPointer++;
-                		IDs[IDCount]=canID;//we also add it to the filter list
-                		IDCount++;
+                		IDs.insert(canID, (canID > 0x7FF));//we also add it to the filter list
 						//now we will check for the reply
 						bool found = false;
 						uint8_t requestSID = payload[1];
@@ -212,17 +195,10 @@ uint32_t DiagSCAN::ScanActiveUDSIDsFromLog(uint32_t *IDList, const char *fileNam
 							}
 							//add algo to find if same request was made later to avoid false positive replies
 							filtered=false;
-					        for (uint32_t a=0;a<IDCount;a++)//make sure the ID we got is not filtered
-					        {
-					          if(canID == IDs[a])
-					          {
-					              filtered=1;
-					          }
-					        }
+					        filtered=IDs.contains(canID, (canID > 0x7FF));//make sure the ID we got is not filtered
 					        if(((payload[0] & 0xF0) != 0 && (payload[0] & 0xF0) != 0x10  && (payload[0] & 0xF0) != 0x20  && (payload[0] & 0xF0) != 0x30) && filtered == 0)//if it is not an ISO-TP frame and was not filtered
 					        {
-					        	IDs[IDCount]=canID;//add it to the filtered list
-					        	IDCount++;
+					        	IDs.insert(canID, (canID > 0x7FF));//add it to the filtered list
 					        	filtered=1;
 					        }
 					        if (((payload[0] & 0xF0) == 0 && payload[1] == requestSID) || ((payload[0] & 0xF0) == 0x10 && payload[2]  == requestSID))//if we see the same request again, the following responses might not be for this request
@@ -233,8 +209,7 @@ uint32_t DiagSCAN::ScanActiveUDSIDsFromLog(uint32_t *IDList, const char *fileNam
 							{
 		                		IDList[arrayPointer]=canID;//if valid, we add it to the entry
 		                		arrayPointer++;
-		                		IDs[IDCount]=canID;//we also add it to the filter list
-		                		IDCount++;
+		                		IDs.insert(canID, (canID > 0x7FF));//we also add it to the filter list
 		                		found=true;
 							}
 						}
@@ -252,8 +227,7 @@ uint32_t DiagSCAN::ScanActiveUDSIDsFromLog(uint32_t *IDList, const char *fileNam
             	{
             		IDList[arrayPointer]=canID;//if valid, we add it to the entry
             		arrayPointer++;
-            		IDs[IDCount]=canID;//we also add it to the filter list
-            		IDCount++;
+            		IDs.insert(canID, (canID > 0x7FF));//we also add it to the filter list
 					//now we will check for the reply
 					bool found = false;
 					uint8_t requestSID = payload[2];
@@ -277,17 +251,10 @@ uint32_t DiagSCAN::ScanActiveUDSIDsFromLog(uint32_t *IDList, const char *fileNam
 						}
 						//add algo to find if same request was made later to avoid false positive replies
 						filtered=false;
-				        for (uint32_t a=0;a<IDCount;a++)//make sure the ID we got is not filtered
-				        {
-				          if(canID == IDs[a])
-				          {
-				              filtered=1;
-				          }
-				        }
+				        filtered=IDs.contains(canID, (canID > 0x7FF));//make sure the ID we got is not filtered
 				        if(((payload[0] & 0xF0) != 0 && (payload[0] & 0xF0) != 0x10  && (payload[0] & 0xF0) != 0x20  && (payload[0] & 0xF0) != 0x30) && filtered == 0)//if it is not an ISO-TP frame and was not filtered
 				        {
-				        	IDs[IDCount]=canID;//add it to the filtered list
-				        	IDCount++;
+				        	IDs.insert(canID, (canID > 0x7FF));//add it to the filtered list
 				        	filtered=1;
 				        }
 				        if (((payload[0] & 0xF0) == 0 && payload[1] == requestSID) || ((payload[0] & 0xF0) == 0x10 && payload[2]  == requestSID))//if we see the same request again, the following responses might not be for this request
@@ -298,8 +265,7 @@ uint32_t DiagSCAN::ScanActiveUDSIDsFromLog(uint32_t *IDList, const char *fileNam
 						{
 	                		IDList[arrayPointer]=canID;//if valid, we add it to the entry
 	                		arrayPointer++;
-	                		IDs[IDCount]=canID;//we also add it to the filter list
-	                		IDCount++;
+	                		IDs.insert(canID, (canID > 0x7FF));//we also add it to the filter list
 	                		found=true;
 						}
 					}
@@ -319,6 +285,7 @@ uint32_t DiagSCAN::ScanActiveUDSIDsFromLog(uint32_t *IDList, const char *fileNam
             }
         }
     }
+    sd->setReadAhead(false);
     sd->closeFile();//close the file
     return channels;
 }
@@ -339,18 +306,15 @@ uint32_t DiagSCAN::scanUDSID(uint32_t targetID, uint8_t sessionType, uint32_t tT
 		return 0;
 	}
 	//now we will manually inspect the replies
-	uint32_t ignoredIDs[100];//create a list of IDs to be ignored
-	uint32_t ignoreCount=0;//pointer to the id array
-	CANMessage can_msg(0,CANAny);
-	uint32_t currentMS=0;
+	CANIDSet ignoredIDs;//IDs to be ignored
+	CANbadger_CAN cb(_canbus);//the TP handler keeps the RX ring running, so replies are read from it
+	CANRxFrame can_msg;
+	Timer idleTimer;//time since the last new ID
+	idleTimer.start();
 	for(uint8_t a=0; a < 200; a++)//we will inspect 200 frames
 	{
-		while(_canbus->read(can_msg) == 0 && currentMS<(tTimeout * 10))
-    	{
-    		currentMS++;
-    		wait(0.0001);
-    	}
-    	if(currentMS == (tTimeout * 10))//if we didnt grab any valid traffic
+		uint32_t elapsed = idleTimer.read_ms();
+    	if(elapsed >= tTimeout || !cb.waitFrame(can_msg, (tTimeout - elapsed)))//if we didnt grab any valid traffic
     	{
     		if(hitCount == 0)
     		{
@@ -365,17 +329,10 @@ uint32_t DiagSCAN::scanUDSID(uint32_t targetID, uint8_t sessionType, uint32_t tT
     			return (hitCount + 0xC0000000);//C0 in MSB indicates broadcast
     		}
     	}
-    	bool isValid=true;
-    	for(uint32_t r=0; r < ignoreCount; r++)
-    	{
-    		if(ignoredIDs[r] == can_msg.id)//if the ID is in the list
-    		{
-    			isValid=false;//we flag so we dont check
-    		}
-    	}
+    	bool isValid=!ignoredIDs.contains(can_msg.id, (can_msg.format == CANExtended));//if the ID is in the list we dont check
     	if(isValid == true)//if it is a new ID
     	{
-    		currentMS=0;//reset the timeout
+    		idleTimer.reset();//reset the timeout
     		if(variantType == 0)//if using standard addressing
 			{
 				if(can_msg.data[1] == 0x50 && can_msg.data[2] == sessionType)//if we got a positive reply
@@ -388,8 +345,7 @@ uint32_t DiagSCAN::scanUDSID(uint32_t targetID, uint8_t sessionType, uint32_t tT
 				}
 				else
 				{
-					ignoredIDs[ignoreCount] = can_msg.id;
-					ignoreCount++;
+					ignoredIDs.insert(can_msg.id, (can_msg.format == CANExtended));
 				}
 			}
     		else//if using extended addressing
@@ -404,12 +360,11 @@ uint32_t DiagSCAN::scanUDSID(uint32_t targetID, uint8_t sessionType, uint32_t tT
 				}
 				else
 				{
-					ignoredIDs[ignoreCount] = can_msg.id;
-					ignoreCount++;
+					ignoredIDs.insert(can_msg.id, (can_msg.format == CANExtended));
 				}
 			}
     	}
-    	if(ignoreCount == 100)
+    	if(ignoredIDs.getCount() == 100)
     	{
     		if(hitCount == 0)
     		{
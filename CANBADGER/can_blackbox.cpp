@@ -0,0 +1,385 @@
+/*
+* CanBadger Black Box
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+
+#include "can_blackbox.h"
+#include "can_log_ring.h"
+#include "timebase.h"
+
+CANBlackBox::CANBlackBox(Ser23LC1024 *ram, FileHandler *sd)
+{
+	_ram = ram;
+	_sd = sd;
+	_gpio = NULL;
+	memset(&_header, 0, sizeof(_header));
+	_state = CAN_BLACKBOX_IDLE;
+	_source = CAN_BLACKBOX_TRIGGER_NONE;
+	_head = 0;
+	_tail = 0;
+	_preTrigger = 2000000;
+	_postTrigger = 1000000;
+	_triggerTime = 0;
+	_postDone = false;
+	_windowStarted = false;
+	_gpioMask = 0;
+	_edgeCount[0] = 0;
+	_edgeCount[1] = 0;
+	_triggerBus = 0;
+	_triggerID = 0;
+	_triggerExtended = false;
+	memset(_triggerValue, 0, 8);
+	memset(_triggerMask, 0, 8);
+	_triggerLen = 0;
+	_captures = 0;
+	_drops = 0;
+	_dropBase = 0;
+	_fileName[0] = 0;
+}
+
+void CANBlackBox::setWindow(uint32_t preTrigger, uint32_t postTrigger)
+{
+	if(preTrigger > 2000000)//keep the windows within the range of the 32 bit us timestamps
+	{
+		preTrigger = 2000000;
+	}
+	if(postTrigger > 2000000)
+	{
+		postTrigger = 2000000;
+	}
+	_preTrigger = (preTrigger * 1000);
+	_postTrigger = (postTrigger * 1000);
+}
+
+void CANBlackBox::setFrameTrigger(uint8_t bus, uint32_t id, bool extended, const uint8_t *value, const uint8_t *mask, uint8_t len)
+{
+	if(len > 8)
+	{
+		len = 8;
+	}
+	_triggerBus = (bus > 3) ? 3 : bus;
+	_triggerID = id;
+	_triggerExtended = extended;
+	_triggerLen = len;
+	for(uint8_t a = 0; a < 8; a++)
+	{
+		_triggerValue[a] = (a < len) ? value[a] : 0;
+		_triggerMask[a] = (a < len) ? mask[a] : 0;
+	}
+}
+
+void CANBlackBox::setGPIOTrigger(GPIOHandler *gpio, uint8_t gpioMask)
+{
+	_gpio = gpio;
+	_gpioMask = (gpio != NULL) ? (gpioMask & 3) : 0;
+}
+
+bool CANBlackBox::arm(const CANLogV2Header &header)
+{
+	if(_ram == NULL || _sd == NULL)
+	{
+		return false;
+	}
+	if(_state != CAN_BLACKBOX_IDLE)
+	{
+		disarm();
+	}
+	_header = header;
+	_head = 0;
+	_tail = 0;
+	_captures = 0;
+	_drops = 0;
+	_fileName[0] = 0;
+	CANLogRing::getRing()->flush();
+	CANLogRing::getRing()->clearStats();
+	for(uint8_t a = 0; a < 2; a++)
+	{
+		if(_gpioMask & (1 << a))
+		{
+			_gpio->setEdgeCounting((a + 1), true);
+			_edgeCount[a] = _gpio->getEdgeCount(a + 1);
+		}
+	}
+	_state = CAN_BLACKBOX_ARMED;
+	return true;
+}
+
+void CANBlackBox::disarm()
+{
+	if(_state == CAN_BLACKBOX_CAPTURING)
+	{
+		finishCapture();
+	}
+	for(uint8_t a = 0; a < 2; a++)
+	{
+		if(_gpioMask & (1 << a))
+		{
+			_gpio->setEdgeCounting((a + 1), false);
+		}
+	}
+	_state = CAN_BLACKBOX_IDLE;
+}
+
+void CANBlackBox::trigger(uint8_t source)
+{
+	if(_state == CAN_BLACKBOX_ARMED)
+	{
+		startCapture(source, (uint32_t)Timebase::now());
+	}
+}
+
+uint8_t CANBlackBox::getState()
+{
+	return _state;
+}
+
+uint32_t CANBlackBox::getCaptureCount()
+{
+	return _captures;
+}
+
+uint32_t CANBlackBox::getDropCount()
+{
+	return (_drops + CANLogRing::getRing()->getDropCount());
+}
+
+const char* CANBlackBox::getFileName()
+{
+	return _fileName;
+}
+
+bool CANBlackBox::checkFrameTrigger(const CANLogRecord *record)
+{
+	if(_triggerBus == 0 || (_triggerBus != 3 && record->bus != _triggerBus))
+	{
+		return false;
+	}
+	bool extended = ((record->flags & 0x20) != 0);
+	if(extended != _triggerExtended || record->id != _triggerID || record->len < _triggerLen)
+	{
+		return false;
+	}
+	for(uint8_t a = 0; a < _triggerLen; a++)
+	{
+		if(((record->data[a] ^ _triggerValue[a]) & _triggerMask[a]) != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void CANBlackBox::startCapture(uint8_t source, uint32_t timestamp)
+{
+	char eXT[3] = {0, 0, 0};
+	strcpy(_fileName, "/Logging/RAW/TRIG_");
+	if(!_sd->getSequencialFileName(_fileName, eXT) || !_sd->openFile(_fileName, O_WRONLY | O_CREAT | O_TRUNC))
+	{
+		_fileName[0] = 0;
+		return;//stay armed, the next trigger may have more luck
+	}
+	_sd->write((char*)_out, _encoder.writeHeader(_out, _header));
+	_state = CAN_BLACKBOX_CAPTURING;
+	_source = source;
+	_triggerTime = timestamp;
+	_postDone = false;
+	_windowStarted = false;
+	_dropBase = getDropCount();
+}
+
+void CANBlackBox::finishCapture()
+{
+	uint32_t len = _encoder.finish(_out);
+	if(len > 0)
+	{
+		_sd->write((char*)_out, len);
+	}
+	_sd->closeFile();
+	_captures++;
+	_tail = _head;//anything left over was cut off by disarm, the next pre-trigger window starts empty
+	for(uint8_t a = 0; a < 2; a++)//edges seen during the capture do not count as a new trigger
+	{
+		if(_gpioMask & (1 << a))
+		{
+			_edgeCount[a] = _gpio->getEdgeCount(a + 1);
+		}
+	}
+	_state = CAN_BLACKBOX_ARMED;
+}
+
+void CANBlackBox::storeRecords(CANLogRecord *records, uint32_t count)
+{
+	uint32_t stored = 0;
+	for(uint32_t a = 0; a < count; a++)
+	{
+		CANLogRecord *record = &records[a];
+		if(_state == CAN_BLACKBOX_ARMED && checkFrameTrigger(record) == true)
+		{
+			startCapture(CAN_BLACKBOX_TRIGGER_FRAME, (uint32_t)record->time);
+		}
+		if(_state == CAN_BLACKBOX_CAPTURING)
+		{
+			if((int32_t)((uint32_t)record->time - _triggerTime) > (int32_t)_postTrigger)
+			{
+				_postDone = true;//past the window, not part of the capture
+				continue;
+			}
+			if(((_head + stored) - _tail) >= CAN_BLACKBOX_CAPACITY)
+			{
+				_drops++;//the backlog still has to reach the SD, it cannot be overwritten
+				continue;
+			}
+		}
+		else if(((_head + stored) - _tail) >= CAN_BLACKBOX_CAPACITY)
+		{
+			_tail++;//armed, the oldest frame makes room
+		}
+		uint8_t *out = &_records[(stored * CAN_BLACKBOX_RECORD_SIZE)];
+		uint32_t id = record->id;
+		if(record->bus == 2)
+		{
+			id |= 0x80000000;
+		}
+		if(record->flags & 0x20)
+		{
+			id |= 0x40000000;
+		}
+		for(uint8_t b = 0; b < 4; b++)
+		{
+			out[b] = ((uint32_t)record->time >> (b * 8));
+			out[4 + b] = (id >> (b * 8));
+		}
+		out[8] = record->len;
+		memcpy(&out[9], record->data, 8);
+		stored++;
+	}
+	uint32_t pos = 0;
+	while(pos < stored)//split where the ring wraps
+	{
+		uint32_t slot = ((_head + pos) % CAN_BLACKBOX_CAPACITY);
+		uint32_t len = (stored - pos);
+		if(len > (CAN_BLACKBOX_CAPACITY - slot))
+		{
+			len = (CAN_BLACKBOX_CAPACITY - slot);
+		}
+		if(_ram->write((slot * CAN_BLACKBOX_RECORD_SIZE), (len * CAN_BLACKBOX_RECORD_SIZE), &_records[(pos * CAN_BLACKBOX_RECORD_SIZE)]) == false)
+		{
+			_drops += (stored - pos);//these never reached the ring
+			break;
+		}
+		pos += len;
+	}
+	_head += pos;
+}
+
+uint32_t CANBlackBox::writeCapture()
+{
+	uint32_t count = (_head - _tail);
+	if(count == 0)
+	{
+		return 0;
+	}
+	uint32_t slot = (_tail % CAN_BLACKBOX_CAPACITY);
+	if(count > CAN_BLACKBOX_BATCH)
+	{
+		count = CAN_BLACKBOX_BATCH;
+	}
+	if(count > (CAN_BLACKBOX_CAPACITY - slot))
+	{
+		count = (CAN_BLACKBOX_CAPACITY - slot);
+	}
+	bool valid = _ram->read((slot * CAN_BLACKBOX_RECORD_SIZE), (count * CAN_BLACKBOX_RECORD_SIZE), _records);
+	_tail += count;
+	if(valid == false)
+	{
+		_drops += count;//skip them rather than retry forever, the drop marker below records the gap
+	}
+	uint32_t outLen = _encoder.encodeDrops((getDropCount() - _dropBase), _out);
+	for(uint32_t a = 0; valid == true && a < count; a++)
+	{
+		uint8_t *in = &_records[(a * CAN_BLACKBOX_RECORD_SIZE)];
+		uint32_t timestamp = (in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24));
+		uint32_t id = (in[4] | (in[5] << 8) | (in[6] << 16) | ((uint32_t)in[7] << 24));
+		if(_windowStarted == false)
+		{
+			if((int32_t)(_triggerTime - timestamp) > (int32_t)_preTrigger)
+			{
+				continue;//older than the pre-trigger window
+			}
+			_windowStarted = true;
+		}
+		uint8_t len = (in[8] > 8) ? 8 : in[8];
+		outLen += _encoder.encode(((id & 0x80000000) ? 2 : 1), ((id & 0x40000000) != 0), (id & 0x1FFFFFFF), &in[9], len, timestamp, &_out[outLen]);
+	}
+	if(outLen > 0)
+	{
+		_sd->write((char*)_out, outLen);
+	}
+	return count;
+}
+
+uint8_t CANBlackBox::run()
+{
+	if(_state == CAN_BLACKBOX_IDLE)
+	{
+		return CAN_BLACKBOX_TRIGGER_NONE;
+	}
+	for(uint8_t a = 0; a < 2 && _state == CAN_BLACKBOX_ARMED; a++)
+	{
+		if(_gpioMask & (1 << a))
+		{
+			uint32_t edges = _gpio->getEdgeCount(a + 1);
+			if(edges != _edgeCount[a])
+			{
+				_edgeCount[a] = edges;
+				trigger(CAN_BLACKBOX_TRIGGER_GPIO);
+			}
+		}
+	}
+	CANLogRing *logRing = CANLogRing::getRing();
+	CANLogRecord *records;
+	uint32_t count = logRing->peek(records);
+	if(count > CAN_BLACKBOX_BATCH)
+	{
+		count = CAN_BLACKBOX_BATCH;
+	}
+	if(count > 0)
+	{
+		storeRecords(records, count);
+		logRing->consume(count);
+	}
+	if(_state != CAN_BLACKBOX_CAPTURING)
+	{
+		return CAN_BLACKBOX_TRIGGER_NONE;
+	}
+	if(((uint32_t)Timebase::now() - _triggerTime) > _postTrigger)//quiet bus, no late frame to tell us the window is over
+	{
+		_postDone = true;
+	}
+	writeCapture();
+	if(_postDone == true && _head == _tail && logRing->pending() == 0)
+	{
+		finishCapture();
+		return _source;
+	}
+	return CAN_BLACKBOX_TRIGGER_NONE;
+}
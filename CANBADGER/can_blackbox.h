@@ -0,0 +1,161 @@
+/*
+* CanBadger Black Box
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+
+/*
+Keeps the most recent traffic of both buses in the 23LC1024 as a ring of fixed size records, without touching the SD.
+When a trigger fires, the frames from the pre-trigger window are written to a v2 RAW log on the SD, followed by the
+frames of the post-trigger window. Frames keep going into the XRAM ring while the SD catches up, so nothing is lost
+unless the card falls behind by a whole ring. The box arms itself again once the capture is closed.
+
+The pre-trigger window is bounded by the ring, CAN_BLACKBOX_CAPACITY frames (about 2s of a fully loaded 500kbps bus).
+
+XRAM record, CAN_BLACKBOX_RECORD_SIZE bytes:
+	-Bytes [0-3] timestamp in us, little endian
+	-Bytes [4-7] ID, little endian. Bit 31 set for bus 2, bit 30 set for extended IDs
+	-Byte [8] length
+	-Bytes [9-16] data
+*/
+
+#ifndef __CAN_BLACKBOX_H__
+#define __CAN_BLACKBOX_H__
+
+#include "mbed.h"
+#include "SER23LC1024.h"
+#include "fileHandler.h"
+#include "can_log_ring.h"
+#include "can_log_v2.h"
+#include <Extensions/gpio_handler.hpp>
+
+#define CAN_BLACKBOX_RAM_SIZE RAM_USABLE_SIZE
+#define CAN_BLACKBOX_RECORD_SIZE 17
+#define CAN_BLACKBOX_CAPACITY (CAN_BLACKBOX_RAM_SIZE / CAN_BLACKBOX_RECORD_SIZE) //records in the ring, 7529
+#define CAN_BLACKBOX_BATCH 32 //records moved per XRAM or SD access
+
+//what fired the trigger
+#define CAN_BLACKBOX_TRIGGER_NONE 0
+#define CAN_BLACKBOX_TRIGGER_FRAME 1
+#define CAN_BLACKBOX_TRIGGER_GPIO 2
+#define CAN_BLACKBOX_TRIGGER_BUTTON 3
+#define CAN_BLACKBOX_TRIGGER_ETHERNET 4
+
+#define CAN_BLACKBOX_IDLE 0
+#define CAN_BLACKBOX_ARMED 1 //recording into XRAM, waiting for a trigger
+#define CAN_BLACKBOX_CAPTURING 2 //writing a capture to the SD
+
+class CANBlackBox
+{
+	public:
+
+		CANBlackBox(Ser23LC1024 *ram, FileHandler *sd);
+
+		/** @param preTrigger ms of traffic kept before the trigger, limited by the ring
+			@param postTrigger ms of traffic recorded after the trigger
+		*/
+		void setWindow(uint32_t preTrigger, uint32_t postTrigger);
+
+		/** Fires on a frame where (data & mask) == (value & mask) for the first len bytes
+
+			@param bus 1 or 2, 3 for any, 0 disables the frame trigger
+			@param len number of data bytes to compare, 0 matches on the ID only
+		*/
+		void setFrameTrigger(uint8_t bus, uint32_t id, bool extended, const uint8_t *value, const uint8_t *mask, uint8_t len);
+
+		/** Fires on any edge on the selected GPIOs. The pins are switched to inputs while the box is armed
+
+			@param gpioMask bit 0 GPIO1, bit 1 GPIO2, 0 disables the GPIO trigger
+		*/
+		void setGPIOTrigger(GPIOHandler *gpio, uint8_t gpioMask);
+
+		/** Starts recording into XRAM. Frames come from the log ring, so the bridge has to be running with logging enabled
+
+			@param header written at the start of every capture file
+		*/
+		bool arm(const CANLogV2Header &header);
+
+		/** Stops recording. A capture in progress is cut short and closed
+		*/
+		void disarm();
+
+		/** Fires the trigger from outside (button, Ethernet). Ignored unless armed
+		*/
+		void trigger(uint8_t source);
+
+		/** Moves frames from the log ring to XRAM, checks the triggers and writes a running capture to the SD.
+			Has to be called in a loop for as long as the box is armed
+
+			@return the trigger source of a capture that was completed in this call, CAN_BLACKBOX_TRIGGER_NONE otherwise
+		*/
+		uint8_t run();
+
+		uint8_t getState();
+
+		uint32_t getCaptureCount();//captures written since arm
+
+		uint32_t getDropCount();//frames lost because the SD could not keep up with a capture, or the log ring overflowed
+
+		const char* getFileName();//the capture being written, or the last one
+
+	private:
+
+		bool checkFrameTrigger(const CANLogRecord *record);
+
+		void startCapture(uint8_t source, uint32_t timestamp);
+
+		void finishCapture();
+
+		void storeRecords(CANLogRecord *records, uint32_t count);
+
+		uint32_t writeCapture();
+
+		Ser23LC1024* _ram;
+		FileHandler* _sd;
+		GPIOHandler* _gpio;
+		CANLogV2Encoder _encoder;
+		CANLogV2Header _header;
+		uint8_t _state;
+		uint8_t _source;
+		uint32_t _head;//records written to the ring
+		uint32_t _tail;//oldest record still in the ring
+		uint32_t _preTrigger;//us
+		uint32_t _postTrigger;//us
+		uint32_t _triggerTime;
+		bool _postDone;//post-trigger window is over, only the backlog is left to write
+		bool _windowStarted;//records older than the pre-trigger window were skipped
+		uint8_t _gpioMask;
+		uint32_t _edgeCount[2];
+		uint8_t _triggerBus;
+		uint32_t _triggerID;
+		bool _triggerExtended;
+		uint8_t _triggerValue[8];
+		uint8_t _triggerMask[8];
+		uint8_t _triggerLen;
+		uint32_t _captures;
+		uint32_t _drops;
+		uint32_t _dropBase;//drops counted before the capture started
+		char _fileName[64];
+		uint8_t _records[(CAN_BLACKBOX_BATCH * CAN_BLACKBOX_RECORD_SIZE)];
+		uint8_t _out[((CAN_BLACKBOX_BATCH * CAN_LOG_V2_MAX_RECORD_SIZE) + CAN_LOG_V2_INDEX_SIZE + 6)];
+};
+
+#endif
@@ -0,0 +1,328 @@
+/*
+* CanBadger CAN Bus Census
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+
+#include "can_census.h"
+#include <new>
+#include <math.h>
+
+#define CAN_ID_SET_EMPTY 0xFFFFFFFF
+#define CAN_CENSUS_MAX_PERIOD 0x07FFFFFF //longest period in us that still fits the 1/16 us fixed point
+
+CANCensus CANCensus::census;
+
+CANCensus::CANCensus()
+{
+	_entries = NULL;
+	_count = 0;
+	_untracked = 0;
+	_running = false;
+	memset(_slots, 0, sizeof(_slots));
+	memset(_stdSeen, 0, sizeof(_stdSeen));
+}
+
+CANCensus* CANCensus::getCensus()
+{
+	return &census;
+}
+
+bool CANCensus::start()
+{
+	_running = false;
+	if(_entries == NULL)
+	{
+		_entries = new (std::nothrow) CANCensusEntry[CAN_CENSUS_SIZE];
+		if(_entries == NULL)
+		{
+			return false;
+		}
+	}
+	memset(_slots, 0, sizeof(_slots));
+	memset(_stdSeen, 0, sizeof(_stdSeen));
+	_count = 0;
+	_untracked = 0;
+	__DMB();
+	_running = true;
+	return true;
+}
+
+void CANCensus::stop()
+{
+	_running = false;
+}
+
+void CANCensus::release()
+{
+	_running = false;
+	__DMB();
+	if(_entries != NULL)
+	{
+		delete[] _entries;
+		_entries = NULL;
+	}
+	_count = 0;
+}
+
+bool CANCensus::isRunning()
+{
+	return _running;
+}
+
+uint32_t CANCensus::hashKey(uint8_t bus, uint32_t id, uint8_t format)
+{
+	uint32_t key = ((id & 0x1FFFFFFF) | ((uint32_t)(format == CANExtended) << 29) | ((uint32_t)bus << 30));
+	return ((key * 2654435761U) >> (32 - CAN_CENSUS_HASH_BITS));//multiplicative hashing, spreads the consecutive IDs typical of a bus
+}
+
+CANCensusEntry* CANCensus::lookup(uint8_t bus, uint32_t id, uint8_t format, bool isNew)
+{
+	uint32_t slot = hashKey(bus, id, format);
+	while(_slots[slot] != 0)
+	{
+		if(isNew == false)
+		{
+			CANCensusEntry *entry = &_entries[_slots[slot] - 1];
+			if(entry->id == id && entry->bus == bus && entry->format == format)
+			{
+				return entry;
+			}
+		}
+		slot = ((slot + 1) & (CAN_CENSUS_HASH_SIZE - 1));
+	}
+	if(_count >= CAN_CENSUS_SIZE)
+	{
+		return NULL;
+	}
+	CANCensusEntry *entry = &_entries[_count];
+	memset(entry, 0, sizeof(CANCensusEntry));
+	entry->id = id;
+	entry->bus = bus;
+	entry->format = format;
+	_count++;
+	_slots[slot] = _count;
+	return entry;
+}
+
+void CANCensus::record(uint8_t bus, uint32_t id, uint8_t format, const uint8_t *data, uint8_t len, uint32_t timestamp)
+{
+	if(_running == false || bus < 1 || bus > 2)
+	{
+		return;
+	}
+	if(len > 8)
+	{
+		len = 8;
+	}
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();//both controllers share one interrupt, but threads may feed it too
+	bool isNew = false;
+	if(format != CANExtended)
+	{
+		uint32_t *word = &_stdSeen[bus - 1][(id & 0x7FF) >> 5];
+		uint32_t bit = (1U << (id & 0x1F));
+		if((*word & bit) == 0)
+		{
+			*word |= bit;
+			isNew = true;//no need to look for it, the slot search can stop at the first free one
+		}
+	}
+	CANCensusEntry *entry = lookup(bus, id, format, isNew);
+	if(entry == NULL)
+	{
+		_untracked++;
+		__set_PRIMASK(primask);
+		return;
+	}
+	if(entry->count == 0)
+	{
+		entry->firstSeen = timestamp;
+		for(uint8_t a = 0; a < len; a++)
+		{
+			entry->lastData[a] = data[a];
+		}
+	}
+	else
+	{
+		uint32_t period = (timestamp - entry->lastSeen);
+		if(period > CAN_CENSUS_MAX_PERIOD)
+		{
+			period = CAN_CENSUS_MAX_PERIOD;
+		}
+		int32_t x = (int32_t)(period << 4);
+		int32_t delta = (x - entry->meanPeriod);
+		entry->meanPeriod += (delta / (int32_t)entry->count);//count is the number of periods including this one
+		entry->m2 += ((int64_t)delta * (x - entry->meanPeriod));
+		for(uint8_t a = 0; a < len; a++)
+		{
+			entry->changed[a] |= (entry->lastData[a] ^ data[a]);
+			entry->lastData[a] = data[a];
+		}
+	}
+	entry->lastSeen = timestamp;
+	entry->dlcMask |= (1U << len);
+	entry->count++;
+	__set_PRIMASK(primask);
+}
+
+uint32_t CANCensus::getIDCount()
+{
+	return _count;
+}
+
+uint32_t CANCensus::getUntrackedFrames()
+{
+	return _untracked;
+}
+
+bool CANCensus::getEntry(uint32_t index, CANCensusEntry &entry)
+{
+	if(_entries == NULL || index >= _count)
+	{
+		return false;
+	}
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	entry = _entries[index];
+	__set_PRIMASK(primask);
+	return true;
+}
+
+uint32_t CANCensus::getMeanPeriod(CANCensusEntry &entry)
+{
+	if(entry.count < 2)
+	{
+		return 0;
+	}
+	return ((uint32_t)entry.meanPeriod >> 4);
+}
+
+uint32_t CANCensus::getJitter(CANCensusEntry &entry)
+{
+	if(entry.count < 3 || entry.m2 <= 0)
+	{
+		return 0;
+	}
+	float variance = ((float)entry.m2 / (float)(entry.count - 2));//count - 1 periods, sample variance
+	return (uint32_t)(sqrtf(variance) / 16);
+}
+
+uint32_t CANCensus::serializeEntry(CANCensusEntry &entry, uint8_t *buf)
+{
+	uint32_t values[6] = {entry.id, entry.count, entry.firstSeen, entry.lastSeen, getMeanPeriod(entry), getJitter(entry)};
+	buf[0] = entry.bus;
+	buf[1] = entry.format;
+	buf[2] = entry.dlcMask;
+	buf[3] = (entry.dlcMask >> 8);
+	for(uint8_t a = 0; a < 6; a++)
+	{
+		buf[4 + (a * 4)] = values[a];
+		buf[5 + (a * 4)] = (values[a] >> 8);
+		buf[6 + (a * 4)] = (values[a] >> 16);
+		buf[7 + (a * 4)] = (values[a] >> 24);
+	}
+	for(uint8_t a = 0; a < 8; a++)
+	{
+		buf[28 + a] = entry.changed[a];
+	}
+	return CAN_CENSUS_RECORD_SIZE;
+}
+
+uint32_t CANCensus::formatEntry(CANCensusEntry &entry, char *buf)
+{
+	return sprintf(buf, "%d,%X,%s,%u,%u,%u,%X,%u,%u,%02X%02X%02X%02X%02X%02X%02X%02X\r\n", entry.bus, (unsigned int)entry.id, (entry.format == CANExtended) ? "XTD" : "STD",
+		(unsigned int)entry.count, (unsigned int)getMeanPeriod(entry), (unsigned int)getJitter(entry), entry.dlcMask, (unsigned int)entry.firstSeen, (unsigned int)entry.lastSeen,
+		entry.changed[0], entry.changed[1], entry.changed[2], entry.changed[3], entry.changed[4], entry.changed[5], entry.changed[6], entry.changed[7]);
+}
+
+CANIDSet::CANIDSet()
+{
+	clear();
+}
+
+void CANIDSet::clear()
+{
+	memset(_std, 0, sizeof(_std));
+	memset(_ext, 0xFF, sizeof(_ext));
+	_count = 0;
+	_extCount = 0;
+}
+
+uint32_t* CANIDSet::find(uint32_t id)
+{
+	uint32_t slot = (((id * 2654435761U) >> 16) & (CAN_ID_SET_SIZE - 1));
+	for(uint32_t a = 0; a < CAN_ID_SET_SIZE; a++)
+	{
+		if(_ext[slot] == id || _ext[slot] == CAN_ID_SET_EMPTY)
+		{
+			return &_ext[slot];
+		}
+		slot = ((slot + 1) & (CAN_ID_SET_SIZE - 1));
+	}
+	return NULL;
+}
+
+bool CANIDSet::insert(uint32_t id, bool extended)
+{
+	if(extended == false)
+	{
+		uint32_t bit = (1U << (id & 0x1F));
+		uint32_t *word = &_std[(id & 0x7FF) >> 5];
+		if(*word & bit)
+		{
+			return false;
+		}
+		*word |= bit;
+		_count++;
+		return true;
+	}
+	id &= 0x1FFFFFFF;
+	if(_extCount >= ((CAN_ID_SET_SIZE * 3) / 4))//keep some room so the probe chains stay short
+	{
+		return false;
+	}
+	uint32_t *slot = find(id);
+	if(slot == NULL || *slot == id)
+	{
+		return false;
+	}
+	*slot = id;
+	_extCount++;
+	_count++;
+	return true;
+}
+
+bool CANIDSet::contains(uint32_t id, bool extended)
+{
+	if(extended == false)
+	{
+		return ((_std[(id & 0x7FF) >> 5] & (1U << (id & 0x1F))) != 0);
+	}
+	id &= 0x1FFFFFFF;
+	uint32_t *slot = find(id);
+	return (slot != NULL && *slot == id);
+}
+
+uint32_t CANIDSet::getCount()
+{
+	return _count;
+}
@@ -0,0 +1,153 @@
+/*
+* CanBadger CAN Bus Census
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Per ID statistics of the traffic seen on both buses, fed from the RX path (RX ring interrupt and the bridge).
+Standard IDs are first checked against a 2048 bit bitmap per bus, so a new ID never has to walk the hash chain.
+Entries are found through an open addressing hash keyed on bus, format and ID.
+Period jitter is kept with Welford's method in fixed point, so the interrupt never touches floats or grows a sum.
+*/
+
+#ifndef __CAN_CENSUS_H__
+#define __CAN_CENSUS_H__
+
+#include "mbed.h"
+
+#define CAN_CENSUS_SIZE 128 //IDs tracked across both buses
+#define CAN_CENSUS_HASH_SIZE 256 //must be a power of two, at least twice CAN_CENSUS_SIZE to keep probe chains short
+#define CAN_CENSUS_HASH_BITS 8
+#define CAN_CENSUS_RECORD_SIZE 36 //bytes per entry when exported
+
+#define CAN_ID_SET_SIZE 256 //extended IDs a CANIDSet can hold, must be a power of two
+
+struct CANCensusEntry
+{
+	uint32_t id;
+	uint32_t count;//frames seen
+	uint32_t firstSeen;//in us
+	uint32_t lastSeen;
+	int32_t meanPeriod;//in 1/16 us
+	int64_t m2;//sum of squared deviations from the mean period, in (1/16 us)^2
+	uint16_t dlcMask;//bit n is set if a frame with DLC n was seen
+	uint8_t bus;
+	uint8_t format;
+	uint8_t lastData[8];
+	uint8_t changed[8];//per byte, the bits that changed at least once
+};
+
+class CANCensus
+{
+	public:
+
+		static CANCensus* getCensus();//the census fed by the RX path
+
+		/** Clears the previous results and starts recording. The entry table is allocated on the first start
+
+			@return false if there was no memory for the table
+		*/
+		bool start();
+
+		void stop();//stops recording, the results are kept until the next start or release
+
+		void release();//stops recording and frees the entry table
+
+		bool isRunning();
+
+		/** Accounts a received frame. Does nothing if the census is not running. Safe to call from interrupt context
+		*/
+		void record(uint8_t bus, uint32_t id, uint8_t format, const uint8_t *data, uint8_t len, uint32_t timestamp);
+
+		uint32_t getIDCount();
+
+		uint32_t getUntrackedFrames();//frames of IDs that did not fit in the table
+
+		/** Copies the entry at index, 0 to getIDCount() - 1, in the order the IDs were first seen
+
+			@return false if index is out of range
+		*/
+		bool getEntry(uint32_t index, CANCensusEntry &entry);
+
+		static uint32_t getMeanPeriod(CANCensusEntry &entry);//in us, 0 if less than two frames were seen
+
+		static uint32_t getJitter(CANCensusEntry &entry);//standard deviation of the period in us, 0 if less than three frames were seen
+
+		/** Serializes an entry for export, little endian:
+			bus (1) | format (1) | DLC mask (2) | ID (4) | count (4) | first seen (4) | last seen (4) | mean period (4) | jitter (4) | changed bits (8)
+
+			@return CAN_CENSUS_RECORD_SIZE
+		*/
+		static uint32_t serializeEntry(CANCensusEntry &entry, uint8_t *buf);
+
+		/** Formats an entry as a line of CSV text: bus,id,format,count,mean period,jitter,dlc mask,first seen,last seen,changed bits
+
+			@return length of the line
+		*/
+		static uint32_t formatEntry(CANCensusEntry &entry, char *buf);
+
+	private:
+
+		CANCensus();
+
+		CANCensusEntry* lookup(uint8_t bus, uint32_t id, uint8_t format, bool isNew);
+
+		static uint32_t hashKey(uint8_t bus, uint32_t id, uint8_t format);
+
+		CANCensusEntry* _entries;
+		uint8_t _slots[CAN_CENSUS_HASH_SIZE];//entry index + 1, 0 means empty
+		uint32_t _stdSeen[2][64];//2048 bit bitmap per bus
+		volatile uint32_t _count;
+		volatile uint32_t _untracked;
+		volatile bool _running;
+
+		static CANCensus census;
+};
+
+/** A set of CAN IDs with constant time lookups. Standard IDs live in a bitmap, extended ones in an open addressing hash
+*/
+class CANIDSet
+{
+	public:
+
+		CANIDSet();
+
+		void clear();
+
+		/** @return true if the ID was not in the set yet and was added, false if it was already there or the set is full
+		*/
+		bool insert(uint32_t id, bool extended = false);
+
+		bool contains(uint32_t id, bool extended = false);
+
+		uint32_t getCount();//IDs in the set
+
+	private:
+
+		uint32_t* find(uint32_t id);//slot holding id, or the empty slot where it would go. NULL if the hash is full
+
+		uint32_t _std[64];
+		uint32_t _ext[CAN_ID_SET_SIZE];
+		uint32_t _count;
+		uint32_t _extCount;
+};
+
+#endif
@@ -0,0 +1,200 @@
+/*
+* CanBadger CAN Change Filter
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "can_change_filter.h"
+#include <new>
+
+CANChangeFilter CANChangeFilter::filter;
+
+CANChangeFilter::CANChangeFilter()
+{
+	_entries = NULL;
+	_keyframeTime = (CAN_CHANGE_FILTER_KEYFRAME_TIME * 1000);
+	_keyframeFrames = CAN_CHANGE_FILTER_KEYFRAME_FRAMES;
+	_count = 0;
+	_passed = 0;
+	_suppressed = 0;
+	_running = false;
+	memset(_slots, 0, sizeof(_slots));
+}
+
+CANChangeFilter* CANChangeFilter::getFilter()
+{
+	return &filter;
+}
+
+bool CANChangeFilter::start()
+{
+	_running = false;
+	if(_entries == NULL)
+	{
+		_entries = new (std::nothrow) CANChangeEntry[CAN_CHANGE_FILTER_SIZE];
+		if(_entries == NULL)
+		{
+			return false;
+		}
+	}
+	memset(_slots, 0, sizeof(_slots));
+	_count = 0;
+	_passed = 0;
+	_suppressed = 0;
+	__DMB();
+	_running = true;
+	return true;
+}
+
+void CANChangeFilter::stop()
+{
+	_running = false;
+}
+
+void CANChangeFilter::release()
+{
+	_running = false;
+	__DMB();
+	if(_entries != NULL)
+	{
+		delete[] _entries;
+		_entries = NULL;
+	}
+	_count = 0;
+}
+
+bool CANChangeFilter::isRunning()
+{
+	return _running;
+}
+
+void CANChangeFilter::setKeyframe(uint32_t time, uint32_t frames)
+{
+	if(time > 0xFFFFFFFF / 1000)//has to fit the 32 bit us clock
+	{
+		time = (0xFFFFFFFF / 1000);
+	}
+	_keyframeTime = (time * 1000);
+	_keyframeFrames = frames;
+}
+
+uint32_t CANChangeFilter::hashKey(uint8_t bus, uint32_t id, uint8_t format)
+{
+	uint32_t key = ((id & 0x1FFFFFFF) | ((uint32_t)(format == CANExtended) << 29) | ((uint32_t)bus << 30));
+	return ((key * 2654435761U) >> (32 - CAN_CHANGE_FILTER_HASH_BITS));
+}
+
+CANChangeEntry* CANChangeFilter::lookup(uint8_t bus, uint32_t id, uint8_t format)
+{
+	uint32_t slot = hashKey(bus, id, format);
+	while(_slots[slot] != 0)
+	{
+		CANChangeEntry *entry = &_entries[_slots[slot] - 1];
+		if(entry->id == id && entry->bus == bus && entry->format == format)
+		{
+			return entry;
+		}
+		slot = ((slot + 1) & (CAN_CHANGE_FILTER_HASH_SIZE - 1));
+	}
+	if(_count >= CAN_CHANGE_FILTER_SIZE)
+	{
+		return NULL;
+	}
+	CANChangeEntry *entry = &_entries[_count];
+	memset(entry, 0, sizeof(CANChangeEntry));
+	entry->id = id;
+	entry->bus = bus;
+	entry->format = format;
+	entry->len = 0xFF;//no DLC matches, so the first frame is always logged
+	_count++;
+	_slots[slot] = _count;
+	return entry;
+}
+
+bool CANChangeFilter::check(uint8_t bus, uint32_t id, uint8_t format, const uint8_t *data, uint8_t len, uint32_t timestamp, uint8_t &skipped)
+{
+	skipped = 0;
+	if(_running == false)
+	{
+		return true;
+	}
+	if(len > 8)
+	{
+		len = 8;
+	}
+	CANChangeEntry *entry = lookup(bus, id, format);
+	if(entry == NULL)
+	{
+		_passed++;
+		return true;
+	}
+	bool changed = (entry->len != len);
+	for(uint8_t a = 0; a < len && changed == false; a++)
+	{
+		changed = (entry->data[a] != data[a]);
+	}
+	if(changed == false && entry->skipped < CAN_CHANGE_FILTER_MAX_SKIP
+		&& (_keyframeFrames == 0 || entry->skipped < _keyframeFrames)
+		&& (_keyframeTime == 0 || (timestamp - entry->lastLogged) < _keyframeTime))
+	{
+		entry->skipped++;
+		entry->suppressed++;
+		_suppressed++;
+		return false;
+	}
+	skipped = entry->skipped;
+	entry->skipped = 0;
+	entry->lastLogged = timestamp;
+	entry->len = len;
+	for(uint8_t a = 0; a < len; a++)
+	{
+		entry->data[a] = data[a];
+	}
+	_passed++;
+	return true;
+}
+
+uint32_t CANChangeFilter::getIDCount()
+{
+	return _count;
+}
+
+uint32_t CANChangeFilter::getPassedCount()
+{
+	return _passed;
+}
+
+uint32_t CANChangeFilter::getSuppressedCount()
+{
+	return _suppressed;
+}
+
+bool CANChangeFilter::getEntry(uint32_t index, CANChangeEntry &entry)
+{
+	if(_entries == NULL || index >= _count)
+	{
+		return false;
+	}
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	entry = _entries[index];
+	__set_PRIMASK(primask);
+	return true;
+}
@@ -0,0 +1,123 @@
+/*
+* CanBadger CAN Change Filter
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Change-only logging. The bridge asks the filter about every frame it is going to log, and a frame is only logged if its
+DLC or payload differ from the last frame logged with the same bus, format and ID. A keyframe forces a frame through
+every CAN_CHANGE_FILTER_MAX_SKIP frames at the latest, or earlier if the configured time or frame interval ran out, so the
+state of every ID can be rebuilt from any point of the log. Each logged frame carries the number of frames left out right
+before it, which is what keeps the periods recoverable.
+Entries are found the same way as in CANCensus, and IDs that do not fit in the table are always logged.
+*/
+
+#ifndef __CAN_CHANGE_FILTER_H__
+#define __CAN_CHANGE_FILTER_H__
+
+#include "mbed.h"
+
+#define CAN_CHANGE_FILTER_SIZE 256 //IDs tracked across both buses
+#define CAN_CHANGE_FILTER_HASH_SIZE 512 //must be a power of two, at least twice CAN_CHANGE_FILTER_SIZE
+#define CAN_CHANGE_FILTER_HASH_BITS 9
+#define CAN_CHANGE_FILTER_MAX_SKIP 255 //frames left out in a row, so the count fits in a log record
+#define CAN_CHANGE_FILTER_KEYFRAME_TIME 1000 //default keyframe interval in ms
+#define CAN_CHANGE_FILTER_KEYFRAME_FRAMES 0 //default keyframe interval in frames, 0 to only use the time
+
+struct CANChangeEntry
+{
+	uint32_t id;
+	uint32_t lastLogged;//in us, when the last frame of this ID was logged
+	uint32_t suppressed;//frames left out in total
+	uint8_t data[8];//payload of the last logged frame
+	uint8_t bus;
+	uint8_t format;
+	uint8_t len;
+	uint8_t skipped;//frames left out since the last logged one
+};
+
+class CANChangeFilter
+{
+	public:
+
+		static CANChangeFilter* getFilter();//the filter used by the bridge
+
+		/** Forgets all payloads and starts filtering. The entry table is allocated on the first start
+
+			@return false if there was no memory for the table
+		*/
+		bool start();
+
+		void stop();//lets every frame through again, the counts are kept until the next start or release
+
+		void release();//stops filtering and frees the entry table
+
+		bool isRunning();
+
+		/** Sets how often an unchanged frame is logged anyway
+
+			@param time in ms since the last logged frame of the ID, 0 to disable
+			@param frames frames left out in a row, 0 to disable. Capped at CAN_CHANGE_FILTER_MAX_SKIP
+		*/
+		void setKeyframe(uint32_t time, uint32_t frames);
+
+		/** Decides whether a frame is logged. Lets everything through if the filter is not running. Called from the bridge interrupt
+
+			@param timestamp in us
+			@param skipped receives the number of frames of this ID left out since the last logged one
+
+			@return true if the frame has to be logged
+		*/
+		bool check(uint8_t bus, uint32_t id, uint8_t format, const uint8_t *data, uint8_t len, uint32_t timestamp, uint8_t &skipped);
+
+		uint32_t getIDCount();
+
+		uint32_t getPassedCount();//frames logged since start
+
+		uint32_t getSuppressedCount();//frames left out since start
+
+		/** Copies the entry at index, 0 to getIDCount() - 1, in the order the IDs were first seen
+
+			@return false if index is out of range
+		*/
+		bool getEntry(uint32_t index, CANChangeEntry &entry);
+
+	private:
+
+		CANChangeFilter();
+
+		CANChangeEntry* lookup(uint8_t bus, uint32_t id, uint8_t format);
+
+		static uint32_t hashKey(uint8_t bus, uint32_t id, uint8_t format);
+
+		CANChangeEntry* _entries;
+		uint16_t _slots[CAN_CHANGE_FILTER_HASH_SIZE];//entry index + 1, 0 means empty
+		uint32_t _keyframeTime;//in us
+		uint32_t _keyframeFrames;
+		volatile uint32_t _count;
+		volatile uint32_t _passed;
+		volatile uint32_t _suppressed;
+		volatile bool _running;
+
+		static CANChangeFilter filter;
+};
+
+#endif
@@ -0,0 +1,226 @@
+/*
+* CanBadger CAN Acceptance Filter Table
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "can_filter_table.h"
+#include <stdlib.h>
+
+#define FILTER_SECTION_SFF 0
+#define FILTER_SECTION_SFF_GRP 1
+#define FILTER_SECTION_EFF 2
+#define FILTER_SECTION_EFF_GRP 3
+#define FILTER_SECTION(key) ((uint32_t)((key) >> 62))
+#define FILTER_SFF_DISABLED ((1U << 13) | (1U << 12) | 0x7FFU) //disabled padding entry, sorts after any real one. Same as the CMSIS code uses
+
+static uint64_t encodeRange(uint32_t section, uint32_t ctrl, uint32_t lo, uint32_t hi)
+{
+	if(section == FILTER_SECTION_SFF_GRP)
+	{
+		return (((uint64_t)section << 62) | (ctrl << 29) | (lo << 16) | (ctrl << 13) | hi);
+	}
+	return (((uint64_t)section << 62) | ((uint64_t)ctrl << 58) | ((uint64_t)lo << 29) | hi);
+}
+
+static void decodeRange(uint64_t key, uint32_t &ctrl, uint32_t &lo, uint32_t &hi)
+{
+	if(FILTER_SECTION(key) == FILTER_SECTION_SFF_GRP)
+	{
+		ctrl = (((uint32_t)key >> 29) & 7);
+		lo = (((uint32_t)key >> 16) & 0x7FF);
+		hi = ((uint32_t)key & 0x7FF);
+		return;
+	}
+	ctrl = ((uint32_t)(key >> 58) & 7);
+	lo = ((uint32_t)(key >> 29) & 0x1FFFFFFF);
+	hi = ((uint32_t)key & 0x1FFFFFFF);
+}
+
+CANFilterTable::CANFilterTable(uint64_t *workBuffer, uint32_t workSize)
+{
+	_items = workBuffer;
+	_size = workSize;
+	_count = 0;
+}
+
+void CANFilterTable::clear()
+{
+	_count = 0;
+}
+
+uint32_t CANFilterTable::getCount()
+{
+	return _count;
+}
+
+bool CANFilterTable::addExactID(uint32_t id, uint8_t interfaceNo)
+{
+	if(_count >= _size || interfaceNo < 1 || interfaceNo > 2)
+	{
+		return false;
+	}
+	uint32_t ctrl = (interfaceNo - 1);
+	if(id & CAN_FILTER_IDE_FLAG)
+	{
+		_items[_count] = (((uint64_t)FILTER_SECTION_EFF << 62) | (ctrl << 29) | (id & 0x1FFFFFFF));
+	}
+	else
+	{
+		_items[_count] = (((uint64_t)FILTER_SECTION_SFF << 62) | (ctrl << 13) | (id & 0x7FF));
+	}
+	_count++;
+	return true;
+}
+
+bool CANFilterTable::addRange(uint32_t id, uint32_t idRangeEnd, uint8_t interfaceNo)
+{
+	if(_count >= _size || interfaceNo < 1 || interfaceNo > 2)
+	{
+		return false;
+	}
+	uint32_t ctrl = (interfaceNo - 1);
+	uint32_t section = FILTER_SECTION_SFF_GRP;
+	uint32_t idMask = 0x7FF;
+	if(id & CAN_FILTER_IDE_FLAG)
+	{
+		section = FILTER_SECTION_EFF_GRP;
+		idMask = 0x1FFFFFFF;
+	}
+	uint32_t lo = (id & idMask);
+	uint32_t hi = (idRangeEnd & idMask);
+	if(lo > hi)
+	{
+		uint32_t tmp = lo;
+		lo = hi;
+		hi = tmp;
+	}
+	_items[_count] = encodeRange(section, ctrl, lo, hi);
+	_count++;
+	return true;
+}
+
+int CANFilterTable::compareKeys(const void *a, const void *b)
+{
+	uint64_t ka = *(const uint64_t*)a;
+	uint64_t kb = *(const uint64_t*)b;
+	if(ka < kb)
+	{
+		return -1;
+	}
+	return (ka > kb) ? 1 : 0;
+}
+
+uint32_t CANFilterTable::compact()
+{
+	uint32_t out = 0;
+	for(uint32_t a = 0; a < _count; a++)
+	{
+		uint64_t key = _items[a];
+		if(out > 0)
+		{
+			uint64_t prev = _items[out - 1];
+			if(prev == key)
+			{
+				continue;
+			}
+			uint32_t section = FILTER_SECTION(key);
+			if(section == FILTER_SECTION(prev) && (section == FILTER_SECTION_SFF_GRP || section == FILTER_SECTION_EFF_GRP))
+			{
+				uint32_t prevCtrl, prevLo, prevHi, ctrl, lo, hi;
+				decodeRange(prev, prevCtrl, prevLo, prevHi);
+				decodeRange(key, ctrl, lo, hi);
+				if(ctrl == prevCtrl && lo <= (prevHi + 1))//sorted by start, so this one overlaps or touches the previous range
+				{
+					if(hi > prevHi)
+					{
+						_items[out - 1] = encodeRange(section, ctrl, prevLo, hi);
+					}
+					continue;
+				}
+			}
+		}
+		_items[out] = key;
+		out++;
+	}
+	return out;
+}
+
+bool CANFilterTable::compile(uint32_t *afRAM, uint32_t ramWords, CANFilterLayout &layout)
+{
+	if(_count > 1)
+	{
+		qsort(_items, _count, sizeof(uint64_t), compareKeys);
+	}
+	_count = compact();
+	uint32_t sectionCount[4] = {0, 0, 0, 0};
+	for(uint32_t a = 0; a < _count; a++)
+	{
+		sectionCount[FILTER_SECTION(_items[a])]++;
+	}
+	uint32_t sffWords = ((sectionCount[FILTER_SECTION_SFF] + 1) / 2);//two entries per word
+	uint32_t totalWords = (sffWords + sectionCount[FILTER_SECTION_SFF_GRP] + sectionCount[FILTER_SECTION_EFF] + (sectionCount[FILTER_SECTION_EFF_GRP] * 2));
+	if(totalWords > ramWords || totalWords > CAN_AF_RAM_WORDS)
+	{
+		return false;
+	}
+	uint32_t pos = 0;
+	uint32_t item = 0;
+	layout.sffStart = 0;
+	for(uint32_t a = 0; a < sectionCount[FILTER_SECTION_SFF]; a += 2)//lower entry goes in the upper half word
+	{
+		uint32_t upper = ((uint32_t)_items[item] & 0xFFFF);
+		uint32_t lower = FILTER_SFF_DISABLED;
+		if((a + 1) < sectionCount[FILTER_SECTION_SFF])
+		{
+			lower = ((uint32_t)_items[item + 1] & 0xFFFF);
+		}
+		afRAM[pos] = ((upper << 16) | lower);
+		pos++;
+		item += 2;
+	}
+	item = sectionCount[FILTER_SECTION_SFF];
+	layout.sffGrpStart = (pos * 4);
+	for(uint32_t a = 0; a < sectionCount[FILTER_SECTION_SFF_GRP]; a++)
+	{
+		afRAM[pos] = (uint32_t)_items[item];//SFF_GRP and EFF keys already hold their final word in the low 32 bits
+		pos++;
+		item++;
+	}
+	layout.effStart = (pos * 4);
+	for(uint32_t a = 0; a < sectionCount[FILTER_SECTION_EFF]; a++)
+	{
+		afRAM[pos] = (uint32_t)_items[item];
+		pos++;
+		item++;
+	}
+	layout.effGrpStart = (pos * 4);
+	for(uint32_t a = 0; a < sectionCount[FILTER_SECTION_EFF_GRP]; a++)
+	{
+		uint32_t ctrl, lo, hi;
+		decodeRange(_items[item], ctrl, lo, hi);
+		afRAM[pos] = ((ctrl << 29) | lo);
+		afRAM[pos + 1] = ((ctrl << 29) | hi);
+		pos += 2;
+		item++;
+	}
+	layout.endOfTable = (pos * 4);
+	return true;
+}
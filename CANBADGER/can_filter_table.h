@@ -0,0 +1,101 @@
+/*
+* CanBadger CAN Acceptance Filter Table
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Builds the complete acceptance filter LUT in one pass instead of inserting entries one by one with CANx_AddFilter.
+Every entry is kept as a 64 bit sort key whose top two bits are the LUT section, so one sort puts the entries in
+table order: SFF, SFF_GRP, EFF, EFF_GRP, each section sorted the way the acceptance filter expects.
+This file does not touch the hardware, compile() writes into any word array and CANbadger_CAN::loadFilterTable points it at the AF RAM.
+*/
+
+#ifndef __CAN_FILTER_TABLE_H__
+#define __CAN_FILTER_TABLE_H__
+
+#include <stdint.h>
+
+#define CAN_AF_RAM_WORDS 512 //size of the acceptance filter RAM on the LPC17xx
+#define CAN_FILTER_IDE_FLAG (1UL << 31) //marks an extended ID, same as ARM_CAN_ID_IDE_Msk
+
+/** Section start addresses as they go into the SFF_sa, SFF_GRP_sa, EFF_sa, EFF_GRP_sa and ENDofTable registers, in bytes
+*/
+struct CANFilterLayout
+{
+	uint32_t sffStart;
+	uint32_t sffGrpStart;
+	uint32_t effStart;
+	uint32_t effGrpStart;
+	uint32_t endOfTable;
+};
+
+class CANFilterTable
+{
+	public:
+
+		/** @param workBuffer storage for the entries, one slot per exact ID or range added
+			@param workSize number of slots in workBuffer
+		*/
+		CANFilterTable(uint64_t *workBuffer, uint32_t workSize);
+
+		void clear();
+
+		/** Adds an exact ID. Set CAN_FILTER_IDE_FLAG in id for extended IDs
+
+			@param interfaceNo 1 or 2
+
+			@return false if the work buffer is full or the parameters are invalid
+		*/
+		bool addExactID(uint32_t id, uint8_t interfaceNo);
+
+		/** Adds an inclusive ID range. Set CAN_FILTER_IDE_FLAG in id for extended IDs
+
+			@param interfaceNo 1 or 2
+
+			@return false if the work buffer is full or the parameters are invalid
+		*/
+		bool addRange(uint32_t id, uint32_t idRangeEnd, uint8_t interfaceNo);
+
+		uint32_t getCount();//entries added so far, before duplicates are dropped
+
+		/** Sorts the entries, drops duplicates, merges overlapping ranges and writes the packed sections to afRAM.
+			Nothing is written if the result does not fit
+
+			@param afRAM destination, the acceptance filter RAM or a copy of it
+			@param ramWords size of afRAM in words
+			@param layout receives the section pointers for the packed table
+
+			@return true if the table fits and was written
+		*/
+		bool compile(uint32_t *afRAM, uint32_t ramWords, CANFilterLayout &layout);
+
+	private:
+
+		uint32_t compact();//drops duplicates and merges ranges in the sorted work buffer, returns the new count
+
+		static int compareKeys(const void *a, const void *b);
+
+		uint64_t *_items;
+		uint32_t _size;
+		uint32_t _count;
+};
+
+#endif
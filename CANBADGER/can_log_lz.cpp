@@ -0,0 +1,363 @@
+/*
+* CanBadger Log Block Compressor
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "can_log_lz.h"
+#include <string.h>
+
+static inline uint32_t hash3(const uint8_t *p)
+{
+	uint32_t v = ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16));
+	return ((v * 2654435761U) >> (32 - CAN_LOG_LZ_HASH_BITS));
+}
+
+CANLogCompressor::CANLogCompressor(uint32_t blockSize)
+{
+	if(blockSize == 0 || blockSize > CAN_LOG_LZ_BLOCK_SIZE)
+	{
+		blockSize = CAN_LOG_LZ_BLOCK_SIZE;
+	}
+	_blockSize = blockSize;
+	_pending = 0;
+	_clock = NULL;
+	clearStats();
+}
+
+void CANLogCompressor::setClock(uint32_t (*clock)(void))
+{
+	_clock = clock;
+}
+
+uint32_t CANLogCompressor::append(const uint8_t *data, uint32_t len)
+{
+	uint32_t room = (_blockSize - _pending);
+	if(len > room)
+	{
+		len = room;
+	}
+	memcpy(&_in[_pending], data, len);
+	_pending += len;
+	return len;
+}
+
+bool CANLogCompressor::isFull()
+{
+	return (_pending >= _blockSize);
+}
+
+uint32_t CANLogCompressor::getPending()
+{
+	return _pending;
+}
+
+uint32_t CANLogCompressor::compress(uint8_t *out)
+{
+	memset(_hash, 0, sizeof(_hash));
+	uint32_t pos = 0;
+	uint32_t outPos = 0;
+	uint32_t flagPos = 0;
+	uint8_t flagBit = 8;
+	while(pos < _pending)
+	{
+		if(flagBit == 8)
+		{
+			flagPos = outPos;
+			out[outPos] = 0;
+			outPos++;
+			flagBit = 0;
+		}
+		if((outPos + 3) >= _pending)//the next token could take 3 bytes, and the payload has to come out smaller than the plain data
+		{
+			return 0;
+		}
+		uint32_t matchLen = 0;
+		uint32_t dist = 0;
+		if((pos + CAN_LOG_LZ_MIN_MATCH) <= _pending)
+		{
+			uint32_t h = hash3(&_in[pos]);
+			uint32_t candidate = _hash[h];
+			_hash[h] = (pos + 1);
+			if(candidate != 0)
+			{
+				candidate--;
+				uint32_t maxLen = (_pending - pos);
+				if(maxLen > CAN_LOG_LZ_MAX_MATCH)
+				{
+					maxLen = CAN_LOG_LZ_MAX_MATCH;
+				}
+				while(matchLen < maxLen && _in[candidate + matchLen] == _in[pos + matchLen])//may run into pos, the decoder copies forward so overlapping matches are fine
+				{
+					matchLen++;
+				}
+				dist = (pos - candidate);
+			}
+		}
+		if(matchLen >= CAN_LOG_LZ_MIN_MATCH)
+		{
+			out[flagPos] |= (1 << flagBit);
+			uint32_t lenField = (matchLen - CAN_LOG_LZ_MIN_MATCH);
+			if(lenField > 31)
+			{
+				lenField = 31;
+			}
+			uint32_t token = ((lenField << 11) | (dist - 1));
+			out[outPos] = (token & 0xFF);
+			out[outPos + 1] = (token >> 8);
+			outPos += 2;
+			if(lenField == 31)
+			{
+				out[outPos] = (matchLen - CAN_LOG_LZ_MIN_MATCH - 31);
+				outPos++;
+			}
+			for(uint32_t a = 1; a < matchLen && (pos + a + CAN_LOG_LZ_MIN_MATCH) <= _pending; a++)//so the next repetition can find any part of this one
+			{
+				_hash[hash3(&_in[pos + a])] = (pos + a + 1);
+			}
+			pos += matchLen;
+		}
+		else
+		{
+			out[outPos] = _in[pos];
+			outPos++;
+			pos++;
+		}
+		flagBit++;
+	}
+	return outPos;
+}
+
+uint16_t CANLogCompressor::checksum(const uint8_t *header, const uint8_t *payload, uint32_t len)
+{
+	uint32_t sum1 = 0;
+	uint32_t sum2 = 0;
+	for(uint8_t a = 2; a < 6; a++)
+	{
+		sum1 += header[a];
+		sum2 += sum1;
+	}
+	for(uint32_t a = 0; a < len; a++)
+	{
+		sum1 += payload[a];
+		sum2 += sum1;
+		if((a & 0xFF) == 0xFF)//reduce well before sum2 can overflow
+		{
+			sum1 %= 255;
+			sum2 %= 255;
+		}
+	}
+	return (((sum2 % 255) << 8) | (sum1 % 255));
+}
+
+uint32_t CANLogCompressor::flush(const uint8_t *&block)
+{
+	if(_pending == 0)
+	{
+		return 0;
+	}
+	uint32_t startTime = 0;
+	if(_clock != NULL)
+	{
+		startTime = _clock();
+	}
+	uint8_t *payload = &_out[CAN_LOG_LZ_HEADER_SIZE];
+	uint32_t payloadLen = compress(payload);
+	uint32_t lenField = payloadLen;
+	if(payloadLen == 0)
+	{
+		memcpy(payload, _in, _pending);
+		payloadLen = _pending;
+		lenField = (payloadLen | CAN_LOG_LZ_STORED);
+	}
+	_out[0] = CAN_LOG_LZ_MAGIC0;
+	_out[1] = CAN_LOG_LZ_MAGIC1;
+	_out[2] = (_pending & 0xFF);
+	_out[3] = (_pending >> 8);
+	_out[4] = (lenField & 0xFF);
+	_out[5] = (lenField >> 8);
+	uint16_t check = checksum(_out, payload, payloadLen);
+	_out[6] = (check & 0xFF);
+	_out[7] = (check >> 8);
+	_plainBytes += _pending;
+	_packedBytes += (CAN_LOG_LZ_HEADER_SIZE + payloadLen);
+	_blocks++;
+	_pending = 0;
+	if(_clock != NULL)
+	{
+		_busyTime += (_clock() - startTime);
+	}
+	block = _out;
+	return (CAN_LOG_LZ_HEADER_SIZE + payloadLen);
+}
+
+uint32_t CANLogCompressor::getPlainBytes()
+{
+	return _plainBytes;
+}
+
+uint32_t CANLogCompressor::getPackedBytes()
+{
+	return _packedBytes;
+}
+
+uint32_t CANLogCompressor::getBlockCount()
+{
+	return _blocks;
+}
+
+uint32_t CANLogCompressor::getBusyTime()
+{
+	return _busyTime;
+}
+
+void CANLogCompressor::clearStats()
+{
+	_plainBytes = 0;
+	_packedBytes = 0;
+	_blocks = 0;
+	_busyTime = 0;
+}
+
+int32_t CANLogCompressor::decodeBlock(const uint8_t *data, uint32_t len, uint8_t *out, uint32_t &consumed)
+{
+	if(len < CAN_LOG_LZ_HEADER_SIZE)
+	{
+		return CAN_LOG_LZ_NEED_MORE;
+	}
+	if(data[0] != CAN_LOG_LZ_MAGIC0 || data[1] != CAN_LOG_LZ_MAGIC1)
+	{
+		return CAN_LOG_LZ_ERROR;
+	}
+	uint32_t plainLen = (data[2] | (data[3] << 8));
+	uint32_t lenField = (data[4] | (data[5] << 8));
+	uint32_t payloadLen = (lenField & ~CAN_LOG_LZ_STORED);
+	bool stored = ((lenField & CAN_LOG_LZ_STORED) != 0);
+	if(plainLen == 0 || plainLen > CAN_LOG_LZ_BLOCK_SIZE || payloadLen == 0 || payloadLen > CAN_LOG_LZ_BLOCK_SIZE || (stored == true && payloadLen != plainLen))
+	{
+		return CAN_LOG_LZ_ERROR;
+	}
+	if(len < (CAN_LOG_LZ_HEADER_SIZE + payloadLen))
+	{
+		return CAN_LOG_LZ_NEED_MORE;
+	}
+	const uint8_t *payload = &data[CAN_LOG_LZ_HEADER_SIZE];
+	if(checksum(data, payload, payloadLen) != (data[6] | (data[7] << 8)))
+	{
+		return CAN_LOG_LZ_ERROR;
+	}
+	if(stored == true)
+	{
+		memcpy(out, payload, plainLen);
+	}
+	else
+	{
+		uint32_t in = 0;
+		uint32_t outPos = 0;
+		uint8_t flags = 0;
+		uint8_t flagBit = 8;
+		while(in < payloadLen)
+		{
+			if(flagBit == 8)
+			{
+				flags = payload[in];
+				in++;
+				flagBit = 0;
+				continue;
+			}
+			if(flags & (1 << flagBit))
+			{
+				if((in + 2) > payloadLen)
+				{
+					return CAN_LOG_LZ_ERROR;
+				}
+				uint32_t token = (payload[in] | (payload[in + 1] << 8));
+				in += 2;
+				uint32_t matchLen = ((token >> 11) + CAN_LOG_LZ_MIN_MATCH);
+				if((token >> 11) == 31)
+				{
+					if(in >= payloadLen)
+					{
+						return CAN_LOG_LZ_ERROR;
+					}
+					matchLen += payload[in];
+					in++;
+				}
+				uint32_t dist = ((token & 0x7FF) + 1);
+				if(dist > outPos || (outPos + matchLen) > plainLen)
+				{
+					return CAN_LOG_LZ_ERROR;
+				}
+				for(uint32_t a = 0; a < matchLen; a++)
+				{
+					out[outPos] = out[outPos - dist];
+					outPos++;
+				}
+			}
+			else
+			{
+				if(outPos >= plainLen)
+				{
+					return CAN_LOG_LZ_ERROR;
+				}
+				out[outPos] = payload[in];
+				outPos++;
+				in++;
+			}
+			flagBit++;
+		}
+		if(outPos != plainLen)
+		{
+			return CAN_LOG_LZ_ERROR;
+		}
+	}
+	consumed = (CAN_LOG_LZ_HEADER_SIZE + payloadLen);
+	return plainLen;
+}
+
+int32_t CANLogCompressor::findBlock(const uint8_t *data, uint32_t len)
+{
+	for(uint32_t a = 0; a < len; a++)
+	{
+		if(data[a] != CAN_LOG_LZ_MAGIC0)
+		{
+			continue;
+		}
+		if((a + CAN_LOG_LZ_HEADER_SIZE) > len)//could be a header that is cut short, let the caller read on
+		{
+			if((a + 1) == len || data[a + 1] == CAN_LOG_LZ_MAGIC1)
+			{
+				return a;
+			}
+			continue;
+		}
+		if(data[a + 1] != CAN_LOG_LZ_MAGIC1)
+		{
+			continue;
+		}
+		uint32_t plainLen = (data[a + 2] | (data[a + 3] << 8));
+		uint32_t payloadLen = ((data[a + 4] | (data[a + 5] << 8)) & ~CAN_LOG_LZ_STORED);
+		if(plainLen > 0 && plainLen <= CAN_LOG_LZ_BLOCK_SIZE && payloadLen > 0 && payloadLen <= CAN_LOG_LZ_BLOCK_SIZE)
+		{
+			return a;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,140 @@
+/*
+* CanBadger Log Block Compressor
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Compressed log streams are a sequence of independent blocks, each holding up to CAN_LOG_LZ_BLOCK_SIZE bytes of the plain
+stream (a v2 RAW log on the SD, v1 RAW records over Ethernet). Nothing is shared between blocks, so a truncated or damaged
+stream loses only the blocks that are cut or corrupt, and a reader can pick up again at the next block magic.
+
+Block header (CAN_LOG_LZ_HEADER_SIZE bytes, little endian):
+	-Bytes [0-1] magic CB 5A
+	-Bytes [2-3] plain length, 1 to CAN_LOG_LZ_BLOCK_SIZE
+	-Bytes [4-5] payload length. Bit 15 set means the payload is the plain data, stored as is because it did not compress
+	-Bytes [6-7] Fletcher-16 of bytes [2-5] and the payload
+
+Payload, LZSS:
+	-A flag byte announces the next 8 tokens, LSB first. A clear bit is a literal byte, a set bit is a match
+	-Match: 2 bytes, bits 15-11 length - 3, bits 10-0 distance - 1. A length field of 31 is followed by one more byte
+	 that adds to the length, so matches run from 3 to 289 bytes and reach back up to 2048 bytes within the block
+*/
+
+#ifndef __CAN_LOG_LZ_H__
+#define __CAN_LOG_LZ_H__
+
+#include <stdint.h>
+
+#define CAN_LOG_LZ_BLOCK_SIZE 2048 //plain bytes per block, matches cannot reach further back than this
+#define CAN_LOG_LZ_ETHERNET_BLOCK_SIZE 1024 //plain bytes per block when streaming, a block has to fit in one Ethernet message
+#define CAN_LOG_LZ_ETHERNET_FLUSH_TIME 50 //ms a partial block may wait before it is sent anyway
+#define CAN_LOG_LZ_HEADER_SIZE 8
+#define CAN_LOG_LZ_MAX_BLOCK_SIZE (CAN_LOG_LZ_HEADER_SIZE + CAN_LOG_LZ_BLOCK_SIZE) //blocks that would grow are stored instead
+#define CAN_LOG_LZ_HASH_BITS 10
+#define CAN_LOG_LZ_MIN_MATCH 3
+#define CAN_LOG_LZ_MAX_MATCH (CAN_LOG_LZ_MIN_MATCH + 31 + 255)
+#define CAN_LOG_LZ_STORED 0x8000
+
+#define CAN_LOG_LZ_MAGIC0 0xCB
+#define CAN_LOG_LZ_MAGIC1 0x5A
+
+#define CAN_LOG_LZ_NEED_MORE 0
+#define CAN_LOG_LZ_ERROR -1
+
+/** Collects a plain log stream and turns it into compressed blocks.
+	Uses about 6KB of RAM, so keep it off the small thread stacks
+*/
+class CANLogCompressor
+{
+	public:
+
+		/** @param blockSize plain bytes per block, up to CAN_LOG_LZ_BLOCK_SIZE. Smaller blocks compress worse but leave sooner
+		*/
+		CANLogCompressor(uint32_t blockSize = CAN_LOG_LZ_BLOCK_SIZE);
+
+		/** Sets the clock used to measure the time spent compressing, us_ticker_read on the device
+
+			@param clock returns a free running us count, NULL disables the measurement
+		*/
+		void setClock(uint32_t (*clock)(void));
+
+		/** Takes as much of data as fits in the current block
+
+			@return the number of bytes taken. Less than len means the block is full and needs a flush
+		*/
+		uint32_t append(const uint8_t *data, uint32_t len);
+
+		bool isFull();
+
+		uint32_t getPending();//plain bytes waiting in the current block
+
+		/** Compresses whatever is pending into a block and starts a new one
+
+			@param block is set to the finished block, valid until the next append or flush
+
+			@return the size of the block, 0 if nothing was pending
+		*/
+		uint32_t flush(const uint8_t *&block);
+
+		uint32_t getPlainBytes();
+
+		uint32_t getPackedBytes();//block bytes produced, headers included
+
+		uint32_t getBlockCount();
+
+		uint32_t getBusyTime();//us spent in flush, 0 without a clock
+
+		void clearStats();
+
+		/** Decodes the block at the start of data
+
+			@param out receives the plain data, must hold CAN_LOG_LZ_BLOCK_SIZE bytes
+			@param consumed is set to the size of the block
+
+			@return the plain length, CAN_LOG_LZ_NEED_MORE if the block is cut short, CAN_LOG_LZ_ERROR if data does not hold a valid block
+		*/
+		static int32_t decodeBlock(const uint8_t *data, uint32_t len, uint8_t *out, uint32_t &consumed);
+
+		/** Looks for something that could be a block header, for readers that hit a damaged block
+
+			@return the offset of the candidate, -1 if there is none in data
+		*/
+		static int32_t findBlock(const uint8_t *data, uint32_t len);
+
+	private:
+
+		uint32_t compress(uint8_t *out);//returns the payload length, 0 if the block does not shrink
+
+		static uint16_t checksum(const uint8_t *header, const uint8_t *payload, uint32_t len);
+
+		uint8_t _in[CAN_LOG_LZ_BLOCK_SIZE];
+		uint8_t _out[CAN_LOG_LZ_MAX_BLOCK_SIZE];
+		uint16_t _hash[1 << CAN_LOG_LZ_HASH_BITS];//last position + 1 of each 3 byte hash, 0 if unused
+		uint32_t _blockSize;
+		uint32_t _pending;
+		uint32_t (*_clock)(void);
+		uint32_t _plainBytes;
+		uint32_t _packedBytes;
+		uint32_t _blocks;
+		uint32_t _busyTime;
+};
+
+#endif
@@ -0,0 +1,149 @@
+/*
+* CanBadger CAN Log Ring
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+
+#include "can_log_ring.h"
+
+CANLogRing CANLogRing::ring;
+
+CANLogRing::CANLogRing()
+{
+	_head = 0;
+	_tail = 0;
+	_drops = 0;
+	_highWater = 0;
+	_epoch = 0;
+}
+
+CANLogRing* CANLogRing::getRing()
+{
+	return &ring;
+}
+
+bool CANLogRing::push(uint8_t bus, uint8_t flags, uint64_t time, CANMessage &msg, uint8_t skipped)
+{
+	uint32_t head = _head;
+	uint32_t used = head - _tail;
+	if(used >= CAN_LOG_RING_SIZE)
+	{
+		_drops++;
+		return false;
+	}
+	CANLogRecord *record = &_records[head & CAN_LOG_RING_MASK];
+	record->time = time;
+	record->id = msg.id;
+	record->bus = bus;
+	record->flags = flags;
+	record->len = (msg.len > 8) ? 8 : msg.len;
+	record->skipped = skipped;
+	for(uint8_t a = 0; a < 8; a++)
+	{
+		record->data[a] = msg.data[a];
+	}
+	__DMB();//the record must be complete before the consumer can see the new head
+	_head = head + 1;
+	if((used + 1) > _highWater)
+	{
+		_highWater = (used + 1);
+	}
+	return true;
+}
+
+uint32_t CANLogRing::peek(CANLogRecord *&records)
+{
+	uint32_t tail = _tail;
+	uint32_t available = (_head - tail);
+	if(available == 0)
+	{
+		return 0;
+	}
+	__DMB();//do not read the records before the head that published them
+	uint32_t idx = (tail & CAN_LOG_RING_MASK);
+	if(available > (CAN_LOG_RING_SIZE - idx))
+	{
+		available = (CAN_LOG_RING_SIZE - idx);
+	}
+	records = &_records[idx];
+	return available;
+}
+
+void CANLogRing::consume(uint32_t count)
+{
+	__DMB();//finish reading the records before handing them back to the producer
+	_tail = (_tail + count);
+}
+
+uint32_t CANLogRing::pending()
+{
+	return (_head - _tail);
+}
+
+void CANLogRing::flush()
+{
+	_tail = _head;
+}
+
+uint32_t CANLogRing::getDropCount()
+{
+	return _drops;
+}
+
+uint32_t CANLogRing::getHighWater()
+{
+	return _highWater;
+}
+
+void CANLogRing::clearStats()
+{
+	_drops = 0;
+	_highWater = 0;
+}
+
+void CANLogRing::setEpoch(uint64_t time)
+{
+	_epoch = time;
+}
+
+uint32_t CANLogRing::serializeRAW(const CANLogRecord *record, uint32_t speed, uint8_t *out)
+{
+	uint32_t timestamp = (record->time > ring._epoch) ? (uint32_t)((record->time - ring._epoch) / 1000) : 0;
+	out[0] = record->flags;
+	out[1] = (timestamp >> 24);
+	out[2] = (timestamp >> 16);
+	out[3] = (timestamp >> 8);
+	out[4] = timestamp;
+	out[5] = (record->id >> 24);
+	out[6] = (record->id >> 16);
+	out[7] = (record->id >> 8);
+	out[8] = record->id;
+	out[9] = (speed >> 24);
+	out[10] = (speed >> 16);
+	out[11] = (speed >> 8);
+	out[12] = speed;
+	out[13] = record->len;
+	for(uint8_t a = 0; a < record->len; a++)
+	{
+		out[CAN_LOG_RAW_HEADER_SIZE + a] = record->data[a];
+	}
+	return (CAN_LOG_RAW_HEADER_SIZE + record->len);
+}
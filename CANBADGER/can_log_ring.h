@@ -0,0 +1,115 @@
+/*
+* CanBadger CAN Log Ring
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+
+#ifndef __CAN_LOG_RING_H__
+#define __CAN_LOG_RING_H__
+
+#include "mbed.h"
+
+#define CAN_LOG_RING_SIZE 128 //records, must be a power of two
+#define CAN_LOG_RING_MASK (CAN_LOG_RING_SIZE - 1)
+#define CAN_LOG_RAW_HEADER_SIZE 14 //header of a frame in the RAW log format
+#define CAN_LOG_RAW_MAX_SIZE (CAN_LOG_RAW_HEADER_SIZE + 8)
+
+/** A frame as queued for logging. Fixed size so the consumer never has to scan for frame boundaries
+*/
+struct CANLogRecord
+{
+	uint64_t time;//Timebase::now() when the frame was read from the controller
+	uint32_t id;
+	uint8_t data[8];
+	uint8_t bus;//1 or 2
+	uint8_t flags;//interface/format byte of the RAW log format (21, 37, 22 or 38)
+	uint8_t len;
+	uint8_t skipped;//unchanged frames of this ID left out right before this one, see CANChangeFilter
+};
+
+/** Single producer/single consumer ring between the bridge interrupt and the logging thread.
+	The consumer takes records in batches straight from the ring with peek/consume
+*/
+class CANLogRing
+{
+	public:
+
+		static CANLogRing* getRing();
+
+		/** Queues a frame. Called from the bridge interrupt only
+
+			@param time when the frame was received, from Timebase::now
+			@param skipped frames of this ID left out by change-only logging before this one
+
+			@return false if the ring was full and the frame was dropped
+		*/
+		bool push(uint8_t bus, uint8_t flags, uint64_t time, CANMessage &msg, uint8_t skipped = 0);
+
+		/** Gives access to the oldest pending records without copying them. Only the records up to the end of the
+			ring storage are returned, the rest comes with the next call
+
+			@param records receives a pointer to the first record
+
+			@return number of records that can be read from records
+		*/
+		uint32_t peek(CANLogRecord *&records);
+
+		/** Hands the first count records returned by peek back to the producer
+		*/
+		void consume(uint32_t count);
+
+		uint32_t pending();//number of records waiting to be consumed
+
+		void flush();//drops all pending records. Consumer side only
+
+		uint32_t getDropCount();//records dropped because the ring was full
+
+		uint32_t getHighWater();//highest fill level seen since the last clearStats
+
+		void clearStats();
+
+		/** Sets the time the ms timestamps of the RAW log format count from. Called when a logger starts
+		*/
+		void setEpoch(uint64_t time);
+
+		/** Writes a record in the RAW log format: flags (1) | timestamp in ms since the epoch (4) | ID (4) | speed (4) | length (1) | data, all big endian
+
+			@param speed bus speed to store in the header
+
+			@return number of bytes written, CAN_LOG_RAW_MAX_SIZE at most
+		*/
+		static uint32_t serializeRAW(const CANLogRecord *record, uint32_t speed, uint8_t *out);
+
+	private:
+
+		CANLogRing();
+
+		CANLogRecord _records[CAN_LOG_RING_SIZE];
+		volatile uint32_t _head;//written only by the producer
+		volatile uint32_t _tail;//written only by the consumer
+		volatile uint32_t _drops;
+		volatile uint32_t _highWater;
+		uint64_t _epoch;
+
+		static CANLogRing ring;
+};
+
+#endif
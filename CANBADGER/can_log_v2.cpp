@@ -0,0 +1,725 @@
+/*
+* CanBadger RAW Log Format v2
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+
+#include "can_log_v2.h"
+#include <string.h>
+
+#define SYNC_PATTERN_SIZE 4
+#define INDEX_CRC_OFFSET (CAN_LOG_V2_INDEX_SIZE - 4)
+
+static const uint8_t syncPattern[SYNC_PATTERN_SIZE] = {CAN_LOG_V2_TAG_SYNC, 0xA5, 0x5A, 0xC3};
+static const uint8_t indexPattern[SYNC_PATTERN_SIZE] = {CAN_LOG_V2_TAG_INDEX, 'I', 'D', 'X'};
+
+static void putLE32(uint8_t *out, uint32_t value)
+{
+	out[0] = value;
+	out[1] = (value >> 8);
+	out[2] = (value >> 16);
+	out[3] = (value >> 24);
+}
+
+static uint32_t getLE32(const uint8_t *in)
+{
+	return (in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24));
+}
+
+static uint32_t getBE32(const uint8_t *in)
+{
+	return (((uint32_t)in[0] << 24) | (in[1] << 16) | (in[2] << 8) | in[3]);
+}
+
+static void putLE64(uint8_t *out, uint64_t value)
+{
+	putLE32(out, (uint32_t)value);
+	putLE32(&out[4], (uint32_t)(value >> 32));
+}
+
+static uint64_t getLE64(const uint8_t *in)
+{
+	return (getLE32(in) | ((uint64_t)getLE32(&in[4]) << 32));
+}
+
+static uint32_t crc32(const uint8_t *data, uint32_t len)//bitwise, it only runs once per index block
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for(uint32_t a = 0; a < len; a++)
+	{
+		crc ^= data[a];
+		for(uint8_t b = 0; b < 8; b++)
+		{
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+		}
+	}
+	return ~crc;
+}
+
+//two bits of the 2048 bit bloom filter for an ID. Bus and format are part of the key
+static void filterBits(uint8_t bus, bool extended, uint32_t id, uint32_t &bit1, uint32_t &bit2)
+{
+	uint32_t key = (id & 0x1FFFFFFF);
+	if(extended == true)
+	{
+		key |= 0x20000000;
+	}
+	if(bus == 2)
+	{
+		key |= 0x40000000;
+	}
+	bit1 = ((key * 0x9E3779B1) >> 21);
+	bit2 = (((key ^ (key >> 15)) * 0x85EBCA6B) >> 21);
+}
+
+static uint32_t putVarint(uint8_t *out, uint32_t value)
+{
+	uint32_t pos = 0;
+	while(value > 0x7F)
+	{
+		out[pos] = ((value & 0x7F) | 0x80);
+		value >>= 7;
+		pos++;
+	}
+	out[pos] = value;
+	return (pos + 1);
+}
+
+//returns the varint size, 0 if it is cut short, -1 if it does not fit in 32 bits
+static int getVarint(const uint8_t *in, uint32_t len, uint32_t &value)
+{
+	value = 0;
+	for(uint32_t a = 0; a < 5; a++)
+	{
+		if(a >= len)
+		{
+			return 0;
+		}
+		if(a == 4 && in[a] > 0x0F)
+		{
+			return -1;
+		}
+		value |= ((uint32_t)(in[a] & 0x7F) << (a * 7));
+		if((in[a] & 0x80) == 0)
+		{
+			return (a + 1);
+		}
+	}
+	return -1;
+}
+
+CANLogV2Encoder::CANLogV2Encoder()
+{
+	_lastTimestamp = 0;
+	_elapsed = 0;
+	_frames = 0;
+	_sinceSync = 0;
+	_lastID[0] = 0;
+	_lastID[1] = 0;
+	_drops = 0;
+	_offset = 0;
+	_previousIndex = 0;
+	_segmentOffset = 0;
+	_segmentFirstFrame = 0;
+	_syncCount = 0;
+	memset(_syncOffset, 0, sizeof(_syncOffset));
+	memset(_syncTime, 0, sizeof(_syncTime));
+	memset(_idFilter, 0, sizeof(_idFilter));
+	_started = false;
+	_haveID[0] = false;
+	_haveID[1] = false;
+}
+
+uint32_t CANLogV2Encoder::writeHeader(uint8_t *out, const CANLogV2Header &header)
+{
+	*this = CANLogV2Encoder();
+	memset(out, 0, CAN_LOG_V2_HEADER_SIZE);
+	out[0] = 'C';
+	out[1] = 'B';
+	out[2] = 'L';
+	out[3] = '2';
+	out[4] = CAN_LOG_V2_VERSION;
+	out[5] = CAN_LOG_V2_HEADER_SIZE;
+	putLE32(&out[6], header.timebase);
+	putLE32(&out[10], header.speed[0]);
+	putLE32(&out[14], header.speed[1]);
+	out[18] = header.busFlags[0];
+	out[19] = header.busFlags[1];
+	for(uint8_t a = 0; a < 8 && header.fwVersion[a] != 0; a++)
+	{
+		out[20 + a] = header.fwVersion[a];
+	}
+	_offset = CAN_LOG_V2_HEADER_SIZE;
+	return CAN_LOG_V2_HEADER_SIZE;
+}
+
+uint32_t CANLogV2Encoder::writeSync(uint8_t *out)
+{
+	memcpy(out, syncPattern, SYNC_PATTERN_SIZE);
+	putLE64(&out[4], _elapsed);
+	putLE32(&out[12], _frames);
+	_sinceSync = 0;
+	_haveID[0] = false;//IDs are never repeated across a sync, so a reader can start right after it
+	_haveID[1] = false;
+	if(_syncCount == 0)//opens a new segment
+	{
+		_segmentOffset = _offset;
+		_segmentFirstFrame = _frames;
+	}
+	if(_syncCount < CAN_LOG_V2_INDEX_SYNCS)
+	{
+		_syncOffset[_syncCount] = _offset;
+		_syncTime[_syncCount] = _elapsed;
+		_syncCount++;
+	}
+	_offset += CAN_LOG_V2_SYNC_SIZE;
+	return CAN_LOG_V2_SYNC_SIZE;
+}
+
+uint32_t CANLogV2Encoder::writeIndex(uint8_t *out)
+{
+	memset(out, 0, CAN_LOG_V2_INDEX_SIZE);
+	memcpy(out, indexPattern, SYNC_PATTERN_SIZE);
+	putLE32(&out[4], _offset);
+	putLE32(&out[8], _previousIndex);
+	putLE32(&out[12], _segmentOffset);
+	putLE32(&out[16], _segmentFirstFrame);
+	putLE32(&out[20], (_frames - _segmentFirstFrame));
+	putLE64(&out[24], _syncTime[0]);
+	putLE64(&out[32], _elapsed);
+	out[40] = _syncCount;
+	for(uint8_t a = 0; a < _syncCount; a++)
+	{
+		putLE32(&out[44 + (a * 12)], _syncOffset[a]);
+		putLE64(&out[48 + (a * 12)], _syncTime[a]);
+	}
+	memcpy(&out[236], _idFilter, CAN_LOG_V2_INDEX_FILTER_SIZE);
+	putLE32(&out[INDEX_CRC_OFFSET], crc32(out, INDEX_CRC_OFFSET));
+	_previousIndex = _offset;
+	_offset += CAN_LOG_V2_INDEX_SIZE;
+	_syncCount = 0;
+	memset(_idFilter, 0, sizeof(_idFilter));
+	return CAN_LOG_V2_INDEX_SIZE;
+}
+
+uint32_t CANLogV2Encoder::encode(uint8_t bus, bool extended, uint32_t id, const uint8_t *data, uint8_t len, uint32_t timestamp, uint8_t *out, uint32_t skipped)
+{
+	uint32_t pos = 0;
+	if(_started == false)
+	{
+		_started = true;
+		_lastTimestamp = timestamp;
+		pos += writeSync(out);
+	}
+	else if(_sinceSync >= CAN_LOG_V2_SYNC_INTERVAL)
+	{
+		if(_syncCount >= CAN_LOG_V2_INDEX_SYNCS)//segment is full, close it before the sync that opens the next one
+		{
+			pos += writeIndex(out);
+		}
+		pos += writeSync(&out[pos]);
+	}
+	uint32_t frameStart = pos;
+	if(skipped > 0)//kept right next to its frame, so no sync or index can come in between
+	{
+		out[pos] = CAN_LOG_V2_TAG_SKIPPED;
+		pos++;
+		pos += putVarint(&out[pos], skipped);
+	}
+	uint32_t delta = (timestamp - _lastTimestamp);//fine across the 32 bit wrap
+	_lastTimestamp = timestamp;
+	_elapsed += delta;
+	uint8_t idx = (bus == 2) ? 1 : 0;
+	if(len > 8)
+	{
+		len = 8;
+	}
+	id &= (extended == true) ? 0x1FFFFFFF : 0x7FF;
+	uint32_t bit1, bit2;
+	filterBits(bus, extended, id, bit1, bit2);
+	_idFilter[(bit1 >> 3)] |= (1 << (bit1 & 7));
+	_idFilter[(bit2 >> 3)] |= (1 << (bit2 & 7));
+	uint8_t tag = len;
+	if(idx == 1)
+	{
+		tag |= 0x40;
+	}
+	if(extended == true)
+	{
+		tag |= 0x20;
+		id |= 0x80000000;//so a standard and an extended frame with the same number do not count as the same ID
+	}
+	bool repeated = (_haveID[idx] == true && _lastID[idx] == id);
+	if(repeated == true)
+	{
+		tag |= 0x10;
+	}
+	out[pos] = tag;
+	pos++;
+	pos += putVarint(&out[pos], delta);
+	if(repeated == false)
+	{
+		out[pos] = id;
+		out[pos + 1] = (id >> 8);
+		pos += 2;
+		if(extended == true)
+		{
+			out[pos] = (id >> 16);
+			out[pos + 1] = ((id >> 24) & 0x1F);
+			pos += 2;
+		}
+		_lastID[idx] = id;
+		_haveID[idx] = true;
+	}
+	for(uint8_t a = 0; a < len; a++)
+	{
+		out[pos + a] = data[a];
+	}
+	pos += len;
+	_offset += (pos - frameStart);
+	_frames++;
+	_sinceSync++;
+	return pos;
+}
+
+uint32_t CANLogV2Encoder::encodeDrops(uint32_t totalDrops, uint8_t *out)
+{
+	if(totalDrops == _drops)
+	{
+		return 0;
+	}
+	uint32_t lost = (totalDrops > _drops) ? (totalDrops - _drops) : totalDrops;//the producer may have cleared its counter
+	_drops = totalDrops;
+	out[0] = CAN_LOG_V2_TAG_DROPS;
+	uint32_t size = (1 + putVarint(&out[1], lost));
+	_offset += size;
+	return size;
+}
+
+uint32_t CANLogV2Encoder::finish(uint8_t *out)
+{
+	if(_started == false || _syncCount == 0)
+	{
+		return 0;
+	}
+	return writeIndex(out);
+}
+
+CANLogV2Decoder::CANLogV2Decoder()
+{
+	_elapsed = 0;
+	_lastID[0] = 0;
+	_lastID[1] = 0;
+	_haveID[0] = false;
+	_haveID[1] = false;
+	_lost = false;
+}
+
+uint32_t CANLogV2Decoder::parseHeader(const uint8_t *data, uint32_t len, CANLogV2Header &header)
+{
+	*this = CANLogV2Decoder();
+	if(len < CAN_LOG_V2_HEADER_SIZE || data[0] != 'C' || data[1] != 'B' || data[2] != 'L' || data[3] != '2')
+	{
+		return 0;
+	}
+	if(data[4] != CAN_LOG_V2_VERSION || data[5] < CAN_LOG_V2_HEADER_SIZE || data[5] > len)
+	{
+		return 0;
+	}
+	header.timebase = getLE32(&data[6]);
+	header.speed[0] = getLE32(&data[10]);
+	header.speed[1] = getLE32(&data[14]);
+	header.busFlags[0] = data[18];
+	header.busFlags[1] = data[19];
+	memcpy(header.fwVersion, &data[20], 8);
+	header.fwVersion[8] = 0;
+	return data[5];//a longer header from a later revision is skipped
+}
+
+uint32_t CANLogV2Decoder::findSync(const uint8_t *data, uint32_t len)
+{
+	for(uint32_t a = 0; a < len; a++)
+	{
+		uint32_t b = 0;
+		while(b < SYNC_PATTERN_SIZE && (a + b) < len && data[a + b] == syncPattern[b])
+		{
+			b++;
+		}
+		if(b == SYNC_PATTERN_SIZE || (a + b) == len)
+		{
+			return a;
+		}
+	}
+	return len;
+}
+
+int CANLogV2Decoder::decode(const uint8_t *data, uint32_t len, CANLogV2Frame &frame, uint32_t &consumed)
+{
+	consumed = 0;
+	if(len == 0)
+	{
+		return CAN_LOG_V2_NEED_MORE;
+	}
+	uint8_t tag = data[0];
+	if(tag == CAN_LOG_V2_TAG_SYNC)
+	{
+		if(len < CAN_LOG_V2_SYNC_SIZE)
+		{
+			if(findSync(data, len) == 0)
+			{
+				return CAN_LOG_V2_NEED_MORE;
+			}
+		}
+		else if(memcmp(data, syncPattern, SYNC_PATTERN_SIZE) == 0)
+		{
+			_elapsed = getLE64(&data[4]);
+			_haveID[0] = false;
+			_haveID[1] = false;
+			_lost = false;
+			memset(&frame, 0, sizeof(frame));
+			frame.timestamp = _elapsed;
+			frame.count = getLE32(&data[12]);
+			consumed = CAN_LOG_V2_SYNC_SIZE;
+			return CAN_LOG_V2_SYNC;
+		}
+	}
+	else if(_lost == false && tag == CAN_LOG_V2_TAG_INDEX)
+	{
+		uint32_t size = (len < SYNC_PATTERN_SIZE) ? len : SYNC_PATTERN_SIZE;
+		if(memcmp(data, indexPattern, size) == 0)
+		{
+			if(len < CAN_LOG_V2_INDEX_SIZE)
+			{
+				return CAN_LOG_V2_NEED_MORE;
+			}
+			memset(&frame, 0, sizeof(frame));
+			frame.timestamp = _elapsed;
+			consumed = CAN_LOG_V2_INDEX_SIZE;
+			return CAN_LOG_V2_INDEX;
+		}
+	}
+	else if(_lost == false && tag == CAN_LOG_V2_TAG_DROPS)
+	{
+		uint32_t lost;
+		int size = getVarint(&data[1], (len - 1), lost);
+		if(size == 0)
+		{
+			return CAN_LOG_V2_NEED_MORE;
+		}
+		if(size > 0)
+		{
+			memset(&frame, 0, sizeof(frame));
+			frame.timestamp = _elapsed;
+			frame.count = lost;
+			consumed = (1 + size);
+			return CAN_LOG_V2_DROPS;
+		}
+	}
+	else if(_lost == false && tag == CAN_LOG_V2_TAG_SKIPPED)
+	{
+		uint32_t skipped;
+		int size = getVarint(&data[1], (len - 1), skipped);
+		if(size == 0)
+		{
+			return CAN_LOG_V2_NEED_MORE;
+		}
+		if(size > 0 && (uint32_t)(1 + size) < len && (data[1 + size] & 0x80) == 0)//has to be followed by a frame
+		{
+			uint32_t frameSize;
+			int result = decode(&data[1 + size], (len - 1 - size), frame, frameSize);
+			if(result == CAN_LOG_V2_FRAME)
+			{
+				frame.count = skipped;
+			}
+			if(result != CAN_LOG_V2_NEED_MORE)
+			{
+				consumed = (1 + size + frameSize);
+			}
+			return result;
+		}
+		if(size > 0 && (uint32_t)(1 + size) >= len)
+		{
+			return CAN_LOG_V2_NEED_MORE;
+		}
+	}
+	else if(_lost == false && (tag & 0x80) == 0 && (tag & 0x0F) <= 8)
+	{
+		uint8_t idx = ((tag & 0x40) != 0) ? 1 : 0;
+		bool extended = ((tag & 0x20) != 0);
+		bool repeated = ((tag & 0x10) != 0);
+		uint8_t dlc = (tag & 0x0F);
+		uint32_t delta;
+		int size = getVarint(&data[1], (len - 1), delta);
+		if(size == 0)
+		{
+			return CAN_LOG_V2_NEED_MORE;
+		}
+		uint32_t idSize = (repeated == true) ? 0 : ((extended == true) ? 4 : 2);
+		uint32_t recordSize = (1 + size + idSize + dlc);
+		bool valid = (size > 0);
+		if(valid == true && repeated == true)
+		{
+			valid = (_haveID[idx] == true && ((_lastID[idx] & 0x80000000) != 0) == extended);
+		}
+		if(valid == true && len < recordSize)
+		{
+			return CAN_LOG_V2_NEED_MORE;
+		}
+		if(valid == true && repeated == false)
+		{
+			const uint8_t *in = &data[1 + size];
+			uint32_t id = (in[0] | (in[1] << 8));
+			if(extended == true)
+			{
+				id |= ((in[2] << 16) | ((uint32_t)in[3] << 24));
+				valid = (id <= 0x1FFFFFFF);
+				id |= 0x80000000;
+			}
+			else
+			{
+				valid = (id <= 0x7FF);
+			}
+			_lastID[idx] = id;
+			_haveID[idx] = valid;
+		}
+		if(valid == true)
+		{
+			_elapsed += delta;
+			frame.timestamp = _elapsed;
+			frame.id = (_lastID[idx] & 0x1FFFFFFF);
+			frame.count = 0;
+			frame.bus = (idx + 1);
+			frame.extended = (extended == true) ? 1 : 0;
+			frame.len = dlc;
+			memset(frame.data, 0, 8);
+			memcpy(frame.data, &data[recordSize - dlc], dlc);
+			consumed = recordSize;
+			return CAN_LOG_V2_FRAME;
+		}
+	}
+	_lost = true;//nothing can be trusted until the next sync
+	consumed = (1 + findSync(&data[1], (len - 1)));
+	return CAN_LOG_V2_ERROR;
+}
+
+bool CANLogV2Decoder::parseIndex(const uint8_t *data, uint32_t len, CANLogV2Index &index)
+{
+	if(len < CAN_LOG_V2_INDEX_SIZE || memcmp(data, indexPattern, SYNC_PATTERN_SIZE) != 0)
+	{
+		return false;
+	}
+	if(getLE32(&data[INDEX_CRC_OFFSET]) != crc32(data, INDEX_CRC_OFFSET) || data[40] > CAN_LOG_V2_INDEX_SYNCS || data[40] == 0)
+	{
+		return false;
+	}
+	index.offset = getLE32(&data[4]);
+	index.previousIndex = getLE32(&data[8]);
+	index.segmentOffset = getLE32(&data[12]);
+	index.firstFrame = getLE32(&data[16]);
+	index.frames = getLE32(&data[20]);
+	index.startTime = getLE64(&data[24]);
+	index.endTime = getLE64(&data[32]);
+	index.syncCount = data[40];
+	for(uint8_t a = 0; a < CAN_LOG_V2_INDEX_SYNCS; a++)
+	{
+		index.syncOffset[a] = getLE32(&data[44 + (a * 12)]);
+		index.syncTime[a] = getLE64(&data[48 + (a * 12)]);
+	}
+	memcpy(index.idFilter, &data[236], CAN_LOG_V2_INDEX_FILTER_SIZE);
+	return true;
+}
+
+uint32_t CANLogV2Decoder::toRAW(const CANLogV2Frame &frame, uint32_t speed, uint8_t *out)
+{
+	uint8_t flags = (frame.bus == 2) ? 22 : 21;
+	if(frame.extended != 0)
+	{
+		flags += 16;
+	}
+	uint32_t timestamp = (uint32_t)(frame.timestamp / 1000);
+	uint8_t len = (frame.len > 8) ? 8 : frame.len;
+	out[0] = flags;
+	out[1] = (timestamp >> 24);
+	out[2] = (timestamp >> 16);
+	out[3] = (timestamp >> 8);
+	out[4] = timestamp;
+	out[5] = (frame.id >> 24);
+	out[6] = (frame.id >> 16);
+	out[7] = (frame.id >> 8);
+	out[8] = frame.id;
+	out[9] = (speed >> 24);
+	out[10] = (speed >> 16);
+	out[11] = (speed >> 8);
+	out[12] = speed;
+	out[13] = len;
+	memcpy(&out[14], frame.data, len);
+	return (14 + len);
+}
+
+uint32_t CANLogV2Decoder::fromRAW(const uint8_t *raw, uint32_t len, CANLogV2Frame &frame, uint32_t &speed)
+{
+	if(len < 14 || raw[13] > 8 || len < (uint32_t)(14 + raw[13]))
+	{
+		return 0;
+	}
+	uint8_t flags = raw[0];
+	if(flags != 21 && flags != 22 && flags != 37 && flags != 38)
+	{
+		return 0;
+	}
+	memset(&frame, 0, sizeof(frame));
+	frame.bus = ((flags & 0x0F) == 6) ? 2 : 1;
+	frame.extended = (flags > 22) ? 1 : 0;
+	frame.timestamp = ((uint64_t)getBE32(&raw[1]) * 1000);
+	frame.id = getBE32(&raw[5]);
+	speed = getBE32(&raw[9]);
+	frame.len = raw[13];
+	memcpy(frame.data, &raw[14], frame.len);
+	return (14 + frame.len);
+}
+
+CANLogV2Reader::CANLogV2Reader()
+{
+	memset(&_header, 0, sizeof(_header));
+	_recordStart = CAN_LOG_V2_HEADER_SIZE;
+	_bufferOffset = 0;
+	_bufferLen = 0;
+}
+
+bool CANLogV2Reader::open()
+{
+	_bufferOffset = 0;
+	_bufferLen = readAt(0, _buffer, sizeof(_buffer));
+	_recordStart = _decoder.parseHeader(_buffer, _bufferLen, _header);
+	return (_recordStart != 0);
+}
+
+const CANLogV2Header& CANLogV2Reader::getHeader()
+{
+	return _header;
+}
+
+bool CANLogV2Reader::readIndex(uint32_t offset, CANLogV2Index &index)
+{
+	_bufferOffset = offset;
+	_bufferLen = readAt(offset, _buffer, CAN_LOG_V2_INDEX_SIZE);
+	return (CANLogV2Decoder::parseIndex(_buffer, _bufferLen, index) == true && index.offset == offset);
+}
+
+bool CANLogV2Reader::getLastIndex(CANLogV2Index &index)
+{
+	uint32_t size = getSize();
+	if(size < (_recordStart + CAN_LOG_V2_INDEX_SIZE))
+	{
+		return false;
+	}
+	if(readIndex((size - CAN_LOG_V2_INDEX_SIZE), index) == true)
+	{
+		return true;
+	}
+	uint8_t chunk[256];
+	uint32_t end = size;
+	while(end > _recordStart)//not closed cleanly, search backwards for the last complete block
+	{
+		uint32_t start = (end > (_recordStart + sizeof(chunk))) ? (end - sizeof(chunk)) : _recordStart;
+		uint32_t len = readAt(start, chunk, (end - start));
+		for(uint32_t a = len; a > 0; a--)
+		{
+			uint32_t pos = (a - 1);
+			if(chunk[pos] == CAN_LOG_V2_TAG_INDEX && (start + pos + CAN_LOG_V2_INDEX_SIZE) <= size && readIndex((start + pos), index) == true)
+			{
+				return true;
+			}
+		}
+		end = start;
+	}
+	return false;
+}
+
+bool CANLogV2Reader::getPreviousIndex(const CANLogV2Index &index, CANLogV2Index &previous)
+{
+	if(index.previousIndex == 0 || index.previousIndex >= index.offset)
+	{
+		return false;
+	}
+	return readIndex(index.previousIndex, previous);
+}
+
+uint32_t CANLogV2Reader::seekTime(uint64_t timestamp)
+{
+	CANLogV2Index index;
+	if(getLastIndex(index) == false)
+	{
+		return _recordStart;
+	}
+	if(timestamp > index.endTime)
+	{
+		return (index.offset + CAN_LOG_V2_INDEX_SIZE);//frames written after the last index, if any
+	}
+	while(index.startTime > timestamp)
+	{
+		CANLogV2Index previous;
+		if(getPreviousIndex(index, previous) == false)
+		{
+			return index.segmentOffset;
+		}
+		index = previous;
+	}
+	uint8_t sync = 0;
+	for(uint8_t a = 1; a < index.syncCount; a++)
+	{
+		if(index.syncTime[a] <= timestamp)
+		{
+			sync = a;
+		}
+	}
+	return index.syncOffset[sync];
+}
+
+int CANLogV2Reader::readRecord(uint32_t &offset, CANLogV2Frame &frame)
+{
+	uint32_t available = 0;
+	if(offset >= _bufferOffset && offset < (_bufferOffset + _bufferLen))
+	{
+		available = (_bufferOffset + _bufferLen - offset);
+	}
+	if(available < CAN_LOG_V2_INDEX_SIZE && (offset + available) < getSize())//make sure the largest record fits
+	{
+		_bufferOffset = offset;
+		_bufferLen = readAt(offset, _buffer, sizeof(_buffer));
+		available = _bufferLen;
+	}
+	if(available == 0)
+	{
+		return CAN_LOG_V2_NEED_MORE;
+	}
+	uint32_t consumed;
+	int result = _decoder.decode(&_buffer[offset - _bufferOffset], available, frame, consumed);
+	offset += consumed;
+	return result;
+}
+
+bool CANLogV2Reader::mayContain(const CANLogV2Index &index, uint8_t bus, bool extended, uint32_t id)
+{
+	uint32_t bit1, bit2;
+	filterBits(bus, extended, (id & ((extended == true) ? 0x1FFFFFFF : 0x7FF)), bit1, bit2);
+	return ((index.idFilter[(bit1 >> 3)] & (1 << (bit1 & 7))) != 0 && (index.idFilter[(bit2 >> 3)] & (1 << (bit2 & 7))) != 0);
+}
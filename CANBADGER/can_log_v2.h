@@ -0,0 +1,308 @@
+/*
+* CanBadger RAW Log Format v2
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+RAW log format v2. All multi-byte fields are little endian.
+
+File header (CAN_LOG_V2_HEADER_SIZE bytes):
+	-Bytes [0-3] magic "CBL2"
+	-Byte [4] format version (2)
+	-Byte [5] header size
+	-Bytes [6-9] timebase in ticks per second (1000000, timestamps are in us)
+	-Bytes [10-13] bus 1 speed, bytes [14-17] bus 2 speed
+	-Byte [18] bus 1 flags, byte [19] bus 2 flags (CAN_LOG_V2_BUS_LOGGED, CAN_LOG_V2_BUS_EXTENDED)
+	-Bytes [20-27] firmware version string, zero padded
+	-Bytes [28-31] reserved
+
+Frame record, tag byte with bit 7 clear:
+	-Tag: bit 6 bus (0 is bus 1), bit 5 extended ID, bit 4 same ID as the previous frame on that bus, bits 3-0 DLC
+	-Time since the previous record in us, as an unsigned LEB128 varint
+	-ID: omitted if repeated, 2 bytes for standard IDs, 4 bytes for extended IDs
+	-Data
+
+Marker records, tag byte with bit 7 set:
+	-Sync (0x80): the 3 byte pattern A5 5A C3, then the time since the start of the log in us (8 bytes) and the number of
+	 frames written so far (4 bytes). Written every CAN_LOG_V2_SYNC_INTERVAL frames. The next delta counts from the sync
+	 and no ID is repeated across it, so a reader that lost track can scan for the pattern and carry on from there.
+	-Drops (0x81): frames lost before they could be logged, as a varint.
+	-Skipped (0x83): written right before a frame, the number of unchanged frames with the same ID that change-only
+	 logging left out before it, as a varint. The decoder reports it in the count of that frame.
+	-Index (0x82): the 3 byte pattern "IDX", then a fixed size block closing a segment of CAN_LOG_V2_INDEX_SYNCS syncs:
+		-Bytes [4-7] file offset of this block, [8-11] offset of the previous index block (0 for the first one)
+		-Bytes [12-15] offset of the sync opening the segment, [16-19] number of the first frame in it, [20-23] frames in it
+		-Bytes [24-31] time of the opening sync, [32-39] time of the last frame
+		-Byte [40] number of syncs in the table, [41-43] reserved
+		-Bytes [44-235] sync table, file offset (4 bytes) and time (8 bytes) of each sync in the segment
+		-Bytes [236-491] bloom filter of the IDs seen in the segment, see CANLogV2Reader::mayContain
+		-Bytes [492-495] CRC32 of bytes [0-491]
+	 The segment following an index always opens with a sync. A cleanly closed log ends with an index block, so a reader
+	 can start from the last CAN_LOG_V2_INDEX_SIZE bytes and walk back through the chain, skipping segments it does not need.
+*/
+
+#ifndef __CAN_LOG_V2_H__
+#define __CAN_LOG_V2_H__
+
+#include <stdint.h>
+
+#define CAN_LOG_V2_HEADER_SIZE 32
+#define CAN_LOG_V2_VERSION 2
+#define CAN_LOG_V2_TIMEBASE 1000000
+#define CAN_LOG_V2_SYNC_INTERVAL 256 //frames between sync markers
+#define CAN_LOG_V2_SYNC_SIZE 16
+#define CAN_LOG_V2_MAX_FRAME_SIZE 18 //tag, 5 byte varint, 4 byte ID, 8 data bytes
+#define CAN_LOG_V2_SKIPPED_SIZE 6 //tag and a 5 byte varint
+#define CAN_LOG_V2_MAX_RECORD_SIZE (CAN_LOG_V2_SYNC_SIZE + CAN_LOG_V2_SKIPPED_SIZE + CAN_LOG_V2_MAX_FRAME_SIZE) //a frame may be preceded by a sync and a skipped marker
+#define CAN_LOG_V2_INDEX_SYNCS 16 //syncs per indexed segment
+#define CAN_LOG_V2_INDEX_FILTER_SIZE 256
+#define CAN_LOG_V2_INDEX_SIZE 496
+
+#define CAN_LOG_V2_BUS_LOGGED 0x01
+#define CAN_LOG_V2_BUS_EXTENDED 0x02
+
+#define CAN_LOG_V2_TAG_SYNC 0x80
+#define CAN_LOG_V2_TAG_DROPS 0x81
+#define CAN_LOG_V2_TAG_INDEX 0x82
+#define CAN_LOG_V2_TAG_SKIPPED 0x83
+
+//decoder results
+#define CAN_LOG_V2_FRAME 1
+#define CAN_LOG_V2_SYNC 2
+#define CAN_LOG_V2_DROPS 3
+#define CAN_LOG_V2_INDEX 4
+#define CAN_LOG_V2_NEED_MORE 0
+#define CAN_LOG_V2_ERROR -1
+
+struct CANLogV2Header
+{
+	uint32_t timebase;
+	uint32_t speed[2];
+	uint8_t busFlags[2];
+	char fwVersion[9];
+};
+
+struct CANLogV2Frame
+{
+	uint64_t timestamp;//in us since the start of the log
+	uint32_t id;
+	uint32_t count;//sync markers: frames written before the marker, drop markers: frames lost, frames: unchanged frames left out before it
+	uint8_t bus;//1 or 2
+	uint8_t extended;
+	uint8_t len;
+	uint8_t data[8];
+};
+
+struct CANLogV2Index
+{
+	uint32_t offset;//of the index block itself
+	uint32_t previousIndex;
+	uint32_t segmentOffset;
+	uint32_t firstFrame;
+	uint32_t frames;
+	uint64_t startTime;
+	uint64_t endTime;
+	uint8_t syncCount;
+	uint32_t syncOffset[CAN_LOG_V2_INDEX_SYNCS];
+	uint64_t syncTime[CAN_LOG_V2_INDEX_SYNCS];
+	uint8_t idFilter[CAN_LOG_V2_INDEX_FILTER_SIZE];
+};
+
+class CANLogV2Encoder
+{
+	public:
+
+		CANLogV2Encoder();
+
+		/** Writes the file header and resets the encoder state
+
+			@return number of bytes written, always CAN_LOG_V2_HEADER_SIZE
+		*/
+		uint32_t writeHeader(uint8_t *out, const CANLogV2Header &header);
+
+		/** Encodes a frame, preceded by a sync marker when one is due
+
+			@param timestamp in us, from a free running 32 bit counter
+			@param skipped unchanged frames of this ID left out before this one, adds a skipped marker if not 0
+
+			@return number of bytes written, CAN_LOG_V2_MAX_RECORD_SIZE at most. Once every
+			CAN_LOG_V2_INDEX_SYNCS syncs an index block comes first, adding CAN_LOG_V2_INDEX_SIZE bytes
+		*/
+		uint32_t encode(uint8_t bus, bool extended, uint32_t id, const uint8_t *data, uint8_t len, uint32_t timestamp, uint8_t *out, uint32_t skipped = 0);
+
+		/** Writes a drop marker if totalDrops grew since the last call
+
+			@param totalDrops running count of lost frames, as kept by the producer
+
+			@return number of bytes written, 6 at most
+		*/
+		uint32_t encodeDrops(uint32_t totalDrops, uint8_t *out);
+
+		/** Writes the index block for the last segment. Call it once before closing the file
+
+			@return number of bytes written, 0 or CAN_LOG_V2_INDEX_SIZE
+		*/
+		uint32_t finish(uint8_t *out);
+
+	private:
+
+		uint32_t writeSync(uint8_t *out);
+
+		uint32_t writeIndex(uint8_t *out);
+
+		uint32_t _lastTimestamp;
+		uint64_t _elapsed;//us since the first frame
+		uint32_t _frames;
+		uint32_t _sinceSync;
+		uint32_t _lastID[2];
+		uint32_t _drops;
+		uint32_t _offset;//bytes written to the file so far
+		uint32_t _previousIndex;
+		uint32_t _segmentOffset;
+		uint32_t _segmentFirstFrame;
+		uint8_t _syncCount;//syncs in the current segment
+		uint32_t _syncOffset[CAN_LOG_V2_INDEX_SYNCS];
+		uint64_t _syncTime[CAN_LOG_V2_INDEX_SYNCS];
+		uint8_t _idFilter[CAN_LOG_V2_INDEX_FILTER_SIZE];
+		bool _started;
+		bool _haveID[2];
+};
+
+class CANLogV2Decoder
+{
+	public:
+
+		CANLogV2Decoder();
+
+		/** Parses the file header and resets the decoder state
+
+			@return the header size, 0 if data does not hold a valid v2 header
+		*/
+		uint32_t parseHeader(const uint8_t *data, uint32_t len, CANLogV2Header &header);
+
+		/** Decodes the record at the start of data
+
+			@param consumed receives the size of the record. On errors, the number of bytes to skip to reach the next sync marker
+
+			@return CAN_LOG_V2_FRAME, CAN_LOG_V2_SYNC, CAN_LOG_V2_DROPS or CAN_LOG_V2_INDEX, CAN_LOG_V2_NEED_MORE if the record is cut short,
+			or CAN_LOG_V2_ERROR if the data is not valid. After an error, everything up to the next sync marker is rejected
+		*/
+		int decode(const uint8_t *data, uint32_t len, CANLogV2Frame &frame, uint32_t &consumed);
+
+		/** Parses an index block and checks its CRC
+
+			@return true if data holds a valid index block
+		*/
+		static bool parseIndex(const uint8_t *data, uint32_t len, CANLogV2Index &index);
+
+		/** @return the offset of the first sync marker in data, or of a marker cut short at the end. len if there is none
+		*/
+		static uint32_t findSync(const uint8_t *data, uint32_t len);
+
+		/** Writes a decoded frame in the v1 RAW layout (see can_log_ring.h)
+
+			@return number of bytes written, 22 at most
+		*/
+		static uint32_t toRAW(const CANLogV2Frame &frame, uint32_t speed, uint8_t *out);
+
+		/** Reads a frame in the v1 RAW layout, so old logs can be converted. The ms timestamp becomes us
+
+			@param speed receives the bus speed stored in the record
+
+			@return size of the v1 record, 0 if it is not valid or cut short
+		*/
+		static uint32_t fromRAW(const uint8_t *raw, uint32_t len, CANLogV2Frame &frame, uint32_t &speed);
+
+	private:
+
+		uint64_t _elapsed;
+		uint32_t _lastID[2];
+		bool _haveID[2];
+		bool _lost;//an error was seen, waiting for a sync
+};
+
+/** Random access to a v2 log through its index blocks. Subclasses provide the storage, a FILE* on a host or a FileHandler here.
+	A time window query is seekTime followed by readRecord until the frames pass the end of the window. An ID query walks
+	the index chain from getLastIndex and only decodes the segments where mayContain returns true
+*/
+class CANLogV2Reader
+{
+	public:
+
+		CANLogV2Reader();
+
+		virtual ~CANLogV2Reader() {}
+
+		/** Reads the file header
+
+			@return false if the file is not a v2 log
+		*/
+		bool open();
+
+		const CANLogV2Header& getHeader();
+
+		/** Finds the last index block. For a cleanly closed log it sits at the end of the file,
+			otherwise the file is searched backwards for it
+
+			@return false if the log holds no index
+		*/
+		bool getLastIndex(CANLogV2Index &index);
+
+		/** @return false if index is the first one
+		*/
+		bool getPreviousIndex(const CANLogV2Index &index, CANLogV2Index &previous);
+
+		/** @return offset of the last sync at or before timestamp, to be passed to readRecord. The start of the
+			records if nothing is indexed, the end of the file if timestamp is past the end of the log
+		*/
+		uint32_t seekTime(uint64_t timestamp);
+
+		/** Decodes the record at offset and moves offset past it. Decoding has to start at a sync, or at the start of the records
+
+			@return same as CANLogV2Decoder::decode. CAN_LOG_V2_NEED_MORE at the end of the file
+		*/
+		int readRecord(uint32_t &offset, CANLogV2Frame &frame);
+
+		/** @return false if the segment behind index holds no frame with this ID. True may be a false positive
+		*/
+		static bool mayContain(const CANLogV2Index &index, uint8_t bus, bool extended, uint32_t id);
+
+	protected:
+
+		/** @return number of bytes read, fewer than len at the end of the file
+		*/
+		virtual uint32_t readAt(uint32_t offset, uint8_t *data, uint32_t len) = 0;
+
+		virtual uint32_t getSize() = 0;
+
+	private:
+
+		bool readIndex(uint32_t offset, CANLogV2Index &index);
+
+		CANLogV2Decoder _decoder;
+		CANLogV2Header _header;
+		uint32_t _recordStart;//offset of the first record, after the header
+		uint8_t _buffer[(CAN_LOG_V2_INDEX_SIZE * 4)];
+		uint32_t _bufferOffset;
+		uint32_t _bufferLen;
+};
+
+#endif
@@ -0,0 +1,99 @@
+/*
+* CanBadger MITM Fix-ups
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Fix-ups are MITM rules with an action of CAN_MITM_ACTION_FIXUP or above. They keep alive counters and checksums
+consistent, so ECUs that check them accept what MITM sends. They use the same 20 byte XRAM layout and rule file syntax as
+the other rules, and they are not used to pick the action for a frame. Once the action of the first matching rule has run,
+every fix-up of the ID whose condition matches the received frame runs on the result, in the order the rules were added.
+Use condition 0x0001 with a zero target payload for a fix-up that always runs. Fix-ups do not run on dropped frames, so
+a rolling counter skips nothing the receiver can see. List the counter before the checksum that covers it.
+
+Checksums (XOR, SUM, CRC8 with the SAE J1850 polynomial 0x1D, CRC8 with the AUTOSAR 0x2F polynomial):
+	-Action mask: bit n set if payload byte n is covered. The checksum byte and bytes past the DLC never are
+	-Payload [0] byte that receives the checksum
+	-Payload [1] start value. FF for SAE J1850
+	-Payload [2] final XOR. FF for SAE J1850
+	-Payload [3-4] data ID, low byte first
+	-Payload [5] where the data ID goes: 0 nowhere, 1 both bytes before the covered bytes (AUTOSAR E2E profile 1),
+	 2 the low byte after them (profile 2)
+The CRCs use a 256 byte table each, so a checksum over a full frame takes a few lookups.
+
+Rolling counter:
+	-Payload [0] byte that holds the counter
+	-Payload [1] 0 for the low nibble, 1 for the high nibble
+	-Payload [2] highest value before the counter wraps to 0, 1 to 15. 14 for AUTOSAR E2E profile 1, 15 for most others
+The counter starts at the value of the first frame it sees and goes up by one for every frame of the ID that is sent.
+There is one counter per ID.
+*/
+
+#ifndef __CAN_MITM_FIXUP_H__
+#define __CAN_MITM_FIXUP_H__
+
+#include "mbed.h"
+#include "can_mitm_index.h"
+#include "can_mitm_rules.h"
+
+#define CAN_MITM_ACTION_FIXUP 9 //first fix-up action
+#define CAN_MITM_ACTION_XOR 9
+#define CAN_MITM_ACTION_SUM 10
+#define CAN_MITM_ACTION_CRC8 11
+#define CAN_MITM_ACTION_CRC8H2F 12
+#define CAN_MITM_ACTION_COUNTER 13
+#define CAN_MITM_DATA_ID_NONE 0
+#define CAN_MITM_DATA_ID_BEFORE 1
+#define CAN_MITM_DATA_ID_AFTER 2
+#define CAN_MITM_COUNTER_UNSYNCED 0xFF
+
+class CANMITMFixup
+{
+	public:
+
+		CANMITMFixup();
+
+		void reset();//forgets all counters, they pick up from the next frames again
+
+		static bool isFixup(uint8_t action);
+
+		/** Checks the payload of a fix-up rule before it is stored. Other actions are always valid
+
+			@param action the action word of the rule, mask in the high byte
+		*/
+		static bool isValid(uint32_t action, const uint8_t *payload);
+
+		/** Runs a fix-up on frame
+
+			@param block rule block of the ID, keeps the counters apart
+
+			@return frame after the fix-up, unchanged if the rule is not a fix-up
+		*/
+		uint64_t apply(const CANMITMRule &rule, uint32_t block, uint64_t frame, uint8_t leng);
+
+		static uint8_t checksum(const CANMITMRule &rule, uint64_t frame, uint8_t leng);
+
+	private:
+
+		uint8_t _counters[CAN_MITM_MAX_IDS];//next value of each counter, CAN_MITM_COUNTER_UNSYNCED before the first frame
+};
+
+#endif
@@ -0,0 +1,105 @@
+/*
+* CanBadger MITM Rule Index
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "can_mitm_index.h"
+#include <string.h>
+
+CANMITMIndex::CANMITMIndex(uint8_t *buffer)
+{
+	_standard = buffer;
+	_extendedIDs = (uint32_t*)(((uintptr_t)buffer + CAN_MITM_STANDARD_IDS + 3) & ~(uintptr_t)3);//word aligned, whatever the buffer is
+	_extendedBlocks = (uint8_t*)&_extendedIDs[CAN_MITM_MAX_IDS];
+	clear();
+}
+
+void CANMITMIndex::clear()
+{
+	memset(_standard, 0, CAN_MITM_STANDARD_IDS);
+	_extendedCount = 0;
+	_count = 0;
+}
+
+uint32_t CANMITMIndex::getCount()
+{
+	return _count;
+}
+
+uint32_t CANMITMIndex::searchExtended(uint32_t id)
+{
+	uint32_t low = 0;
+	uint32_t high = _extendedCount;
+	while(low < high)
+	{
+		uint32_t mid = ((low + high) >> 1);
+		if(_extendedIDs[mid] < id)
+		{
+			low = (mid + 1);
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+	return low;
+}
+
+uint32_t CANMITMIndex::findExtended(uint32_t id)
+{
+	uint32_t pos = searchExtended(id);
+	if(pos < _extendedCount && _extendedIDs[pos] == id)
+	{
+		return _extendedBlocks[pos];
+	}
+	return 0;
+}
+
+uint32_t CANMITMIndex::add(uint32_t id)
+{
+	uint32_t offset = find(id);
+	if(offset != CAN_MITM_NO_RULES)
+	{
+		return offset;
+	}
+	if(_count >= CAN_MITM_MAX_IDS)
+	{
+		return CAN_MITM_NO_RULES;
+	}
+	_count++;
+	if(id < CAN_MITM_STANDARD_IDS)
+	{
+		_standard[id] = _count;
+	}
+	else
+	{
+		uint32_t pos = searchExtended(id);
+		for(uint32_t a = _extendedCount; a > pos; a--)//rules are added while loading, so keeping the order here is cheap
+		{
+			_extendedIDs[a] = _extendedIDs[a - 1];
+			_extendedBlocks[a] = _extendedBlocks[a - 1];
+		}
+		_extendedIDs[pos] = id;
+		_extendedBlocks[pos] = _count;
+		_extendedCount++;
+	}
+	return ((_count - 1) * CAN_MITM_RULE_BLOCK);
+}
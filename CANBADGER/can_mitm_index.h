@@ -0,0 +1,83 @@
+/*
+* CanBadger MITM Rule Index
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Finds the XRAM rule block of a CAN ID in constant time, instead of walking a list of IDs for every frame.
+Every ID with rules owns one block of CAN_MITM_RULE_BLOCK bytes in XRAM, handed out in the order the IDs are added,
+so the index only has to keep the block number:
+	-IDs up to 0x7FF: a direct table with one byte per ID, the block number + 1, 0 if the ID has no rules
+	-Higher IDs: a sorted array of IDs and one of block numbers, searched with a fixed number of halvings
+The index lives in a buffer of CAN_MITM_INDEX_SIZE bytes handed in by the caller, the same IRAM the old ID list used.
+*/
+
+#ifndef __CAN_MITM_INDEX_H__
+#define __CAN_MITM_INDEX_H__
+
+#include <stdint.h>
+
+#define CAN_MITM_RULE_BLOCK 1024 //XRAM bytes per ID, room for 51 rules
+#define CAN_MITM_MAX_IDS 125 //as many blocks as fit below RAM_USABLE_SIZE (0x1F400) of the 23LC1024 driver
+#define CAN_MITM_STANDARD_IDS 0x800
+#define CAN_MITM_INDEX_SIZE (CAN_MITM_STANDARD_IDS + 3 + (CAN_MITM_MAX_IDS * 5)) //direct table, alignment, extended IDs and their blocks
+#define CAN_MITM_NO_RULES 0xFFFFFFFF
+
+class CANMITMIndex
+{
+	public:
+
+		/** @param buffer storage for the index, CAN_MITM_INDEX_SIZE bytes
+		*/
+		CANMITMIndex(uint8_t *buffer);
+
+		void clear();
+
+		/** @return XRAM offset of the rule block of id, CAN_MITM_NO_RULES if it has none
+		*/
+		inline uint32_t find(uint32_t id)
+		{
+			uint32_t block = (id < CAN_MITM_STANDARD_IDS) ? _standard[id] : findExtended(id);
+			return (block == 0) ? CAN_MITM_NO_RULES : ((block - 1) * CAN_MITM_RULE_BLOCK);
+		}
+
+		/** Gives id a rule block, or returns the one it already has
+
+			@return XRAM offset of the rule block, CAN_MITM_NO_RULES if all blocks are taken
+		*/
+		uint32_t add(uint32_t id);
+
+		uint32_t getCount();//IDs with a rule block
+
+	private:
+
+		uint32_t findExtended(uint32_t id);//block number + 1, 0 if not found
+
+		uint32_t searchExtended(uint32_t id);//position of the first extended ID not below id
+
+		uint8_t *_standard;
+		uint32_t *_extendedIDs;
+		uint8_t *_extendedBlocks;
+		uint32_t _extendedCount;
+		uint32_t _count;
+};
+
+#endif
@@ -0,0 +1,331 @@
+/*
+* CanBadger MITM Compiled Rules
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "can_mitm_rules.h"
+
+CANMITMRuleSet::CANMITMRuleSet()
+{
+	_ram = NULL;
+	_pool = NULL;
+	_cache = NULL;
+	_blocks = 0;
+	_residentRules = 0;
+	_overflowBlocks = 0;
+	_lookups = 0;
+	_cacheHits = 0;
+	_cacheMisses = 0;
+	memset(_cacheBlock, 0xFF, sizeof(_cacheBlock));
+}
+
+CANMITMRuleSet::~CANMITMRuleSet()
+{
+	release();
+}
+
+void CANMITMRuleSet::release()
+{
+	if(_pool != NULL)
+	{
+		delete[] _pool;
+		_pool = NULL;
+	}
+	if(_cache != NULL)
+	{
+		delete[] _cache;
+		_cache = NULL;
+	}
+	_blocks = 0;
+}
+
+bool CANMITMRuleSet::compileRule(const uint8_t *raw, CANMITMRule &rule)
+{
+	uint8_t condMask = raw[0];
+	rule.condition = raw[1];
+	if(rule.condition > 3)//end marker or unknown, checking stops here
+	{
+		return false;
+	}
+	uint8_t actionMask = raw[10];
+	rule.action = raw[11];
+	rule.mask = 0;
+	rule.value = 0;
+	rule.actionMask = 0;
+	rule.operand = 0;
+	for(uint8_t a = 0; a < 8; a++)
+	{
+		if(rule.condition == 0 || (condMask & (1 << a)))//the whole frame or the selected bytes
+		{
+			rule.mask |= ((uint64_t)0xFF << (a * 8));
+		}
+		if(actionMask & (1 << a))
+		{
+			rule.actionMask |= ((uint64_t)0xFF << (a * 8));
+		}
+		rule.value |= ((uint64_t)raw[2 + a] << (a * 8));
+		rule.operand |= ((uint64_t)raw[12 + a] << (a * 8));
+	}
+	return true;
+}
+
+// per byte x > y for all eight bytes at once. The low seven bits are compared with the top bit of every byte set in x
+// and cleared in y, so no borrow crosses into the next byte, and the top bits decide where they differ
+static inline uint64_t lanesGreater(uint64_t x, uint64_t y)
+{
+	uint64_t yGreaterEqual = ((y & ~x) | (~(x ^ y) & ((y | CAN_MITM_LANE_HIGH) - (x & ~CAN_MITM_LANE_HIGH))));
+	return (~yGreaterEqual & CAN_MITM_LANE_HIGH);//top bit of every byte where x > y
+}
+
+bool CANMITMRuleSet::matchRule(const CANMITMRule &rule, uint64_t frame, uint64_t lenMask)
+{
+	uint64_t mask = (rule.mask & lenMask);
+	switch (rule.condition)
+	{
+		case 0://If entire frame matches
+		case 1://check for specific bytes if equal
+		{
+			return (((frame ^ rule.value) & mask) == 0);
+		}
+		case 2://check for specific bytes if greater
+		{
+			return ((~lanesGreater(frame, rule.value) & mask & CAN_MITM_LANE_HIGH) == 0);
+		}
+		case 3://check for specific bytes if less
+		{
+			return ((~lanesGreater(rule.value, frame) & mask & CAN_MITM_LANE_HIGH) == 0);
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+bool CANMITMRuleSet::applyRule(const CANMITMRule &rule, uint64_t frame, uint8_t leng, uint64_t &toSend)
+{
+	uint64_t mask = rule.actionMask;
+	uint64_t operand = (rule.operand & mask);//bytes the action leaves alone get 0, which adds and subtracts nothing
+	switch (rule.action)
+	{
+		case 0://Swap an entire frame
+		{
+			toSend = rule.operand;
+			break;
+		}
+		case 1://Swap specific bytes
+		{
+			toSend = ((frame & ~mask) | operand);
+			break;
+		}
+		case 2://add a fixed value to specific bytes, each byte wraps on its own
+		{
+			toSend = (((frame & ~CAN_MITM_LANE_HIGH) + (operand & ~CAN_MITM_LANE_HIGH)) ^ ((frame ^ operand) & CAN_MITM_LANE_HIGH));
+			break;
+		}
+		case 3://substract a fixed value to specific bytes, each byte wraps on its own
+		{
+			toSend = (((frame | CAN_MITM_LANE_HIGH) - (operand & ~CAN_MITM_LANE_HIGH)) ^ ((frame ^ ~operand) & CAN_MITM_LANE_HIGH));
+			break;
+		}
+		case 4://Multiply specific bytes
+		case 5://Divide specific bytes
+		case 6://Increase a percent to specific bytes
+		case 7://Decrease a percent to specific bytes
+		{
+			toSend = frame;//no carry-free way to do these on all bytes at once, so only the selected bytes are worked on
+			for(uint8_t a = 0; a < leng; a++)
+			{
+				uint32_t shift = (a * 8);
+				if(((mask >> shift) & 0xFF) == 0)
+				{
+					continue;
+				}
+				uint8_t value = (frame >> shift);
+				uint8_t op = (rule.operand >> shift);
+				uint8_t result;
+				switch (rule.action)
+				{
+					case 4:
+						result = (value * op);
+						break;
+					case 5:
+						result = (op != 0) ? (value / op) : 0;//the M3 divider returns 0 on a division by zero
+						break;
+					case 6:
+						result = (value + ((value * op) / 100));
+						break;
+					default:
+						result = (value - ((value * op) / 100));
+						break;
+				}
+				toSend = ((toSend & ~((uint64_t)0xFF << shift)) | ((uint64_t)result << shift));
+			}
+			break;
+		}
+		case 8://drop the frame
+		{
+			return false;
+		}
+		default:
+		{
+			toSend = frame;//unknown rule, so just forward the frame as it is and dont check for more rules
+			break;
+		}
+	}
+	return true;
+}
+
+uint32_t CANMITMRuleSet::loadBlock(uint32_t block, CANMITMRule *out, uint32_t maxRules)
+{
+	uint32_t count = 0;
+	while(count < maxRules && readRule(block, count, out[count]))
+	{
+		count++;
+	}
+	return count;
+}
+
+bool CANMITMRuleSet::readRule(uint32_t block, uint32_t index, CANMITMRule &rule)
+{
+	if(index >= CAN_MITM_MAX_RULES)
+	{
+		return false;
+	}
+	uint8_t raw[CAN_MITM_RULE_SIZE];
+	if(!_ram->read(((block * CAN_MITM_RULE_BLOCK) + (index * CAN_MITM_RULE_SIZE)), CAN_MITM_RULE_SIZE, raw))
+	{
+		return false;//nothing was read, so raw holds no rule
+	}
+	return compileRule(raw, rule);
+}
+
+bool CANMITMRuleSet::load(Ser23LC1024 *ram, uint32_t blocks)
+{
+	_ram = ram;
+	_blocks = (blocks > CAN_MITM_MAX_IDS) ? CAN_MITM_MAX_IDS : blocks;
+	_residentRules = 0;
+	_overflowBlocks = 0;
+	_lookups = 0;
+	_cacheHits = 0;
+	_cacheMisses = 0;
+	memset(_cacheBlock, 0xFF, sizeof(_cacheBlock));
+	memset(_cacheUsed, 0, sizeof(_cacheUsed));
+	if(_pool == NULL)
+	{
+		_pool = new CANMITMRule[CAN_MITM_IRAM_RULES];
+	}
+	if(_cache == NULL)
+	{
+		_cache = new CANMITMRule[CAN_MITM_CACHE_SLOTS * CAN_MITM_CACHE_RULES];
+	}
+	CANMITMRule rule;
+	for(uint32_t block = 0; block < _blocks; block++)
+	{
+		uint32_t count = 0;
+		while(readRule(block, count, rule))//count first, the rules of a block have to stay together in the pool
+		{
+			count++;
+		}
+		_count[block] = count;
+		_first[block] = CAN_MITM_NOT_RESIDENT;
+		if(_pool != NULL && (_residentRules + count) <= CAN_MITM_IRAM_RULES)
+		{
+			_first[block] = _residentRules;
+			_count[block] = loadBlock(block, &_pool[_residentRules], count);//fewer if a read failed on the way
+			_residentRules += _count[block];
+		}
+		else
+		{
+			_overflowBlocks++;
+		}
+	}
+	return (_pool != NULL && _cache != NULL);
+}
+
+bool CANMITMRuleSet::isResident(uint32_t block)
+{
+	return (block < _blocks && _first[block] != CAN_MITM_NOT_RESIDENT);
+}
+
+uint32_t CANMITMRuleSet::getRules(uint32_t block, const CANMITMRule *&rules)
+{
+	if(block >= _blocks)
+	{
+		return 0;
+	}
+	if(_first[block] != CAN_MITM_NOT_RESIDENT)
+	{
+		rules = &_pool[_first[block]];
+		return _count[block];
+	}
+	if(_cache == NULL || _count[block] > CAN_MITM_CACHE_RULES)
+	{
+		return CAN_MITM_RULES_IN_XRAM;
+	}
+	_lookups++;
+	uint8_t victim = 0;
+	for(uint8_t a = 0; a < CAN_MITM_CACHE_SLOTS; a++)
+	{
+		if(_cacheBlock[a] == block)
+		{
+			_cacheUsed[a] = _lookups;
+			_cacheHits++;
+			rules = &_cache[a * CAN_MITM_CACHE_RULES];
+			return _count[block];
+		}
+		if(_cacheUsed[a] < _cacheUsed[victim])//free slots were never used, so they go first
+		{
+			victim = a;
+		}
+	}
+	_cacheMisses++;
+	_cacheBlock[victim] = block;
+	_cacheUsed[victim] = _lookups;
+	rules = &_cache[victim * CAN_MITM_CACHE_RULES];
+	uint32_t count = loadBlock(block, &_cache[victim * CAN_MITM_CACHE_RULES], _count[block]);
+	if(count < _count[block])//a read failed, so the slot must not be taken for the whole block later
+	{
+		_cacheBlock[victim] = 0xFF;
+		_cacheUsed[victim] = 0;
+	}
+	return count;
+}
+
+uint32_t CANMITMRuleSet::getResidentRules()
+{
+	return _residentRules;
+}
+
+uint32_t CANMITMRuleSet::getOverflowBlocks()
+{
+	return _overflowBlocks;
+}
+
+uint32_t CANMITMRuleSet::getCacheHits()
+{
+	return _cacheHits;
+}
+
+uint32_t CANMITMRuleSet::getCacheMisses()
+{
+	return _cacheMisses;
+}
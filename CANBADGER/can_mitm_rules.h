@@ -0,0 +1,143 @@
+/*
+* CanBadger MITM Compiled Rules
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+The MITM rules of every ID are compiled once when MITM starts, so the forwarding path does not read them over SPI.
+A rule in XRAM (see CAN_MITM.h) becomes a CANMITMRule: the condition and action byte masks expanded to one 0xFF byte per
+payload byte they select, and the condition and action payloads as 64 bit values (byte 0 in the lowest bits), so a rule is
+checked and applied to all eight payload bytes at once.
+The rules of as many IDs as fit go into a pool of CAN_MITM_IRAM_RULES. IDs that do not fit stay in XRAM, and the ones
+seen most recently are kept compiled in a small LRU cache. An ID with more rules than a cache slot holds is compiled
+straight from XRAM on every frame, like before. Only resident IDs may be looked up from an interrupt, the others read
+XRAM over SPI, so CAN_MITM hands their frames to its thread.
+*/
+
+#ifndef __CAN_MITM_RULES_H__
+#define __CAN_MITM_RULES_H__
+
+#include "mbed.h"
+#include "SER23LC1024.h"
+#include "can_mitm_index.h"
+
+#if ((CAN_MITM_MAX_IDS * CAN_MITM_RULE_BLOCK) > RAM_USABLE_SIZE)
+#error "the MITM rule blocks do not fit in the XRAM the 23LC1024 driver hands out"
+#endif
+
+#define CAN_MITM_RULE_SIZE 20 //bytes of a rule in XRAM
+#define CAN_MITM_MAX_RULES 51 //rules per ID, as many as fit in a rule block
+#define CAN_MITM_IRAM_RULES 64 //compiled rules kept for good
+#define CAN_MITM_CACHE_SLOTS 4 //IDs of the overflow kept compiled
+#define CAN_MITM_CACHE_RULES 8 //rules per cache slot
+#define CAN_MITM_NOT_RESIDENT 0xFFFF
+#define CAN_MITM_RULES_IN_XRAM 0xFFFFFFFF
+#define CAN_MITM_LANE_HIGH 0x8080808080808080ULL //top bit of every payload byte, keeps carries and borrows inside their byte
+
+struct CANMITMRule
+{
+	uint64_t mask;//0xFF for every payload byte the condition looks at
+	uint64_t value;//condition payload
+	uint64_t actionMask;//0xFF for every payload byte the action changes
+	uint64_t operand;//action payload
+	uint8_t condition;
+	uint8_t action;
+};
+
+class CANMITMRuleSet
+{
+	public:
+
+		CANMITMRuleSet();
+
+		~CANMITMRuleSet();
+
+		/** Compiles the rules of all blocks from XRAM. Allocates the pool and the cache on the first call
+
+			@param blocks number of rule blocks in use, see CANMITMIndex::getCount
+
+			@return false if there was no memory for the pool, MITM still works from XRAM then
+		*/
+		bool load(Ser23LC1024 *ram, uint32_t blocks);
+
+		void release();//frees the pool and the cache
+
+		bool isResident(uint32_t block);//true if the rules of block are in the pool, so getRules never touches XRAM for it
+
+		/** Gives access to the compiled rules of a block. Fills the cache from XRAM if needed, so blocks that are not
+			resident must only be looked up from a thread
+
+			@param rules receives the first rule
+
+			@return the number of rules, CAN_MITM_RULES_IN_XRAM if the block has to be read rule by rule with readRule
+		*/
+		uint32_t getRules(uint32_t block, const CANMITMRule *&rules);
+
+		/** Reads and compiles a single rule straight from XRAM
+
+			@return false if the rule ends the list of the block, or if it could not be read from XRAM
+		*/
+		bool readRule(uint32_t block, uint32_t index, CANMITMRule &rule);
+
+		/** Compiles a rule in the XRAM layout
+
+			@return false if it ends the list of the block: the end marker or an unknown condition
+		*/
+		static bool compileRule(const uint8_t *raw, CANMITMRule &rule);
+
+		static bool matchRule(const CANMITMRule &rule, uint64_t frame, uint64_t lenMask);//frame and lenMask hold the payload as in CANMITMRule
+
+		/** Runs the action of rule on frame, which holds the payload as in CANMITMRule
+
+			@param toSend receives the payload to send
+
+			@return false if the frame has to be dropped
+		*/
+		static bool applyRule(const CANMITMRule &rule, uint64_t frame, uint8_t leng, uint64_t &toSend);
+
+		uint32_t getResidentRules();//rules compiled in the pool
+
+		uint32_t getOverflowBlocks();//blocks left in XRAM
+
+		uint32_t getCacheHits();
+
+		uint32_t getCacheMisses();
+
+	private:
+
+		uint32_t loadBlock(uint32_t block, CANMITMRule *out, uint32_t maxRules);//compiles up to maxRules, returns how many
+
+		Ser23LC1024 *_ram;
+		CANMITMRule *_pool;
+		CANMITMRule *_cache;//CAN_MITM_CACHE_RULES per slot
+		uint16_t _first[CAN_MITM_MAX_IDS];//first pool rule of each block, CAN_MITM_NOT_RESIDENT if it stayed in XRAM
+		uint8_t _count[CAN_MITM_MAX_IDS];//rules of each block
+		uint8_t _cacheBlock[CAN_MITM_CACHE_SLOTS];//block in each slot, 0xFF if free
+		uint32_t _cacheUsed[CAN_MITM_CACHE_SLOTS];//when the slot was used last, in lookups
+		uint32_t _blocks;
+		uint32_t _residentRules;
+		uint32_t _overflowBlocks;
+		uint32_t _lookups;
+		uint32_t _cacheHits;
+		uint32_t _cacheMisses;
+};
+
+#endif
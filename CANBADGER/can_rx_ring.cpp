@@ -0,0 +1,270 @@
+/*
+* CanBadger CAN RX Ring
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "can_rx_ring.h"
+#include "canbadger_CAN.h"
+#include "can_census.h"
+#include "us_ticker_api.h"
+#include "timebase.h"
+
+CANRxRing CANRxRing::rings[2];
+
+CANRxRing::CANRxRing()
+{
+	_canbus = NULL;
+	_controller = NULL;
+	_interfaceNo = 0;
+	_head = 0;
+	_tail = 0;
+	_received = 0;
+	_overruns = 0;
+	_hwOverruns = 0;
+	_highWater = 0;
+	_waiter = NULL;
+	_running = false;
+}
+
+CANRxRing* CANRxRing::getRing(CAN *canbus)
+{
+	LPC_CAN_TypeDef* controller = CANbadger_CAN::getController(canbus);
+	uint8_t idx;
+	if(controller == LPC_CAN1)
+	{
+		idx = 0;
+	}
+	else if(controller == LPC_CAN2)
+	{
+		idx = 1;
+	}
+	else
+	{
+		return NULL;
+	}
+	if(rings[idx]._running == false)//do not swap the object under a running ISR
+	{
+		rings[idx]._canbus = canbus;
+		rings[idx]._controller = controller;
+		rings[idx]._interfaceNo = (idx + 1);
+	}
+	return &rings[idx];
+}
+
+CANRxRing* CANRxRing::getRing(uint8_t interfaceNo)
+{
+	if(interfaceNo < 1 || interfaceNo > 2 || rings[interfaceNo - 1]._canbus == NULL)
+	{
+		return NULL;
+	}
+	return &rings[interfaceNo - 1];
+}
+
+bool CANRxRing::start()
+{
+	if(_canbus == NULL)
+	{
+		return false;
+	}
+	if(_running == true)
+	{
+		return true;
+	}
+	_tail = _head;//drop anything left over from a previous session
+	_running = true;
+	_canbus->attach(this, &CANRxRing::overrunISR, CAN::DoIrq);
+	_canbus->attach(this, &CANRxRing::rxISR, CAN::RxIrq);
+	return true;
+}
+
+void CANRxRing::stop()
+{
+	if(_running == false)
+	{
+		return;
+	}
+	_canbus->attach(0, CAN::RxIrq);
+	_canbus->attach(0, CAN::DoIrq);
+	_running = false;
+	_tail = _head;
+}
+
+bool CANRxRing::isRunning()
+{
+	return _running;
+}
+
+void CANRxRing::rxISR()
+{
+	uint64_t timestamp = Timebase::now();//sample first, so the time spent in here does not skew it
+	CANMessage msg;
+	CANCensus *census = CANCensus::getCensus();
+	while(_canbus->read(msg) != 0)
+	{
+		census->record(_interfaceNo, msg.id, msg.format, msg.data, msg.len, (uint32_t)timestamp);
+		push(msg, timestamp);
+	}
+	osThreadId waiter = _waiter;
+	if(waiter != NULL)
+	{
+		osSignalSet(waiter, CAN_RX_RING_SIGNAL);
+	}
+}
+
+void CANRxRing::drain()
+{
+	uint64_t timestamp = Timebase::now();
+	CANMessage msg;
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();//we act as producer here, the RX interrupt must not run in between
+	while(_canbus->read(msg) != 0)
+	{
+		CANCensus::getCensus()->record(_interfaceNo, msg.id, msg.format, msg.data, msg.len, (uint32_t)timestamp);
+		push(msg, timestamp);
+	}
+	__set_PRIMASK(primask);//a caller that had interrupts masked keeps them masked
+}
+
+void CANRxRing::overrunISR()
+{
+	_hwOverruns++;
+	_controller->CMR = (1 << 3);//CDO, clear the data overrun status so the next one is reported too
+}
+
+bool CANRxRing::push(CAN_Message &msg, uint64_t timestamp)
+{
+	uint32_t head = _head;
+	uint32_t used = head - _tail;
+	if(used >= CAN_RX_RING_SIZE)
+	{
+		_overruns++;
+		return false;
+	}
+	CANRxFrame *frame = &_frames[head & CAN_RX_RING_MASK];
+	frame->timestamp = timestamp;
+	frame->id = msg.id;
+	frame->len = msg.len;
+	frame->format = msg.format;
+	frame->type = msg.type;
+	for(uint8_t a = 0; a < 8; a++)
+	{
+		frame->data[a] = msg.data[a];
+	}
+	__DMB();//the slot must be complete before the consumer can see the new head
+	_head = head + 1;
+	_received++;
+	if((used + 1) > _highWater)
+	{
+		_highWater = (used + 1);
+	}
+	return true;
+}
+
+bool CANRxRing::pop(CANRxFrame &frame)
+{
+	uint32_t tail = _tail;
+	if(tail == _head)
+	{
+		return false;
+	}
+	__DMB();//do not read the slot before the head that published it
+	frame = _frames[tail & CAN_RX_RING_MASK];
+	__DMB();//finish reading the slot before handing it back to the producer
+	_tail = tail + 1;
+	return true;
+}
+
+bool CANRxRing::waitFrame(CANRxFrame &frame, uint32_t timeout)
+{
+	if(__get_IPSR() != 0)//an interrupt must not spin here, and a second consumer would break the ring anyway
+	{
+		return false;
+	}
+	uint32_t startTime = us_ticker_read();
+	while(1)
+	{
+		if(pop(frame) == true)
+		{
+			return true;
+		}
+		if(_running == false)//nobody is going to fill it
+		{
+			return false;
+		}
+		uint32_t waitTime = osWaitForever;
+		if(timeout != 0)
+		{
+			uint32_t elapsed = ((us_ticker_read() - startTime) / 1000);
+			if(elapsed >= timeout)
+			{
+				return false;
+			}
+			waitTime = (timeout - elapsed);
+		}
+		_waiter = osThreadGetId();
+		__DMB();
+		if(pop(frame) == true)//a frame may have landed before the ISR could see us waiting
+		{
+			_waiter = NULL;
+			return true;
+		}
+		Thread::signal_wait(CAN_RX_RING_SIGNAL, waitTime);
+		_waiter = NULL;
+	}
+}
+
+uint32_t CANRxRing::pending()
+{
+	return (_head - _tail);
+}
+
+void CANRxRing::flush()
+{
+	_tail = _head;
+}
+
+uint32_t CANRxRing::getReceivedCount()
+{
+	return _received;
+}
+
+uint32_t CANRxRing::getOverrunCount()
+{
+	return _overruns;
+}
+
+uint32_t CANRxRing::getHWOverrunCount()
+{
+	return _hwOverruns;
+}
+
+uint32_t CANRxRing::getHighWater()
+{
+	return _highWater;
+}
+
+void CANRxRing::clearStats()
+{
+	_received = 0;
+	_overruns = 0;
+	_hwOverruns = 0;
+	_highWater = 0;
+}
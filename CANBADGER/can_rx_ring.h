@@ -0,0 +1,134 @@
+/*
+* CanBadger CAN RX Ring
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef __CAN_RX_RING_H__
+#define __CAN_RX_RING_H__
+
+#include "mbed.h"
+#include "rtos.h"
+
+#define CAN_RX_RING_SIZE 64 //frames per controller, must be a power of two
+#define CAN_RX_RING_MASK (CAN_RX_RING_SIZE - 1)
+#define CAN_RX_RING_SIGNAL 0x4 //thread signal used to wake a waiting consumer. 0x1 is taken by SimpleDMA
+
+/** A received frame as stored in the RX ring. The timestamp is taken at interrupt entry
+*/
+struct CANRxFrame
+{
+	uint64_t timestamp;//Timebase::now() when the RX interrupt fired
+	uint32_t id;
+	uint8_t data[8];
+	uint8_t len;
+	uint8_t format;//CANStandard or CANExtended
+	uint8_t type;//CANData or CANRemote
+	uint8_t reserved;
+};
+
+/** Single producer/single consumer frame ring, one per CAN controller.
+	The producer is the CAN RX interrupt, the consumer is a single thread (TP, TP2.0, DiagSCAN, hijack loops...)
+*/
+class CANRxRing
+{
+	public:
+
+		/** Returns the ring that belongs to the controller behind canbus
+
+			@return NULL if the controller could not be identified
+		*/
+		static CANRxRing* getRing(CAN *canbus);
+
+		/** Returns the ring for controller 1 or 2, NULL if it was never claimed
+		*/
+		static CANRxRing* getRing(uint8_t interfaceNo);
+
+		/** Attaches the RX and data overrun interrupts of the controller to the ring.
+			Anything else attached to RxIrq on this controller is replaced
+
+			@return true if the ring is running
+		*/
+		bool start();
+
+		/** Detaches the interrupts and drops any pending frames
+		*/
+		void stop();
+
+		bool isRunning();
+
+		/** Retrieves the oldest frame without blocking
+
+			@return true if a frame was retrieved
+		*/
+		bool pop(CANRxFrame &frame);
+
+		/** Retrieves the oldest frame, blocking the calling thread until a frame arrives or the timeout expires.
+			Only for threads: from interrupt context it returns false right away
+
+			@param timeout in ms, 0 waits forever
+
+			@return true if a frame was retrieved
+		*/
+		bool waitFrame(CANRxFrame &frame, uint32_t timeout);
+
+		uint32_t pending();//number of frames waiting to be consumed
+
+		void flush();//drops all pending frames
+
+		uint32_t getReceivedCount();//frames stored since the last clearStats
+
+		uint32_t getOverrunCount();//frames dropped because the ring was full
+
+		uint32_t getHWOverrunCount();//data overruns reported by the controller, frames lost before reaching the ring
+
+		uint32_t getHighWater();//highest fill level seen since the last clearStats
+
+		void clearStats();
+
+		void drain();//moves whatever the controller holds into the ring, for a consumer thread that runs with the RX interrupt blocked
+
+	private:
+
+		CANRxRing();
+
+		void rxISR();
+
+		void overrunISR();
+
+		bool push(CAN_Message &msg, uint64_t timestamp);
+
+		CAN* _canbus;
+		LPC_CAN_TypeDef* _controller;
+		uint8_t _interfaceNo;//1 or 2
+		CANRxFrame _frames[CAN_RX_RING_SIZE];
+		volatile uint32_t _head;//written only by the producer
+		volatile uint32_t _tail;//written only by the consumer
+		volatile uint32_t _received;
+		volatile uint32_t _overruns;
+		volatile uint32_t _hwOverruns;
+		volatile uint32_t _highWater;
+		volatile osThreadId _waiter;//thread blocked in waitFrame, if any
+		volatile bool _running;
+
+		static CANRxRing rings[2];
+};
+
+#endif
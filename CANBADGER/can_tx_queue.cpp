@@ -0,0 +1,456 @@
+/*
+* CanBadger CAN TX Queue
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "can_tx_queue.h"
+#include "canbadger_CAN.h"
+#include "us_ticker_api.h"
+#include "timebase.h"
+
+#define CAN_SR_TBS1 (1U << 2) //buffer 1 released
+#define CAN_SR_TBS2 (1U << 10)
+#define CAN_SR_TBS3 (1U << 18)
+#define CAN_MOD_RM (1U << 0)
+#define CAN_MOD_STM (1U << 2)
+#define CAN_MOD_TPM (1U << 3)
+#define CAN_CMR_TR (1U << 0)
+#define CAN_CMR_AT (1U << 1)
+#define CAN_CMR_SRR (1U << 4)
+#define CAN_CMR_STB(x) (1U << (5 + (x)))
+#define CAN_IER_TIE2 (1U << 9)
+#define CAN_IER_TIE3 (1U << 10)
+
+CANTxQueue CANTxQueue::queues[2];
+
+CANTxQueue::CANTxQueue()
+{
+	_canbus = NULL;
+	_controller = NULL;
+	_heapCount = 0;
+	_inFlightCount = 0;
+	_inFlightTimed = 0;
+	_nextToken = 1;
+	_maxDepth = 0;
+	_drops = 0;
+	_sent = 0;
+	_waiter = NULL;
+	_running = false;
+	_measureLatency = false;
+}
+
+CANTxQueue* CANTxQueue::getQueue(CAN *canbus)
+{
+	LPC_CAN_TypeDef* controller = CANbadger_CAN::getController(canbus);
+	uint8_t idx;
+	if(controller == LPC_CAN1)
+	{
+		idx = 0;
+	}
+	else if(controller == LPC_CAN2)
+	{
+		idx = 1;
+	}
+	else
+	{
+		return NULL;
+	}
+	if(queues[idx]._running == false)
+	{
+		queues[idx]._canbus = canbus;
+		queues[idx]._controller = controller;
+	}
+	return &queues[idx];
+}
+
+bool CANTxQueue::start()
+{
+	if(_canbus == NULL)
+	{
+		return false;
+	}
+	if(_running == true)
+	{
+		return true;
+	}
+	for(uint32_t a = 0; a < 1000 && (_controller->GSR & 4) == 0; a++)//reset mode aborts a pending transmission, so let it finish first
+	{
+		wait_us(10);
+	}
+	_controller->MOD |= CAN_MOD_RM;
+	_controller->MOD |= CAN_MOD_TPM;//buffers are picked by the PRIO field we load, not by ID
+	_controller->MOD &= ~CAN_MOD_RM;
+	_canbus->attach(this, &CANTxQueue::txISR, CAN::TxIrq);
+	_controller->MOD |= CAN_MOD_RM;
+	_controller->IER &= ~(CAN_IER_TIE2 | CAN_IER_TIE3);//mbed only dispatches TI1, the other two would just cost an interrupt each
+	_controller->MOD &= ~CAN_MOD_RM;
+	_running = true;
+	return true;
+}
+
+void CANTxQueue::stop()
+{
+	if(_running == false)
+	{
+		return;
+	}
+	_canbus->attach(0, CAN::TxIrq);
+	flush();
+	_running = false;
+}
+
+bool CANTxQueue::isRunning()
+{
+	return _running;
+}
+
+bool CANTxQueue::isBefore(CANTxEntry *a, CANTxEntry *b)
+{
+	if(a->key != b->key)
+	{
+		return (a->key < b->key);
+	}
+	return ((int32_t)(a->token - b->token) < 0);//same ID, keep the order they were queued in
+}
+
+uint32_t CANTxQueue::push(uint32_t msgID, const uint8_t *payload, uint8_t len, CANFormat frameFormat, CANType frameType, uint64_t rxTime)
+{
+	if(_running == false && (__get_IPSR() != 0 || start() == false))//start spins in reset mode, so not from an interrupt
+	{
+		_drops++;
+		return 0;
+	}
+	if(len > 8)
+	{
+		len = 8;
+	}
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if(_heapCount >= CAN_TX_QUEUE_SIZE)
+	{
+		_drops++;
+		__set_PRIMASK(primask);
+		return 0;
+	}
+	uint32_t token = _nextToken++;
+	if(token == 0)//0 means dropped
+	{
+		token = _nextToken++;
+	}
+	CANTxEntry entry;
+	entry.token = token;
+	entry.id = msgID;
+	entry.len = len;
+	entry.format = frameFormat;
+	entry.type = frameType;
+	entry.rxTime = (uint32_t)rxTime;//delays are short, the low word is enough
+	entry.timed = (_measureLatency == true && rxTime != 0) ? 1 : 0;
+	for(uint8_t a = 0; a < 8; a++)
+	{
+		entry.data[a] = (a < len) ? payload[a] : 0;
+	}
+	uint32_t rtr = (frameType == CANRemote) ? 1 : 0;
+	if(frameFormat == CANExtended)//base ID, SRR, IDE, extended ID, RTR, as they appear on the wire
+	{
+		entry.key = ((((msgID >> 18) & 0x7FF) << 21) | (1U << 20) | (1U << 19) | ((msgID & 0x3FFFF) << 1) | rtr);
+	}
+	else
+	{
+		entry.key = (((msgID & 0x7FF) << 21) | (rtr << 20));
+	}
+	uint32_t pos = _heapCount;
+	_heapCount++;
+	while(pos > 0)//sift up
+	{
+		uint32_t parent = ((pos - 1) / 2);
+		if(!isBefore(&entry, &_heap[parent]))
+		{
+			break;
+		}
+		_heap[pos] = _heap[parent];
+		pos = parent;
+	}
+	_heap[pos] = entry;
+	if(_heapCount > _maxDepth)
+	{
+		_maxDepth = _heapCount;
+	}
+	service();//starts right away if the controller is idle
+	__set_PRIMASK(primask);
+	return token;
+}
+
+bool CANTxQueue::heapPop(CANTxEntry &entry)
+{
+	if(_heapCount == 0)
+	{
+		return false;
+	}
+	entry = _heap[0];
+	_heapCount--;
+	if(_heapCount == 0)
+	{
+		return true;
+	}
+	CANTxEntry last = _heap[_heapCount];
+	uint32_t pos = 0;
+	while(1)//sift down
+	{
+		uint32_t child = ((pos * 2) + 1);
+		if(child >= _heapCount)
+		{
+			break;
+		}
+		if((child + 1) < _heapCount && isBefore(&_heap[child + 1], &_heap[child]))
+		{
+			child++;
+		}
+		if(!isBefore(&_heap[child], &last))
+		{
+			break;
+		}
+		_heap[pos] = _heap[child];
+		pos = child;
+	}
+	_heap[pos] = last;
+	return true;
+}
+
+void CANTxQueue::load(uint8_t buffer, CANTxEntry *entry, uint8_t prio)
+{
+	volatile uint32_t *regs = (&_controller->TFI1 + (buffer * 4));//TFIx, TIDx, TDAx, TDBx are consecutive for each buffer
+	uint32_t tfi = (prio | ((uint32_t)entry->len << 16));
+	if(entry->type == CANRemote)
+	{
+		tfi |= (1U << 30);
+	}
+	if(entry->format == CANExtended)
+	{
+		tfi |= (1U << 31);
+	}
+	regs[0] = tfi;
+	regs[1] = entry->id;
+	regs[2] = (entry->data[0] | (entry->data[1] << 8) | (entry->data[2] << 16) | ((uint32_t)entry->data[3] << 24));
+	regs[3] = (entry->data[4] | (entry->data[5] << 8) | (entry->data[6] << 16) | ((uint32_t)entry->data[7] << 24));
+	_inFlight[_inFlightCount] = entry->token;
+	_inFlightTime[_inFlightCount] = entry->rxTime;
+	if(entry->timed)
+	{
+		_inFlightTimed |= (1 << _inFlightCount);
+	}
+	_inFlightCount++;
+}
+
+bool CANTxQueue::service()
+{
+	bool completed = false;
+	uint32_t sr = _controller->SR;
+	if((sr & CAN_SR_TBS1) == 0)//the last frame of the batch is still going out, or CAN::write is using buffer 1
+	{
+		return false;
+	}
+	if(_inFlightCount > 0)
+	{
+		if(_inFlightTimed != 0 && _measureLatency == true)
+		{
+			uint32_t now = (uint32_t)Timebase::now();
+			for(uint8_t a = 0; a < _inFlightCount; a++)
+			{
+				if(_inFlightTimed & (1 << a))
+				{
+					_latency.record(now - _inFlightTime[a]);
+				}
+			}
+		}
+		_inFlightTimed = 0;
+		_sent += _inFlightCount;
+		_inFlightCount = 0;
+		completed = true;
+	}
+	//buffers 2 and 3 may still hold a frame of a direct CAN::write, which raises no interrupt here, so only the free ones are used
+	uint8_t spare[2];
+	uint8_t spareCount = 0;
+	if(sr & CAN_SR_TBS2)
+	{
+		spare[spareCount++] = 1;
+	}
+	if(sr & CAN_SR_TBS3)
+	{
+		spare[spareCount++] = 2;
+	}
+	uint8_t count = (_heapCount < (uint32_t)(spareCount + 1)) ? _heapCount : (spareCount + 1);
+	if(count == 0)
+	{
+		return completed;
+	}
+	//the last frame of the batch always sits in buffer 1 with the lowest local priority, so TI1 marks the end of the batch
+	uint32_t cmr = 0;
+	for(uint8_t a = 0; a < count; a++)
+	{
+		CANTxEntry entry;
+		heapPop(entry);
+		uint8_t buffer = (a == (count - 1)) ? 0 : spare[a];
+		load(buffer, &entry, a);
+		cmr |= CAN_CMR_STB(buffer);
+	}
+	if(_controller->MOD & CAN_MOD_STM)//self test mode needs a self reception request instead
+	{
+		cmr |= CAN_CMR_SRR;
+	}
+	else
+	{
+		cmr |= CAN_CMR_TR;
+	}
+	_controller->CMR = cmr;
+	return completed;
+}
+
+void CANTxQueue::txISR()
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	bool completed = service();
+	__set_PRIMASK(primask);
+	osThreadId waiter = _waiter;
+	if(completed == true && waiter != NULL)
+	{
+		osSignalSet(waiter, CAN_TX_QUEUE_SIGNAL);
+	}
+}
+
+bool CANTxQueue::isComplete(uint32_t token)
+{
+	bool found = false;
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	for(uint32_t a = 0; a < _heapCount && found == false; a++)
+	{
+		if(_heap[a].token == token)
+		{
+			found = true;
+		}
+	}
+	for(uint8_t a = 0; a < _inFlightCount && found == false; a++)
+	{
+		if(_inFlight[a] == token)
+		{
+			found = true;
+		}
+	}
+	__set_PRIMASK(primask);
+	return !found;
+}
+
+bool CANTxQueue::waitComplete(uint32_t token, uint32_t timeout)
+{
+	uint32_t startTime = us_ticker_read();
+	while(1)
+	{
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		service();//in case we are called with the TX interrupt masked
+		__set_PRIMASK(primask);
+		if(isComplete(token) == true)
+		{
+			return true;
+		}
+		uint32_t waitTime = osWaitForever;
+		if(timeout != 0)
+		{
+			uint32_t elapsed = ((us_ticker_read() - startTime) / 1000);
+			if(elapsed >= timeout)
+			{
+				return false;
+			}
+			waitTime = (timeout - elapsed);
+		}
+		if(__get_IPSR() != 0)//no sleeping inside an interrupt
+		{
+			wait_us(20);
+			continue;
+		}
+		_waiter = osThreadGetId();
+		__DMB();
+		if(isComplete(token) == true)
+		{
+			_waiter = NULL;
+			return true;
+		}
+		Thread::signal_wait(CAN_TX_QUEUE_SIGNAL, waitTime);
+		_waiter = NULL;
+	}
+}
+
+void CANTxQueue::flush()
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	_drops += (_heapCount + _inFlightCount);
+	_heapCount = 0;
+	_inFlightCount = 0;
+	_inFlightTimed = 0;
+	if(_controller != NULL)
+	{
+		_controller->CMR = CAN_CMR_AT;//abort whatever is still loaded
+	}
+	__set_PRIMASK(primask);
+}
+
+uint32_t CANTxQueue::getDepth()
+{
+	return _heapCount;
+}
+
+uint32_t CANTxQueue::getMaxDepth()
+{
+	return _maxDepth;
+}
+
+uint32_t CANTxQueue::getDropCount()
+{
+	return _drops;
+}
+
+uint32_t CANTxQueue::getSentCount()
+{
+	return _sent;
+}
+
+void CANTxQueue::clearStats()
+{
+	_maxDepth = 0;
+	_drops = 0;
+	_sent = 0;
+}
+
+void CANTxQueue::measureLatency(bool enable)
+{
+	if(enable == true && _measureLatency == false)
+	{
+		_latency.clear();
+	}
+	_measureLatency = enable;
+}
+
+LatencyHistogram* CANTxQueue::getLatency()
+{
+	return &_latency;
+}
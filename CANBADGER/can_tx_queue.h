@@ -0,0 +1,152 @@
+/*
+* CanBadger CAN TX Queue
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Frames are kept in a min-heap ordered by arbitration priority (the same order the bus would pick them in), with a sequence
+number as tie breaker so frames with the same ID leave in the order they were queued.
+The three hardware TX buffers are loaded as a batch using local priority mode (TPM). The lowest priority frame of the batch
+always goes to buffer 1, so TI1 (the only TX interrupt mbed dispatches) fires once the whole batch is out and the next batch is loaded from there.
+A batch is retired as soon as buffer 1 is released, whatever a direct CAN::write left in buffers 2 and 3, and the next
+batch only uses the buffers that are free.
+*/
+
+#ifndef __CAN_TX_QUEUE_H__
+#define __CAN_TX_QUEUE_H__
+
+#include "mbed.h"
+#include "rtos.h"
+#include "latency_histogram.h"
+
+#define CAN_TX_QUEUE_SIZE 32 //frames per controller
+#define CAN_TX_QUEUE_SIGNAL 0x8 //thread signal used to wake a thread waiting for a completion
+
+struct CANTxEntry
+{
+	uint32_t key;//arbitration order, lower goes first
+	uint32_t token;//sequence number handed back to the caller
+	uint32_t id;
+	uint32_t rxTime;//low 32 bits of the timebase when the frame was received, if timed
+	uint8_t data[8];
+	uint8_t len;
+	uint8_t format;
+	uint8_t type;
+	uint8_t timed;//set if the frame counts towards the latency histogram
+};
+
+class CANTxQueue
+{
+	public:
+
+		/** Returns the queue that belongs to the controller behind canbus
+
+			@return NULL if the controller could not be identified
+		*/
+		static CANTxQueue* getQueue(CAN *canbus);
+
+		/** Enables local priority mode on the controller and attaches the TX interrupt. Waits for the controller in reset
+			mode, so it must run in a thread: users that push from an interrupt start the queue before attaching it.
+			A push from a thread starts it if needed
+		*/
+		bool start();
+
+		/** Detaches the TX interrupt, aborts whatever is loaded in the controller and empties the queue
+		*/
+		void stop();
+
+		bool isRunning();
+
+		/** Queues a frame for transmission and returns immediately. Safe to call from interrupt context once the queue
+			was started, before that a push from an interrupt is dropped
+
+			@param rxTime when the frame being forwarded was received, from Timebase::now. 0 if it is not forwarded
+
+			@return a completion token, 0 if the queue was full and the frame was dropped
+		*/
+		uint32_t push(uint32_t msgID, const uint8_t *payload, uint8_t len, CANFormat frameFormat = CANStandard, CANType frameType = CANData, uint64_t rxTime = 0);
+
+		/** @return true if the frame behind token is no longer queued or loaded in the controller
+		*/
+		bool isComplete(uint32_t token);
+
+		/** Waits until the frame behind token has been sent
+
+			@param timeout in ms, 0 waits forever
+
+			@return true if it was sent within the timeout
+		*/
+		bool waitComplete(uint32_t token, uint32_t timeout);
+
+		void flush();//drops everything queued and aborts what is loaded in the controller
+
+		uint32_t getDepth();//frames queued, not counting the ones already loaded in the controller
+
+		uint32_t getMaxDepth();//highest depth seen since the last clearStats
+
+		uint32_t getDropCount();//frames rejected because the queue was full, or flushed before being sent
+
+		uint32_t getSentCount();
+
+		void clearStats();
+
+		/** Starts or stops timing forwarded frames from their reception to the end of the TX batch they went out in.
+			The histogram is cleared when the measurement starts
+		*/
+		void measureLatency(bool enable);
+
+		LatencyHistogram* getLatency();
+
+	private:
+
+		CANTxQueue();
+
+		void txISR();
+
+		bool service();//retires a finished batch and loads the next one. Must run with interrupts disabled
+
+		void load(uint8_t buffer, CANTxEntry *entry, uint8_t prio);
+
+		bool heapPop(CANTxEntry &entry);
+
+		static bool isBefore(CANTxEntry *a, CANTxEntry *b);
+
+		CAN* _canbus;
+		LPC_CAN_TypeDef* _controller;
+		CANTxEntry _heap[CAN_TX_QUEUE_SIZE];
+		volatile uint32_t _heapCount;
+		uint32_t _inFlight[3];//tokens loaded in the hardware buffers
+		uint32_t _inFlightTime[3];//rxTime of the loaded frames
+		uint8_t _inFlightTimed;//bit n set if _inFlightTime[n] is valid
+		volatile uint8_t _inFlightCount;
+		uint32_t _nextToken;
+		volatile uint32_t _maxDepth;
+		volatile uint32_t _drops;
+		volatile uint32_t _sent;
+		volatile osThreadId _waiter;
+		volatile bool _running;
+		volatile bool _measureLatency;
+		LatencyHistogram _latency;
+
+		static CANTxQueue queues[2];
+};
+
+#endif
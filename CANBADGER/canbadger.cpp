@@ -36,9 +36,18 @@ The header has always the same length, and consists of the following:
 -Bytes [9-12] are the frequency/speed the interface had at the time of the capture
 -Byte [13] is the length of the data. We should be good as CAN has max 8 bytes of data per frame, and KLINE has a max of 255
 -Following bytes are the data
+
+Logs recorded with startLog use the compact v2 format instead, see can_log_v2.h. The other logs keep the format above.
+With LOG_COMPRESSION set, the whole v2 log (header included) is written as compressed blocks, see can_log_lz.h
 */
 #include "crc32.h"
 #include "canbadger.h"
+#include "can_census.h"
+#include "can_change_filter.h"
+#include "can_log_ring.h"
+#include "timebase.h"
+#include "us_ticker_api.h"
+#include <new>
 
 //We first create all the objects, and later destroy them if not used
 
@@ -136,14 +145,14 @@ CANbadger::CANbadger()
 			isSDInserted=1;//we have detected an inserted SD
 
 			// create (or make sure they exist) the following directories in the SD
-			const char *folders[36] = {"/Emulator", "/MemDumps", "/MemDumps/DID", "/MemDumps/DID/TP20", "/MemDumps/DID/TP20/LID", "/MemDumps/DID/TP20/CID", "/MemDumps/DID/TP20/ECUID",
+			const char *folders[37] = {"/Emulator", "/MemDumps", "/MemDumps/DID", "/MemDumps/DID/TP20", "/MemDumps/DID/TP20/LID", "/MemDumps/DID/TP20/CID", "/MemDumps/DID/TP20/ECUID",
 					"/MemDumps/DID/UDS", "/MemDumps/DID/KWP2K", "/MemDumps/DID/KWP2K/LID", "/MemDumps/DID/KWP2K/CID", "/MemDumps/DID/KWP2K/ECUID", "/MemDumps/MBA", "/Logging", "/Logging/CAN", "/Logging/RAW", "/Logging/UDS", "/Logging/UDS/Hammer", "/Logging/UDS/Puppet",
 					"/Logging/UDS/Scans", "/Logging/KWP2KCAN", "/Logging/KWP2KCAN/Hammer", "/Logging/KWP2KCAN/Puppet", "/Logging/KWP2KCAN/Scans", "/Logging/TP", "/Logging/TP20",
-					"/Logging/TP20/Hammer", "/Logging/TP20/Puppet", "/Logging/TP20/Scans", "/Logging/KLINE", "/MITM", "/Replay", "/Transfers", "/Transfers/CAN", "/Transfers/CAN/Uploads",
+					"/Logging/TP20/Hammer", "/Logging/TP20/Puppet", "/Logging/TP20/Scans", "/Logging/KLINE", "/Logging/Census", "/MITM", "/Replay", "/Transfers", "/Transfers/CAN", "/Transfers/CAN/Uploads",
 					"/Transfers/CAN/Downloads"}; //creating an array this long on PC is nice, but this is an embedded system. If we experience crashes it will need to be rolled back.
 
 
-			for (int folder_iterate = 0; folder_iterate<36; folder_iterate++) {
+			for (int folder_iterate = 0; folder_iterate<37; folder_iterate++) {
 				if(!sd.doesDirExist(folders[folder_iterate])) {
 					if(!sd.makeFolder(folders[folder_iterate])){
 						oled.displayMessage("SD Error",1);
@@ -4216,16 +4225,19 @@ uint16_t CANbadger::TP20SecurityHijack(uint32_t ownID, uint32_t rID, uint8_t lev
 {
 	oled.clearScreen();
 	oled.displayMessage("Waiting...");
-	CANFormat format = CANStandard;
-	CANMessage can1_msg(0,format);
-	CANMessage can2_msg(0,format);
+	CANbadger_CAN cb1(&can1);//frames are buffered from the RX interrupts, so none get lost while the other bus is being handled
+	CANbadger_CAN cb2(&can2);
+	cb1.startRxRing();
+	cb2.startRxRing();
+	CANRxFrame can1_msg;
+	CANRxFrame can2_msg;
 	uint8_t pwn=0;//used as a counter for actions
 	uint8_t lvl = 0;//to grab the security level
 	uint8_t cnnt=0;//to count frames and discard a false channel negociation
 	uint16_t tpCounter=0;//used to grab the current counter
 	while(buttons.isButtonPressed(4) == false)//we will wait until we find a SA or the back button is pressed
 	{
-		if(can1.read(can1_msg))
+		if(cb1.readFrame(can1_msg))
 		{
 			if(can1_msg.id == rID)//target side
 			{
@@ -4274,7 +4286,7 @@ uint16_t CANbadger::TP20SecurityHijack(uint32_t ownID, uint32_t rID, uint8_t lev
 				timeout++;
 			}//make sure the msg goes out
 		}
-		if(can2.read(can2_msg))//tool side
+		if(cb2.readFrame(can2_msg))//tool side
 		{
 			if(can2_msg.id == ownID)
 			{
@@ -4334,16 +4346,19 @@ uint16_t CANbadger::KWP2KSecurityHijack(uint32_t ownID, uint32_t rID, uint8_t le
 {
 	oled.clearScreen();
 	oled.displayMessage("Waiting...");
-	CANFormat format = CANStandard;
-	CANMessage can1_msg(0,format);
-	CANMessage can2_msg(0,format);
+	CANbadger_CAN cb1(&can1);//frames are buffered from the RX interrupts, so none get lost while the other bus is being handled
+	CANbadger_CAN cb2(&can2);
+	cb1.startRxRing();
+	cb2.startRxRing();
+	CANRxFrame can1_msg;
+	CANRxFrame can2_msg;
 	uint8_t pwn=0;//used as a counter for actions
 	uint8_t lvl = 0;//to grab the security level
 	uint8_t cnnt=0;//to count frames and discard a false channel negotiation
 	uint16_t tpCounter=0;//used to grab the current counter
 	while(buttons.isButtonPressed(4) == false)//we will wait until we find a SA or the back button is pressed
 	{
-		if(can1.read(can1_msg))
+		if(cb1.readFrame(can1_msg))
 		{
 			if(can1_msg.id == rID)//target side
 			{
@@ -4383,7 +4398,7 @@ uint16_t CANbadger::KWP2KSecurityHijack(uint32_t ownID, uint32_t rID, uint8_t le
 				timeout++;
 			}//make sure the msg goes out
 		}
-		if(can2.read(can2_msg))//tool side
+		if(cb2.readFrame(can2_msg))//tool side
 		{
 			if(can2_msg.id == ownID)
 			{
@@ -4440,25 +4455,12 @@ uint8_t CANbadger::UDSSecurityHijack(uint32_t ownID, uint32_t rID, uint8_t level
 {
 	oled.clearScreen();
 	oled.displayMessage("Waiting...");
-	CANFormat format;
-	if(getCANBadgerStatus(CAN1_STANDARD) == true)
-	{
-		format = CANStandard;
-	}
-	else
-	{
-		format = CANExtended;
-	}
-	CANMessage can1_msg(0,format);
-	if(getCANBadgerStatus(CAN2_STANDARD) == true)
-	{
-		format = CANStandard;
-	}
-	else
-	{
-		format = CANExtended;
-	}
-	CANMessage can2_msg(0,format);
+	CANbadger_CAN cb1(&can1);//frames are buffered from the RX interrupts, so none get lost while the other bus is being handled
+	CANbadger_CAN cb2(&can2);
+	cb1.startRxRing();
+	cb2.startRxRing();
+	CANRxFrame can1_msg;
+	CANRxFrame can2_msg;
 	uint8_t pwn=0;//used as a counter for actions
 	uint8_t lvl = 0;//to grab the security level
 	uint8_t cnnt=0;//to count frames and discard a false channel negociation
@@ -4466,7 +4468,7 @@ uint8_t CANbadger::UDSSecurityHijack(uint32_t ownID, uint32_t rID, uint8_t level
 	uint32_t key=0;
 	while(buttons.isButtonPressed(4) == false)//we will wait until we find a SA or the back button is pressed
 	{
-		if(can1.read(can1_msg))
+		if(cb1.readFrame(can1_msg))
 		{
 			if(can1_msg.id == rID)//target side
 			{
@@ -4511,7 +4513,7 @@ uint8_t CANbadger::UDSSecurityHijack(uint32_t ownID, uint32_t rID, uint8_t level
 				timeout++;
 			}//make sure the msg goes out
 		}
-		if(can2.read(can2_msg))
+		if(cb2.readFrame(can2_msg))
 		{
 			if(can2_msg.id == rID)//target side
 			{
@@ -4633,67 +4635,21 @@ void CANbadger::ScanActiveUDSIDs()//need to add support for extended addressing
 			return;//we are looking for a lot of conditions, but if somehow they are not met, then go back
 		}
 	}
-	generalCounter1=0;//we initialize the buffer pointer for the interrupts and the pending packets
-	generalCounter2=0;
-	generalCounter3=0;//used as our buffer Pointer
-	uint8_t data[269];//we will store the retrieved data from buffer here. 269 is the maximum length we will ever get
+	CANLogRing::getRing()->flush();//start with an empty log ring
 	oled.displayMessage("Logging traffic");
 	oled.displayMessage("   Press back ",1);
 	oled.displayMessage("    to stop   ",1);
 	timer.stop();
 	timer.reset();
 	timer.start();//start it!
+	CANLogRing::getRing()->setEpoch(Timebase::now());//RAW log timestamps count from here
 	while(buttons.isButtonPressed(4) == false)//log while the back button is not pressed
 	{
-		if(generalCounter2 > 0)//if we have pending data to retrieve from RAM
-		{
-			if(generalCounter3 == 4096)//if we have reached the end of the buffer space
-			{
-				generalCounter3 = 0;//reset it to make it circular!
-			}
-			readTmpBuffer(generalCounter3, 1, data);
-			while(data[0] == 0)//to skip bytes intentionally left blank or if there was a read attempt that was interrupted
-			{
-				generalCounter3++;//we position the counter on the next byte
-				if(generalCounter3 == 4096)//if we have reached the end of the buffer space
-				{
-					generalCounter3 = 0;//reset it to make it circular!
-				}
-				readTmpBuffer(generalCounter3, 1, data);
-			}
-			readTmpBuffer((generalCounter3 + 13),1,data);//retrieve the length of the payload
-			uint32_t pLen=(data[0] + 14);//calculate the total length of the packet including header
-			readTmpBuffer(generalCounter3,pLen,data);
-			generalCounter3 = (generalCounter3 + pLen);//add the total length, and substract one so we are pointing at the last byte of the previous packet
-			sd.write((char*)data,pLen);//write the data to the file
-			generalCounter2--;//remove the packet we just wrote from the queue
-		}
+		writeLogRingToSD();
 	}
 	setCANBadgerStatus(CAN1_LOGGING,0);//now we will disable logging so we can process the pending frames
 	setCANBadgerStatus(CAN2_LOGGING,0);
-	while(generalCounter2 > 0)//if we have pending data to retrieve from buffer after stopping the logger
-	{
-		if(generalCounter3 == 4096)//if we have reached the end of the buffer space
-		{
-			generalCounter3 = 0;//reset it to make it circular!
-		}
-		readTmpBuffer(generalCounter3, 1, data);
-		while(data[0] == 0)//to skip bytes intentionally left blank
-		{
-			generalCounter3++;//we position the counter on the next byte
-			if(generalCounter3 == 4096)//if we have reached the end of the buffer space
-			{
-				generalCounter3 = 0;//reset it to make it circular!
-			}
-			readTmpBuffer(generalCounter3, 1, data);
-		}
-		readTmpBuffer((generalCounter3 + 13),1,data);//retrieve the length of the payload
-		uint32_t pLen=(data[0] + 14);//calculate the total length of the packet including header
-		readTmpBuffer(generalCounter3,pLen,data);
-		generalCounter3 = (generalCounter3 + pLen);//add the total length, and substract one so we are pointing at the last byte of the previous packet
-		sd.write((char*)data,pLen);//write the data to the file
-		generalCounter2--;//remove the packet we just wrote from the queue
-	}
+	writeLogRingToSD();//write whatever was still pending when logging stopped
 	if(wasCANBridgeEnabled == false)//if bridge was not enabled before logging, we disable it
 	{
 		CANBridge(0);
@@ -4857,67 +4813,21 @@ void CANbadger::ScanActiveKWP2KIDs()//need to add support for extended addressin
 			return;//we are looking for a lot of conditions, but if somehow they are not met, then go back
 		}
 	}
-	generalCounter1=0;//we initialize the buffer pointer for the interrupts and the pending packets
-	generalCounter2=0;
-	generalCounter3=0;//used as our buffer Pointer
-	uint8_t data[269];//we will store the retrieved data from buffer here. 269 is the maximum length we will ever get
+	CANLogRing::getRing()->flush();//start with an empty log ring
 	oled.displayMessage("Logging traffic");
 	oled.displayMessage("   Press back ",1);
 	oled.displayMessage("    to stop   ",1);
 	timer.stop();
 	timer.reset();
 	timer.start();//start it!
+	CANLogRing::getRing()->setEpoch(Timebase::now());//RAW log timestamps count from here
 	while(buttons.isButtonPressed(4) == false)//log while the back button is not pressed
 	{
-		if(generalCounter2 > 0)//if we have pending data to retrieve from RAM
-		{
-			if(generalCounter3 == 4096)//if we have reached the end of the buffer space
-			{
-				generalCounter3 = 0;//reset it to make it circular!
-			}
-			readTmpBuffer(generalCounter3, 1, data);
-			while(data[0] == 0)//to skip bytes intentionally left blank or if there was a read attempt that was interrupted
-			{
-				generalCounter3++;//we position the counter on the next byte
-				if(generalCounter3 == 4096)//if we have reached the end of the buffer space
-				{
-					generalCounter3 = 0;//reset it to make it circular!
-				}
-				readTmpBuffer(generalCounter3, 1, data);
-			}
-			readTmpBuffer((generalCounter3 + 13),1,data);//retrieve the length of the payload
-			uint32_t pLen=(data[0] + 14);//calculate the total length of the packet including header
-			readTmpBuffer(generalCounter3,pLen,data);
-			generalCounter3 = (generalCounter3 + pLen);//add the total length, and substract one so we are pointing at the last byte of the previous packet
-			sd.write((char*)data,pLen);//write the data to the file
-			generalCounter2--;//remove the packet we just wrote from the queue
-		}
+		writeLogRingToSD();
 	}
 	setCANBadgerStatus(CAN1_LOGGING,0);//now we will disable logging so we can process the pending frames
 	setCANBadgerStatus(CAN2_LOGGING,0);
-	while(generalCounter2 > 0)//if we have pending data to retrieve from buffer after stopping the logger
-	{
-		if(generalCounter3 == 4096)//if we have reached the end of the buffer space
-		{
-			generalCounter3 = 0;//reset it to make it circular!
-		}
-		readTmpBuffer(generalCounter3, 1, data);
-		while(data[0] == 0)//to skip bytes intentionally left blank
-		{
-			generalCounter3++;//we position the counter on the next byte
-			if(generalCounter3 == 4096)//if we have reached the end of the buffer space
-			{
-				generalCounter3 = 0;//reset it to make it circular!
-			}
-			readTmpBuffer(generalCounter3, 1, data);
-		}
-		readTmpBuffer((generalCounter3 + 13),1,data);//retrieve the length of the payload
-		uint32_t pLen=(data[0] + 14);//calculate the total length of the packet including header
-		readTmpBuffer(generalCounter3,pLen,data);
-		generalCounter3 = (generalCounter3 + pLen);//add the total length, and substract one so we are pointing at the last byte of the previous packet
-		sd.write((char*)data,pLen);//write the data to the file
-		generalCounter2--;//remove the packet we just wrote from the queue
-	}
+	writeLogRingToSD();//write whatever was still pending when logging stopped
 	if(wasCANBridgeEnabled == false)//if bridge was not enabled before logging, we disable it
 	{
 		CANBridge(0);
@@ -5557,12 +5467,14 @@ void CANbadger::diagMenu()
 
 void CANbadger::loggingMenu()
 {
-	const char* options[15]={"Start logging"};
+	const char* options[15]={"Start logging", "Black box", "Compress: OFF", "Delta log: OFF", "Bridge latency"};
 	uint8_t option = 1;
 	while(1)
 	{
+		options[2] = getCANBadgerStatus(LOG_COMPRESSION) ? "Compress: ON" : "Compress: OFF";
+		options[3] = getCANBadgerStatus(LOG_CHANGES_ONLY) ? "Delta log: ON" : "Delta log: OFF";
 		oled.clearScreen();
-		option = oled.showOLEDMenu((const char*)"  Logging Menu  ", options, 1, &buttons);
+		option = oled.showOLEDMenu((const char*)"  Logging Menu  ", options, 5, &buttons);
 		if(option == 0)
 		{
 			return;
@@ -5572,6 +5484,22 @@ void CANbadger::loggingMenu()
 			oled.clearScreen();
 			startLog();
 		}
+		else if(option == 2)
+		{
+			blackBoxMode();
+		}
+		else if(option == 3)
+		{
+			setCANBadgerStatus(LOG_COMPRESSION, !getCANBadgerStatus(LOG_COMPRESSION));
+		}
+		else if(option == 4)
+		{
+			setCANBadgerStatus(LOG_CHANGES_ONLY, !getCANBadgerStatus(LOG_CHANGES_ONLY));
+		}
+		else if(option == 5)
+		{
+			bridgeLatencyMode();
+		}
 	}	
 }
 
@@ -6115,10 +6043,12 @@ void CANbadger::CANConfigMenu(uint8_t busno)
 					oled.clearScreen();
 					oled.displayMessage("Please wait..");
 					uint32_t r;
+					uint16_t samplePoint;
 					if(busno == 1)
 					{
 						CANbadger_CAN canbus(&can1);
 						r=canbus.detectSpeed();
+						samplePoint=canbus.getSamplePoint();
 						if(r == 0)
 						{
 							canbadger_settings->setSpeed(1,500000);
@@ -6132,6 +6062,7 @@ void CANbadger::CANConfigMenu(uint8_t busno)
 					{
 						CANbadger_CAN canbus(&can2);
 						r=canbus.detectSpeed();
+						samplePoint=canbus.getSamplePoint();
 						if(r == 0)
 						{
 							canbadger_settings->setSpeed(2,500000);
@@ -6147,7 +6078,10 @@ void CANbadger::CANConfigMenu(uint8_t busno)
 					}
 					else
 					{
+						char tmpBuf[20];
 						oled.displayMessage("Speed was set",1);
+						sprintf(tmpBuf,"%u SP %u.%u%%",(unsigned int)r,(unsigned int)(samplePoint / 10),(unsigned int)(samplePoint % 10));
+						oled.displayMessage(tmpBuf,1);
 					}
 					buttons.getButtonPressed();
 					optChanged=true;
@@ -6631,62 +6565,25 @@ bool CANbadger::displayFile(const char *filename)
 
 bool CANbadger::sendCANFrame(uint32_t msgID, uint8_t *payload, uint8_t len, uint8_t bus, CANFormat frameFormat, CANType frameType, uint32_t timeout)
 {
-	uint32_t currentMS=0;
-	if(timeout != 0)
+	CANTxQueue *queue;
+	if(bus == 1)
 	{
-		if(bus == 1)
-		{
-			while(((LPC_CAN1->GSR & 4) == 0) && currentMS < (timeout * 10))//hack to fix a silicon bug.
-			{
-				wait(0.0001);
-				currentMS++;
-			}
-			while (!can1.write(CANMessage(msgID, reinterpret_cast<char*>(payload), len, frameType, frameFormat)) && currentMS < (timeout * 10))
-			{
-				wait(0.0001);
-				currentMS++;
-			}//make sure the msg goes out
-		}
-		else
-		{
-			while(((LPC_CAN2->GSR & 4) == 0) && currentMS < (timeout * 10))//hack to fix a silicon bug.
-			{
-				wait(0.0001);
-				currentMS++;
-			}
-			while (!can2.write(CANMessage(msgID, reinterpret_cast<char*>(payload), len, frameType, frameFormat)) && currentMS < (timeout * 10))
-			{
-				wait(0.0001);
-				currentMS++;
-			}//make sure the msg goes out
-		}
+		queue = CANTxQueue::getQueue(&can1);
 	}
 	else
 	{
-		if(bus == 1)
-		{
-			while(((LPC_CAN1->GSR & 4) == 0) && currentMS < (timeout * 10))//hack to fix a silicon bug.
-			{
-				wait(0.0001);
-				currentMS++;
-			}
-			can1.write(CANMessage(msgID, reinterpret_cast<char*>(payload), len, frameType, frameFormat));
-		}
-		else
-		{
-			while(((LPC_CAN2->GSR & 4) == 0) && currentMS < (timeout * 10))//hack to fix a silicon bug.
-			{
-				wait(0.0001);
-				currentMS++;
-			}
-			can2.write(CANMessage(msgID, reinterpret_cast<char*>(payload), len, frameType, frameFormat));
-		}
+		queue = CANTxQueue::getQueue(&can2);
 	}
-	if(currentMS >= (timeout * 10) && timeout != 0)
+	uint32_t token = queue->push(msgID, payload, len, frameFormat, frameType);
+	if(token == 0)//queue full
 	{
 		return false;
 	}
-	return true;
+	if(timeout == 0)
+	{
+		return true;
+	}
+	return queue->waitComplete(token, timeout);
 }
 
 bool CANbadger::listAllFiles(char *lookupDir, vector<std::string>* filenames) {
@@ -6894,19 +6791,48 @@ bool CANbadger::startLog()//uint8_t interfaces)
 		buttons.getButtonPressed();
 		return false;
 	}
+	CANLogV2Encoder logEncoder;
+	CANLogV2Header logHeader;
+	uint8_t headerData[CAN_LOG_V2_HEADER_SIZE];
+	CANLogCompressor *compressor = NULL;//about 6KB, too big for the stack and only needed with compression on
+	if(getCANBadgerStatus(LOG_COMPRESSION))
+	{
+		compressor = new (std::nothrow) CANLogCompressor();
+		if(compressor == NULL)
+		{
+			oled.displayMessage("Out of memory");
+			sd.closeFile();
+			sd.deleteFile(filename);
+			buttons.getButtonPressed();
+			return false;
+		}
+		compressor->setClock(us_ticker_read);
+	}
+	fillLogHeader(logHeader);
+	writeLogData(headerData, logEncoder.writeHeader(headerData, logHeader), compressor);
 	bool wasCANBridgeEnabled=false;
 	bool wasKLINEBridgeEnabled=false;
 	//uint32_t frmCount=0;//to keep track of processed frames
-	generalCounter1=0;//we initialize the buffer pointer for the interrupts and the pending packets
-	generalCounter2=0;
-	generalCounter3=0;//used as our buffer Pointer
-	uint8_t data[269];//we will store the retrieved data from buffer here. 269 is the maximum length we will ever get
+	CANChangeFilter *changeFilter = CANChangeFilter::getFilter();
+	if(getCANBadgerStatus(LOG_CHANGES_ONLY) && !changeFilter->start())
+	{
+		oled.displayMessage("Out of memory");
+		delete compressor;
+		sd.closeFile();
+		sd.deleteFile(filename);
+		buttons.getButtonPressed();
+		return false;
+	}
+	CANLogRing::getRing()->flush();//start with an empty log ring
+	CANLogRing::getRing()->clearStats();//drop markers in the log count from here
 	timer.reset();//reset the timer
 	if(!getCANBadgerStatus(CAN_BRIDGE_ENABLED) && (getCANBadgerStatus(CAN1_LOGGING) || getCANBadgerStatus(CAN2_LOGGING)))//enable the bridges so logging happens
 	{
 		if(!CANBridge(1))
 		{
 			oled.displayMessage("Bridge error");
+			changeFilter->release();
+			delete compressor;
 			sd.closeFile();//clean up
 			sd.deleteFile(filename);
 			buttons.getButtonPressed();
@@ -6959,32 +6885,11 @@ bool CANbadger::startLog()//uint8_t interfaces)
 	timer.stop();
 	timer.reset();
 	timer.start();//start it!
+	CANLogRing::getRing()->setEpoch(Timebase::now());//RAW log timestamps count from here
+	uint32_t frames = 0;
 	while(buttons.isButtonPressed(4) == false)//log while the back button is not pressed
 	{
-		if(generalCounter2 > 0)//if we have pending data to retrieve from RAM
-		{
-			if(generalCounter3 == 4096)//if we have reached the end of the buffer space
-			{
-				generalCounter3 = 0;//reset it to make it circular!
-			}
-			readTmpBuffer(generalCounter3, 1, data);
-			while(data[0] == 0)//to skip bytes intentionally left blank or if there was a read attempt that was interrupted
-			{
-				generalCounter3++;//we position the counter on the next byte
-				if(generalCounter3 == 4096)//if we have reached the end of the buffer space
-				{
-					generalCounter3 = 0;//reset it to make it circular!
-				}
-				readTmpBuffer(generalCounter3, 1, data);
-			}
-			readTmpBuffer((generalCounter3 + 13),1,data);//retrieve the length of the payload
-			uint32_t pLen=(data[0] + 14);//calculate the total length of the packet including header
-			readTmpBuffer(generalCounter3,pLen,data);
-			generalCounter3 = (generalCounter3 + pLen);//add the total length, and substract one so we are pointing at the last byte of the previous packet
-			sd.write((char*)data,pLen);//write the data to the file
-			generalCounter2--;//remove the packet we just wrote from the queue
-			//frmCount++;
-		}
+		frames += writeLogRingToSD(&logEncoder, compressor);
 	}
 	oled.clearScreen();
 /*	if(convert.getBit(interfaces,0))//disable logging
@@ -7027,30 +6932,16 @@ bool CANbadger::startLog()//uint8_t interfaces)
 		setCANBadgerStatus(KLINE2_LOGGING,0);
 		KLINE2Logging=true;
 	}	
-	while(generalCounter2 > 0)//if we have pending data to retrieve from buffer after stopping the logger
+	frames += writeLogRingToSD(&logEncoder, compressor);//write whatever was still pending when logging stopped
+	bool changesOnly = changeFilter->isRunning();
+	changeFilter->stop();
+	uint8_t indexData[CAN_LOG_V2_INDEX_SIZE];
+	uint32_t indexLen = logEncoder.finish(indexData);//index the last segment, readers look for it at the end of the file
+	if(indexLen > 0)
 	{
-		if(generalCounter3 == 4096)//if we have reached the end of the buffer space
-		{
-			generalCounter3 = 0;//reset it to make it circular!
-		}
-		readTmpBuffer(generalCounter3, 1, data);
-		while(data[0] == 0)//to skip bytes intentionally left blank
-		{
-			generalCounter3++;//we position the counter on the next byte
-			if(generalCounter3 == 4096)//if we have reached the end of the buffer space
-			{
-				generalCounter3 = 0;//reset it to make it circular!
-			}
-			readTmpBuffer(generalCounter3, 1, data);
-		}
-		readTmpBuffer((generalCounter3 + 13),1,data);//retrieve the length of the payload
-		uint32_t pLen=(data[0] + 14);//calculate the total length of the packet including header
-		readTmpBuffer(generalCounter3,pLen,data);
-		generalCounter3 = (generalCounter3 + pLen);//add the total length, and substract one so we are pointing at the last byte of the previous packet
-		sd.write((char*)data,pLen);//write the data to the file
-		generalCounter2--;//remove the packet we just wrote from the queue
-		//frmCount++;
-	}	
+		writeLogData(indexData, indexLen, compressor);
+	}
+	flushLogData(compressor);
 	if(wasCANBridgeEnabled == false)//if bridge was not enabled before logging, we disable it
 	{
 		CANBridge(0);
@@ -7067,6 +6958,28 @@ bool CANbadger::startLog()//uint8_t interfaces)
 	oled.clearScreen();
 	oled.displayMessage("Log saved in:");
 	oled.displayMessage(filename,1);
+	if(compressor != NULL && compressor->getPackedBytes() > 0)//show what the compression bought us and what it cost
+	{
+		char stats[17];
+		uint32_t ratio = (uint32_t)(((uint64_t)compressor->getPlainBytes() * 100) / compressor->getPackedBytes());
+		sprintf(stats, "Ratio %u.%02u", (unsigned int)(ratio / 100), (unsigned int)(ratio % 100));
+		oled.displayMessage(stats,1);
+		if(frames > 0)
+		{
+			sprintf(stats, "%u us/frame", (unsigned int)(compressor->getBusyTime() / frames));
+			oled.displayMessage(stats,1);
+		}
+	}
+	delete compressor;
+	if(changesOnly == true)//how much change-only logging left out
+	{
+		char stats[17];
+		sprintf(stats, "Kept %u", (unsigned int)changeFilter->getPassedCount());
+		oled.displayMessage(stats,1);
+		sprintf(stats, "Skipped %u", (unsigned int)changeFilter->getSuppressedCount());
+		oled.displayMessage(stats,1);
+		changeFilter->release();
+	}
 	if(CAN1Logging == true)//If Logging was enabled, re-enable it
 	{
 		setCANBadgerStatus(CAN1_LOGGING,1);
@@ -7135,10 +7048,15 @@ void CANbadger::MITMMode(char *filename, CANFormat format)
 		for (uint8_t a = 0;a<8; a++) //grab the action payload
 		{
 			actionPayload[a] = grabASCIIValue();
+		}
+		if(!CANMITMFixup::isValid(action, actionPayload))//a fix-up that points outside the frame
+		{
+			oled.displayMessage("Bad fix-up rule",1);
+			continue;
 		}
 		 //now we check if there is already an entry for that ID
 		uint32_t ruleOffset = mitm.tableLookUp(targetID);
-		if(ruleOffset != 0xFFFFFFFF)//if an entry is found
+		if(ruleOffset != CAN_MITM_NO_RULES)//if an entry is found
 		{
 			if(!mitm.addRule(ruleOffset, CondType,targetPayload,action,actionPayload))//this works
 			{
@@ -7155,8 +7073,8 @@ void CANbadger::MITMMode(char *filename, CANFormat format)
 		}
 		else //if an entry is not found
 		{
-			ruleOffset = mitm.getLastIDEntryOffset();//retrieve the last offset where a rule was stored
-			if (ruleOffset == 0xFFFFFFFF)
+			ruleOffset = mitm.allocRAM(targetID);//get a rule block for the new ID
+			if (ruleOffset == CAN_MITM_NO_RULES)
 			{
 				/*if(uartMode)
 					device.printf("Reached maximum number of IDs, will not be able to store rules for ID 0x%x...\n", targetID);
@@ -7166,8 +7084,6 @@ void CANbadger::MITMMode(char *filename, CANFormat format)
 			}
 			else
 			{
-				uint32_t oPos = ruleOffset;
-				ruleOffset = mitm.allocRAM(targetID, oPos);
 				mitm.addRule(ruleOffset, CondType,targetPayload,action,actionPayload);
 				IDsAllocated++;
 				rulesAllocated++;
@@ -7190,7 +7106,14 @@ void CANbadger::MITMMode(char *filename, CANFormat format)
 		ethernetManager->debugLog("MITM stopped!");*/
 	oled.clearScreen();
 	oled.displayMessage("MITM stopped");
-	wait(2);
+	char tmp[22];
+	sprintf(tmp, "Fwd:%u", (unsigned int)mitm.getForwardedCount());
+	oled.displayMessage(tmp,1);
+	sprintf(tmp, "Mod:%u Drop:%u", (unsigned int)mitm.getModifiedCount(), (unsigned int)mitm.getDroppedCount());
+	oled.displayMessage(tmp,1);
+	sprintf(tmp, "Avg:%u Max:%u us", (unsigned int)mitm.getLatency()->getMean(), (unsigned int)mitm.getLatency()->getMax());
+	oled.displayMessage(tmp,1);
+	if(this->ethernet_manager == NULL) {buttons.getButtonPressed();} else {wait(2);}
 }
 
 // create a persistent MITM object, that can accept new rules
@@ -7216,45 +7139,49 @@ bool CANbadger::addMITMRule(const char *rule) {
 	uint32_t targetID;
 	uint8_t conditionPayload[8] = {0};
 	uint8_t actionPayload[8] = {0};
-	char* next;
+	const char* field[19];  // condition, ID, 8 condition bytes, action, 8 action bytes
+
+	// find the start of every field, a rule that is cut short is rejected
+	field[0] = rule;
+	for(int i = 1; i < 19; i++) {
+		const char *comma = strchr(field[i - 1], ',');
+		if(comma == NULL) { return false; }
+		field[i] = comma + 1;
+	}
 
 	// parse condition and condition mask to uint32_t
-	condType = atoh<uint32_t>(rule);
-	next = strchr(rule, ',') + 1;
+	condType = atoh<uint32_t>(field[0]);
 
 	// parse target ID
-	targetID = atoh<uint32_t>(next);
-	next = strchr(next, ',') + 1;
+	targetID = atoh<uint32_t>(field[1]);
 
 	// get contition payload as uint8_t array
 	for(int i = 0; i < 8; i++) {
-		conditionPayload[i] = atoh<uint8_t>(next);
-		next = strchr(next, ',') + 1;
+		conditionPayload[i] = atoh<uint8_t>(field[2 + i]);
 	}
 
 	// parse action type and mask into uint32_t
-	actionType = atoh<uint32_t>(next);
-	next = strchr(next, ',') + 1;
+	actionType = atoh<uint32_t>(field[10]);
 
 	// get the action payload into a uint8_t array
 	for(int i = 0; i < 8; i++) {
-		actionPayload[i] = atoh<uint8_t>(next);
-		next = strchr(next, ',') + 1;
+		actionPayload[i] = atoh<uint8_t>(field[11 + i]);
 	}
 
+	// fix-ups (checksums and counters) have to point inside the frame
+	if(!CANMITMFixup::isValid(actionType, actionPayload)) { return false; }
+
 	// check for existing ID entry
 	uint32_t ruleOffset = persistent_mitm->tableLookUp(targetID);
 
 
-	if(ruleOffset != 0xFFFFFFFF) {  //if an entry is found, add the new rule
+	if(ruleOffset != CAN_MITM_NO_RULES) {  //if an entry is found, add the new rule
 		return persistent_mitm->addRule(ruleOffset, condType,conditionPayload,actionType,actionPayload);
 	}
 
 	// get new offset for the new ID
-	ruleOffset = persistent_mitm->getLastIDEntryOffset();  // retrieve the last offset where a rule was stored
-	uint32_t oPos = ruleOffset;
-	ruleOffset = persistent_mitm->allocRAM(targetID, oPos);  // get the new rule offset for the target ID
-	if (ruleOffset == 0xFFFFFFFF) { return false; }  // no XRAM space available anymore
+	ruleOffset = persistent_mitm->allocRAM(targetID);  // get the new rule offset for the target ID
+	if (ruleOffset == CAN_MITM_NO_RULES) { return false; }  // no XRAM space available anymore
 
 	// try to store the new rule and return the result
 	return persistent_mitm->addRule(ruleOffset, condType,conditionPayload,actionType,actionPayload);
@@ -12676,12 +12603,14 @@ bool CANbadger::setCANSpeed(uint8_t bus, uint32_t speed)
 {
 	if(bus == 1)
 	{
-		if(!can1.frequency(speed)) {return 0;}
+		CANbadger_CAN can(&can1);//goes through the BTR calculation, so rates found by detectSpeed can be restored
+		if(!can.setCANSpeed(speed)) {return 0;}
 		//canbadger_settings->setSpeed(1, speed);
 	}
 	else
 	{
-		if(!can2.frequency(speed)) {return 0;}
+		CANbadger_CAN can(&can2);
+		if(!can.setCANSpeed(speed)) {return 0;}
 		canbadger_settings->setSpeed(2, speed);
 	}
 	return 1;
@@ -12795,214 +12724,62 @@ void CANbadger::setKLINESpeed(uint8_t bus, uint32_t speed)
 	
 	
 
-void CANbadger::doCANBridge(void)
+void CANbadger::bridgeFrames(CAN &from, uint8_t bus, const CANBridgeRoute &route, CANTxQueue *queue)
 {
 	CANMessage canMsg(0,CANAny);//we create a message for any kind of ID
-	if(getCANBadgerStatus(CAN1_TO_CAN2_BRIDGE) || getCANBadgerStatus(CAN1_LOGGING))//if CAN1 to CAN2 bridge is enabled or we want to log it
+	CANChangeFilter *changeFilter = CANChangeFilter::getFilter();
+	while(from.read(canMsg) != 0)//take everything the controller holds, a frame left behind would be overwritten by the next one
 	{
-		while(can1.read(canMsg) != 0)
+		uint64_t rxTime = Timebase::now();//one timestamp for the census, the log and the latency measurement
+		CANCensus::getCensus()->record(bus, canMsg.id, canMsg.format, canMsg.data, canMsg.len, (uint32_t)rxTime);
+		uint8_t skipped;
+		if(route.log && changeFilter->check(bus, canMsg.id, canMsg.format, canMsg.data, canMsg.len, (uint32_t)rxTime, skipped))//change-only logging may leave it out
+		{
+			CANLogRing::getRing()->push(bus, route.logFlags, rxTime, canMsg, skipped);
+		}
+		if(route.forward)
 		{
-			if(getCANBadgerStatus(CAN1_LOGGING))
+			if(route.fullFrame)
 			{
-				uint8_t tmpbuf[22]={0};//to store the info
-				uint32_t us=timer.read_ms();//get the current time
-				tmpbuf[1]=(us >> 24);//store it 
-				tmpbuf[2]=(us >> 16);
-				tmpbuf[3]=(us >> 8);
-				tmpbuf[4]=us;
-				uint32_t temp_speed = canbadger_settings->getSpeed(1);
-				tmpbuf[9]=(temp_speed >> 24);//get the current speed and store it
-				tmpbuf[10]=(temp_speed >> 16);
-				tmpbuf[11]=(temp_speed >> 8);
-				tmpbuf[12]=temp_speed;
-				if(getCANBadgerStatus(CAN1_STANDARD))
-				{
-					tmpbuf[0]=21; //Bus 1, CAN, Standard frame
-				}
-				else
-				{
-					tmpbuf[0]=37; //Bus 1, CAN, Extended frame
-				}
-				tmpbuf[5]=(canMsg.id >> 24);//get the ID
-				tmpbuf[6]=(canMsg.id >> 16);
-				tmpbuf[7]=(canMsg.id >> 8);
-				tmpbuf[8]=canMsg.id;
-				tmpbuf[13]=canMsg.len;//get the data length
-				for(uint8_t a=0; a<tmpbuf[13];a++)//and get the data
+				for(uint8_t a=canMsg.len; a< 8; a++)
 				{
-					tmpbuf[(a+14)]=canMsg.data[a];
+					canMsg.data[a] = 0;
 				}
-				if((generalCounter1 + (tmpbuf[13] + 14)) > 4096)//if we would overflow
-				{
-					uint8_t tmp[22]={0};//we will write zeros so the parser knows to skip those bytes
-					memset(tmp,0,22);
-					writeTmpBuffer(generalCounter1,(4096 - generalCounter1),tmp);
-					generalCounter1=0;
-				}
-				writeTmpBuffer(generalCounter1, (tmpbuf[13] + 14), tmpbuf);
-				generalCounter1 = (generalCounter1 + (tmpbuf[13] + 14));//we are using generalCounter1 as the Array pointer
-				generalCounter2++;//and we are using generalCounter2 to indicate that we have pushed a new frame to the buffer
+				canMsg.len=8;
 			}
-			if(getCANBadgerStatus(CAN1_TO_CAN2_BRIDGE))//if bridge is enabled
+			switch(route.format)
 			{
-				if(getCANBadgerStatus(CAN2_USE_FULLFRAME))
-				{
-					for(uint8_t a=canMsg.len; a< 8; a++)
-					{
-						canMsg.data[a] = 0;
-					}
-					canMsg.len=8;
-				}
-				if(getCANBadgerStatus(CAN1_STANDARD))//If CAN1 is set as standard, then we use the standard message
-				{
-					if(getCANBadgerStatus(CAN2_STANDARD))//then, we check if CAN2 is set to Standard or Extended mode to do the bridge
+				case CAN_BRIDGE_FORMAT_STANDARD:
+					canMsg.format=CANStandard;
+					break;
+				case CAN_BRIDGE_FORMAT_BY_ID:
+					canMsg.format = (canMsg.id < 0x800) ? CANStandard : CANExtended;
+					break;
+				case CAN_BRIDGE_FORMAT_SHORT_STANDARD:
+					if(canMsg.id < 0x800)
 					{
 						canMsg.format=CANStandard;
 					}
-					else if (getCANBadgerStatus(CAN2_EXTENDED))
-					{
-						if(canMsg.id < 0x800)
-						{
-							canMsg.format=CANStandard;
-						}
-						else
-						{
-							canMsg.format=CANExtended;
-						}
-					}
-				}
-				else if(getCANBadgerStatus(CAN1_EXTENDED))
-				{
-					if(getCANBadgerStatus(CAN1_TO_CAN2_BRIDGE))//if bridge is enabled
-					{
-						if(getCANBadgerStatus(CAN2_STANDARD))//then, we check if CAN2 is set to Standard or Extended mode to do the bridge
-						{
-							if(canMsg.id <= 0x7FF)//we can only send an extended ID in Standard CAN if its under 0x800
-							{
-								canMsg.format=CANStandard;
-							}
-						}
-						else
-						{
-							if(canMsg.id < 0x800)
-							{
-								canMsg.format=CANStandard;
-							}
-							else
-							{
-								canMsg.format=CANExtended;
-							}
-						}
-					}
-				}
-				while((LPC_CAN2->GSR & 4) == 0){}
-				while(can2.write(canMsg) == 0){}
-				canMsg.format=CANAny;
+					break;
+				default:
+					break;
 			}
-			wait(0.0003);
+			queue->push(canMsg.id, canMsg.data, canMsg.len, canMsg.format, canMsg.type, rxTime);//queued, the TX interrupt sends it in ID order
 		}
+		canMsg.format=CANAny;
 	}
-	if(getCANBadgerStatus(CAN2_TO_CAN1_BRIDGE) || getCANBadgerStatus(CAN2_LOGGING))//if CAN2 to CAN1 bridge is enabled or we want to log it
+}
+
+void CANbadger::doCANBridge(void)
+{
+	const CanbadgerRuntimeConfig *config = this->canbadger_settings->getRuntimeConfig();//everything the bridge needs, worked out when the settings changed
+	if(config->bridge[0].log || config->bridge[0].forward)//if CAN1 to CAN2 bridge is enabled or we want to log it
 	{
-		canMsg.id=0;//reset it in case it was used by CAN1
-		while(can2.read(canMsg)!= 0)
-		{
-			if(getCANBadgerStatus(CAN2_LOGGING))
-			{
-				uint8_t tmpbuf[22]={0};//to store the info
-				uint32_t us=timer.read_ms();//get the current time
-				tmpbuf[1]=(us >> 24);//store it 
-				tmpbuf[2]=(us >> 16);
-				tmpbuf[3]=(us >> 8);
-				tmpbuf[4]=us;
-				uint32_t temp_speed = canbadger_settings->getSpeed(2);
-				tmpbuf[9]=(temp_speed >> 24);//get the current speed and store it
-				tmpbuf[10]=(temp_speed >> 16);
-				tmpbuf[11]=(temp_speed >> 8);
-				tmpbuf[12]=temp_speed;
-				if(getCANBadgerStatus(CAN2_STANDARD))
-				{
-					tmpbuf[0]=22; //Bus 2, CAN, Standard frame
-				}
-				else
-				{
-					tmpbuf[0]=38; //Bus 2, CAN, Extended frame
-				}
-				tmpbuf[5]=(canMsg.id >> 24);//get the ID
-				tmpbuf[6]=(canMsg.id >> 16);
-				tmpbuf[7]=(canMsg.id >> 8);
-				tmpbuf[8]=canMsg.id;
-				tmpbuf[13]=canMsg.len;//get the data length
-				for(uint8_t a=0; a<tmpbuf[13];a++)//and get the data
-				{
-					tmpbuf[(a+14)]=canMsg.data[a];
-				}
-				if((generalCounter1 + (tmpbuf[13] + 14)) > 4096)//if we would overflow
-				{
-					uint8_t tmp[22]={0};//we will write zeros so the parser knows to skip those bytes
-					memset(tmp,0,22);
-					writeTmpBuffer(generalCounter1,(4096 - generalCounter1),tmp);
-					generalCounter1=0;
-				}
-				writeTmpBuffer(generalCounter1, (tmpbuf[13] + 14), tmpbuf);
-				generalCounter1 = (generalCounter1 + (tmpbuf[13] + 14));//we are using generalCounter1 as the RAM pointer
-				generalCounter2++;//and we are using generalCounter2 to indicate that we have pushed a new frame to the RAM
-			}
-			if(getCANBadgerStatus(CAN2_TO_CAN1_BRIDGE))//if bridge is enabled
-			{
-				if(getCANBadgerStatus(CAN1_USE_FULLFRAME))
-				{
-					for(uint8_t a=canMsg.len; a< 8; a++)
-					{
-						canMsg.data[a] = 0;
-					}
-					canMsg.len=8;
-				}
-				if(getCANBadgerStatus(CAN2_STANDARD))//If CAN2 is set as standard, then we use the standard message
-				{
-					if(getCANBadgerStatus(CAN1_STANDARD))//then, we check if CAN1 is set to Standard or Extended mode to do the bridge
-					{
-							canMsg.format=CANStandard;
-					}
-					else if (getCANBadgerStatus(CAN1_EXTENDED))
-					{
-						if(canMsg.id < 0x800)
-						{
-							canMsg.format=CANStandard;
-						}
-						else
-						{
-							canMsg.format=CANExtended;
-						}
-					}
-				}
-				else if(getCANBadgerStatus(CAN2_EXTENDED))
-				{
-					if(getCANBadgerStatus(CAN1_STANDARD))//then, we check if CAN1 is set to Standard or Extended mode to do the bridge
-					{
-						if(canMsg.id <= 0x7FF)//we can only send an extended ID in Standard CAN if its under 0x800
-						{
-							canMsg.format=CANStandard;
-						}
-					}
-					else
-					{
-						if(canMsg.id < 0x800)
-						{
-							canMsg.format=CANStandard;
-						}
-						else
-						{
-							canMsg.format=CANExtended;
-						}
-					}
-				}
-				while((LPC_CAN1->GSR & 4) == 0){}
-				while(can1.write(canMsg) == 0){}
-				canMsg.format=CANAny;
-			}
-			wait(0.0003);
-		}
+		bridgeFrames(can1, 1, config->bridge[0], CANTxQueue::getQueue(&can2));
+	}
+	if(config->bridge[1].log || config->bridge[1].forward)//if CAN2 to CAN1 bridge is enabled or we want to log it
+	{
+		bridgeFrames(can2, 2, config->bridge[1], CANTxQueue::getQueue(&can1));
 	}
 }
 
@@ -13065,9 +12842,8 @@ bool CANbadger::dumpCANUDSTransfer(uint32_t targetID, uint8_t bus, uint8_t dumpF
 	{
 		setCANBadgerStatus(CAN2_LOGGING,1);
 	}	
-	generalCounter1=0;//we initialize the buffer pointer for the interrupts and the pending packets
-	generalCounter2=0;
-	generalCounter3=0;//used as our buffer Pointer
+	CANLogRing *logRing = CANLogRing::getRing();
+	logRing->flush();//start with an empty log ring
 	generalCounter4=0;//used as the data array pointer
 	uint8_t data[4094];//we will store the retrieved data from buffer here. 4094 is the maximum length we will ever get
 	uint8_t tmpData[22];
@@ -13079,23 +12855,11 @@ bool CANbadger::dumpCANUDSTransfer(uint32_t targetID, uint8_t bus, uint8_t dumpF
 	CANBridge(true);//start the bridge
 	while(buttons.isButtonPressed(4) == false && itsDone == false)//wait while the back button is not pressed or we didnt dump the file
 	{
-		if(generalCounter2 > 0)//if we have pending data to retrieve from XRAM
+		CANLogRecord *record;
+		if(logRing->peek(record) > 0)//if we have pending frames
 		{
-			readTmpBuffer(generalCounter3, 1, tmpData);
-			while(tmpData[0] == 0)//to skip bytes intentionally left blank or if there was a read attempt that was interrupted
-			{
-				generalCounter3++;//we position the counter on the next byte
-				if(generalCounter3 == 4096)//if we have reached the end of the buffer space
-				{
-					generalCounter3 = 0;//reset it to make it circular!
-				}
-				readTmpBuffer(generalCounter3, 1, tmpData);
-			}
-			readTmpBuffer((generalCounter3 + 13),1,tmpData);//retrieve the length of the payload
-			uint8_t pLen=(tmpData[0] + 14);//calculate the total length of the packet including header
-			readTmpBuffer(generalCounter3,pLen,tmpData);
-			generalCounter3 = (generalCounter3 + pLen);//add the total length, and substract one so we are pointing at the last byte of the previous packet
-			generalCounter2--;//remove the packet we just got from the queue
+			CANLogRing::serializeRAW(record, 0, tmpData);//the transfer parser below works on the RAW log layout
+			logRing->consume(1);
 			uint32_t ID= ((uint32_t)tmpData[5] << 24) + ((uint32_t)tmpData[6] << 16) + ((uint32_t)tmpData[7] << 8) + ((uint32_t)tmpData[8]);
 			if(ID == targetID)//if it is the taget ID
 			{
@@ -13368,6 +13132,279 @@ void CANbadger::readTmpBuffer(uint32_t startAdr, uint32_t len, uint8_t* data)
 	}
 }
 
+void CANbadger::fillLogHeader(CANLogV2Header &header)
+{
+	memset(&header, 0, sizeof(header));
+	header.timebase = CAN_LOG_V2_TIMEBASE;
+	header.speed[0] = canbadger_settings->getSpeed(1);
+	header.speed[1] = canbadger_settings->getSpeed(2);
+	header.busFlags[0] = getCANBadgerStatus(CAN1_LOGGING) ? CAN_LOG_V2_BUS_LOGGED : 0;
+	header.busFlags[1] = getCANBadgerStatus(CAN2_LOGGING) ? CAN_LOG_V2_BUS_LOGGED : 0;
+	if(getCANBadgerStatus(CAN1_STANDARD) == false)
+	{
+		header.busFlags[0] |= CAN_LOG_V2_BUS_EXTENDED;
+	}
+	if(getCANBadgerStatus(CAN2_STANDARD) == false)
+	{
+		header.busFlags[1] |= CAN_LOG_V2_BUS_EXTENDED;
+	}
+	memcpy(header.fwVersion, fwVersion, sizeof(fwVersion));
+}
+
+bool CANbadger::startBlackBox(CANBlackBox *box)
+{
+	if(isSDInserted == 0 || blackBoxRestore != 0)
+	{
+		return false;
+	}
+	uint8_t restore = 0x80;//set while a box is running
+	if(!getCANBadgerStatus(CAN1_LOGGING))//the box wants the traffic of both buses
+	{
+		setCANBadgerStatus(CAN1_LOGGING,1);
+		restore |= 1;
+	}
+	if(!getCANBadgerStatus(CAN2_LOGGING))
+	{
+		setCANBadgerStatus(CAN2_LOGGING,1);
+		restore |= 2;
+	}
+	if(!getCANBadgerStatus(CAN_BRIDGE_ENABLED))
+	{
+		if(!CANBridge(1))
+		{
+			blackBoxRestore = restore;
+			stopBlackBox(box);
+			return false;
+		}
+		restore |= 4;
+	}
+	checkSPISpeed(1);
+	CANLogV2Header header;
+	fillLogHeader(header);
+	blackBoxRestore = restore;
+	return box->arm(header);
+}
+
+void CANbadger::stopBlackBox(CANBlackBox *box)
+{
+	box->disarm();
+	if(blackBoxRestore & 4)//bridge was not enabled before, we disable it
+	{
+		CANBridge(0);
+	}
+	if(blackBoxRestore & 1)
+	{
+		setCANBadgerStatus(CAN1_LOGGING,0);
+	}
+	if(blackBoxRestore & 2)
+	{
+		setCANBadgerStatus(CAN2_LOGGING,0);
+	}
+	blackBoxRestore = 0;
+}
+
+void CANbadger::blackBoxMode()
+{
+	oled.clearScreen();
+	if(isSDInserted == 0)
+	{
+		oled.displayMessage("SD Not detected");
+		buttons.getButtonPressed();
+		return;
+	}
+	CANBlackBox box(&ram, &sd);
+	if(!startBlackBox(&box))
+	{
+		oled.displayMessage("Bridge error");
+		buttons.getButtonPressed();
+		return;
+	}
+	oled.displayMessage("Black box armed");
+	oled.displayMessage(" ",1);
+	oled.displayMessage(" Press start key",1);
+	oled.displayMessage("   to trigger   ",1);
+	oled.displayMessage(" Press back key ",1);
+	oled.displayMessage("     to stop    ",1);
+	while(buttons.isButtonPressed(4) == false)//run until the back button is pressed
+	{
+		if(buttons.isButtonPressed(1))
+		{
+			box.trigger(CAN_BLACKBOX_TRIGGER_BUTTON);
+		}
+		if(box.run() != CAN_BLACKBOX_TRIGGER_NONE)
+		{
+			oled.clearScreen();
+			oled.displayMessage("Capture saved in:");
+			oled.displayMessage(box.getFileName(),1);
+			oled.displayMessage(" ",1);
+			oled.displayMessage("Black box armed",1);
+			oled.displayMessage(" Press back key ",1);
+			oled.displayMessage("     to stop    ",1);
+		}
+	}
+	stopBlackBox(&box);
+	oled.clearScreen();
+	oled.displayMessage("Captures saved:");
+	char tmp[12];
+	sprintf(tmp, "%u", (unsigned int)box.getCaptureCount());
+	oled.displayMessage(tmp,1);
+	buttons.getButtonPressed();
+}
+
+bool CANbadger::startBridgeLatency()
+{
+	if(latencyRestore != 0)
+	{
+		return false;
+	}
+	uint8_t restore = 0x80;//set while a measurement is running
+	if(!getCANBadgerStatus(CAN1_TO_CAN2_BRIDGE))
+	{
+		setCANBadgerStatus(CAN1_TO_CAN2_BRIDGE,1);
+		restore |= 1;
+	}
+	if(!getCANBadgerStatus(CAN_BRIDGE_ENABLED))
+	{
+		if(!CANBridge(1))
+		{
+			latencyRestore = restore;
+			stopBridgeLatency();
+			return false;
+		}
+		restore |= 4;
+	}
+	latencyRestore = restore;
+	CANTxQueue::getQueue(&can2)->measureLatency(true);
+	CANTxQueue::getQueue(&can1)->measureLatency(true);
+	return true;
+}
+
+void CANbadger::stopBridgeLatency()
+{
+	CANTxQueue::getQueue(&can2)->measureLatency(false);
+	CANTxQueue::getQueue(&can1)->measureLatency(false);
+	if(latencyRestore & 4)//bridge was not enabled before, we disable it
+	{
+		CANBridge(0);
+	}
+	if(latencyRestore & 1)
+	{
+		setCANBadgerStatus(CAN1_TO_CAN2_BRIDGE,0);
+	}
+	latencyRestore = 0;
+}
+
+void CANbadger::bridgeLatencyMode()
+{
+	oled.clearScreen();
+	if(!startBridgeLatency())
+	{
+		oled.displayMessage("Bridge error");
+		buttons.getButtonPressed();
+		return;
+	}
+	LatencyHistogram *toCAN2 = CANTxQueue::getQueue(&can2)->getLatency();
+	LatencyHistogram *toCAN1 = CANTxQueue::getQueue(&can1)->getLatency();
+	char tmp[22];
+	uint32_t lastUpdate = (Timebase::nowMs() - 1000);
+	while(buttons.isButtonPressed(4) == false)//run until the back button is pressed
+	{
+		if((Timebase::nowMs() - lastUpdate) < 500)
+		{
+			continue;
+		}
+		lastUpdate = Timebase::nowMs();
+		oled.clearScreen();
+		oled.displayMessage(" Bridge latency ");
+		sprintf(tmp, "C1>C2 N:%u", (unsigned int)toCAN2->getCount());
+		oled.displayMessage(tmp,1);
+		sprintf(tmp, "Min:%u Avg:%u", (unsigned int)toCAN2->getMin(), (unsigned int)toCAN2->getMean());
+		oled.displayMessage(tmp,1);
+		sprintf(tmp, "Max:%u P99:%u", (unsigned int)toCAN2->getMax(), (unsigned int)toCAN2->getPercentile(99));
+		oled.displayMessage(tmp,1);
+		if(toCAN1->getCount() > 0)
+		{
+			sprintf(tmp, "C2>C1 N:%u", (unsigned int)toCAN1->getCount());
+			oled.displayMessage(tmp,1);
+			sprintf(tmp, "Avg:%u Max:%u", (unsigned int)toCAN1->getMean(), (unsigned int)toCAN1->getMax());
+			oled.displayMessage(tmp,1);
+		}
+		oled.displayMessage("  All in us",1);
+	}
+	stopBridgeLatency();
+}
+
+void CANbadger::writeLogData(const uint8_t *data, uint32_t len, CANLogCompressor *compressor)
+{
+	if(compressor == NULL)
+	{
+		sd.write((char*)data, len);
+		return;
+	}
+	while(len > 0)
+	{
+		uint32_t taken = compressor->append(data, len);
+		data += taken;
+		len -= taken;
+		if(compressor->isFull())
+		{
+			flushLogData(compressor);
+		}
+	}
+}
+
+void CANbadger::flushLogData(CANLogCompressor *compressor)
+{
+	if(compressor == NULL)
+	{
+		return;
+	}
+	const uint8_t *block;
+	uint32_t blockLen = compressor->flush(block);
+	if(blockLen > 0)
+	{
+		sd.write((char*)block, blockLen);
+	}
+}
+
+uint32_t CANbadger::writeLogRingToSD(CANLogV2Encoder *encoder, CANLogCompressor *compressor)
+{
+	CANLogRing *logRing = CANLogRing::getRing();
+	uint8_t out[((32 * CAN_LOG_V2_MAX_RECORD_SIZE) + CAN_LOG_V2_INDEX_SIZE + 6)];//room for a full v2 batch with an index block and a drop marker, more than a v1 batch needs
+	uint32_t written = 0;
+	CANLogRecord *records;
+	uint32_t count = logRing->peek(records);
+	while(count > 0)
+	{
+		if(count > 32)
+		{
+			count = 32;
+		}
+		uint32_t outLen = 0;
+		if(encoder != NULL)
+		{
+			outLen += encoder->encodeDrops(logRing->getDropCount(), out);
+		}
+		for(uint32_t a = 0; a < count; a++)
+		{
+			if(encoder != NULL)
+			{
+				bool extended = ((records[a].flags & 0x20) != 0);
+				outLen += encoder->encode(records[a].bus, extended, records[a].id, records[a].data, records[a].len, (uint32_t)records[a].time, &out[outLen], records[a].skipped);
+			}
+			else
+			{
+				outLen += CANLogRing::serializeRAW(&records[a], canbadger_settings->getSpeed(records[a].bus), &out[outLen]);
+			}
+		}
+		logRing->consume(count);
+		writeLogData(out, outLen, compressor);
+		written += count;
+		count = logRing->peek(records);
+	}
+	return written;
+}
+
 
 void CANbadger::enableCANBridge(uint8_t interface)
 {
@@ -13411,6 +13448,8 @@ bool CANbadger::CANBridge(bool enable)
 		{
 			ram.clearRAM();
 		}
+		CANTxQueue::getQueue(&can1)->start();//the RX interrupt pushes, and a queue cannot be started from there
+		CANTxQueue::getQueue(&can2)->start();
 		can1.attach(this,&CANbadger::doCANBridge, CAN::RxIrq);
 		can2.attach(this,&CANbadger::doCANBridge, CAN::RxIrq);
 		return true;
@@ -13554,6 +13593,10 @@ FileHandler* CANbadger::getFileHandler() {
 	return &sd;
 }
 
+Ser23LC1024* CANbadger::getRAM() {
+	return &ram;
+}
+
 Timer* CANbadger::getTimer() {
 	return &timer;
 }
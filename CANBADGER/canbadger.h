@@ -70,6 +70,9 @@
 #include "PID.h"
 #include "kwp2k_can.h"
 #include "kwp2k_tp20.h"
+#include "can_log_v2.h"
+#include "can_log_lz.h"
+#include "can_blackbox.h"
 
 
 
@@ -160,6 +163,8 @@
 #define CAN2_USE_FULLFRAME 27
 #define CAN1_MONITOR 28
 #define CAN2_MONITOR 29
+#define LOG_COMPRESSION 30
+#define LOG_CHANGES_ONLY 31
 
 #define EEPROM_CS_OFFS 160
 
@@ -168,6 +173,7 @@
 static const char fwVersion[9]={'F','W',' ','V','1','.','0','A',0};//fw version string
 
 class CanbadgerSettings;
+class CANTxQueue;
 class EthernetManager;
 class CAN_MITM;
 
@@ -252,6 +258,8 @@ class CANbadger
 						CAN2_USE_FULLFRAME
 						CAN1_MONITOR
 						CAN2_MONITOR
+						LOG_COMPRESSION
+						LOG_CHANGES_ONLY
 
 					@return TRUE if the requested status is set, FALSE if it is not set
 
@@ -363,6 +371,21 @@ class CANbadger
 
 				*/
 				void readTmpBuffer(uint32_t startAdr, uint32_t len, uint8_t* data);
+
+		        /** Writes the frames pending in the log ring to the open file, one SD write per batch
+					@param encoder writes v2 records through it if set, v1 RAW records otherwise
+					@param compressor packs the records into compressed blocks if set, see writeLogData
+					@return the number of frames written
+				*/
+				uint32_t writeLogRingToSD(CANLogV2Encoder *encoder = NULL, CANLogCompressor *compressor = NULL);
+
+		        /** Writes to the open log file. With a compressor the data is collected and only full blocks are written
+				*/
+				void writeLogData(const uint8_t *data, uint32_t len, CANLogCompressor *compressor = NULL);
+
+		        /** Writes out whatever the compressor still holds as a last, shorter block
+				*/
+				void flushLogData(CANLogCompressor *compressor);
 				
 		        /** Sends a CAN frame on the specified bus. Used by the command handler
 		            @param frameFormat determines if the frame is a Standard (CANStandard) or an extended (CANExtended) frame
@@ -411,6 +434,31 @@ class CANbadger
 				
 				bool startLog();//uint8_t interfaces);
 
+		        /** Fills the header of a v2 RAW log with the current bus settings
+				*/
+				void fillLogHeader(CANLogV2Header &header);
+
+		        /** Enables logging on both buses and the bridge if needed, and arms the box
+					@return false if there is no SD, the bridge could not be started or a box is already running
+				*/
+				bool startBlackBox(CANBlackBox *box);
+
+		        /** Disarms the box and puts logging and the bridge back the way they were before startBlackBox
+				*/
+				void stopBlackBox(CANBlackBox *box);
+
+				void blackBoxMode();//black box from the logging menu, triggered with the start key
+
+		        /** Starts timing the frames the bridge forwards, from the RX interrupt to the end of their TX batch.
+					Enables the CAN1 to CAN2 bridge if needed. CAN2 to CAN1 is timed as well if it is bridged
+					@return false if the bridge could not be started or a measurement is already running
+				*/
+				bool startBridgeLatency();
+
+				void stopBridgeLatency();//stops timing and puts the bridge back the way it was before startBridgeLatency
+
+				void bridgeLatencyMode();//live forwarding delay figures from the logging menu
+
 		        /** Sets the padding byte for CAN transmissions if using full frame.
 					@param interfaceNo is the interface to set the byte for (1 or 2)
 		            @param pByte is the value of the padding byte
@@ -593,6 +641,8 @@ class CANbadger
 
 				FileHandler* getFileHandler();
 
+				Ser23LC1024* getRAM();
+
 				Timer* getTimer();
 
 				CAN* getCANClient(uint8_t interface);
@@ -642,6 +692,7 @@ class CANbadger
 				EthernetManager *ethernet_manager;
 		private:
 				void doCANBridge(void);
+				void bridgeFrames(CAN &from, uint8_t bus, const CANBridgeRoute &route, CANTxQueue *queue);//logs and forwards all frames pending on from
 				void checkSPISpeed(uint8_t memType);
 				void doOLEDTP20(CAN *canbus, uint8_t interfaceNo, bool isInSession = false, uint8_t tpCounter = 0);
 				void doOLEDUDS(CAN *canbus, uint8_t interfaceno, bool isInSession=false);
@@ -651,6 +702,8 @@ class CANbadger
 				CanbadgerSettings *canbadger_settings;
 				UDSCANHandler *uds_handler = NULL;
 				CAN_MITM *persistent_mitm = NULL;
+				uint8_t blackBoxRestore = 0;//what stopBlackBox has to undo, 0 if no box is running
+				uint8_t latencyRestore = 0;//what stopBridgeLatency has to undo, 0 if no measurement is running
 };
 
 #endif
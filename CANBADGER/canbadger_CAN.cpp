@@ -22,21 +22,125 @@
 */
 
 #include "canbadger_CAN.h"
+#include "us_ticker_api.h"
+#include "timebase.h"
 
+//mbed keeps the controller handle protected, this exposes it without touching the library
+class CANControllerAccess : public CAN
+{
+	public:
+		static LPC_CAN_TypeDef* getController(CAN *canbus)
+		{
+			return (LPC_CAN_TypeDef*)(canbus->*(&CANControllerAccess::_can)).dev;
+		}
+};
 
 
 CANbadger_CAN::CANbadger_CAN(CAN *canbus)
 {
 	_canbus=canbus;
+	_rxRing = CANRxRing::getRing(canbus);
+	_txQueue = CANTxQueue::getQueue(canbus);
+	_ownsRxRing = false;
+	_busErrors = 0;
 }
 
 CANbadger_CAN::~CANbadger_CAN()
 {
+	if(_ownsRxRing == true)
+	{
+		stopRxRing();
+	}
+}
+
+LPC_CAN_TypeDef* CANbadger_CAN::getController(CAN *canbus)
+{
+	LPC_CAN_TypeDef* controller = CANControllerAccess::getController(canbus);
+	if(controller != LPC_CAN1 && controller != LPC_CAN2)
+	{
+		return NULL;
+	}
+	return controller;
+}
+
+bool CANbadger_CAN::startRxRing()
+{
+	if(_rxRing == NULL)
+	{
+		return false;
+	}
+	if(_rxRing->isRunning() == true)//someone else is already feeding it
+	{
+		return true;
+	}
+	_ownsRxRing = _rxRing->start();
+	return _ownsRxRing;
+}
+
+void CANbadger_CAN::stopRxRing()
+{
+	if(_rxRing != NULL)
+	{
+		_rxRing->stop();
+	}
+	_ownsRxRing = false;
+}
+
+CANRxRing* CANbadger_CAN::getRxRing()
+{
+	return _rxRing;
+}
+
+bool CANbadger_CAN::readFrame(CANRxFrame &frame)
+{
+	if(_rxRing != NULL && _rxRing->isRunning() == true)
+	{
+		return _rxRing->pop(frame);
+	}
+	CANMessage can_msg(0,CANAny);
+	if(_canbus->read(can_msg) == 0)
+	{
+		return false;
+	}
+	frame.timestamp = Timebase::now();
+	frame.id = can_msg.id;
+	frame.len = can_msg.len;
+	frame.format = can_msg.format;
+	frame.type = can_msg.type;
+	for(uint8_t a = 0; a < 8; a++)
+	{
+		frame.data[a] = can_msg.data[a];
+	}
+	return true;
+}
+
+bool CANbadger_CAN::waitFrame(CANRxFrame &frame, uint32_t timeout)
+{
+	if(_rxRing != NULL && _rxRing->isRunning() == true)
+	{
+		return _rxRing->waitFrame(frame, timeout);
+	}
+	uint32_t currentMS=0;
+	while(readFrame(frame) == false)
+	{
+		if(timeout != 0 && currentMS >= (timeout * 10))
+		{
+			return false;
+		}
+		wait(0.0001);
+		currentMS++;
+	}
+	return true;
 }
 
 
 bool CANbadger_CAN::available(uint8_t interfaceNo)
 {
+	CANRxRing* ring = CANRxRing::getRing(interfaceNo);
+	if(ring != NULL && ring->isRunning() == true)//the ISR empties the controller, so look at the ring instead
+	{
+		return (ring->pending() > 0);
+	}
 	if(interfaceNo == 1)
 	{
 		if((LPC_CAN1->GSR & 1) == 0)
@@ -57,39 +161,92 @@ bool CANbadger_CAN::available(uint8_t interfaceNo)
 
 bool CANbadger_CAN::sendCANFrame(uint32_t msgID, uint8_t *payload, uint8_t len, CANFormat frameFormat, CANType frameType, uint32_t timeout)
 {
-	uint32_t currentMS=0;
-	while(((LPC_CAN1->GSR & 4) == 0 || (LPC_CAN2->GSR & 4) == 0) && currentMS < (timeout * 10))//hack to fix a silicon bug.
+	uint32_t token = queueCANFrame(msgID, payload, len, frameFormat, frameType);
+	if(token == 0)
 	{
-		wait(0.0001);
-		currentMS++;
+		return false;
 	}
-	_canbus->write(CANMessage(msgID, reinterpret_cast<char*>(payload), len, frameType, frameFormat));
-	if(timeout != 0)
+	if(timeout == 0)
 	{
-		while(((LPC_CAN1->GSR & 4) == 0 || (LPC_CAN2->GSR & 4) == 0) && currentMS < (timeout * 10))//hack to fix a silicon bug.
-		{
-			wait(0.0001);
-			currentMS++;
-		}
+		return true;
 	}
-	if(currentMS >= (timeout * 10) && timeout != 0)
+	return _txQueue->waitComplete(token, timeout);
+}
+
+uint32_t CANbadger_CAN::queueCANFrame(uint32_t msgID, uint8_t *payload, uint8_t len, CANFormat frameFormat, CANType frameType)
+{
+	if(_txQueue == NULL)
 	{
-		return false;
+		return 0;
 	}
-	return true;	
+	return _txQueue->push(msgID, payload, len, frameFormat, frameType);
+}
+
+CANTxQueue* CANbadger_CAN::getTxQueue()
+{
+	return _txQueue;
 }
 
 bool CANbadger_CAN::setCANSpeed(uint32_t speed)
 {
 	if(!_canbus->frequency(speed))
 	{
-		return 0;
+		uint32_t btr = computeBTR(speed);//mbed only takes rates it can hit exactly, detectSpeed may have found one it cannot
+		if(btr == 0)
+		{
+			return 0;
+		}
+		writeBTR(btr);
 	}
 	return 1;
 }
 
+uint8_t CANbadger_CAN::getRingFrame(uint32_t msgID, uint8_t *payload, uint32_t timeout)
+{
+	CANRxFrame frame;
+	uint32_t startTime = us_ticker_read();
+	while(1)
+	{
+		bool gotFrame;
+		if(msgID == 0 && timeout == 0)//single attempt, same as the polled version
+		{
+			gotFrame = _rxRing->pop(frame);
+		}
+		else
+		{
+			uint32_t remaining = 0;//waits forever when looking for an ID without timeout
+			if(timeout != 0)
+			{
+				uint32_t elapsed = ((us_ticker_read() - startTime) / 1000);
+				if(elapsed >= timeout)
+				{
+					return 0;
+				}
+				remaining = (timeout - elapsed);
+			}
+			gotFrame = _rxRing->waitFrame(frame, remaining);
+		}
+		if(gotFrame == false)
+		{
+			return 0;
+		}
+		if(msgID == 0 || frame.id == msgID)
+		{
+			for(uint8_t a = 0; a < frame.len; a++)
+			{
+				payload[a]=frame.data[a];
+			}
+			return frame.len;
+		}
+	}
+}
+
 uint8_t CANbadger_CAN::getCANFrame(uint32_t msgID, uint8_t *payload, uint32_t timeout )
 {
+	if(_rxRing != NULL && _rxRing->isRunning() == true)
+	{
+		return getRingFrame(msgID, payload, timeout);
+	}
 	CANMessage can_msg(0,CANAny);
 	uint32_t currentMS=0; // used to measure against timeout
 	bool gotFrame = false;
@@ -163,100 +320,288 @@ uint8_t CANbadger_CAN::getCANFrame(uint32_t msgID, uint8_t *payload, uint32_t ti
 	return can_msg.len;
 }
 
-uint32_t CANbadger_CAN::detectSpeed()
+uint32_t CANbadger_CAN::getCANClock()
 {
-    uint32_t cnt=0;//for timeout
-    for(uint8_t a=0; a<13; a++)
-    {
-      uint32_t speed;
-      switch (a)
-      {
-		 case 0:
-		 {
-			 speed=20000;
-			 break;
-		 }
-		 case 1:
-		 {
-			 speed=33333;
-			 break;
-		 }
-		 case 2:
-		 {
-			 speed=40000;
-			 break;
-		 }
-		 case 3:
-		 {
-			 speed=50000;
-			 break;
-		 }
-		 case 4:
-		 {
-			 speed=62500;
-			 break;
-		 }
-		 case 5:
-		 {
-			 speed=83333;
-			 break;
-		 }
-		 case 6:
-		 {
-			 speed=100000;
-			 break;
-		 }
-		 case 7:
-		 {
-			 speed=125000;
-			 break;
-		 }
-		 case 8:
-		 {
-			 speed=250000;
-			 break;
-		 }
-		 case 9:
-		 {
-			 speed=500000;
-			 break;
-		 }
-		 case 10:
-		 {
-			 speed=750000;
-			 break;
-		 }
-		 case 11:
-		 {
-			 speed=800000;
-			 break;
-		 }
-		 case 12:
-		 {
-			 speed=1000000;
-			break;
-		 }
-      }
-      CANMessage can_msg(0,CANAny);
-      _canbus->frequency(speed);
-      while(_canbus->read(can_msg)){}//just to clear the buffer
-	  while(!_canbus->read(can_msg) || can_msg.id == 0)
-	  {
-		wait(0.01);
-		cnt++;
-		if(cnt == 101)
+	LPC_CAN_TypeDef* controller = getController(_canbus);
+	uint32_t sel = (controller == LPC_CAN2) ? ((LPC_SC->PCLKSEL0 >> 28) & 3) : ((LPC_SC->PCLKSEL0 >> 26) & 3);
+	switch(sel)
+	{
+		case 1:
 		{
-			break;
+			return SystemCoreClock;
 		}
-	  }
-      if(cnt<101)
-      {
-		return speed;
-      }
-      cnt=0;//reset the delay counter
-  }
-  _canbus->frequency(500000);
-  return 0;
+		case 2:
+		{
+			return (SystemCoreClock / 2);
+		}
+		case 3:
+		{
+			return (SystemCoreClock / 6);//CAN peripherals use /6 instead of /8
+		}
+	}
+	return (SystemCoreClock / 4);
+}
+
+uint32_t CANbadger_CAN::computeBTR(uint32_t speed)
+{
+	if(speed == 0)
+	{
+		return 0;
+	}
+	uint32_t pclk = getCANClock();
+	uint32_t bestErr = 0xFFFFFFFF;
+	uint32_t bestBrp = 0;
+	uint32_t bestTq = 0;
+	for(uint32_t tq = 20; tq >= 8; tq--)//more quanta per bit first, it gives finer resync steps
+	{
+		uint32_t brp = ((pclk + ((speed * tq) / 2)) / (speed * tq));
+		if(brp == 0 || brp > 1024)
+		{
+			continue;
+		}
+		uint32_t actual = (pclk / (brp * tq));
+		uint32_t err = (actual > speed) ? (actual - speed) : (speed - actual);
+		if(err < bestErr)
+		{
+			bestErr = err;
+			bestBrp = brp;
+			bestTq = tq;
+		}
+	}
+	if(bestBrp == 0 || (bestErr * 1000) > (speed * 5))//more than 0.5% off is not worth trying
+	{
+		return 0;
+	}
+	uint32_t tseg2 = (((bestTq * 2) + 5) / 10);//sample at about 80%
+	if(tseg2 < 2)
+	{
+		tseg2 = 2;
+	}
+	uint32_t tseg1 = (bestTq - 1 - tseg2);
+	uint32_t sjw = (tseg2 < 4) ? tseg2 : 4;
+	return ((bestBrp - 1) | ((sjw - 1) << 14) | ((tseg1 - 1) << 16) | ((tseg2 - 1) << 20));
+}
+
+void CANbadger_CAN::writeBTR(uint32_t btr)
+{
+	LPC_CAN_TypeDef* controller = getController(_canbus);
+	controller->MOD |= 1;//BTR can only be written in reset mode
+	controller->BTR = btr;
+	controller->MOD &= ~1;
+}
+
+uint32_t CANbadger_CAN::getCANSpeed()
+{
+	uint32_t btr = getController(_canbus)->BTR;
+	uint32_t brp = ((btr & 0x3FF) + 1);
+	uint32_t tq = (3 + ((btr >> 16) & 0xF) + ((btr >> 20) & 7));
+	return (getCANClock() / (brp * tq));
+}
+
+uint16_t CANbadger_CAN::getSamplePoint()
+{
+	uint32_t btr = getController(_canbus)->BTR;
+	uint32_t tseg1 = (((btr >> 16) & 0xF) + 1);
+	uint32_t tseg2 = (((btr >> 20) & 7) + 1);
+	return (uint16_t)(((1 + tseg1) * 1000) / (1 + tseg1 + tseg2));
+}
+
+void CANbadger_CAN::busErrorISR()
+{
+	_busErrors++;
+}
+
+uint8_t CANbadger_CAN::probeBTR(uint32_t btr, uint32_t window)
+{
+	CANMessage can_msg;
+	writeBTR(btr);//leaving reset mode the controller waits for bus idle, so we never start in the middle of a frame
+	while(_canbus->read(can_msg)){}//just to clear the buffer
+	_busErrors = 0;
+	uint8_t frames = 0;
+	uint32_t startTime = us_ticker_read();
+	while((us_ticker_read() - startTime) < (window * 1000))
+	{
+		if(_busErrors != 0)
+		{
+			return AUTOBAUD_ERROR;
+		}
+		if(_canbus->read(can_msg) != 0)
+		{
+			frames++;
+			if(frames >= AUTOBAUD_CONFIRM_FRAMES)
+			{
+				return AUTOBAUD_FRAME;
+			}
+		}
+	}
+	if(_busErrors != 0)
+	{
+		return AUTOBAUD_ERROR;
+	}
+	return AUTOBAUD_SILENT;//too few frames to tell, the slow pass listens longer
+}
+
+uint32_t CANbadger_CAN::measureBitTime(uint32_t window)
+{
+	//the GPIO pin register reads the pin whatever function it is set to, so the RX line can be watched while the controller owns it
+	uint32_t pinMask = (getController(_canbus) == LPC_CAN2) ? (1UL << 4) : (1UL << 0);//RD2 is P0.4, RD1 is P0.0
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	uint32_t sliceCycles = ((SystemCoreClock / 1000) * AUTOBAUD_EDGE_SLICE_MS);
+	uint32_t glitch = (SystemCoreClock / 2000000);//nothing shorter than half a bit at 1Mbit is a real bit
+	uint32_t shortest = 0xFFFFFFFF;
+	uint32_t edges = 0;
+	uint32_t startTime = us_ticker_read();
+	while((us_ticker_read() - startTime) < (window * 1000) && edges < AUTOBAUD_EDGES)
+	{
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();//an interrupt in the middle of a pulse would stretch it
+		uint32_t sliceStart = DWT->CYCCNT;
+		uint32_t level = (LPC_GPIO0->FIOPIN & pinMask);
+		uint32_t lastEdge = 0;
+		bool haveEdge = false;//a pulse that started before this slice has an unknown width
+		while((DWT->CYCCNT - sliceStart) < sliceCycles)
+		{
+			uint32_t now = (LPC_GPIO0->FIOPIN & pinMask);
+			if(now != level)
+			{
+				uint32_t edgeTime = DWT->CYCCNT;
+				if(haveEdge == true)
+				{
+					uint32_t width = (edgeTime - lastEdge);
+					if(width >= glitch && width < shortest)
+					{
+						shortest = width;
+					}
+					edges++;
+				}
+				lastEdge = edgeTime;
+				haveEdge = true;
+				level = now;
+			}
+		}
+		__set_PRIMASK(primask);
+	}
+	if(edges < AUTOBAUD_EDGES || shortest == 0xFFFFFFFF)
+	{
+		return 0;
+	}
+	return shortest;
+}
+
+uint32_t CANbadger_CAN::searchRates(uint32_t low, uint32_t high, uint32_t &foundBTR)
+{
+	//most common first, a live bus is usually found within the first few probes
+	static const uint32_t speeds[13] = {500000, 250000, 125000, 1000000, 100000, 83333, 50000, 33333, 800000, 62500, 40000, 20000, 750000};
+	uint32_t found = 0;
+	bool sawErrors = false;
+	bool silent[13];
+	for(uint8_t a = 0; a < 13 && found == 0; a++)//first pass, wrong rates show bus errors on the first frame
+	{
+		silent[a] = false;
+		if(speeds[a] < low || speeds[a] > high)
+		{
+			continue;
+		}
+		uint32_t btr = computeBTR(speeds[a]);
+		uint8_t r = probeBTR(btr, AUTOBAUD_PROBE_MS);
+		silent[a] = (r == AUTOBAUD_SILENT);
+		if(r == AUTOBAUD_FRAME)
+		{
+			found = speeds[a];
+			foundBTR = btr;
+		}
+		else if(r == AUTOBAUD_ERROR)
+		{
+			sawErrors = true;
+		}
+	}
+	for(uint8_t a = 0; a < 13 && found == 0; a++)//second pass for a slow bus, only the rates that saw no errors
+	{
+		if(silent[a] == false)
+		{
+			continue;
+		}
+		uint32_t btr = computeBTR(speeds[a]);
+		uint8_t r = probeBTR(btr, AUTOBAUD_SLOW_PROBE_MS);
+		if(r == AUTOBAUD_FRAME)
+		{
+			found = speeds[a];
+			foundBTR = btr;
+		}
+		else if(r == AUTOBAUD_ERROR)
+		{
+			sawErrors = true;
+		}
+	}
+	if(found == 0 && sawErrors == true)//there is traffic but at no standard rate, sweep the range
+	{
+		uint32_t lastBTR = 0;
+		uint32_t top = (high < 1000000) ? high : 1000000;
+		uint32_t bottom = (low > 10000) ? low : 10000;
+		for(uint32_t speed = top; speed >= bottom && found == 0; speed = ((speed * (100 - AUTOBAUD_SWEEP_STEP)) / 100))
+		{
+			uint32_t btr = computeBTR(speed);
+			if(btr == 0 || btr == lastBTR)//neighbouring steps can round to the same timing
+			{
+				continue;
+			}
+			lastBTR = btr;
+			if(probeBTR(btr, AUTOBAUD_PROBE_MS) == AUTOBAUD_FRAME)
+			{
+				foundBTR = btr;
+				writeBTR(btr);
+				found = getCANSpeed();//report what the timing really gives, not the sweep step
+			}
+		}
+	}
+	return found;
+}
+
+uint32_t CANbadger_CAN::detectSpeed()
+{
+	LPC_CAN_TypeDef* controller = getController(_canbus);
+	if(controller == NULL)
+	{
+		return 0;
+	}
+	bool ringWasRunning = (_rxRing != NULL && _rxRing->isRunning() == true);
+	if(ringWasRunning == true)//the probes need to see the frames themselves
+	{
+		_rxRing->stop();
+	}
+	bool wasSilent = ((controller->MOD & 2) != 0);
+	uint32_t oldBTR = controller->BTR;
+	_canbus->monitor(true);//listen only, a wrong rate must not disturb the bus with error frames
+	_canbus->attach(this, &CANbadger_CAN::busErrorISR, CAN::BeIrq);
+	uint32_t found = 0;
+	uint32_t foundBTR = 0;
+	uint32_t bitCycles = measureBitTime(AUTOBAUD_EDGE_MS);
+	if(bitCycles != 0)//only probe the rates close to the measured one
+	{
+		uint32_t estimate = (SystemCoreClock / bitCycles);
+		found = searchRates(((estimate / 100) * (100 - AUTOBAUD_EDGE_TOLERANCE)), ((estimate / 100) * (100 + AUTOBAUD_EDGE_TOLERANCE)), foundBTR);
+	}
+	if(found == 0)//quiet bus, or the measurement was off
+	{
+		found = searchRates(0, 0xFFFFFFFF, foundBTR);
+	}
+	_canbus->attach(0, CAN::BeIrq);
+	_canbus->monitor(wasSilent);
+	if(found != 0)
+	{
+		writeBTR(foundBTR);
+	}
+	else
+	{
+		writeBTR(oldBTR);
+		_canbus->frequency(500000);
+	}
+	if(ringWasRunning == true)
+	{
+		_rxRing->start();
+	}
+	return found;
 }
 
 
@@ -296,22 +641,13 @@ uint32_t CANbadger_CAN::getIDsList(uint32_t *idList)
 	}
 	currentMS=0;//we did get a frame
 	uint32_t f_counter=0;//value to be returned, how many IDs were found
+	CANIDSet seen;//constant time duplicate check instead of scanning idList for every frame
     while(currentMS < timeout)
     {
     	currentMS=0;//we did get a frame
-    	uint32_t cid=can_msg.id;
-    	uint8_t doit=1;
-    	for(uint32_t cnt2=0;cnt2<f_counter;cnt2++)
+    	if(seen.insert(can_msg.id, (can_msg.format == CANExtended)))
     	{
-    		if(idList[cnt2]==cid)
-    		{
-    			doit=0;
-    			break;
-    		}
-    	}
-    	if(doit==1 || f_counter==0)//need to also save the first ID!
-    	{
-    		idList[f_counter]=cid;
+    		idList[f_counter]=can_msg.id;
     		f_counter++;
     	}
     	while(_canbus->read(can_msg) == 0 && currentMS<timeout)
@@ -333,6 +669,30 @@ void CANbadger_CAN::enableCANFilters()
 	LPC_CANAF->AFMR = 0x00000000;//enable filters
 }
 
+bool CANbadger_CAN::loadFilterTable(CANFilterTable &table)
+{
+	uint32_t afmr = LPC_CANAF->AFMR;
+	LPC_CANAF->AFMR = CANAF_AFMR_AccBP | CANAF_AFMR_AccOff;//disable filter and allow table RAM access
+	CANFilterLayout layout;
+	bool status = table.compile((uint32_t*)LPC_CANAF_RAM->mask, CAN_AF_RAM_WORDS, layout);
+	if(status == true)
+	{
+		LPC_CANAF->SFF_sa = layout.sffStart;
+		LPC_CANAF->SFF_GRP_sa = layout.sffGrpStart;
+		LPC_CANAF->EFF_sa = layout.effStart;
+		LPC_CANAF->EFF_GRP_sa = layout.effGrpStart;
+		LPC_CANAF->ENDofTable = layout.endOfTable;
+	}
+	LPC_CANAF->AFMR = afmr;
+	return status;
+}
+
+void CANbadger_CAN::clearFilterTable()
+{
+	CANFilterTable table(NULL, 0);
+	loadFilterTable(table);
+}
+
 /**
   \fn          int32_t CANx_RemoveFilter (CAN_FILTER_TYPE filter_type, uint32_t id, uint32_t id_range_end, uint8_t x)
   \brief       Remove receive filter for specified id or id range.
@@ -42,6 +42,19 @@ enum  	ARM_CAN_FILTER_OPERATION {
 #define 	ARM_CAN_ID_IDE_Pos   31UL
 #define 	ARM_CAN_ID_IDE_Msk   (1UL << ARM_CAN_ID_IDE_Pos)
 
+#define AUTOBAUD_PROBE_MS 20 //how long a rate is listened to before moving on
+#define AUTOBAUD_SLOW_PROBE_MS 250 //second chance for rates that saw no traffic at all in the first pass
+#define AUTOBAUD_CONFIRM_FRAMES 3 //error free frames needed to accept a rate
+#define AUTOBAUD_SWEEP_STEP 2 //in percent, between the rates tried when sweeping for non standard rates
+#define AUTOBAUD_EDGE_MS 50 //how long the RX pin is watched to measure the bit time
+#define AUTOBAUD_EDGE_SLICE_MS 1 //the pin is polled with interrupts off, in slices this long
+#define AUTOBAUD_EDGES 64 //edges needed before the shortest pulse is taken as one bit
+#define AUTOBAUD_EDGE_TOLERANCE 12 //in percent, rates this close to the measured one are probed first
+
+#define AUTOBAUD_SILENT 0
+#define AUTOBAUD_FRAME 1
+#define AUTOBAUD_ERROR 2
+
 #define CANAF_ENDofTable_ENDofTable_Pos (            2U)
 #define CANAF_ENDofTable_ENDofTable_Msk (0x3FFU  <<  CANAF_ENDofTable_ENDofTable_Pos)
 #define CANAF_ENDofTable_ENDofTable(x)  (((x)    <<  CANAF_ENDofTable_ENDofTable_Pos) & CANAF_ENDofTable_ENDofTable_Msk)
@@ -86,6 +99,10 @@ enum  	ARM_CAN_FILTER_OPERATION {
 
 
 #include "mbed.h"
+#include "can_rx_ring.h"
+#include "can_tx_queue.h"
+#include "can_filter_table.h"
+#include "can_census.h"
 
 class CANbadger_CAN
 {
@@ -96,15 +113,26 @@ class CANbadger_CAN
 				~CANbadger_CAN();
 	
 
-        /** Sends a CAN frame on the specified bus.
+        /** Sends a CAN frame on the specified bus. The frame goes through the TX queue of the controller, so it never waits on the other bus.
             @param frameFormat determines if the frame is a Standard (CANStandard) or an extended (CANExtended) frame
 						@param frameType determines if the frame is a Data frame (CANData) or a Remote frame (CANRemote) frame
+						@param timeout in ms to wait for the frame to go out. 0 only queues it
 						
 						@return TRUE if the frame was sent within the required timeout, FALSE if it wasnt.
 						
 				*/
 				bool sendCANFrame(uint32_t msgID, uint8_t *payload, uint8_t len, CANFormat frameFormat = CANStandard, CANType frameType = CANData, uint32_t timeout = 10);
 
+				/** Queues a CAN frame for transmission and returns immediately. Frames leave in arbitration order (lowest ID first).
+
+						@return a completion token to be used with getTxQueue()->isComplete() or waitComplete(), 0 if the queue was full
+				*/
+				uint32_t queueCANFrame(uint32_t msgID, uint8_t *payload, uint8_t len, CANFormat frameFormat = CANStandard, CANType frameType = CANData);
+
+				/** @return the TX queue of this controller, to query depth and drop counters. NULL if the controller could not be identified
+				*/
+				CANTxQueue* getTxQueue();
+
 				/** Retrieves a CAN frame on the specified bus.
 						@param msgID is used to tell the function to look for a specific CAN ID or to any (when value is set to zero), and in the return of the function contains the CAN ID of the captured frame. This parameter must be passed as the variable address (preceded by &)
 						@param frameFormat determines if the frame is a Standard (CANStandard) or an extended (CANExtended) frame
@@ -115,6 +143,37 @@ class CANbadger_CAN
 				*/
 				uint8_t getCANFrame(uint32_t msgID, uint8_t *payload, uint32_t timeout = 10);
 
+				/** Starts buffering received frames for this controller in its RX ring. While the ring is running, getCANFrame, readFrame
+						and waitFrame are served from it instead of polling the controller, so frames are no longer lost between reads.
+						The ring owns the RX interrupt of the controller while it runs, and is stopped when this object is destroyed.
+
+						@return true if the ring is running
+				*/
+				bool startRxRing();
+
+				void stopRxRing();
+
+				/** @return the RX ring of this controller, to query overrun counters. NULL if the controller could not be identified
+				*/
+				CANRxRing* getRxRing();
+
+				/** Retrieves the oldest received frame without blocking.
+
+						@return true if a frame was retrieved
+				*/
+				bool readFrame(CANRxFrame &frame);
+
+				/** Retrieves the oldest received frame, waiting up to timeout ms for one to arrive (0 waits forever).
+						Without a running RX ring this falls back to polling the controller.
+
+						@return true if a frame was retrieved
+				*/
+				bool waitFrame(CANRxFrame &frame, uint32_t timeout = 10);
+
+				/** @return the controller registers behind canbus, NULL if it is neither CAN1 nor CAN2
+				*/
+				static LPC_CAN_TypeDef* getController(CAN *canbus);
+
 
 				/**
 					\fn          int32_t CANx_AddFilter (CAN_FILTER_TYPE filter_type, uint32_t id, uint32_t id_range_end, uint8_t x)
@@ -164,6 +223,15 @@ class CANbadger_CAN
 
 				bool CANx_ObjectSetFilter (ARM_CAN_FILTER_OPERATION operation, uint32_t id, uint32_t arg, uint8_t y);
 
+				/** Replaces the whole acceptance filter table with the compiled contents of table, in a single pass.
+						Much faster than adding the entries one by one through CANx_ObjectSetFilter. The filter mode is left as it was
+
+						@return false if the table does not fit in the acceptance filter RAM, in which case the current table is kept
+				*/
+				bool loadFilterTable(CANFilterTable &table);
+
+				void clearFilterTable();//removes every entry from the acceptance filter table
+
 		        /** Used to disable the CAN filters. This will make the CAN PHY accept incoming frames from all IDs
 
 				*/
@@ -195,19 +263,48 @@ class CANbadger_CAN
 				
 				
 
-				/** Tries to detect the speed
+				/** Tries to detect the speed. Measures the bit time on the RX pin first, so only the rates close to it
+						are probed. Probes run in listen only mode, reject a wrong rate on the first bus error and need
+						AUTOBAUD_CONFIRM_FRAMES clean frames. Non standard rates are swept if none of the usual ones match.
+						With traffic on the bus this takes a few ms plus a couple of probes. On a quiet bus, where too
+						few edges are seen, it falls back to probing every rate and can take seconds.
+						The controller is left at the detected bit timing
 
 						@return 0 if it was not found, otherwise it will return the detected baudrate
 				 */
 				uint32_t detectSpeed();
 
+				uint32_t getCANSpeed();//bit rate the controller is currently set to, computed from BTR
+
+				uint16_t getSamplePoint();//sample point of the current bit timing, in 1/1000 of the bit time
+
 
 				uint32_t getIDsList(uint32_t *idList);//generates a list of active CAN IDs so they can be filtered. returns the number of IDs it got
 
 
 				private:
-						
-				CAN* _canbus;	
+
+				uint8_t getRingFrame(uint32_t msgID, uint8_t *payload, uint32_t timeout);
+
+				uint32_t getCANClock();
+
+				uint32_t computeBTR(uint32_t speed);//returns 0 if the rate cannot be reached within 0.5%
+
+				void writeBTR(uint32_t btr);
+
+				uint8_t probeBTR(uint32_t btr, uint32_t window);//listens for window ms, returns AUTOBAUD_FRAME, AUTOBAUD_ERROR or AUTOBAUD_SILENT
+
+				uint32_t measureBitTime(uint32_t window);//shortest pulse on the RX pin in core cycles, 0 if too few edges were seen
+
+				uint32_t searchRates(uint32_t low, uint32_t high, uint32_t &foundBTR);//probes the rates between low and high, returns the one found or 0
+
+				void busErrorISR();
+
+				CAN* _canbus;
+				CANRxRing* _rxRing;
+				CANTxQueue* _txQueue;
+				bool _ownsRxRing;//true if this object started the ring and has to stop it
+				volatile uint32_t _busErrors;//bus errors seen by the current speed probe
 				
 				
 };
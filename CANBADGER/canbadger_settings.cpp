@@ -39,6 +39,8 @@ CanbadgerSettings::CanbadgerSettings(CANbadger *cb) {
 	this->isConnected = false;
 	this->cb = cb;
 	this->canbadgerStatus = 0;
+	this->runtimeGeneration = 0;
+	memset(this->runtimeConfigs, 0, sizeof(this->runtimeConfigs));
 	this->useDHCP = true;
 	// use eep id for unique default id
 	cb->readEEPROMUID((uint8_t*) id);
@@ -59,6 +61,7 @@ CanbadgerSettings::CanbadgerSettings(CANbadger *cb) {
 	if(this->cb->isSDInserted) {
 		this->setStatus(SD_ENABLED, 1);
 	}
+	this->publishRuntimeConfig();
 }
 
 
@@ -92,12 +95,13 @@ void CanbadgerSettings::persist() {
 
 	uint32_t offset = 0;
 
-	const char *statusSettings[30] = { "SD_ENABLED", "USB_SERIAL_ENABLED", "ETHERNET_ENABLED", "OLED_ENABLED", "KEYBOARD_ENABLED",
+	const char *statusSettings[32] = { "SD_ENABLED", "USB_SERIAL_ENABLED", "ETHERNET_ENABLED", "OLED_ENABLED", "KEYBOARD_ENABLED",
 					"LEDS_ENABLED", "KLINE1_INT_ENABLED",  "KLINE2_INT_ENABLED",  "CAN1_INT_ENABLED",  "CAN2_INT_ENABLED",
 					"KLINE_BRIDE_ENABLED", "CAN_BRIDGE_ENABLED", "CAN1_LOGGING", "CAN2_LOGGING",  "KLINE1_LOGGING",
 					"KLINE2_LOGGING", "CAN1_STANDARD", "CAN1_EXTENDED", "CAN2_STANDARD", "CAN2_EXTENDED",
 					"CAN1_TO_CAN2_BRIDGE", "CAN2_TO_CAN1_BRIDGE", "KLINE1_TO_KLINE2_BRIDGE", "KLINE2_TO_KLINE1_BRIDGE", "UDS_CAN1_ENABLED",
-					"UDS_CAN2_ENABLED", "CAN1_USE_FULLFRAME", "CAN2_USE_FULLFRAME", "CAN1_MONITOR", "CAN2_MONITOR"
+					"UDS_CAN2_ENABLED", "CAN1_USE_FULLFRAME", "CAN2_USE_FULLFRAME", "CAN1_MONITOR", "CAN2_MONITOR",
+					"LOG_COMPRESSION", "LOG_CHANGES_ONLY"
 			};
 
 	// write settings in key: value form into the canbadgers tmpBuffer
@@ -108,7 +112,7 @@ void CanbadgerSettings::persist() {
 	cpyToOutBuf("\n", &offset);
 
 	// add the boolean parameters
-	for(int i = 0; i<30; i++) {
+	for(int i = 0; i<32; i++) {
 		cpyToOutBuf(statusSettings[i], &offset);
 		cpyToOutBuf(": ", &offset);
 		this->getStatus(i) ? cpyToOutBuf("1", &offset) : cpyToOutBuf("0", &offset);
@@ -218,12 +222,13 @@ CanbadgerSettings* CanbadgerSettings::restore(CANbadger *cb)  {
 
 // parse content from file or EEPROM to set the attributes of this settings object
 bool CanbadgerSettings::parse(char *unparsed_settings, size_t len) {
-	const char *statusSettings[30] = { "SD_ENABLED", "USB_SERIAL_ENABLED", "ETHERNET_ENABLED", "OLED_ENABLED", "KEYBOARD_ENABLED",
+	const char *statusSettings[32] = { "SD_ENABLED", "USB_SERIAL_ENABLED", "ETHERNET_ENABLED", "OLED_ENABLED", "KEYBOARD_ENABLED",
 						"LEDS_ENABLED", "KLINE1_INT_ENABLED",  "KLINE2_INT_ENABLED",  "CAN1_INT_ENABLED",  "CAN2_INT_ENABLED",
 						"KLINE_BRIDE_ENABLED", "CAN_BRIDGE_ENABLED", "CAN1_LOGGING", "CAN2_LOGGING",  "KLINE1_LOGGING",
 						"KLINE2_LOGGING", "CAN1_STANDARD", "CAN1_EXTENDED", "CAN2_STANDARD", "CAN2_EXTENDED",
 						"CAN1_TO_CAN2_BRIDGE", "CAN2_TO_CAN1_BRIDGE", "KLINE1_TO_KLINE2_BRIDGE", "KLINE2_TO_KLINE1_BRIDGE", "UDS_CAN1_ENABLED",
-						"UDS_CAN2_ENABLED", "CAN1_USE_FULLFRAME", "CAN2_USE_FULLFRAME", "CAN1_MONITOR", "CAN2_MONITOR"
+						"UDS_CAN2_ENABLED", "CAN1_USE_FULLFRAME", "CAN2_USE_FULLFRAME", "CAN1_MONITOR", "CAN2_MONITOR",
+						"LOG_COMPRESSION", "LOG_CHANGES_ONLY"
 				};
 
 	char *settings_str = unparsed_settings;
@@ -297,7 +302,7 @@ bool CanbadgerSettings::parse(char *unparsed_settings, size_t len) {
 			this->KLINE2Speed = (uint32_t)strtoumax(value, NULL, 10);
 		} else {
 			// parse all the status bits
-			for(int i = 0; i<30; i++) {
+			for(int i = 0; i<32; i++) {
 				if(strcmp(key, statusSettings[i]) == 0) {
 					this->setStatus((uint8_t)i, (uint8_t)strtoumax(value, NULL, 10));
 					break;
@@ -307,6 +312,7 @@ bool CanbadgerSettings::parse(char *unparsed_settings, size_t len) {
 
 	}
 
+	this->publishRuntimeConfig();
 	return true;
 }
 
@@ -343,7 +349,11 @@ char* CanbadgerSettings::getIP() {
 
 void CanbadgerSettings::setStatus(uint8_t statusType, uint8_t value)
 {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq(); // bits are set from threads and interrupts alike, none may get lost
 	converter.setBit(&canbadgerStatus,value,statusType);
+	publishRuntimeConfig();
+	__set_PRIMASK(primask);
 }
 
 bool CanbadgerSettings::getStatus(uint8_t statusType)
@@ -351,6 +361,64 @@ bool CanbadgerSettings::getStatus(uint8_t statusType)
 	return converter.getBit(canbadgerStatus,statusType);
 }
 
+uint32_t CanbadgerSettings::getStatusWord()
+{
+	return canbadgerStatus;
+}
+
+const CanbadgerRuntimeConfig* CanbadgerSettings::getRuntimeConfig()
+{
+	return &runtimeConfigs[runtimeGeneration & 1];
+}
+
+void CanbadgerSettings::publishRuntimeConfig()
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq(); // two publishes at once would fill the same buffer
+	uint32_t generation = (runtimeGeneration + 1);
+	CanbadgerRuntimeConfig *config = &runtimeConfigs[generation & 1]; // not the one readers are looking at
+	uint32_t status = canbadgerStatus;
+	for(uint8_t a = 0; a < 2; a++)
+	{
+		uint8_t from = a; // 0 for CAN1, 1 for CAN2. The CAN2 bit follows the CAN1 one, the format bits come in pairs
+		uint8_t to = (1 - a);
+		CANBridgeRoute *route = &config->bridge[a];
+		bool fromStandard = ((status >> (CAN1_STANDARD + (from * 2))) & 1);
+		bool fromExtended = ((status >> (CAN1_EXTENDED + (from * 2))) & 1);
+		bool toStandard = ((status >> (CAN1_STANDARD + (to * 2))) & 1);
+		bool toExtended = ((status >> (CAN1_EXTENDED + (to * 2))) & 1);
+		route->log = ((status >> (CAN1_LOGGING + from)) & 1);
+		route->forward = ((status >> (CAN1_TO_CAN2_BRIDGE + from)) & 1);
+		route->fullFrame = ((status >> (CAN1_USE_FULLFRAME + to)) & 1);
+		route->logFlags = (fromStandard ? 21 : 37) + from; // Bus, CAN, Standard or Extended frame
+		route->format = CAN_BRIDGE_FORMAT_KEEP;
+		if(fromStandard)
+		{
+			if(toStandard)
+			{
+				route->format = CAN_BRIDGE_FORMAT_STANDARD;
+			}
+			else if(toExtended)
+			{
+				route->format = CAN_BRIDGE_FORMAT_BY_ID;
+			}
+		}
+		else if(fromExtended)
+		{
+			route->format = toStandard ? CAN_BRIDGE_FORMAT_SHORT_STANDARD : CAN_BRIDGE_FORMAT_BY_ID; // we can only send an extended ID in Standard CAN if its under 0x800
+		}
+	}
+	config->CANSpeed[0] = CAN1Speed;
+	config->CANSpeed[1] = CAN2Speed;
+	config->KLINESpeed[0] = KLINE1Speed;
+	config->KLINESpeed[1] = KLINE2Speed;
+	config->status = status;
+	config->generation = generation;
+	__DMB(); // the config has to be complete before it is handed out
+	runtimeGeneration = generation;
+	__set_PRIMASK(primask);
+}
+
 // set one of the interface speed values (! this just applies to the settings value and not to the interface directly !)
 bool CanbadgerSettings::setSpeed(uint8_t if_ident, uint32_t speed) {
 	switch(if_ident) {
@@ -359,19 +427,21 @@ bool CanbadgerSettings::setSpeed(uint8_t if_ident, uint32_t speed) {
 			return 1;
 		case 1:
 			CAN1Speed = speed;
-			return 1;
+			break;
 		case 2:
 			CAN2Speed = speed;
-			return 1;
+			break;
 		case 3:
 			KLINE1Speed = speed;
-			return 1;
+			break;
 		case 4:
 			KLINE2Speed = speed;
-			return 1;
+			break;
 		default:
 			return 0;
 	}
+	this->publishRuntimeConfig();
+	return 1;
 }
 
 // TODO
@@ -439,6 +509,7 @@ void CanbadgerSettings::receiveSettingsPayload(uint8_t *payload, bool save) {
 	memcpy(&(this->CAN2Speed), &payload[integers_start + 12], 4);
 	memcpy(&(this->KLINE1Speed), &payload[integers_start + 16], 4);
 	memcpy(&(this->KLINE2Speed), &payload[integers_start + 20], 4);
+	this->publishRuntimeConfig();
 
 	// as we have received new settings, we persist them on the sd
 	if(save) { this->persist(); }
@@ -34,6 +34,24 @@
 #include <sstream>
 #include <cinttypes>
 #include <stdint.h>
+
+/*How the bridge sets the format of a forwarded frame*/
+#define CAN_BRIDGE_FORMAT_KEEP 0 // as received
+#define CAN_BRIDGE_FORMAT_STANDARD 1
+#define CAN_BRIDGE_FORMAT_BY_ID 2 // standard below 0x800, extended from there on
+#define CAN_BRIDGE_FORMAT_SHORT_STANDARD 3 // standard below 0x800, as received from there on
+
+/*What the bridge does with the frames of one direction. Part of the runtime config, see CanbadgerSettings, so the
+receive interrupt does not have to look up the status bits for every frame*/
+struct CANBridgeRoute
+{
+	bool log;
+	bool forward;
+	bool fullFrame; // pad forwarded frames to 8 bytes
+	uint8_t format; // CAN_BRIDGE_FORMAT_*
+	uint8_t logFlags; // flags of the log records
+};
+
 #include "canbadger.h"
 #include "ethernet_message.hpp"
 #include "conversions.h"
@@ -43,6 +61,17 @@
 using namespace std;
 class CANbadger;
 
+/*
+ * Everything the interrupt handlers need from the settings, worked out once per change instead of once per frame.
+ * Published as a whole, so a reader never sees half of an update
+ */
+struct CanbadgerRuntimeConfig {
+	uint32_t generation; // counts publishes, a reader can tell a new config by it
+	uint32_t status; // canbadgerStatus at the time
+	CANBridgeRoute bridge[2]; // CAN1 to CAN2, CAN2 to CAN1
+	uint32_t CANSpeed[2];
+	uint32_t KLINESpeed[2];
+};
 
 
 class CanbadgerSettings {
@@ -64,6 +93,11 @@ public:
 	// set or get the value of a certain bit in the canbadger status bytes
 	void setStatus(uint8_t statusType, uint8_t value);
 	bool getStatus(uint8_t statusType);
+	uint32_t getStatusWord(); // all status bits at once, see canbadgerStatus
+
+	// the current runtime config. Stays valid and unchanged until the next publish after the one that replaced it,
+	// which is plenty for an interrupt handler. Thread code that keeps it for longer should compare the generation
+	const CanbadgerRuntimeConfig* getRuntimeConfig();
 
 	char* getID();
 
@@ -143,6 +177,12 @@ private:
 
 	uint32_t cpyToOutBuf(const char *data, uint32_t *offset);
 
+	// rebuilds the runtime config from the fields above, called by everything that changes them
+	void publishRuntimeConfig();
+
+	CanbadgerRuntimeConfig runtimeConfigs[2]; // the published one and the one the next publish fills
+	volatile uint32_t runtimeGeneration; // generation of the published config, its index is the lowest bit
+
 };
 
 void trim(char *s);
@@ -28,6 +28,12 @@
 
 #include "command_handler.hpp"
 #include "canbadger_settings_constants.h"
+#include "can_log_ring.h"
+#include "can_blackbox.h"
+#include "can_change_filter.h"
+#include "can_tx_queue.h"
+#include "timebase.h"
+#include "us_ticker_api.h"
 
 bool handleEthernetMessage(EthernetMessage *msg, CANbadger *canbadger)
 {
@@ -37,11 +43,24 @@ bool handleEthernetMessage(EthernetMessage *msg, CANbadger *canbadger)
 	switch(msg->actionType)
 	{
 		case LOG_RAW_CAN_TRAFFIC:
+		{
+			// data[0] enables bridge mode, data[1] asks for compressed blocks, data[2] for change-only logging,
+			// data[3-6] is the keyframe interval in ms and data[7] in frames, data[8-9] a UDP port to stream to instead of TCP, little endian
+			bool compress = canbadger->getCANBadgerStatus(LOG_COMPRESSION) || (msg->dataLength > 1 && msg->data[1]);
+			bool changesOnly = canbadger->getCANBadgerStatus(LOG_CHANGES_ONLY) || (msg->dataLength > 2 && msg->data[2]);
+			if(msg->dataLength > 7) {
+				CANChangeFilter::getFilter()->setKeyframe(parse32(msg->data, 3, "LE"), (uint8_t)msg->data[7]);
+			}
+			uint16_t udpPort = 0;
+			if(msg->dataLength > 9) {
+				udpPort = ((uint8_t)msg->data[8] | ((uint8_t)msg->data[9] << 8));
+			}
 			if(msg->dataLength > 0) {
-				return canLogging(canbadger, msg->data[0]);
+				return canLogging(canbadger, msg->data[0], compress, changesOnly, udpPort);
 			} else
-				return canLogging(canbadger, false);
+				return canLogging(canbadger, false, compress, changesOnly, udpPort);
 			break;
+		}
 		case SETTINGS:
 			if(msg->dataLength == 0) {
 				// if the message holds no data, its a request to send the current settings
@@ -236,6 +255,7 @@ bool handleEthernetMessage(EthernetMessage *msg, CANbadger *canbadger)
 					ethMan->sendNACK();
 					return false;
 				}
+				sd->setReadAhead(true);
 
 				// send the file in packets with a leading 4 byte packet number and 2 byte data length
 				while(true) {
@@ -257,6 +277,7 @@ bool handleEthernetMessage(EthernetMessage *msg, CANbadger *canbadger)
 				}
 
 				// close file and send ACK to confirm end of transmission
+				sd->setReadAhead(false);
 				sd->closeFile(1);
 				ethMan->sendACK();
 				return true;
@@ -389,6 +410,31 @@ bool handleEthernetMessage(EthernetMessage *msg, CANbadger *canbadger)
 
 			break;
 		}
+		case CENSUS: {
+			// collect per ID statistics. 1st byte is a bus mask (bit 0 CAN1, bit 1 CAN2, 0 for both),
+			// bytes 2-5 the duration in ms (little endian, 0 runs until stopped), 6th byte set to also save a CSV to the SD
+			uint8_t busMask = 0;
+			uint32_t duration = 0;
+			bool saveToSD = false;
+			if(msg->dataLength >= 1) { busMask = msg->data[0]; }
+			if(msg->dataLength >= 5) { duration = parse32(msg->data, 1, "LE"); }
+			if(msg->dataLength >= 6) { saveToSD = (msg->data[5] != 0); }
+			return runCensus(canbadger, busMask, duration, saveToSD);
+		}
+		case BLACKBOX: {
+			// 1st byte 0 arms the black box, see runBlackBox for the rest of the payload.
+			// 1st byte 1 fires the trigger, only meaningful while the box is running
+			if(msg->dataLength >= 1 && msg->data[0] == 0) {
+				return runBlackBox(canbadger, msg);
+			}
+			break;
+		}
+		case BRIDGE_LATENCY: {
+			// time the frames the bridge forwards. Bytes 1-4 are the duration in ms (little endian, 0 or missing runs until stopped)
+			uint32_t duration = 0;
+			if(msg->dataLength >= 4) { duration = parse32(msg->data, 0, "LE"); }
+			return runBridgeLatency(canbadger, duration);
+		}
 		case LED: {
 			// set the LED to the color specified in the 1st byte (0 = off, 1 = red, 2 = green, 3 = orange)
 			// if 2nd byte was send it is interpreted as a blink command
@@ -409,7 +455,293 @@ bool handleEthernetMessage(EthernetMessage *msg, CANbadger *canbadger)
 	return true;
 }
 
-bool canLogging(CANbadger *canbadger, bool enableBridgeMode)
+bool runCensus(CANbadger *canbadger, uint8_t busMask, uint32_t duration, bool saveToSD)
+{
+	EthernetManager *ethManager = canbadger->getEthernetManager();
+	CanbadgerSettings *cbSettings = canbadger->getCanbadgerSettings();
+	CANCensus *census = CANCensus::getCensus();
+	if(busMask == 0)
+	{
+		busMask = 3;
+	}
+	if(!census->start())
+	{
+		ethManager->sendNACK();
+		return false;
+	}
+	{
+		CANbadger_CAN cb1(canbadger->getCANClient(1));
+		CANbadger_CAN cb2(canbadger->getCANClient(2));
+		if(!canbadger->getCANBadgerStatus(CAN_BRIDGE_ENABLED))//a running bridge feeds the census by itself
+		{
+			if(busMask & 1)
+			{
+				cb1.startRxRing();
+			}
+			if(busMask & 2)
+			{
+				cb2.startRxRing();
+			}
+		}
+		Timer censusTimer;
+		censusTimer.start();
+		while(cbSettings->currentActionIsRunning && (duration == 0 || (uint32_t)censusTimer.read_ms() < duration))
+		{
+			if(cb1.getRxRing() != NULL)//the census is fed from the interrupt, the frames themselves are not needed
+			{
+				cb1.getRxRing()->flush();
+			}
+			if(cb2.getRxRing() != NULL)
+			{
+				cb2.getRxRing()->flush();
+			}
+			ethManager->run();
+			osEvent evt = canbadger->commandQueue->get(0);
+			if(evt.status == osEventMail) {
+				EthernetMessage *msg = (EthernetMessage*) evt.value.p;
+				if(msg != 0) {
+					switch(msg->actionType)
+					{
+						case RESET:
+							ethManager->closeConnection();
+						case STOP_CURRENT_ACTION:
+						case RELAY:
+						case LED:
+							handleEthernetMessage(msg, canbadger);
+							break;
+						default:
+							break;
+					}
+				}
+				canbadger->commandQueue->free(msg);
+				delete msg;
+			}
+			Thread::wait(5);
+		}
+	}//rings stop here if we started them
+	census->stop();
+
+	// results go out as DATA/CENSUS messages: ID count (4) | untracked frames (4) | records
+	uint8_t buf[8 + (32 * CAN_CENSUS_RECORD_SIZE)];
+	uint32_t idCount = census->getIDCount();
+	uint32_t untracked = census->getUntrackedFrames();
+	for(uint8_t a = 0; a < 4; a++)
+	{
+		buf[a] = (idCount >> (a * 8));
+		buf[4 + a] = (untracked >> (a * 8));
+	}
+	uint32_t pos = 8;
+	CANCensusEntry entry;
+	for(uint32_t a = 0; a < idCount; a++)
+	{
+		if((pos + CAN_CENSUS_RECORD_SIZE) > sizeof(buf))
+		{
+			ethManager->sendMessageBlocking(DATA, CENSUS, (char*)buf, pos);
+			pos = 0;
+		}
+		census->getEntry(a, entry);
+		pos += CANCensus::serializeEntry(entry, &buf[pos]);
+	}
+	ethManager->sendMessageBlocking(DATA, CENSUS, (char*)buf, pos);
+
+	if(saveToSD)
+	{
+		FileHandler *sd = canbadger->getFileHandler();
+		char fileName[90] = "/Logging/Census/CENSUS_";
+		char fExt[6] = ".CSV";
+		if(!sd->getSequencialFileName(fileName, fExt) || !sd->openFile(fileName, O_WRONLY | O_CREAT | O_TRUNC))
+		{
+			return false;
+		}
+		char line[100];
+		strcpy(line, "bus,id,format,count,period_us,jitter_us,dlc_mask,first_us,last_us,changed\r\n");
+		sd->write(line, strlen(line));
+		for(uint32_t a = 0; a < idCount; a++)
+		{
+			census->getEntry(a, entry);
+			uint32_t len = CANCensus::formatEntry(entry, line);
+			sd->write(line, len);
+		}
+		sd->closeFile();
+	}
+	return true;
+}
+
+bool runBlackBox(CANbadger *canbadger, EthernetMessage *msg)
+{
+	// payload: 0 | pre-trigger ms (4) | post-trigger ms (4) | GPIO mask (1), all little endian.
+	// optional frame trigger: bus (1, 3 for any) | ID (4) | extended (1) | length (1) | value (8) | mask (8)
+	EthernetManager *ethManager = canbadger->getEthernetManager();
+	CanbadgerSettings *cbSettings = canbadger->getCanbadgerSettings();
+	CANBlackBox box(canbadger->getRAM(), canbadger->getFileHandler());
+	if(msg->dataLength >= 9) {
+		box.setWindow(parse32(msg->data, 1, "LE"), parse32(msg->data, 5, "LE"));
+	}
+	if(msg->dataLength >= 10) {
+		box.setGPIOTrigger(canbadger->getGPIOHandler(), msg->data[9]);
+	}
+	if(msg->dataLength >= 33) {
+		box.setFrameTrigger(msg->data[10], parse32(msg->data, 11, "LE"), (msg->data[15] != 0), (uint8_t*)&msg->data[17], (uint8_t*)&msg->data[25], msg->data[16]);
+	}
+	if(!canbadger->startBlackBox(&box))
+	{
+		ethManager->sendNACK();
+		return false;
+	}
+	ethManager->sendACK();
+	while(cbSettings->currentActionIsRunning)
+	{
+		uint8_t source = box.run();
+		if(source != CAN_BLACKBOX_TRIGGER_NONE)
+		{
+			// every capture is reported as DATA/BLACKBOX: trigger source (1) | dropped frames (4) | file name
+			char answer[70];
+			uint32_t drops = box.getDropCount();
+			answer[0] = source;
+			for(uint8_t a = 0; a < 4; a++)
+			{
+				answer[1 + a] = (drops >> (a * 8));
+			}
+			strncpy(&answer[5], box.getFileName(), 64);
+			answer[69] = 0;
+			ethManager->sendMessageBlocking(DATA, BLACKBOX, answer, (5 + strlen(&answer[5])));
+		}
+		ethManager->run();
+		osEvent evt = canbadger->commandQueue->get(0);
+		if(evt.status == osEventMail) {
+			EthernetMessage *queued = (EthernetMessage*) evt.value.p;
+			if(queued != 0) {
+				switch(queued->actionType)
+				{
+					case BLACKBOX:
+						if(queued->dataLength >= 1 && queued->data[0] == 1) {
+							box.trigger(CAN_BLACKBOX_TRIGGER_ETHERNET);
+						}
+						break;
+					case STOP_CURRENT_ACTION:
+						// not passed on, the handler would close the capture file under the box
+						cbSettings->currentActionIsRunning = false;
+						break;
+					case RESET:
+						ethManager->closeConnection();
+					case RELAY:
+					case LED:
+						handleEthernetMessage(queued, canbadger);
+						break;
+					default:
+						break;
+				}
+			}
+			canbadger->commandQueue->free(queued);
+			delete queued;
+		}
+	}
+	canbadger->stopBlackBox(&box);
+	ethManager->sendACK();
+	return true;
+}
+
+static void sendBridgeLatency(EthernetManager *ethManager, CANTxQueue *queue, uint8_t direction)
+{
+	// DATA/BRIDGE_LATENCY: direction (1 for CAN1 to CAN2, 2 for CAN2 to CAN1) | histogram, see latency_histogram.h
+	uint8_t buf[1 + LATENCY_HISTOGRAM_EXPORT_SIZE];
+	buf[0] = direction;
+	uint32_t len = (1 + queue->getLatency()->serialize(&buf[1]));
+	ethManager->sendMessageBlocking(DATA, BRIDGE_LATENCY, (char*)buf, len);
+}
+
+bool runBridgeLatency(CANbadger *canbadger, uint32_t duration)
+{
+	EthernetManager *ethManager = canbadger->getEthernetManager();
+	CanbadgerSettings *cbSettings = canbadger->getCanbadgerSettings();
+	if(!canbadger->startBridgeLatency())
+	{
+		ethManager->sendNACK();
+		return false;
+	}
+	ethManager->sendACK();
+	CANTxQueue *toCAN2 = CANTxQueue::getQueue(canbadger->getCANClient(2));
+	CANTxQueue *toCAN1 = CANTxQueue::getQueue(canbadger->getCANClient(1));
+	uint32_t startTime = Timebase::nowMs();
+	uint32_t lastReport = startTime;
+	while(cbSettings->currentActionIsRunning && (duration == 0 || (Timebase::nowMs() - startTime) < duration))
+	{
+		if((Timebase::nowMs() - lastReport) >= 1000)//running figures once a second
+		{
+			lastReport = Timebase::nowMs();
+			sendBridgeLatency(ethManager, toCAN2, 1);
+		}
+		ethManager->run();
+		osEvent evt = canbadger->commandQueue->get(0);
+		if(evt.status == osEventMail) {
+			EthernetMessage *msg = (EthernetMessage*) evt.value.p;
+			if(msg != 0) {
+				switch(msg->actionType)
+				{
+					case RESET:
+						ethManager->closeConnection();
+					case STOP_CURRENT_ACTION:
+					case RELAY:
+					case LED:
+						handleEthernetMessage(msg, canbadger);
+						break;
+					default:
+						break;
+				}
+			}
+			canbadger->commandQueue->free(msg);
+			delete msg;
+		}
+		Thread::wait(5);
+	}
+	canbadger->stopBridgeLatency();
+	sendBridgeLatency(ethManager, toCAN2, 1);
+	if(toCAN1->getLatency()->getCount() > 0)//only if the other direction was bridged too
+	{
+		sendBridgeLatency(ethManager, toCAN1, 2);
+	}
+	ethManager->sendACK();
+	return true;
+}
+
+// both return the bytes put on the network, message or datagram header included, 0 if there was nothing to send.
+// With udp set the data goes out as a stream datagram, firstTime being the time of its first record. Over TCP it is
+// spooled in the xram while the connection is stalled, and a message that does not fit there is lost and returns 0
+static uint32_t sendCompressedLog(EthernetManager *ethManager, CANLogCompressor *compressor, bool udp, uint64_t firstTime)
+{
+	const uint8_t *block;
+	uint32_t blockLen = compressor->flush(block);
+	if(blockLen == 0) {
+		return 0;
+	}
+	if(udp) {
+		ethManager->sendStreamDatagram(ETHERNET_STREAM_COMPRESSED, firstTime, (char*)block, blockLen);
+		return (ETHERNET_STREAM_HEADER_SIZE + blockLen);
+	}
+	if(ethManager->sendRamFrame(DATA, LOG_RAW_CAN_TRAFFIC, (char*)block, blockLen) != 0) {
+		return 0;
+	}
+	return (6 + blockLen);
+}
+
+static uint32_t sendLogBatch(EthernetManager *ethManager, uint8_t *batch, uint32_t &batchLen, bool udp, uint64_t firstTime)
+{
+	uint32_t len = batchLen;
+	if(len == 0) {
+		return 0;
+	}
+	batchLen = 0;
+	if(udp) {
+		ethManager->sendStreamDatagram(0, firstTime, (char*)batch, len);
+		return (ETHERNET_STREAM_HEADER_SIZE + len);
+	}
+	if(ethManager->sendRamFrame(DATA, NO_TYPE, (char*)batch, len) != 0) {
+		return 0;
+	}
+	return (6 + len);
+}
+
+bool canLogging(CANbadger *canbadger, bool enableBridgeMode, bool compress, bool changesOnly, uint16_t udpPort)
 {
 	Timer *timer = canbadger->getTimer();
 	canbadger->setCANBadgerStatus(CAN1_STANDARD, 1);
@@ -426,15 +758,51 @@ bool canLogging(CANbadger *canbadger, bool enableBridgeMode)
 	bool wasCANBridgeEnabled=false;
 	bool wasKLINEBridgeEnabled=false;
 	uint32_t frmCount=0;//to keep track of processed frames
-	canbadger->generalCounter1=0;//we initialize the buffer pointer for the interrupts and the pending packets
-	canbadger->generalCounter2=0;
-	canbadger->generalCounter3=0;//used as our buffer Pointer
-	uint8_t data[269];//we will store the retrieved data from buffer here. 269 is the maximum length we will ever get
+	CANLogRing *logRing = CANLogRing::getRing();
+	logRing->flush();//start with an empty log ring
+	logRing->clearStats();//so the drop count covers this session only
+	ethManager->resetRam();//same for the xram spool behind it
+	uint8_t data[CAN_LOG_RAW_MAX_SIZE];
+	// records go out packed in DATA/NO_TYPE messages, sent when the next record would not fit or CAN_LOG_ETHERNET_BATCH_TIME ran out
+	uint8_t batch[CAN_LOG_ETHERNET_BATCH_SIZE];
+	uint32_t batchLen = 0;
+	int batchStartTime = 0;
+	uint64_t batchFirstTime = 0;
+	// or as datagrams of the UDP stream, so a slow server cannot hold the logger up
+	bool udp = (udpPort != 0);
+	// throughput: totals, and the best one second window so a full bus burst shows up even in a long session
+	uint32_t sentBytes = 0;
+	uint32_t windowFrames = 0;
+	uint32_t windowBytes = 0;
+	uint32_t peakFrames = 0;
+	uint32_t peakBytes = 0;
+	int windowStartTime = 0;
+	// with compression the records are sent as blocks of DATA/LOG_RAW_CAN_TRAFFIC instead
+	CANLogCompressor *compressor = NULL;
+	if(compress) {
+		compressor = new CANLogCompressor(CAN_LOG_LZ_ETHERNET_BLOCK_SIZE);
+		compressor->setClock(us_ticker_read);
+	}
+	int lastBlockTime = 0;
+	uint64_t blockFirstTime = 0;
+	if(udp && !ethManager->openStream(udpPort)) {
+		delete compressor;
+		return false;
+	}
+	CANChangeFilter *changeFilter = CANChangeFilter::getFilter();
+	if(changesOnly && !changeFilter->start()) {
+		ethManager->closeStream();
+		delete compressor;
+		return false;
+	}
 
 	if(!(canbadger->getCANBadgerStatus(CAN_BRIDGE_ENABLED)) && (canbadger->getCANBadgerStatus(CAN1_LOGGING) || canbadger->getCANBadgerStatus(CAN2_LOGGING)))//enable the bridges so logging happens
 	{
 		if(!(canbadger->CANBridge(1)))
 		{
+			changeFilter->release();
+			ethManager->closeStream();
+			delete compressor;
 			return false;//we are looking for a lot of conditions, but if somehow they are not met, then go back
 		}
 	}
@@ -456,29 +824,56 @@ bool canLogging(CANbadger *canbadger, bool enableBridgeMode)
 	timer->stop();
 	timer->reset();
 	timer->start();
+	logRing->setEpoch(Timebase::now());//RAW timestamps count from here
 	while(cbSettings->currentActionIsRunning)//log while we have not gotten a stop action
 	{
-		if(canbadger->generalCounter2 > 0)//if we have pending data to retrieve from RAM
+		CANLogRecord *records;
+		uint32_t count = logRing->peek(records);
+		uint32_t sent = 0;//bytes sent in this pass
+		for(uint32_t a = 0; a < count; a++)
 		{
-			canbadger->readTmpBuffer(canbadger->generalCounter3, 1, data);
-			while(data[0] == 0)//to skip bytes intentionally left blank or if there was a read attempt that was interrupted
-			{
-				canbadger->generalCounter3++;//we position the counter on the next byte
-				if(canbadger->generalCounter3 == 4096)//if we have reached the end of the buffer space
-				{
-					canbadger->generalCounter3 = 0;//reset it to make it circular!
+			if(compressor != NULL) {
+				uint32_t pLen = CANLogRing::serializeRAW(&records[a], cbSettings->getSpeed(records[a].bus), data);
+				uint64_t recordTime = records[a].time;
+				logRing->consume(1);//copied out, the slot can be reused while we wait on the network
+				if(compressor->getPending() + pLen > CAN_LOG_LZ_ETHERNET_BLOCK_SIZE) {// keep records whole within a block
+					sent += sendCompressedLog(ethManager, compressor, udp, blockFirstTime);
+					lastBlockTime = timer->read_ms();
+				}
+				if(compressor->getPending() == 0) {
+					blockFirstTime = recordTime;
+				}
+				compressor->append(data, pLen);
+			} else {
+				if(batchLen + CAN_LOG_RAW_MAX_SIZE > sizeof(batch)) {// keep records whole within a batch
+					sent += sendLogBatch(ethManager, batch, batchLen, udp, batchFirstTime);
+				}
+				if(batchLen == 0) {
+					batchStartTime = timer->read_ms();
+					batchFirstTime = records[a].time;
 				}
-				canbadger->readTmpBuffer(canbadger->generalCounter3, 1, data);
-			}
-			canbadger->readTmpBuffer((canbadger->generalCounter3 + 13),1,data);//retrieve the length of the payload
-			uint32_t pLen=(data[0] + 14);//calculate the total length of the packet including header
-			canbadger->readTmpBuffer(canbadger->generalCounter3,pLen,data);
-			canbadger->generalCounter3 = (canbadger->generalCounter3 + pLen);//add the total length, and subtract one so we are pointing at the last byte of the previous packet
-			canbadger->generalCounter2--;//remove the packet we just wrote from the queue
-			//ethManager->sendRamFrame(DATA, (char*)data, pLen);
-			ethManager->sendMessageBlocking(DATA, NO_TYPE, (char*)data, pLen);
+				batchLen += CANLogRing::serializeRAW(&records[a], cbSettings->getSpeed(records[a].bus), &batch[batchLen]);
+				logRing->consume(1);
+			}
 			frmCount++;
 		}
+		windowFrames += count;
+		if(compressor != NULL && compressor->getPending() > 0 && (timer->read_ms() - lastBlockTime) >= CAN_LOG_LZ_ETHERNET_FLUSH_TIME) {
+			sent += sendCompressedLog(ethManager, compressor, udp, blockFirstTime);// do not hold frames back for long on a quiet bus
+			lastBlockTime = timer->read_ms();
+		}
+		if(batchLen > 0 && (timer->read_ms() - batchStartTime) >= CAN_LOG_ETHERNET_BATCH_TIME) {
+			sent += sendLogBatch(ethManager, batch, batchLen, udp, batchFirstTime);// do not hold frames back for long on a quiet bus
+		}
+		sentBytes += sent;
+		windowBytes += sent;
+		if((timer->read_ms() - windowStartTime) >= 1000) {
+			peakFrames = (windowFrames > peakFrames) ? windowFrames : peakFrames;
+			peakBytes = (windowBytes > peakBytes) ? windowBytes : peakBytes;
+			windowFrames = 0;
+			windowBytes = 0;
+			windowStartTime = timer->read_ms();
+		}
 
 		// run the EthernetManagers loop once
 		ethManager->run();
@@ -518,7 +913,59 @@ bool canLogging(CANbadger *canbadger, bool enableBridgeMode)
 		}
 	}
 
+	sentBytes += sendLogBatch(ethManager, batch, batchLen, udp, batchFirstTime);
+	if(compressor != NULL) {
+		sentBytes += sendCompressedLog(ethManager, compressor, udp, blockFirstTime);
+	}
+	uint32_t elapsed = timer->read_ms();
+	// give what is still spooled a chance to get out before the stats and the ACK
+	while(ethManager->getRamUsed() > 0 && cbSettings->isConnected && (uint32_t)(timer->read_ms() - elapsed) < CAN_LOG_ETHERNET_DRAIN_TIME) {
+		if(ethManager->flushRam(ETHERNET_RAM_DRAIN_BATCH) == 0) {
+			Thread::wait(1);
+		}
+	}
 	timer->stop();
+	if(elapsed > 0) {
+		char stats[128];
+		peakFrames = (windowFrames > peakFrames) ? windowFrames : peakFrames;
+		peakBytes = (windowBytes > peakBytes) ? windowBytes : peakBytes;
+		snprintf(stats, sizeof(stats), "Ethernet logging: %u frames/s, %u bytes/s, peak %u frames/s, %u bytes/s, %u dropped",
+				(unsigned int)(((uint64_t)frmCount * 1000) / elapsed), (unsigned int)(((uint64_t)sentBytes * 1000) / elapsed),
+				(unsigned int)peakFrames, (unsigned int)peakBytes, (unsigned int)logRing->getDropCount());
+		ethManager->debugLog(stats);
+		if(!udp) {
+			snprintf(stats, sizeof(stats), "Log buffers: ring peak %u of %u, xram peak %u bytes, %u spilled, %u dropped, %u left",
+					(unsigned int)logRing->getHighWater(), (unsigned int)CAN_LOG_RING_SIZE, (unsigned int)ethManager->getRamHighWater(),
+					(unsigned int)ethManager->getRamSpillCount(), (unsigned int)ethManager->getRamDropCount(), (unsigned int)ethManager->getRamUsed());
+			ethManager->debugLog(stats);
+		}
+	}
+	if(udp) {
+		char stats[64];
+		snprintf(stats, sizeof(stats), "UDP stream: %u datagrams, %u send errors", (unsigned int)ethManager->getStreamSequence(),
+				(unsigned int)ethManager->getStreamErrors());
+		ethManager->debugLog(stats);
+		ethManager->closeStream();
+	}
+	if(changeFilter->isRunning()) {
+		// RAW records have no room for the skip counts, so at least report how much was left out
+		char stats[64];
+		changeFilter->stop();
+		snprintf(stats, sizeof(stats), "Change-only logging: kept %u, skipped %u frames", (unsigned int)changeFilter->getPassedCount(),
+				(unsigned int)changeFilter->getSuppressedCount());
+		ethManager->debugLog(stats);
+		changeFilter->release();
+	}
+	if(compressor != NULL) {
+		if(compressor->getPackedBytes() > 0 && frmCount > 0) {
+			char stats[64];
+			uint32_t ratio = (uint32_t)(((uint64_t)compressor->getPlainBytes() * 100) / compressor->getPackedBytes());
+			snprintf(stats, sizeof(stats), "Log compression: ratio %u.%02u, %u us/frame", (unsigned int)(ratio / 100),
+					(unsigned int)(ratio % 100), (unsigned int)(compressor->getBusyTime() / frmCount));
+			ethManager->debugLog(stats);
+		}
+		delete compressor;
+	}
 	bool CAN1Logging=false;
 	bool CAN2Logging=false;
 	bool KLINE1Logging=false;
@@ -35,6 +35,10 @@
 #include "can_helper.h"
 #include "fileHandler.h"
 
+#define CAN_LOG_ETHERNET_BATCH_SIZE ETHERNET_MAX_SEND_DATA //RAW records packed into one DATA message
+#define CAN_LOG_ETHERNET_BATCH_TIME 5 //ms the first record of a batch may wait before the batch is sent anyway
+#define CAN_LOG_ETHERNET_DRAIN_TIME 1000 //ms the logger waits at the end for the xram spool to empty
+
 
 // forward declarations
 class CANbadger;
@@ -42,7 +46,13 @@ class FileHandler;
 
 bool handleEthernetMessage(EthernetMessage *msg, CANbadger *canbadger);
 
-bool canLogging(CANbadger *canbadger, bool enableBridgeMode);
+bool canLogging(CANbadger *canbadger, bool enableBridgeMode, bool compress = false, bool changesOnly = false, uint16_t udpPort = 0);
+
+bool runCensus(CANbadger *canbadger, uint8_t busMask, uint32_t duration, bool saveToSD);
+
+bool runBlackBox(CANbadger *canbadger, EthernetMessage *msg);
+
+bool runBridgeLatency(CANbadger *canbadger, uint32_t duration);
 
 bool startUDSSession(CANbadger *canbadger, UDSSessionArgument *args);
 
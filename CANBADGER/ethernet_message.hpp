@@ -65,7 +65,10 @@ enum ActionType {
 	ENABLE_MITM_MODE,
 	START_REPLAY,
 	RELAY,
-	LED
+	LED,
+	CENSUS,
+	BLACKBOX,
+	BRIDGE_LATENCY
 };
 
 enum TestType {
@@ -34,10 +34,14 @@ FileHandler::FileHandler()
 	isFile1Open = false;
 	isFile2Open = false;
 	filePointer = 0;
+	readAheadBuffer = NULL;
+	readAheadLen = 0;
+	readAheadPos = 0;
 }
 
 FileHandler::~FileHandler()
 {
+	setReadAhead(false);
 	delete sd;
 	delete sdcard;
 }
@@ -66,8 +70,19 @@ bool FileHandler::lseekFile(uint32_t offset, uint8_t op)
 	{
 		return false;
 	}
-	file->lseek(offset, op);
-	filePointer=offset;
+	if(op == SEEK_CUR && readAheadLen > readAheadPos)//the file itself is ahead of us by whatever is left in the window
+	{
+		offset = (filePointer + offset);
+		op = SEEK_SET;
+	}
+	readAheadLen = 0;
+	readAheadPos = 0;
+	off_t newPosition = file->lseek(offset, op);
+	if(newPosition < 0)
+	{
+		return false;
+	}
+	filePointer = newPosition;
 	return true;
 }
 
@@ -160,6 +175,10 @@ uint32_t FileHandler::read(char *whereTo, uint32_t howMuch, uint8_t fileNo)
 		{
 			return 0;
 		}
+		if(readAheadBuffer != NULL)
+		{
+			return readBuffered(whereTo, howMuch);
+		}
 		uint32_t toReturn = file->read((char*)whereTo, howMuch);
 		filePointer= (filePointer + toReturn);//update the file pointer
 		return toReturn;
@@ -174,6 +193,70 @@ uint32_t FileHandler::read(char *whereTo, uint32_t howMuch, uint8_t fileNo)
 	}
 }
 
+uint32_t FileHandler::readBuffered(char *whereTo, uint32_t howMuch)
+{
+	uint32_t done = 0;
+	while(done < howMuch)
+	{
+		if(readAheadPos == readAheadLen)//window used up, refill it
+		{
+			readAheadPos = 0;
+			readAheadLen = 0;
+			uint32_t fileOffset = (filePointer + done);
+			uint32_t left = (howMuch - done);
+			if(left >= FILE_READ_AHEAD_SIZE && (fileOffset % 512) == 0)//big aligned reads go straight to the caller
+			{
+				ssize_t got = file->read(whereTo + done, (left - (left % 512)));
+				if(got <= 0)
+				{
+					break;
+				}
+				done += got;
+				continue;
+			}
+			ssize_t got = file->read(readAheadBuffer, (FILE_READ_AHEAD_SIZE - (fileOffset % 512)));//realign the window to a sector after a seek
+			if(got <= 0)
+			{
+				break;
+			}
+			readAheadLen = got;
+		}
+		uint32_t chunk = (readAheadLen - readAheadPos);
+		if(chunk > (howMuch - done))
+		{
+			chunk = (howMuch - done);
+		}
+		memcpy(whereTo + done, readAheadBuffer + readAheadPos, chunk);
+		readAheadPos += chunk;
+		done += chunk;
+	}
+	filePointer = (filePointer + done);//update the file pointer
+	return done;
+}
+
+bool FileHandler::setReadAhead(bool enable)
+{
+	readAheadLen = 0;
+	readAheadPos = 0;
+	if(enable == false)
+	{
+		if(readAheadBuffer != NULL)
+		{
+			if(isFile1Open == true)//put the file back where the caller thinks it is
+			{
+				file->lseek(filePointer, SEEK_SET);
+			}
+			free(readAheadBuffer);
+			readAheadBuffer = NULL;
+		}
+		return true;
+	}
+	if(readAheadBuffer == NULL)
+	{
+		readAheadBuffer = (char*)malloc(FILE_READ_AHEAD_SIZE);
+	}
+	return (readAheadBuffer != NULL);
+}
 
 bool FileHandler::write(char *whereFrom, uint32_t howMuch, uint8_t fileNo)
 {
@@ -183,6 +266,12 @@ bool FileHandler::write(char *whereFrom, uint32_t howMuch, uint8_t fileNo)
 		{
 			return false;
 		}
+		if(readAheadLen > readAheadPos)//whatever is left in the window was read ahead of the position we write at
+		{
+			file->lseek(filePointer, SEEK_SET);
+		}
+		readAheadLen = 0;
+		readAheadPos = 0;
 		file->write((char*)whereFrom,howMuch);
 		if(file->fsync() == 0)//sync to make sure the data is in the file
 		{
@@ -290,6 +379,9 @@ bool FileHandler::openFile(const char *filename, uint16_t mode, uint8_t fileNo)
 			return false;
 		}
 		isFile1Open=true;
+		filePointer = 0;
+		readAheadLen = 0;
+		readAheadPos = 0;
 	}
 	else
 	{
@@ -325,6 +417,8 @@ bool FileHandler::closeFile(uint8_t fileNo)
 		}
 		file->close();
 		isFile1Open = false;
+		readAheadLen = 0;
+		readAheadPos = 0;
 	}
 	else
 	{
@@ -368,3 +462,23 @@ bool FileHandler::getSequencialFileName(char *fileName, char *fileExtension)
 		}
 	}
 }
+
+const sd_write_stats_t& FileHandler::getWriteStats()
+{
+	return sd->write_stats();
+}
+
+void FileHandler::clearWriteStats()
+{
+	sd->clear_write_stats();
+}
+
+const sd_read_stats_t& FileHandler::getReadStats()
+{
+	return sd->read_stats();
+}
+
+void FileHandler::clearReadStats()
+{
+	sd->clear_read_stats();
+}
@@ -43,6 +43,8 @@
 #define SD_SCK  P0_7
 #define SD_SS   P0_6
 
+#define FILE_READ_AHEAD_SIZE 2048 //read-ahead window, whole sectors so FatFs can fetch it with a single multi block read
+
 
 
 class FileHandler
@@ -94,6 +96,14 @@ class FileHandler
 
 		uint32_t read(char *whereTo, uint32_t howMuch, uint8_t fileNo=1);
 
+        /** Enables or disables the read-ahead window for file 1. While enabled, small sequential reads are served
+         * from a buffer that is refilled FILE_READ_AHEAD_SIZE bytes at a time
+            @param enable true to allocate the window, false to release it
+
+            @return false if the window could not be allocated
+		*/
+		bool setReadAhead(bool enable);
+
 		bool write(char *whereFrom, uint32_t howMuch, uint8_t fileNo=1);
 
         /** Provides a sequential filename for a base filename.
@@ -107,11 +117,21 @@ class FileHandler
 		*/
 		bool getSequencialFileName(char *fileName, char *fileExtension);
 
+		const sd_write_stats_t& getWriteStats();//block write counters and timing of the card, to check logging throughput
+
+		void clearWriteStats();
+
+		const sd_read_stats_t& getReadStats();
+
+		void clearReadStats();
+
 
 
 
 	private:
 
+		uint32_t readBuffered(char *whereTo, uint32_t howMuch);//read() for file 1 while read-ahead is enabled
+
 		RTOS_SPI* sdcard;
 		SDFileSystem* sd;
 		FileHandle* file;
@@ -119,6 +139,9 @@ class FileHandler
 		bool isFile1Open;
 		bool isFile2Open;
 		uint32_t filePointer;//used to know the current position of the file
+		char* readAheadBuffer;//NULL while read-ahead is disabled
+		uint32_t readAheadLen;//bytes currently held in the window
+		uint32_t readAheadPos;//bytes of the window already handed out
 
 };
 #endif
@@ -0,0 +1,175 @@
+/*
+* CanBadger Latency Histogram
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "latency_histogram.h"
+
+LatencyHistogram::LatencyHistogram()
+{
+	clear();
+}
+
+void LatencyHistogram::record(uint32_t delay)
+{
+	uint32_t bucket = (32 - __CLZ(delay));//number of significant bits
+	if(bucket >= LATENCY_HISTOGRAM_BUCKETS)
+	{
+		bucket = (LATENCY_HISTOGRAM_BUCKETS - 1);
+	}
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	_buckets[bucket]++;
+	_sum += delay;
+	if(_count == 0 || delay < _min)
+	{
+		_min = delay;
+	}
+	if(delay > _max)
+	{
+		_max = delay;
+	}
+	_count++;
+	__set_PRIMASK(primask);
+}
+
+void LatencyHistogram::clear()
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	memset(_buckets, 0, sizeof(_buckets));
+	_sum = 0;
+	_count = 0;
+	_min = 0;
+	_max = 0;
+	__set_PRIMASK(primask);
+}
+
+uint32_t LatencyHistogram::getCount()
+{
+	return _count;
+}
+
+uint32_t LatencyHistogram::getMin()
+{
+	return _min;
+}
+
+uint32_t LatencyHistogram::getMax()
+{
+	return _max;
+}
+
+uint32_t LatencyHistogram::getMean()
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	uint64_t sum = _sum;
+	uint32_t count = _count;
+	__set_PRIMASK(primask);
+	if(count == 0)
+	{
+		return 0;
+	}
+	return (uint32_t)(sum / count);
+}
+
+uint32_t LatencyHistogram::getBucket(uint8_t bucket)
+{
+	if(bucket >= LATENCY_HISTOGRAM_BUCKETS)
+	{
+		return 0;
+	}
+	return _buckets[bucket];
+}
+
+uint32_t LatencyHistogram::getBucketStart(uint8_t bucket)
+{
+	if(bucket == 0)
+	{
+		return 0;
+	}
+	return (1U << (bucket - 1));
+}
+
+uint32_t LatencyHistogram::getPercentile(uint8_t percent)
+{
+	LatencyHistogram copy;
+	snapshot(copy);
+	if(copy._count == 0)
+	{
+		return 0;
+	}
+	if(percent > 100)
+	{
+		percent = 100;
+	}
+	uint64_t target = ((((uint64_t)copy._count * percent) + 99) / 100);//samples at or below the percentile, rounded up
+	uint64_t seen = 0;
+	for(uint8_t a = 0; a < LATENCY_HISTOGRAM_BUCKETS; a++)
+	{
+		seen += copy._buckets[a];
+		if(seen >= target && a < (LATENCY_HISTOGRAM_BUCKETS - 1))
+		{
+			uint32_t end = ((getBucketStart(a) * 2) - 1);
+			if(a == 0)
+			{
+				end = 0;
+			}
+			return (end < copy._max) ? end : copy._max;
+		}
+	}
+	return copy._max;
+}
+
+void LatencyHistogram::snapshot(LatencyHistogram &copy)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	memcpy(copy._buckets, _buckets, sizeof(_buckets));
+	copy._sum = _sum;
+	copy._count = _count;
+	copy._min = _min;
+	copy._max = _max;
+	__set_PRIMASK(primask);
+}
+
+uint32_t LatencyHistogram::serialize(uint8_t *out)
+{
+	LatencyHistogram copy;
+	snapshot(copy);
+	uint32_t values[4] = {copy._count, copy._min, copy._max, copy.getMean()};
+	for(uint8_t a = 0; a < 4; a++)
+	{
+		for(uint8_t b = 0; b < 4; b++)
+		{
+			out[(a * 4) + b] = (values[a] >> (b * 8));
+		}
+	}
+	for(uint8_t a = 0; a < LATENCY_HISTOGRAM_BUCKETS; a++)
+	{
+		for(uint8_t b = 0; b < 4; b++)
+		{
+			out[16 + (a * 4) + b] = (copy._buckets[a] >> (b * 8));
+		}
+	}
+	return LATENCY_HISTOGRAM_EXPORT_SIZE;
+}
@@ -0,0 +1,90 @@
+/*
+* CanBadger Latency Histogram
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Histogram of delays in us with power of two buckets: bucket 0 counts 0 us, bucket n counts n bit values, from 2^(n-1)
+to 2^n - 1 us, and the last bucket takes everything longer. Recording is a count leading zeros and a few adds with
+interrupts blocked, so it can be fed from any interrupt. Minimum, maximum and mean are kept exactly.
+
+Export layout (LATENCY_HISTOGRAM_EXPORT_SIZE bytes, little endian):
+	-Bytes [0-3] samples
+	-Bytes [4-7] minimum in us
+	-Bytes [8-11] maximum in us
+	-Bytes [12-15] mean in us
+	-Bytes [16-] LATENCY_HISTOGRAM_BUCKETS counts of 4 bytes each
+*/
+
+#ifndef __LATENCY_HISTOGRAM_H__
+#define __LATENCY_HISTOGRAM_H__
+
+#include "mbed.h"
+
+#define LATENCY_HISTOGRAM_BUCKETS 24 //the last one starts at 4.2 s
+#define LATENCY_HISTOGRAM_EXPORT_SIZE (16 + (LATENCY_HISTOGRAM_BUCKETS * 4))
+
+class LatencyHistogram
+{
+	public:
+
+		LatencyHistogram();
+
+		void record(uint32_t delay);//adds a sample in us. Safe to call from interrupt context
+
+		void clear();
+
+		uint32_t getCount();
+
+		uint32_t getMin();//in us, 0 without samples
+
+		uint32_t getMax();
+
+		uint32_t getMean();
+
+		uint32_t getBucket(uint8_t bucket);
+
+		static uint32_t getBucketStart(uint8_t bucket);//shortest delay in us counted in bucket
+
+		/** Estimates a percentile from the buckets
+
+			@param percent 1 to 100
+
+			@return the highest delay the bucket holding the percentile can count, capped at the maximum seen
+		*/
+		uint32_t getPercentile(uint8_t percent);
+
+		/** Takes a consistent copy, for readers that run while samples keep coming in
+		*/
+		void snapshot(LatencyHistogram &copy);
+
+		uint32_t serialize(uint8_t *out);//writes the export layout, returns LATENCY_HISTOGRAM_EXPORT_SIZE
+
+	private:
+
+		uint32_t _buckets[LATENCY_HISTOGRAM_BUCKETS];
+		uint64_t _sum;
+		uint32_t _count;
+		uint32_t _min;
+		uint32_t _max;
+};
+
+#endif
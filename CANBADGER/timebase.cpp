@@ -0,0 +1,61 @@
+/*
+* CanBadger Timebase
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "timebase.h"
+#include "us_ticker_api.h"
+
+volatile uint32_t Timebase::_high = 0;
+volatile uint32_t Timebase::_last = 0;
+
+static Ticker guardTicker;
+
+void Timebase::start()
+{
+	now();
+	guardTicker.attach(&Timebase::guard, TIMEBASE_GUARD_INTERVAL);
+}
+
+uint64_t Timebase::now()
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();//the counter and the wrap count have to be read as one
+	uint32_t low = us_ticker_read();
+	if(low < _last)
+	{
+		_high++;
+	}
+	_last = low;
+	uint64_t time = (((uint64_t)_high << 32) | low);
+	__set_PRIMASK(primask);
+	return time;
+}
+
+uint32_t Timebase::nowMs()
+{
+	return (uint32_t)(now() / 1000);
+}
+
+void Timebase::guard()
+{
+	now();
+}
@@ -0,0 +1,61 @@
+/*
+* CanBadger Timebase
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+The one clock every timestamp on the device comes from: CAN RX interrupts, the bridge, the log ring, SLCAN and K-Line.
+It is the us_ticker counter (TIMER3, 1 MHz) with the wraps counted in software, so the low 32 bits are always exactly
+what us_ticker_read returns and code that keeps 32 bit us values stays comparable with the full time.
+A wrap is only seen when the clock is read, so a ticker reads it every TIMEBASE_GUARD_INTERVAL seconds to make sure
+no more than one wrap can happen between two reads.
+*/
+
+#ifndef __TIMEBASE_H__
+#define __TIMEBASE_H__
+
+#include "mbed.h"
+
+#define TIMEBASE_GUARD_INTERVAL 600 //s between guard reads, well below the 71 minutes the 32 bit counter takes to wrap
+
+class Timebase
+{
+	public:
+
+		static void start();//starts the guard ticker. Call once at boot, before anything keeps timestamps
+
+		/** Reads the clock. Safe to call from any context
+
+			@return us since boot
+		*/
+		static uint64_t now();
+
+		static uint32_t nowMs();//ms since boot, wraps after 49 days
+
+	private:
+
+		static void guard();
+
+		static volatile uint32_t _high;//wraps of the hardware counter
+		static volatile uint32_t _last;//counter value at the last read
+};
+
+#endif
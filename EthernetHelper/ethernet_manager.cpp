@@ -40,9 +40,13 @@
 				cbName, CB_VERSION);
 		this->idLength = strlen(this->deviceIdentifier);
 		this->commandQueue = commandQueue;
-		this->ramStart = 0;
-		this->ramEnd = 0;
-		this->xramSerializationBuffer = new char[sizeof(EthernetMessage) + 255];
+		this->ramMessages = 0;
+		this->resetRam();
+		this->xramSerializationBuffer = new char[sizeof(EthernetMessage) + ETHERNET_MAX_SEND_DATA];
+		this->streamOpen = false;
+		this->streamSequence = 0;
+		this->streamErrors = 0;
+		this->streamBuffer = NULL;
 
 		//this->debugLog("Initializing ethernet..");
 
@@ -82,7 +86,6 @@
 
 		// initialize buffers
 		this->recvBuffer = new char[130];
-		this->xramSendBuffer = new char[sizeof(EthernetMessage) + 22];
 
 		// tcp setup
 		this->actionSocket = TCPSocketConnection();
@@ -108,7 +111,7 @@
 		// check for incoming commands over tcp
 		if(this->canbadgerSettings->isConnected) {
 			handleInbox();
-			//handleOutqueue();
+			handleOutqueue();
 		}
 
 		// check CONNECT requests on the udp socket
@@ -187,8 +190,6 @@
 			uint16_t numMsgs = 0;
 			osEvent evt = this->outQueue.get(0);
 			while(evt.status == osEventMail && (numMsgs < 200)) {
-				//if(numMsgs > 200)
-				//	cancel = true;
 				EthernetMessage *outMsg;
 				outMsg = 0;
 				outMsg = (EthernetMessage*) evt.value.p;
@@ -201,40 +202,11 @@
 					delete[] msgData;
 				}
 				numMsgs++;
-				evt = this->outQueue.get(15);
+				evt = this->outQueue.get(0); // do not wait for more, run() is called in tight loops
 			}
 
-			// empty the xram
-			unsigned int sentCount = 0;
-			/* pre-allocate 21 bytes so we dont have to re-allocate things
-			   this can be done, because xram transfers are only used by the canlogger, currently */
-			while(this->ramStart != this->ramEnd) {
-				if(sentCount > 200)
-					break;
-
-				if(this->ramStart > 0x1fff4) {
-					this->ramStart = 0;
-				}
-
-				char headerBuf[6];
-				ram_read(this->ramStart, headerBuf, 6);
-
-				uint32_t dataLength = (headerBuf[5] << 24) | (headerBuf[4] << 16) | (headerBuf[3] << 8) | (headerBuf[2]);
-				if(dataLength > 255) {
-					continue;
-				}
-
-				ram_read(this->ramStart+6, xramSendBuffer+6, dataLength);
-				memcpy(xramSendBuffer, headerBuf, 6);
-				this->actionSocket.send(xramSendBuffer, 6+dataLength);
-				if(this->ramStart + 6 + dataLength > 0x20000) {
-					// wrap around
-					this->ramStart = 0;
-				} else {
-					this->ramStart += 6 + dataLength;
-				}
-				sentCount++;
-			}
+			// send what waits in the xram
+			flushRam(ETHERNET_RAM_DRAIN_BATCH);
 		}
 	};
 
@@ -243,6 +215,68 @@
 		actionSocket = TCPSocketConnection();
 	}
 
+	bool EthernetManager::openStream(uint16_t port) {
+		if(!this->canbadgerSettings->isConnected || port == 0) {
+			return false;
+		}
+		if(this->streamBuffer == NULL) {
+			this->streamBuffer = new char[ETHERNET_STREAM_HEADER_SIZE + ETHERNET_MAX_SEND_DATA];
+		}
+		if(!this->streamOpen) {
+			if(this->streamSocket.init() != 0) {
+				return false;
+			}
+			this->streamSocket.set_blocking(false, 1);
+		}
+		if(this->streamEndpoint.set_address(this->canbadgerSettings->connectedTo, port) != 0) {
+			this->closeStream();
+			return false;
+		}
+		this->streamOpen = true;
+		this->streamSequence = 0;
+		this->streamErrors = 0;
+		return true;
+	}
+
+	void EthernetManager::closeStream() {
+		if(this->streamOpen) {
+			this->streamSocket.close();
+			this->streamOpen = false;
+		}
+	}
+
+	int EthernetManager::sendStreamDatagram(uint8_t flags, uint64_t firstTime, char *data, uint32_t dataLength) {
+		if(!this->streamOpen || dataLength > ETHERNET_MAX_SEND_DATA) {
+			return -1;
+		}
+		char *buf = this->streamBuffer;
+		uint32_t seq = this->streamSequence++;
+		buf[0] = ETHERNET_STREAM_MAGIC0;
+		buf[1] = ETHERNET_STREAM_MAGIC1;
+		buf[2] = flags;
+		buf[3] = 0;
+		for(uint8_t a = 0; a < 4; a++) {
+			buf[4 + a] = (seq >> (a * 8));
+		}
+		for(uint8_t a = 0; a < 8; a++) {
+			buf[8 + a] = (firstTime >> (a * 8));
+		}
+		memcpy(&buf[ETHERNET_STREAM_HEADER_SIZE], data, dataLength);
+		int sent = this->streamSocket.sendTo(this->streamEndpoint, buf, ETHERNET_STREAM_HEADER_SIZE + dataLength);
+		if(sent <= 0) { // 0 when the socket stayed busy for the whole timeout
+			this->streamErrors++;
+		}
+		return sent;
+	}
+
+	uint32_t EthernetManager::getStreamSequence() {
+		return this->streamSequence;
+	}
+
+	uint32_t EthernetManager::getStreamErrors() {
+		return this->streamErrors;
+	}
+
 	void EthernetManager::sendACK() {
 		// blindly sends an ack, acquiring and releasing the actionSocket mutex
 		uint8_t serBuf[6];
@@ -334,6 +368,9 @@ int EthernetManager::sendFormattedDebugMessage(char *msg, ...) {
 }
 
 int EthernetManager::sendMessageBlocking(MessageType type, ActionType atype, char *data, uint32_t dataLength) {
+	if(dataLength > ETHERNET_MAX_SEND_DATA) {
+		return -1;
+	}
 	if(this->canbadgerSettings->isConnected) {
 		//EthernetMessage *msg = new EthernetMessage();
 		EthernetMessage msg;
@@ -374,30 +411,113 @@ int EthernetManager::sendMessagesBlocking(EthernetMessage **messages, size_t num
 	return -1;
 }
 
-int EthernetManager::sendRamFrame(MessageType type, char *data, uint32_t dataLength) {
-	// serialize here, send later
-	// use already allocated memory, as this is only used by canlogger right now
+int EthernetManager::sendRamFrame(MessageType type, ActionType atype, char *data, uint32_t dataLength) {
+	if(dataLength > ETHERNET_MAX_SEND_DATA || !this->canbadgerSettings->isConnected) {
+		return -1;
+	}
 	EthernetMessage ethMsg;
 	ethMsg.type = type;
+	ethMsg.actionType = atype;
 	ethMsg.dataLength = dataLength;
 	ethMsg.data = data;
 	char *msgData = EthernetMessage::serialize(&ethMsg, this->xramSerializationBuffer);
-	if(this->ramEnd + 6 + dataLength > 0x20000) {
-		if(this->ramStart > 6 + dataLength) {
-			// we have to wrap around
-			ram_write(0, msgData, 6 + dataLength);
-			this->ramEnd = 6 + dataLength;
-			return 6 + dataLength;
+	uint32_t msgLen = 6 + dataLength;
+	if(this->ramUsed == 0) {
+		// nothing waiting, so nothing to overtake. once the socket is writable lwip queues the whole message, so a send never leaves half of one behind
+		if(this->actionSocket.send(msgData, msgLen) > 0) {
+			return 0;
+		}
+	}
+	// the network is stalled or still catching up, keep the message behind the ones already waiting
+	uint32_t addr;
+	uint32_t wrap;
+	if(this->ramUsed == 0) {
+		this->ramStart = 0;
+		this->ramEnd = 0;
+		this->ramWrap = ETHERNET_RAM_SIZE;
+	}
+	wrap = this->ramWrap;
+	if(this->ramWrap == ETHERNET_RAM_SIZE) {
+		// not wrapped, the messages sit in [ramStart, ramEnd)
+		if(this->ramEnd + msgLen <= ETHERNET_RAM_SIZE) {
+			addr = this->ramEnd;
+		} else if(msgLen < this->ramStart) {
+			wrap = this->ramEnd; // the reader jumps back to 0 here
+			addr = 0;
 		} else {
-			// no space anymore, drop
+			this->ramDrops++;
 			return -1;
 		}
 	} else {
-		ram_write(this->ramEnd, msgData, 6 + dataLength);
-		this->ramEnd += 6 + dataLength;
-		return 6 + dataLength;
+		// wrapped, the messages sit in [ramStart, ramWrap) and [0, ramEnd)
+		if(this->ramEnd + msgLen < this->ramStart) {
+			addr = this->ramEnd;
+		} else {
+			this->ramDrops++;
+			return -1;
+		}
 	}
-	return -1;
+	if(ram_write(addr, msgData, msgLen) == 0) {
+		// nothing changed in the ring, just this message is lost
+		this->ramDrops++;
+		return -1;
+	}
+	this->ramWrap = wrap;
+	this->ramEnd = addr + msgLen;
+	this->ramUsed += msgLen;
+	this->ramMessages++;
+	this->ramSpills++;
+	if(this->ramUsed > this->ramHighWater) {
+		this->ramHighWater = this->ramUsed;
+	}
+	return 0;
+}
+
+uint32_t EthernetManager::flushRam(uint32_t maxMessages) {
+	uint32_t sent = 0;
+	while(this->ramUsed > 0 && sent < maxMessages) {
+		if(this->ramStart == this->ramWrap) {
+			this->ramStart = 0;
+			this->ramWrap = ETHERNET_RAM_SIZE;
+		}
+		char *buf = this->xramSerializationBuffer;
+		if(ram_read(this->ramStart, buf, 6) == 0) {
+			// the ring cannot be walked without its headers
+			this->dropRamSpool();
+			break;
+		}
+		uint8_t *header = (uint8_t*) buf;
+		uint32_t dataLength = (header[2] | (header[3] << 8) | (header[4] << 16) | ((uint32_t)header[5] << 24));
+		if(dataLength > ETHERNET_MAX_SEND_DATA || ram_read(this->ramStart + 6, buf + 6, dataLength) == 0) {
+			// can only be a broken ring, nothing in it can be trusted anymore
+			this->dropRamSpool();
+			break;
+		}
+		if(this->actionSocket.send(buf, 6 + dataLength) <= 0) {
+			break; // still stalled, try again on the next call
+		}
+		this->ramStart += 6 + dataLength;
+		this->ramUsed -= 6 + dataLength;
+		this->ramMessages--;
+		sent++;
+	}
+	return sent;
+}
+
+uint32_t EthernetManager::getRamUsed() {
+	return this->ramUsed;
+}
+
+uint32_t EthernetManager::getRamHighWater() {
+	return this->ramHighWater;
+}
+
+uint32_t EthernetManager::getRamSpillCount() {
+	return this->ramSpills;
+}
+
+uint32_t EthernetManager::getRamDropCount() {
+	return this->ramDrops;
 }
 
 	int EthernetManager::debugLog(char *debugMsg) {
@@ -432,7 +552,10 @@ int EthernetManager::sendRamFrame(MessageType type, char *data, uint32_t dataLen
 	    return i;*/
 
 		// we can make use of the canbadgers respective methods
-		return (uint32_t)this->canbadgerSettings->cb->writeRAM(addr, len, (uint8_t*)buf);
+		this->ramLock.lock();
+		uint32_t written = (uint32_t)this->canbadgerSettings->cb->writeRAM(addr, len, (uint8_t*)buf);
+		this->ramLock.unlock();
+		return written;
 
 	}
 
@@ -454,12 +577,34 @@ int EthernetManager::sendRamFrame(MessageType type, char *data, uint32_t dataLen
 	    return i;*/
 
 		// we can make use of the canbadgers respective methods
-		return (uint32_t)this->canbadgerSettings->cb->readRAM(addr, len, (uint8_t*)buf);
+		this->ramLock.lock();
+		uint32_t read = (uint32_t)this->canbadgerSettings->cb->readRAM(addr, len, (uint8_t*)buf);
+		this->ramLock.unlock();
+		return read;
 	}
 
-void EthernetManager::resetRam() {
+void EthernetManager::lockRam() {
+	this->ramLock.lock();
+}
+
+void EthernetManager::unlockRam() {
+	this->ramLock.unlock();
+}
+
+void EthernetManager::dropRamSpool() {
+	this->ramDrops += this->ramMessages;
 	this->ramStart = 0;
 	this->ramEnd = 0;
+	this->ramWrap = ETHERNET_RAM_SIZE;
+	this->ramUsed = 0;
+	this->ramMessages = 0;
+}
+
+void EthernetManager::resetRam() {
+	this->dropRamSpool();
+	this->ramHighWater = 0;
+	this->ramSpills = 0;
+	this->ramDrops = 0;
 }
 
 
@@ -29,10 +29,15 @@
 #define START_THREAD 1
 #define CB_VERSION 2
 #define ETHERNET_START_SIG 1
+#define ETHERNET_MAX_SEND_DATA 1400 //largest payload sendMessageBlocking and sendRamFrame take, one TCP segment
+#define ETHERNET_RAM_SIZE RAM_USABLE_SIZE //the part of the SPI RAM the driver hands out, sendRamFrame spools messages here while the connection is stalled
+#define ETHERNET_RAM_DRAIN_BATCH 8 //spooled messages handleOutqueue sends per run
 
 
 #include "mbed.h"
 #include "EthernetInterface.h"
+#include "ethernet_stream.hpp"
+#include "SER23LC1024.h"
 #include "rtos.h"
 #include "ethernet_message.hpp"
 #include "canbadger_settings.hpp"
@@ -72,17 +77,36 @@ public:
 	 */
 	int sendMessageBlocking(MessageType type, ActionType atype, char *data, uint32_t dataLength);
 	int sendMessagesBlocking(EthernetMessage **messages, size_t numMessages);
-	// store frame in xram and send it - used for canlogger
-	int sendRamFrame(MessageType type, char *data, uint32_t dataLength);
+	/*
+	 * sends a message if the connection takes it right away, otherwise spools it in the xram - used for canlogger
+	 * spooled messages go out in order before any new one, see flushRam
+	 * returns 0 if the message was sent or spooled, -1 if it was dropped because it is too long or the xram is full
+	 */
+	int sendRamFrame(MessageType type, ActionType atype, char *data, uint32_t dataLength);
+
+	// sends up to maxMessages spooled messages, stops at the first the connection does not take. returns the number sent
+	uint32_t flushRam(uint32_t maxMessages);
+
+	uint32_t getRamUsed(); // bytes spooled right now
+	uint32_t getRamHighWater(); // most bytes spooled at once since resetRam
+	uint32_t getRamSpillCount(); // messages that had to be spooled since resetRam
+	uint32_t getRamDropCount(); // messages lost to a full xram or an xram access that failed since resetRam
 
 	void run();
 
 	// this will block - you have been warned
 	int debugLog(char *debugMsg);
 
-	// will clear the ramStart and ramEnd counters
+	// drops whatever is spooled and clears the counters
 	void resetRam();
 
+	/*
+	 * the spool shares the xram with other users, like the MITM rules. threads that read or write it while the spool
+	 * may be in use take this lock around it, the spool takes it for each of its own accesses. never from an interrupt
+	 */
+	void lockRam();
+	void unlockRam();
+
 	// called if we received an id change
 	// will reacquire the deviceIdentifier from the settings
 	void reacquireIdentifier();
@@ -105,6 +129,21 @@ public:
 	// close TCP connection (and create new socket for next connection)
 	void closeConnection();
 
+	// open the UDP capture stream to the connected server, restarting the sequence numbers
+	bool openStream(uint16_t port);
+
+	void closeStream();
+
+	/* send one stream datagram carrying data, see the layout above
+	 * returns what the socket returned, -1 if the stream is not open or data is too long
+	 * the sequence number is used up either way, so the server sees a failed send as loss
+	 */
+	int sendStreamDatagram(uint8_t flags, uint64_t firstTime, char *data, uint32_t dataLength);
+
+	uint32_t getStreamSequence(); // datagrams sent since openStream
+
+	uint32_t getStreamErrors(); // datagrams the socket did not take, or took no bytes of
+
 
 private:
 	int deviceUid;
@@ -117,6 +156,12 @@ private:
 	UDPSocket broadcastSocket;
 	UDPSocket connectionSocket;
 	TCPSocketConnection actionSocket;
+	UDPSocket streamSocket;
+	Endpoint streamEndpoint;
+	bool streamOpen;
+	uint32_t streamSequence;
+	uint32_t streamErrors;
+	char *streamBuffer;
 
 	Endpoint broadcastEndpoint;
 	Endpoint server;
@@ -124,14 +169,21 @@ private:
 	Mail<EthernetMessage, 16> outQueue;
 	Mail<EthernetMessage, 16> *commandQueue;
 
-	volatile uint32_t ramStart;
-	volatile uint32_t ramEnd;
+	volatile uint32_t ramStart; // oldest spooled message
+	volatile uint32_t ramEnd; // where the next message goes
+	uint32_t ramWrap; // end of the data before the wrap to 0, ETHERNET_RAM_SIZE if not wrapped
+	uint32_t ramUsed;
+	uint32_t ramMessages; // spooled right now
+	uint32_t ramHighWater;
+	uint32_t ramSpills;
+	uint32_t ramDrops;
+	Mutex ramLock; // see lockRam
 	uint32_t ram_write(uint32_t addr, char *buf, uint32_t len);
 	uint32_t ram_read(uint32_t addr, char *buf, uint32_t len);
+	void dropRamSpool(); // empties the spool, counting what was in it as dropped
 	char *xramSerializationBuffer;
 
 	char *recvBuffer;
-	char *xramSendBuffer;
 
 };
 
@@ -0,0 +1,43 @@
+/*
+* CANBadger Ethernet Stream
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef ETHERNET_STREAM_HPP_
+#define ETHERNET_STREAM_HPP_
+
+/*
+ * UDP capture stream, used by the CAN logger next to the TCP connection, which stays the control channel.
+ * Datagrams go to the connected server on the port it asked for and look like this (little endian):
+ *  - Bytes [0-1] magic CB 55
+ *  - Byte [2] flags, bit 0 set if the payload is a compressed block (see can_log_lz.h) instead of RAW records
+ *  - Byte [3] reserved, 0
+ *  - Bytes [4-7] sequence number, 0 for the first datagram of a stream, one up for every datagram. A gap means loss
+ *  - Bytes [8-15] time of the first record in the payload, in us on the device timebase
+ *  - Bytes [16-] payload, up to ETHERNET_MAX_SEND_DATA bytes, never splitting a record or block
+ * Kept apart from ethernet_manager.hpp so host side receivers can use it without mbed.
+ */
+#define ETHERNET_STREAM_HEADER_SIZE 16
+#define ETHERNET_STREAM_MAGIC0 0xCB
+#define ETHERNET_STREAM_MAGIC1 0x55
+#define ETHERNET_STREAM_COMPRESSED 0x01
+
+#endif /* ETHERNET_STREAM_HPP_ */
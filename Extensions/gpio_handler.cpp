@@ -24,8 +24,8 @@
 
 #include <Extensions/gpio_handler.hpp>
 
-DigitalOut gpio1(GPIO1);
-DigitalOut gpio2(GPIO2);
+DigitalInOut gpio1(GPIO1, PIN_OUTPUT, PullNone, 0);
+DigitalInOut gpio2(GPIO2, PIN_OUTPUT, PullNone, 0);
 
 
 void GPIOHandler::gpioToggle(uint8_t gpio) {
@@ -64,13 +64,61 @@ uint8_t GPIOHandler::gpioState() {
 	return state;
 }
 
+bool GPIOHandler::setEdgeCounting(uint8_t gpio, bool enable) {
+	if(gpio < 1 || gpio > 2) {
+		return false;
+	}
+	uint8_t idx = gpio - 1;
+	if(enable) {
+		if(edgeIn[idx] == NULL) {
+			edgeIn[idx] = new InterruptIn((gpio == 1) ? GPIO1 : GPIO2);
+			if(gpio == 1) {
+				edgeIn[idx]->rise(this, &GPIOHandler::edge1);
+				edgeIn[idx]->fall(this, &GPIOHandler::edge1);
+			} else {
+				edgeIn[idx]->rise(this, &GPIOHandler::edge2);
+				edgeIn[idx]->fall(this, &GPIOHandler::edge2);
+			}
+		}
+		return true;
+	}
+	if(edgeIn[idx] != NULL) {
+		delete edgeIn[idx];
+		edgeIn[idx] = NULL;
+		DigitalInOut* pin = (gpio == 1) ? &gpio1 : &gpio2;
+		pin->write(0);
+		pin->output();
+	}
+	return true;
+}
+
+uint32_t GPIOHandler::getEdgeCount(uint8_t gpio) {
+	if(gpio < 1 || gpio > 2) {
+		return 0;
+	}
+	return edgeCount[gpio - 1];
+}
+
+void GPIOHandler::edge1() {
+	edgeCount[0]++;
+}
+
+void GPIOHandler::edge2() {
+	edgeCount[1]++;
+}
+
 GPIOHandler::GPIOHandler() {
 	gpio1.write(0);
 	gpio2.write(0);
+	edgeIn[0] = NULL;
+	edgeIn[1] = NULL;
+	edgeCount[0] = 0;
+	edgeCount[1] = 0;
 }
 
 GPIOHandler::~GPIOHandler() {
-
+	setEdgeCounting(1, false);
+	setEdgeCounting(2, false);
 }
 
 
@@ -40,10 +40,20 @@ public:
 	void gpioOn(uint8_t relay);
 	void gpioOff(uint8_t relay);
 	uint8_t gpioState();
+
+	// turns the pin into an input and counts its edges, e.g. to use an external signal as a trigger.
+	// disabling it makes the pin an output again, driven low
+	bool setEdgeCounting(uint8_t gpio, bool enable);
+	uint32_t getEdgeCount(uint8_t gpio);
 	
 
 private:
 
+	void edge1();
+	void edge2();
+
+	InterruptIn* edgeIn[2];
+	volatile uint32_t edgeCount[2];
 };
 
 #endif
@@ -24,6 +24,7 @@
 
 #include "mbed.h"
 #include "kline.h"
+#include "timebase.h"
 
 #define SBIT_WordLenght    0x00u
 #define SBIT_DLAB          0x07u
@@ -44,6 +45,7 @@ KLINEHandler::KLINEHandler(Serial *kline, uint8_t interfaceNo)
 	byteTimeout = (KLINE_DEFAULT_BYTE_READ_TIMEOUT * 10);
 	_kline->baud(speed);
 	interface=interfaceNo;
+	rxTime=0;
 }
 
 KLINEHandler::~KLINEHandler()
@@ -76,9 +78,15 @@ uint16_t KLINEHandler::getByte()
 			return 0xFF00;
 		}
 	}
+	rxTime=Timebase::now();
 	return _kline->getc();
 }
 
+uint64_t KLINEHandler::getRxTime()
+{
+	return rxTime;
+}
+
 bool KLINEHandler::sendByte(uint8_t toSend)
 {
 	uint32_t timeout = 0;
@@ -314,6 +322,10 @@ uint32_t KLINEHandler::read(uint8_t *response, uint32_t len, bool checkCRC)
 						return (0);//return zero
 					}
 				}
+				if(a == 0)
+				{
+					rxTime=Timebase::now();
+				}
 				response[a]=_kline->getc();
 			}
 			if(checkCRC)
@@ -355,6 +367,7 @@ uint32_t KLINEHandler::read(uint8_t *response, uint32_t len, bool checkCRC)
 				}
 			}	
 			//we are supposed to have something now
+			rxTime=Timebase::now();
 			timeout = 0;//need to reset it to get into the while loop
 			while(timeout < byteTimeout)
 			{
@@ -53,6 +53,7 @@ class KLINEHandler
 	  void setBaudrate(uint32_t baudrate);
 		void fastInit(uint8_t *initSequence, uint8_t len, bool doCRC = true);//initSequence contains the sequence that should be sent after the init
 		uint16_t getByte();
+		uint64_t getRxTime();//Timebase time the first byte of the last read or getByte arrived at. Polled, so within about 100us
 		bool sendByte(uint8_t toSend);
 		void ftdiPassthrough(Buttons* buttons);// Uses K-LINE 1 as an ftdi passthrough. Useful to emulate interfaces.
 	
@@ -64,6 +65,7 @@ class KLINEHandler
 		uint32_t readTimeout;
 		uint32_t speed;
 		uint8_t interface;
+		uint64_t rxTime;
 	
 };
 
@@ -5,6 +5,8 @@
 #include "rtos.h"
 #include "SimpleDMA.h"
 
+#define RTOS_SPI_MAX_DMA 4095 // largest transfer size a GPDMA channel takes, longer blocks are split
+
 /**
 * RTOS_SPI uses SimpleDMA to control SPI using DMA. 
 *
@@ -31,7 +33,7 @@ class RTOS_SPI: public SPI {
     /** 
     * Write a block of data via SPI
     *
-    * This throws away all read data
+    * This throws away all read data. Must be called from a thread, not from an interrupt
     *
     * @param *write_data - uint8_t pointer to data to write
     * @param length - number of bytes to write
@@ -43,7 +45,7 @@ class RTOS_SPI: public SPI {
     }
     
     /** 
-    * Write a block of data via SPI, read returning value
+    * Write a block of data via SPI, read returning value. Must be called from a thread, not from an interrupt
     *
     * @param *read_data - uint8_t pointer to array where received data should be stored
     * @param *write_data - uint8_t pointer to data to write
@@ -18,11 +18,19 @@ void RTOS_SPI::bulkInternal(uint8_t *read_data, uint8_t *write_data, int length,
     aquire();
     _spi.spi->DMACR = 3;
 
-    read_dma.destination(read_data, read_inc);
-    write_dma.source(write_data, write_inc);
-    read_dma.start(length);
-    write_dma.wait(length);
-    while(read_dma.isBusy());
+    while (length > 0) {
+        int chunk = (length > RTOS_SPI_MAX_DMA) ? RTOS_SPI_MAX_DMA : length;
+        read_dma.destination(read_data, read_inc);
+        write_dma.source(write_data, write_inc);
+        read_dma.start(chunk);
+        write_dma.wait(chunk);
+        while(read_dma.isBusy());
+        if (read_inc)
+            read_data += chunk;
+        if (write_inc)
+            write_data += chunk;
+        length -= chunk;
+    }
 
     _spi.spi->DMACR = 0;
 }
@@ -60,8 +60,9 @@
  * just always use the Standard Capacity cards with a block size of 512 bytes.
  * This is set with CMD16.
  *
- * You can read and write single blocks (CMD17, CMD25) or multiple blocks
- * (CMD18, CMD25). For simplicity, I'll just use single block accesses. When
+ * You can read and write single blocks (CMD17, CMD24) or multiple blocks
+ * (CMD18, CMD25). Accesses of more than one block use the multiple block
+ * commands, so the card can stream them back to back. When
  * the card gets a read command, it responds with a response token, and then
  * a data token or an error.
  *
@@ -111,11 +112,36 @@
  * +------+---------+---------+- -  - -+---------+-----------+----------+
  * | 0xFE | data[0] | data[1] |        | data[n] | crc[15:8] | crc[7:0] |
  * +------+---------+---------+- -  - -+---------+-----------+----------+
+ *
+ * Multiple Block Write
+ * --------------------
+ * CMD25 is followed by any number of blocks, each one started with 0xFC
+ * instead of 0xFE and acknowledged with a data response token. The card
+ * signals busy (zeros) while it programs a block. The transfer is ended
+ * with the STOP_TRAN token (0xFD), after which the card is busy again.
+ *
+ * If the number of blocks is known, ACMD23 (SET_WR_BLK_ERASE_COUNT) lets
+ * the card erase them in advance, which makes the write itself faster.
+ * Cards that reject CMD25 or ACMD23 get single block writes instead.
+ *
+ * Multiple Block Read
+ * -------------------
+ * After CMD18 the card sends one data block (0xFE, data, CRC) after another
+ * until it gets STOP_TRANSMISSION (CMD12). The byte following CMD12 is a
+ * stuff byte and has to be skipped before the R1b response.
  */
 #include "SDFileSystem.h"
 #include "mbed_debug.h"
+#include "us_ticker_api.h"
 
 #define SD_COMMAND_TIMEOUT 5000
+#define SD_WRITE_TIMEOUT_US 500000 // worst case busy time for a block write (SDXC)
+#define SD_READ_TIMEOUT_US  100000 // worst case access time for a block read
+#define SD_DMA_MIN_LENGTH   64     // shorter transfers are not worth the DMA setup and the thread switch
+
+#define SD_TOKEN_START_BLOCK       0xFE
+#define SD_TOKEN_START_MULTI_WRITE 0xFC
+#define SD_TOKEN_STOP_TRAN         0xFD
 
 #define SD_DBG             0
 
@@ -128,6 +154,12 @@ FATFileSystem(name)
     // Set default to 400kHz for initialisation and 20MHz for data transfer
     _init_sck = 400000;
     _transfer_sck = 12000000;
+    _multi_write_ok = true;
+    _multi_read_ok = true;
+    _pre_erase_ok = true;
+    _use_dma = true;
+    clear_write_stats();
+    clear_read_stats();
 }
 
 SDFileSystem::~SDFileSystem()
@@ -238,43 +270,210 @@ int SDFileSystem::disk_initialize() {
     }
     // Set SCK for data transfer
     _spi->frequency(_transfer_sck); 
+    // a new card gets a new chance at multi block transfers
+    _multi_write_ok = true;
+    _multi_read_ok = true;
+    _pre_erase_ok = true;
     return 0;
 }
 
 int SDFileSystem::disk_write(const uint8_t* buffer, uint32_t block_number, uint32_t count) {
     if (!_is_initialized) {
         return -1;
-    }		
-    for (uint32_t b = block_number; b < block_number + count; b++) {
+    }
+    uint32_t start = us_ticker_read();
+    uint32_t done = 0;
+    if (count > 1 && _multi_write_ok) {
+        done = _write_multi(buffer, block_number, count);
+        if (done < count) {
+            _write_stats.fallbacks++;
+        }
+    }
+    for (uint32_t b = block_number + done; b < block_number + count; b++) {
         // set write address for single block (CMD24)
         if (_cmd(24, b * cdv) != 0) {
+            _write_stats.total_us += us_ticker_read() - start;
             return 1;
         }
         
         // send the data block
-        _write(buffer, 512);
-        buffer += 512;
+        if (_write(buffer + ((b - block_number) * 512), 512) != 0) {
+            _write_stats.total_us += us_ticker_read() - start;
+            return 1;
+        }
+        _write_stats.single_writes++;
+        _write_stats.blocks++;
     }
+    _write_stats.total_us += us_ticker_read() - start;
     return 0;
 }
 
+uint32_t SDFileSystem::_write_multi(const uint8_t* buffer, uint32_t block_number, uint32_t count) {
+    if (_pre_erase_ok) {
+        // ACMD23, a hint only, so a card that does not take it just loses the pre-erase
+        _cmd(55, 0);
+        if (_cmd(23, count) & R1_ILLEGAL_COMMAND) {
+            _pre_erase_ok = false;
+        }
+    }
+    int r1 = _cmd(25, block_number * cdv);
+    if (r1 != 0) {
+        if (r1 > 0 && (r1 & R1_ILLEGAL_COMMAND)) {
+            debug_if(SD_DBG, "CMD25 rejected, using single block writes\n");
+            _multi_write_ok = false;
+        }
+        return 0;
+    }
+    _cs->write(0);
+    uint32_t done = 0;
+    for (; done < count; done++) {
+        if (!_wait_ready(SD_WRITE_TIMEOUT_US)) {
+            break;
+        }
+        _spi->write(SD_TOKEN_START_MULTI_WRITE);
+        _send(buffer, 512);
+        // write the checksum
+        _spi->write(0xFF);
+        _spi->write(0xFF);
+        // check the response token
+        if ((_spi->write(0xFF) & 0x1F) != 0x05) {
+            break;
+        }
+        buffer += 512;
+    }
+    // end the transfer. Blocks that were not acknowledged are written again one by one
+    _wait_ready(SD_WRITE_TIMEOUT_US);
+    _spi->write(SD_TOKEN_STOP_TRAN);
+    _spi->write(0xFF); // the card only starts signalling busy one byte after the token
+    _wait_ready(SD_WRITE_TIMEOUT_US);
+    _cs->write(1);
+    _spi->write(0xFF);
+    _write_stats.multi_writes++;
+    _write_stats.blocks += done;
+    return done;
+}
+
+bool SDFileSystem::_wait_ready(uint32_t timeout_us) {
+    uint32_t start = us_ticker_read();
+    while (_spi->write(0xFF) != 0xFF) {
+        if ((us_ticker_read() - start) > timeout_us) {
+            _write_stats.busy_us += us_ticker_read() - start;
+            return false;
+        }
+    }
+    _write_stats.busy_us += us_ticker_read() - start;
+    return true;
+}
+
+void SDFileSystem::clear_write_stats() {
+    _write_stats.blocks = 0;
+    _write_stats.multi_writes = 0;
+    _write_stats.single_writes = 0;
+    _write_stats.fallbacks = 0;
+    _write_stats.busy_us = 0;
+    _write_stats.total_us = 0;
+}
+
+const sd_write_stats_t& SDFileSystem::write_stats() {
+    return _write_stats;
+}
+
+void SDFileSystem::clear_read_stats() {
+    _read_stats.blocks = 0;
+    _read_stats.multi_reads = 0;
+    _read_stats.single_reads = 0;
+    _read_stats.fallbacks = 0;
+    _read_stats.total_us = 0;
+}
+
+const sd_read_stats_t& SDFileSystem::read_stats() {
+    return _read_stats;
+}
+
 int SDFileSystem::disk_read(uint8_t* buffer, uint32_t block_number, uint32_t count) {
     if (!_is_initialized) {
         return -1;
     }
-    for (uint32_t b = block_number; b < block_number + count; b++) {
+    uint32_t start = us_ticker_read();
+    uint32_t done = 0;
+    if (count > 1 && _multi_read_ok) {
+        done = _read_multi(buffer, block_number, count);
+        if (done < count) {
+            _read_stats.fallbacks++;
+        }
+    }
+    for (uint32_t b = block_number + done; b < block_number + count; b++) {
         // set read address for single block (CMD17)
         if (_cmd(17, b * cdv) != 0) {
+            _read_stats.total_us += us_ticker_read() - start;
             return 1;
         }
         
         // receive the data
-        _read(buffer, 512);
-        buffer += 512;
-    }		
+        if (_read(buffer + ((b - block_number) * 512), 512) != 0) {
+            _read_stats.total_us += us_ticker_read() - start;
+            return 1;
+        }
+        _read_stats.single_reads++;
+        _read_stats.blocks++;
+    }
+    _read_stats.total_us += us_ticker_read() - start;
     return 0;
 }
 
+uint32_t SDFileSystem::_read_multi(uint8_t* buffer, uint32_t block_number, uint32_t count) {
+    // CS stays low after the response, the data blocks follow right away
+    int r1 = _cmdx(18, block_number * cdv);
+    if (r1 != 0) {
+        if (r1 > 0) {
+            _cs->write(1);
+            _spi->write(0xFF);
+            if (r1 & R1_ILLEGAL_COMMAND) {
+                debug_if(SD_DBG, "CMD18 rejected, using single block reads\n");
+                _multi_read_ok = false;
+            }
+        }
+        return 0;
+    }
+    uint32_t done = 0;
+    for (; done < count; done++) {
+        // wait for the start token, anything else that is not 0xFF is an error token
+        uint32_t wait_start = us_ticker_read();
+        int token = _spi->write(0xFF);
+        while (token == 0xFF && (us_ticker_read() - wait_start) < SD_READ_TIMEOUT_US) {
+            token = _spi->write(0xFF);
+        }
+        if (token != SD_TOKEN_START_BLOCK) {
+            break;
+        }
+        _receive(buffer, 512);
+        _spi->write(0xFF); // checksum
+        _spi->write(0xFF);
+        buffer += 512;
+    }
+    // STOP_TRANSMISSION (CMD12)
+    _spi->write(0x40 | 12);
+    _spi->write(0x00);
+    _spi->write(0x00);
+    _spi->write(0x00);
+    _spi->write(0x00);
+    _spi->write(0x95);
+    _spi->write(0xFF); // stuff byte
+    for (int i = 0; i < SD_COMMAND_TIMEOUT; i++) {
+        if (!(_spi->write(0xFF) & 0x80)) {
+            break;
+        }
+    }
+    // R1b, wait for the busy signal to clear
+    uint32_t busy_start = us_ticker_read();
+    while (_spi->write(0xFF) != 0xFF && (us_ticker_read() - busy_start) < SD_READ_TIMEOUT_US);
+    _cs->write(1);
+    _spi->write(0xFF);
+    _read_stats.multi_reads++;
+    _read_stats.blocks += done;
+    return done;
+}
+
 int SDFileSystem::disk_status() 
 {
     if (_is_initialized) {
@@ -397,16 +596,20 @@ int SDFileSystem::_cmd8() {
 
 int SDFileSystem::_read(uint8_t *buffer, uint32_t length) {
     _cs->write(0);
-    // read until start byte (0xFF)
-    while (_spi->write(0xFF) != 0xFE); 
+    // read until start byte (0xFE), give up on an error token or timeout
+    uint32_t start = us_ticker_read();
+    int token = _spi->write(0xFF);
+    while (token == 0xFF && (us_ticker_read() - start) < SD_READ_TIMEOUT_US) {
+        token = _spi->write(0xFF);
+    }
+    if (token != SD_TOKEN_START_BLOCK) {
+        _cs->write(1);
+        _spi->write(0xFF);
+        return 1;
+    }
     
-//	uint8_t writeval[1] = {0xFF};
-//    _spi->bulkReadWrite(buffer, writeval, length, false);
-	
     // read data
-    for (uint32_t i = 0; i < length; i++) {
-        buffer[i] = _spi->write(0xFF);
-    }
+    _receive(buffer, length);
 
     _spi->write(0xFF); // checksum
     _spi->write(0xFF);
@@ -422,12 +625,8 @@ int SDFileSystem::_write(const uint8_t*buffer, uint32_t length) {
     // indicate start of block
     _spi->write(0xFE);
     
-//    _spi->bulkWrite((uint8_t*)buffer, length);
-
     // write the data
-    for (uint32_t i = 0; i < length; i++) {
-        _spi->write(buffer[i]);
-    }
+    _send(buffer, length);
 	
     // write the checksum
     _spi->write(0xFF);
@@ -441,12 +640,38 @@ int SDFileSystem::_write(const uint8_t*buffer, uint32_t length) {
     }
 
     // wait for write to finish
-    while (_spi->write(0xFF) == 0);
+    bool ready = _wait_ready(SD_WRITE_TIMEOUT_US);
     
     _cs->write(1);
     _spi->write(0xFF);
 
-    return 0;
+    return ready ? 0 : 1;
+}
+
+void SDFileSystem::_receive(uint8_t *buffer, uint32_t length) {
+    // DMA blocks the calling thread until the transfer is done, so interrupt context keeps the byte loop
+    if (_use_dma && length >= SD_DMA_MIN_LENGTH && __get_IPSR() == 0) {
+        uint8_t fill = 0xFF;
+        _spi->bulkReadWrite(buffer, &fill, length, false);
+        return;
+    }
+    for (uint32_t i = 0; i < length; i++) {
+        buffer[i] = _spi->write(0xFF);
+    }
+}
+
+void SDFileSystem::_send(const uint8_t *buffer, uint32_t length) {
+    if (_use_dma && length >= SD_DMA_MIN_LENGTH && __get_IPSR() == 0) {
+        _spi->bulkWrite((uint8_t*)buffer, length);
+        return;
+    }
+    for (uint32_t i = 0; i < length; i++) {
+        _spi->write(buffer[i]);
+    }
+}
+
+void SDFileSystem::set_dma(bool enable) {
+    _use_dma = enable;
 }
 
 static uint32_t ext_bits(unsigned char *data, int msb, int lsb) {
@@ -27,6 +27,27 @@
 #include "RTOS_SPI.h"
 #include <stdint.h>
 
+/** Write throughput counters of an SDFileSystem
+ */
+typedef struct {
+    uint32_t blocks;        // 512 byte blocks written
+    uint32_t multi_writes;  // CMD25 transfers
+    uint32_t single_writes; // CMD24 transfers
+    uint32_t fallbacks;     // multi block writes that had to be finished one block at a time
+    uint32_t busy_us;       // time spent waiting for the card to program
+    uint32_t total_us;      // time spent in disk_write
+} sd_write_stats_t;
+
+/** Read throughput counters of an SDFileSystem
+ */
+typedef struct {
+    uint32_t blocks;        // 512 byte blocks read
+    uint32_t multi_reads;   // CMD18 transfers
+    uint32_t single_reads;  // CMD17 transfers
+    uint32_t fallbacks;     // multi block reads that had to be finished one block at a time
+    uint32_t total_us;      // time spent in disk_read
+} sd_read_stats_t;
+
 /** Access the filesystem on an SD Card using SPI
  *
  * @code
@@ -58,6 +79,18 @@ public:
     virtual int disk_write(const uint8_t* buffer, uint32_t block_number, uint32_t count);
     virtual int disk_sync();
     virtual uint32_t disk_sectors();
+
+    /** Counters of the transfers done since the object was created or the clear function was called
+     */
+    const sd_write_stats_t& write_stats();
+    void clear_write_stats();
+    const sd_read_stats_t& read_stats();
+    void clear_read_stats();
+
+    /** Moves data blocks with GPDMA (default) or byte by byte. With DMA the calling thread sleeps while
+     * a block is in flight, so other threads get the CPU in the meantime
+     */
+    void set_dma(bool enable);
     
 protected:
 
@@ -71,6 +104,11 @@ protected:
     
     int _read(uint8_t * buffer, uint32_t length);
     int _write(const uint8_t *buffer, uint32_t length);
+    uint32_t _write_multi(const uint8_t *buffer, uint32_t block_number, uint32_t count);
+    uint32_t _read_multi(uint8_t *buffer, uint32_t block_number, uint32_t count);
+    bool _wait_ready(uint32_t timeout_us);
+    void _receive(uint8_t *buffer, uint32_t length);
+    void _send(const uint8_t *buffer, uint32_t length);
     uint32_t _sd_sectors();
     uint32_t _sectors;
 
@@ -84,6 +122,12 @@ protected:
     DigitalOut* _cs;
     int cdv;
 		int _is_initialized;
+    bool _multi_write_ok;
+    bool _multi_read_ok;
+    bool _pre_erase_ok;
+    bool _use_dma;
+    sd_write_stats_t _write_stats;
+    sd_read_stats_t _read_stats;
 };
 
 #endif
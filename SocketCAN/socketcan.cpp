@@ -27,6 +27,7 @@
 
 
 #include "socketcan.h"
+#include "timebase.h"
 
 Serial ftdi(FTDI_TX, FTDI_RX);//Serial object for FTDI
 
@@ -68,9 +69,9 @@ void SocketCAN::start(Buttons* buttons)
 	}
 }
 
-void SocketCAN::resetTimerScheduler()
+uint16_t SocketCAN::getTimestamp(uint64_t time)
 {
-	timer.reset();
+	return (uint16_t)((time / 1000) % (MAX_TIMESTAMP + 1));
 }
 
 void SocketCAN::commandQueue()
@@ -438,6 +439,7 @@ void SocketCAN::processCommand()
 				replyLen++;
 				break;
 			}
+			uint64_t rxTime = Timebase::now();
 			memset(params,0,64);
 			if(can_msg.id < 0x800)//if standard ID
 			{
@@ -465,7 +467,7 @@ void SocketCAN::processCommand()
 				}
 				if(isTimeStampEnabled == true)//if timestamp is enabled
 				{
-					uint16_t currentTime= timer.read_ms();
+					uint16_t currentTime= getTimestamp(rxTime);
 					memset(params,0,64);
 					convert.itox(currentTime, params, 4);
 					for(uint8_t a=0; a<4; a++)
@@ -503,7 +505,7 @@ void SocketCAN::processCommand()
 				}
 				if(isTimeStampEnabled == true)//if timestamp is enabled
 				{
-					uint16_t currentTime= timer.read_ms();
+					uint16_t currentTime= getTimestamp(rxTime);
 					memset(params,0,64);
 					convert.itox(currentTime, params, 4);
 					for(uint8_t a=0; a<4; a++)
@@ -541,6 +543,7 @@ void SocketCAN::processCommand()
 			CANMessage can_msg(0,CANAny);//create a message for any kind of ID
 			while(_canbus->read(can_msg) != 0)//while there are frames in buffer
 			{
+				uint64_t rxTime = Timebase::now();
 				memset(params,0,64);
 				if(can_msg.id < 0x800)//if standard ID
 				{
@@ -567,7 +570,7 @@ void SocketCAN::processCommand()
 					}
 					if(isTimeStampEnabled == true)//if timestamp is enabled
 					{
-						uint16_t currentTime= timer.read_ms();
+						uint16_t currentTime= getTimestamp(rxTime);
 						memset(params,0,64);
 						convert.itox(currentTime, params, 4);
 						for(uint8_t a=0; a<4; a++)
@@ -604,7 +607,7 @@ void SocketCAN::processCommand()
 					}
 					if(isTimeStampEnabled == true)//if timestamp is enabled
 					{
-						uint16_t currentTime= timer.read_ms();
+						uint16_t currentTime= getTimestamp(rxTime);
 						memset(params,0,64);
 						convert.itox(currentTime, params, 4);
 						for(uint8_t a=0; a<4; a++)
@@ -806,21 +809,13 @@ void SocketCAN::processCommand()
 			{
 				case '0'://disable
 				{
-					if(isTimeStampEnabled == true)
-					{
-						timer.stop();
-						timer.reset();
-						isTimeStampEnabled =false;
-						resetTimer.detach();
-					}
-
+					isTimeStampEnabled =false;
+					break;
 				}
-				case '1':
+				case '1'://timestamps come from the shared timebase, nothing to start
 				{
-					timer.reset();
-					timer.start();
 					isTimeStampEnabled =true;
-					resetTimer.attach(this,&SocketCAN::resetTimerScheduler, 60.0);
+					break;
 				}
 			}
 			reply[replyLen] = 0xD;
@@ -855,6 +850,7 @@ void SocketCAN::getCANFrame()
 	char reply[64];
 	uint8_t replyLen=0;
 	memset(reply,0,64);
+	uint64_t rxTime = Timebase::now();//sample at interrupt entry, before the frames are formatted
 	CANMessage can_msg(0,CANAny);//create a message for any kind of ID
 	while(_canbus->read(can_msg) != 0)//while there are frames in buffer
 	{
@@ -884,7 +880,7 @@ void SocketCAN::getCANFrame()
 			}
 			if(isTimeStampEnabled == true)//if timestamp is enabled
 			{
-				uint16_t currentTime= timer.read_ms();
+				uint16_t currentTime= getTimestamp(rxTime);
 				memset(params,0,64);
 				convert.itox(currentTime, params, 4);
 				for(uint8_t a=0; a<4; a++)
@@ -921,7 +917,7 @@ void SocketCAN::getCANFrame()
 			}
 			if(isTimeStampEnabled == true)//if timestamp is enabled
 			{
-				uint16_t currentTime= timer.read_ms();
+				uint16_t currentTime= getTimestamp(rxTime);
 				memset(params,0,64);
 				convert.itox(currentTime, params, 4);
 				for(uint8_t a=0; a<4; a++)
@@ -84,13 +84,14 @@ class SocketCAN
 
 		void updateStatusByte();//used to update the status byte. Called with a tick
 
-		void resetTimerScheduler();//resets the timer for timestamp
 
 
 
 
   private:
 
+	uint16_t getTimestamp(uint64_t time);//ms within the minute of a Timebase time, as SLCAN wants it
+
 	CAN* _canbus;
 
 	uint8_t _interfaceNo;
@@ -105,8 +106,6 @@ class SocketCAN
 	Serial* ftdi;//Serial port used by ftdi
 	uint32_t CANStatus;//used to store the status of the CAN peripheral
 	bool isTimeStampEnabled;//used to know if the time stamp should be used
-	Timer timer;//used in timestamp;
-	Ticker resetTimer; //used to reset the timer every 60 seconds
 	Conversions convert;
 	uint32_t perfCounter;//used only for test
 
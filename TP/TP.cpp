@@ -33,6 +33,7 @@ TPHandler::TPHandler(CAN *canbus)
 {
 	_canbus=canbus;
 	_cb = new CANbadger_CAN(_canbus);
+	_cb->startRxRing();//replies are buffered from the RX interrupt, so none get lost between reads
 	useFullFrame = 1; 
 	bsByte = 0x00;
 	variant = 0;
@@ -76,10 +77,7 @@ void TPHandler::disableFilters()
 		rID = (rID + 0x80000000);
 		ownID = (ownID + 0x80000000);
 	}
-	_cb->CANx_ObjectSetFilter(ARM_CAN_FILTER_ID_EXACT_REMOVE, rID, rID, 1);//clean up
-	_cb->CANx_ObjectSetFilter(ARM_CAN_FILTER_ID_EXACT_REMOVE, rID, rID, 2);
-	_cb->CANx_ObjectSetFilter(ARM_CAN_FILTER_ID_EXACT_REMOVE, ownID, ownID, 1);
-	_cb->CANx_ObjectSetFilter(ARM_CAN_FILTER_ID_EXACT_REMOVE, ownID, ownID, 2);
+	_cb->clearFilterTable();//clean up, enableFilters owns the whole table
 	_cb->disableCANFilters();
 	areFiltersActive=false;
 	if(frameFormat == CANExtended)//restore IDS
@@ -96,10 +94,13 @@ void TPHandler::enableFilters()
 		rID = (rID + 0x80000000);
 		ownID = (ownID + 0x80000000);
 	}
-	_cb->CANx_ObjectSetFilter(ARM_CAN_FILTER_ID_EXACT_ADD, rID, rID, 1);//enable filtering for ease of traffic handling
-	_cb->CANx_ObjectSetFilter(ARM_CAN_FILTER_ID_EXACT_ADD, rID, rID, 2);
-	_cb->CANx_ObjectSetFilter(ARM_CAN_FILTER_ID_EXACT_ADD, ownID, ownID, 1);
-	_cb->CANx_ObjectSetFilter(ARM_CAN_FILTER_ID_EXACT_ADD, ownID, ownID, 2);
+	uint64_t filterItems[4];
+	CANFilterTable filters(filterItems, 4);
+	filters.addExactID(rID, 1);//enable filtering for ease of traffic handling
+	filters.addExactID(rID, 2);
+	filters.addExactID(ownID, 1);
+	filters.addExactID(ownID, 2);
+	_cb->loadFilterTable(filters);
 	_cb->enableCANFilters();
 	areFiltersActive=true;
 	if(frameFormat == CANExtended)//restore IDS
@@ -34,6 +34,7 @@ TP20Handler::TP20Handler(CAN *canbus, uint8_t interface)
 {
 	_canbus=canbus;
 	_cb = new CANbadger_CAN(_canbus);
+	_cb->startRxRing();//replies are buffered from the RX interrupt, so none get lost between reads
 	ownID=0x200;//standard for TP2.0 channel negotiation
 	rID=0;
 	requestTimeout=TP20_DEFAULT_REQUEST_TIMEOUT;
@@ -594,6 +595,8 @@ void TP20Handler::sendCA(uint8_t wat)
 			keepChannelAlive();
 		}
 		_canbus->attach(0);
+		_cb->stopRxRing();//the line above also removed the ring handler if it was running, so restart it clean
+		_cb->startRxRing();
 		tick.detach();
 		TPtimer.stop();
 		TPtimer.reset();
@@ -611,6 +614,7 @@ void TP20Handler::sendCA(uint8_t wat)
 		{
 			return;
 		}
+		_cb->stopRxRing();//the keepalive handler takes over the RX interrupt
 		_canbus->attach(this,&TP20Handler::keepChannelAlive);
 		tick.attach(this,&TP20Handler::checkSessionStatus, 1.0);
 		TPtimer.start();
@@ -666,20 +670,20 @@ void TP20Handler::keepChannelAlive()
 
 void TP20Handler::disableFilters()
 {
-	_cb->CANx_ObjectSetFilter(ARM_CAN_FILTER_ID_EXACT_REMOVE, rID, rID, 1);//clean up
-	_cb->CANx_ObjectSetFilter(ARM_CAN_FILTER_ID_EXACT_REMOVE, rID, rID, 2);
-	_cb->CANx_ObjectSetFilter(ARM_CAN_FILTER_ID_EXACT_REMOVE, ownID, ownID, 1);
-	_cb->CANx_ObjectSetFilter(ARM_CAN_FILTER_ID_EXACT_REMOVE, ownID, ownID, 2);
+	_cb->clearFilterTable();//clean up, enableFilters owns the whole table
 	_cb->disableCANFilters();
 	areFiltersActive=false;
 }
 
 void TP20Handler::enableFilters()
 {
-	_cb->CANx_ObjectSetFilter(ARM_CAN_FILTER_ID_EXACT_ADD, rID, rID, 1);//enable filtering for ease of traffic handling
-	_cb->CANx_ObjectSetFilter(ARM_CAN_FILTER_ID_EXACT_ADD, rID, rID, 2);
-	_cb->CANx_ObjectSetFilter(ARM_CAN_FILTER_ID_EXACT_ADD, ownID, ownID, 1);
-	_cb->CANx_ObjectSetFilter(ARM_CAN_FILTER_ID_EXACT_ADD, ownID, ownID, 2);
+	uint64_t filterItems[4];
+	CANFilterTable filters(filterItems, 4);
+	filters.addExactID(rID, 1);//enable filtering for ease of traffic handling
+	filters.addExactID(rID, 2);
+	filters.addExactID(ownID, 1);
+	filters.addExactID(ownID, 2);
+	_cb->loadFilterTable(filters);
 	_cb->enableCANFilters();
 	areFiltersActive=true;
 }
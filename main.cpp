@@ -26,11 +26,14 @@
 #include "canbadger.h"
 #include "canbadger_settings.hpp"
 #include "ethernet_manager.hpp"
+#include "timebase.h"
 
 char cbMac[6];//used to store the ethernet mac, which is derived from the eeprom UID
 
 int main()
 {
+	Timebase::start();//every timestamp on the device comes from here
+
 	//setting up the EthernetManager
 	CANbadger canbadger;
 
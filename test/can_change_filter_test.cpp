@@ -0,0 +1,259 @@
+/*
+* CanBadger CAN Change Filter Test
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Feeds CANChangeFilter a minute of an idle bus: mostly periodic IDs with a fixed payload, a few rolling counters and a
+few values that change now and then, on both buses, with the us clock wrapping on the way. Checks that change-only
+logging cuts the frames by an order of magnitude, that keyframes come no later than the time or frame limit allows, and
+that the skip counts handed to the log add up to what was left out, per ID.
+*/
+
+#include "test_common.h"
+#include "can_change_filter.h"
+
+#define TRACE_IDS 40
+#define TRACE_MS 60000
+#define TRACE_START (0xFFFFFFFF - 5000000) //the us clock wraps 5 s in
+
+struct TraceID
+{
+	uint8_t bus;
+	uint32_t id;
+	uint8_t format;
+	uint32_t period;//in ms
+	uint32_t changeEvery;//frames between payload changes, 1 for a counter, 0 for never
+	uint32_t sent;
+	uint32_t logged;
+	uint32_t skippedSum;//skip counts handed back with the logged frames
+	uint32_t sinceLogged;//frames left out since the last logged one, as the test counts them
+	uint32_t lastLogged;//ms
+	uint32_t maxGap;//longest time between two logged frames, in ms
+	uint32_t minGap;
+	uint32_t maxSkipped;
+};
+
+static TraceID trace[TRACE_IDS];
+
+static void makeTrace()
+{
+	static const uint32_t periods[] = {10, 20, 50, 100, 200, 500, 1000};
+	for(uint32_t a = 0; a < TRACE_IDS; a++)
+	{
+		memset(&trace[a], 0, sizeof(TraceID));
+		trace[a].bus = (a & 1) + 1;
+		trace[a].format = ((a % 5) == 4) ? CANExtended : CANStandard;
+		trace[a].id = (trace[a].format == CANExtended) ? (0x18FF0000 + a) : (0x100 + (a * 0x11));
+		trace[a].period = periods[a % 7];
+		trace[a].changeEvery = (a < 2) ? 1 : ((a < 4) ? 500 : 0);
+		trace[a].minGap = 0xFFFFFFFF;
+	}
+	trace[0].period = 100;//the counters on slower IDs, as on a real idle bus
+	trace[1].period = 200;
+}
+
+static void payload(const TraceID &t, uint8_t *data)
+{
+	uint32_t version = (t.changeEvery == 0) ? 0 : (t.sent / t.changeEvery);
+	for(uint8_t a = 0; a < 8; a++)
+	{
+		data[a] = (uint8_t)((t.id >> (a & 3)) + a);
+	}
+	data[7] = (uint8_t)version;
+}
+
+// runs the trace through the filter, returns the frames sent
+static uint32_t replay(CANChangeFilter *filter)
+{
+	makeTrace();
+	uint32_t frames = 0;
+	for(uint32_t ms = 0; ms < TRACE_MS; ms++)
+	{
+		for(uint32_t a = 0; a < TRACE_IDS; a++)
+		{
+			TraceID &t = trace[a];
+			if((ms % t.period) != (a % t.period))
+			{
+				continue;
+			}
+			uint8_t data[8];
+			payload(t, data);
+			uint8_t skipped = 0xEE;
+			if(filter->check(t.bus, t.id, t.format, data, 8, TRACE_START + (ms * 1000), skipped))
+			{
+				if(t.logged != 0 && (ms - t.lastLogged) > t.maxGap)
+				{
+					t.maxGap = (ms - t.lastLogged);
+				}
+				if(t.logged != 0 && (ms - t.lastLogged) < t.minGap)
+				{
+					t.minGap = (ms - t.lastLogged);
+				}
+				CHECK_EQUAL(t.sinceLogged, skipped);
+				t.logged++;
+				t.skippedSum += skipped;
+				t.sinceLogged = 0;
+				t.lastLogged = ms;
+			}
+			else
+			{
+				t.sinceLogged++;
+				if(t.sinceLogged > t.maxSkipped)
+				{
+					t.maxSkipped = t.sinceLogged;
+				}
+			}
+			t.sent++;
+			frames++;
+		}
+	}
+	return frames;
+}
+
+// per ID the frames add up, and the filter counted what the test saw
+static void checkCounts(CANChangeFilter *filter, uint32_t frames)
+{
+	CHECK_EQUAL(TRACE_IDS, filter->getIDCount());
+	uint32_t logged = 0;
+	CANChangeEntry entry;
+	for(uint32_t a = 0; a < TRACE_IDS; a++)
+	{
+		CHECK(filter->getEntry(a, entry));
+		TraceID *t = NULL;
+		for(uint32_t b = 0; b < TRACE_IDS && t == NULL; b++)//entries are in the order the IDs were first seen
+		{
+			if(trace[b].id == entry.id && trace[b].bus == entry.bus && trace[b].format == entry.format)
+			{
+				t = &trace[b];
+			}
+		}
+		if(!CHECK(t != NULL))
+		{
+			continue;
+		}
+		CHECK_EQUAL(t->sent, t->logged + t->skippedSum + t->sinceLogged);
+		CHECK_EQUAL(t->sent - t->logged, entry.suppressed);
+		CHECK_EQUAL(t->sinceLogged, entry.skipped);
+		logged += t->logged;
+	}
+	CHECK(!filter->getEntry(TRACE_IDS, entry));
+	CHECK_EQUAL(logged, filter->getPassedCount());
+	CHECK_EQUAL(frames - logged, filter->getSuppressedCount());
+}
+
+// with the default 1 s keyframes, an unchanged ID is logged about once a second whatever its period
+static void testIdleBus()
+{
+	CANChangeFilter *filter = CANChangeFilter::getFilter();
+	filter->setKeyframe(CAN_CHANGE_FILTER_KEYFRAME_TIME, CAN_CHANGE_FILTER_KEYFRAME_FRAMES);
+	CHECK(filter->start());
+	uint32_t frames = replay(filter);
+	checkCounts(filter, frames);
+	uint32_t logged = filter->getPassedCount();
+	for(uint32_t a = 0; a < TRACE_IDS; a++)
+	{
+		if(trace[a].changeEvery == 1)//counters change every frame, nothing is left out
+		{
+			CHECK_EQUAL(trace[a].sent, trace[a].logged);
+			continue;
+		}
+		CHECK(trace[a].maxGap < (CAN_CHANGE_FILTER_KEYFRAME_TIME + trace[a].period));//the first frame after the keyframe time
+		CHECK(trace[a].minGap >= CAN_CHANGE_FILTER_KEYFRAME_TIME || trace[a].changeEvery != 0);//and not before, across the clock wrap too
+		CHECK(trace[a].maxSkipped <= CAN_CHANGE_FILTER_MAX_SKIP);
+	}
+	CHECK((logged * 10) < frames);
+	printf("idle bus: %u frames in %u s, %u logged (%.1f%%), %u left out\n", frames, TRACE_MS / 1000, logged,
+		(100.0 * logged) / frames, filter->getSuppressedCount());
+	filter->stop();
+	uint8_t skipped = 0xEE;
+	uint8_t data[8];
+	payload(trace[5], data);
+	CHECK(filter->check(trace[5].bus, trace[5].id, trace[5].format, data, 8, TRACE_START, skipped));//stopped, everything goes through
+	CHECK_EQUAL(0, skipped);
+	CHECK_EQUAL(logged, filter->getPassedCount());
+	filter->release();
+	CHECK_EQUAL(0, filter->getIDCount());
+}
+
+// a frame limit keyframes every ID after that many frames, and the skip count never gets past what a log record holds
+static void testFrameLimit()
+{
+	CANChangeFilter *filter = CANChangeFilter::getFilter();
+	filter->setKeyframe(0, 20);
+	CHECK(filter->start());
+	uint32_t frames = replay(filter);
+	checkCounts(filter, frames);
+	for(uint32_t a = 0; a < TRACE_IDS; a++)
+	{
+		if(trace[a].changeEvery == 0)
+		{
+			CHECK_EQUAL(20, trace[a].maxSkipped);
+			CHECK_EQUAL((trace[a].sent + 20) / 21, trace[a].logged);//the first frame, then every 21st
+		}
+		CHECK(trace[a].maxSkipped <= 20);
+	}
+	filter->setKeyframe(0, 0);//no keyframes but the skip limit
+	CHECK(filter->start());
+	frames = replay(filter);
+	checkCounts(filter, frames);
+	for(uint32_t a = 0; a < TRACE_IDS; a++)
+	{
+		if(trace[a].changeEvery == 0)
+		{
+			CHECK_EQUAL(((trace[a].sent > CAN_CHANGE_FILTER_MAX_SKIP) ? CAN_CHANGE_FILTER_MAX_SKIP : (trace[a].sent - 1)), trace[a].maxSkipped);
+			CHECK_EQUAL((trace[a].sent + CAN_CHANGE_FILTER_MAX_SKIP) / (CAN_CHANGE_FILTER_MAX_SKIP + 1), trace[a].logged);
+		}
+	}
+	filter->release();
+	filter->setKeyframe(CAN_CHANGE_FILTER_KEYFRAME_TIME, CAN_CHANGE_FILTER_KEYFRAME_FRAMES);
+}
+
+// IDs past the table are always logged, and so is a new DLC with the same bytes
+static void testLimits()
+{
+	CANChangeFilter *filter = CANChangeFilter::getFilter();
+	CHECK(filter->start());
+	const uint8_t data[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+	uint8_t skipped = 0;
+	for(uint32_t id = 0; id < CAN_CHANGE_FILTER_SIZE; id++)
+	{
+		CHECK(filter->check(1, id, CANStandard, data, 8, 0, skipped));
+		CHECK(!filter->check(1, id, CANStandard, data, 8, 1000, skipped));
+	}
+	CHECK(filter->check(2, 0, CANStandard, data, 8, 0, skipped));//the same ID on the other bus does not fit any more
+	CHECK(filter->check(2, 0, CANStandard, data, 8, 1000, skipped));
+	CHECK_EQUAL(0, skipped);
+	CHECK(filter->check(1, 7, CANStandard, data, 4, 2000, skipped));
+	CHECK_EQUAL(1, skipped);
+	CHECK(!filter->check(1, 7, CANStandard, data, 4, 3000, skipped));
+	CHECK(filter->check(1, 7, CANExtended, data, 4, 3000, skipped));//extended 7 is another ID
+	CHECK_EQUAL(CAN_CHANGE_FILTER_SIZE, filter->getIDCount());
+	filter->release();
+}
+
+int main()
+{
+	testIdleBus();
+	testFrameLimit();
+	testLimits();
+	return testResult("can_change_filter_test");
+}
@@ -0,0 +1,267 @@
+/*
+* CanBadger CAN Filter Table Test
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Checks the LUT CANFilterTable::compile writes into a simulated AF RAM: the exact words of a small table (SFF pairs with the
+lower entry in the upper half word, the disabled padding entry, section order and range merging), then random tables
+against a model of the acceptance filter that looks IDs up the way the LPC17xx does.
+*/
+
+#include "test_common.h"
+#include "can_filter_table.h"
+#include <string.h>
+#include <set>
+#include <vector>
+
+#define AF_SFF_DISABLED 0x37FF //padding the compiler uses: controller 2, disable bit, ID 0x7FF
+
+struct AFRange
+{
+	uint8_t ctrl;
+	uint32_t lo;
+	uint32_t hi;
+};
+
+// what the acceptance filter does with a frame, given the RAM and the section registers
+static bool afAccepts(const uint32_t *ram, const CANFilterLayout &layout, uint8_t ctrl, uint32_t id, bool extended)
+{
+	if(!extended)
+	{
+		for(uint32_t w = (layout.sffStart / 4); w < (layout.sffGrpStart / 4); w++)
+		{
+			for(uint8_t half = 0; half < 2; half++)
+			{
+				uint32_t entry = (half == 0) ? (ram[w] >> 16) : (ram[w] & 0xFFFF);
+				if((entry & (1 << 12)) == 0 && (entry >> 13) == ctrl && (entry & 0x7FF) == id)
+				{
+					return true;
+				}
+			}
+		}
+		for(uint32_t w = (layout.sffGrpStart / 4); w < (layout.effStart / 4); w++)
+		{
+			uint32_t lo = (ram[w] >> 16);
+			uint32_t hi = (ram[w] & 0xFFFF);
+			if((lo & (1 << 12)) == 0 && (lo >> 13) == ctrl && (hi >> 13) == ctrl && id >= (lo & 0x7FF) && id <= (hi & 0x7FF))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+	for(uint32_t w = (layout.effStart / 4); w < (layout.effGrpStart / 4); w++)
+	{
+		if((ram[w] >> 29) == ctrl && (ram[w] & 0x1FFFFFFF) == id)
+		{
+			return true;
+		}
+	}
+	for(uint32_t w = (layout.effGrpStart / 4); (w + 1) < (layout.endOfTable / 4); w += 2)
+	{
+		if((ram[w] >> 29) == ctrl && (ram[w + 1] >> 29) == ctrl && id >= (ram[w] & 0x1FFFFFFF) && id <= (ram[w + 1] & 0x1FFFFFFF))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// the hardware searches each section in order, so the entries have to ascend by controller and ID
+static bool sectionsSorted(const uint32_t *ram, const CANFilterLayout &layout)
+{
+	uint32_t last = 0;
+	for(uint32_t w = (layout.sffStart / 4); w < (layout.sffGrpStart / 4); w++)
+	{
+		uint32_t upper = (ram[w] >> 16);
+		uint32_t lower = (ram[w] & 0xFFFF);
+		uint32_t upperKey = (((upper >> 13) << 11) | (upper & 0x7FF));
+		uint32_t lowerKey = (((lower >> 13) << 11) | (lower & 0x7FF));
+		if(upperKey < last || (lower != AF_SFF_DISABLED && lowerKey <= upperKey))
+		{
+			return false;
+		}
+		last = lowerKey;
+	}
+	last = 0;
+	for(uint32_t w = (layout.effStart / 4); w < (layout.effGrpStart / 4); w++)
+	{
+		if(w > (layout.effStart / 4) && ram[w] <= last)
+		{
+			return false;
+		}
+		last = ram[w];
+	}
+	return true;
+}
+
+static void testLayout()
+{
+	uint64_t work[32];
+	CANFilterTable table(work, 32);
+	CHECK(table.addExactID(0x200, 1));
+	CHECK(table.addExactID(0x100, 1));
+	CHECK(table.addExactID(0x050, 2));//controller 2 sorts after every controller 1 entry
+	CHECK(table.addExactID(0x123, 1));
+	CHECK(table.addExactID(0x100, 1));//duplicate, dropped
+	CHECK(table.addExactID(0x7FF, 1));
+	CHECK(table.addRange(0x30F, 0x300, 1));//reversed bounds are swapped
+	CHECK(table.addRange(0x305, 0x320, 1));//overlaps, merged into 0x300-0x320
+	CHECK(table.addRange(0x321, 0x330, 1));//touches, merged too
+	CHECK(table.addRange(0x321, 0x330, 2));//other controller, kept apart
+	CHECK(table.addExactID(CAN_FILTER_IDE_FLAG | 0x12345, 2));
+	CHECK(table.addExactID(CAN_FILTER_IDE_FLAG | 0x00042, 2));
+	CHECK(table.addRange(CAN_FILTER_IDE_FLAG | 0x1000, CAN_FILTER_IDE_FLAG | 0x1FFF, 1));
+	CHECK(table.addRange(CAN_FILTER_IDE_FLAG | 0x1800, CAN_FILTER_IDE_FLAG | 0x2FFF, 1));
+	CHECK(!table.addExactID(0x100, 3));
+	uint32_t ram[CAN_AF_RAM_WORDS];
+	memset(ram, 0xA5, sizeof(ram));
+	CANFilterLayout layout;
+	CHECK(table.compile(ram, CAN_AF_RAM_WORDS, layout));
+	CHECK_EQUAL(0, layout.sffStart);
+	CHECK_EQUAL(12, layout.sffGrpStart);
+	CHECK_EQUAL(20, layout.effStart);
+	CHECK_EQUAL(28, layout.effGrpStart);
+	CHECK_EQUAL(36, layout.endOfTable);
+	CHECK_EQUAL(0x01000123, ram[0]);//lower entry in the upper half word
+	CHECK_EQUAL(0x020007FF, ram[1]);
+	CHECK_EQUAL((0x2050U << 16) | AF_SFF_DISABLED, ram[2]);//odd count, padded with a disabled entry
+	CHECK_EQUAL(0x03000330, ram[3]);
+	CHECK_EQUAL(0x23212330, ram[4]);
+	CHECK_EQUAL(0x20000042, ram[5]);
+	CHECK_EQUAL(0x20012345, ram[6]);
+	CHECK_EQUAL(0x00001000, ram[7]);
+	CHECK_EQUAL(0x00002FFF, ram[8]);
+	CHECK_EQUAL(0xA5A5A5A5, ram[9]);//nothing written past the end of the table
+	CHECK(sectionsSorted(ram, layout));
+}
+
+static void testEmptyAndFull()
+{
+	uint64_t work[CAN_AF_RAM_WORDS * 2 + 1];
+	CANFilterTable table(work, CAN_AF_RAM_WORDS * 2 + 1);
+	uint32_t ram[CAN_AF_RAM_WORDS];
+	CANFilterLayout layout;
+	CHECK(table.compile(ram, CAN_AF_RAM_WORDS, layout));
+	CHECK_EQUAL(0, layout.endOfTable);
+	for(uint32_t a = 0; a < (CAN_AF_RAM_WORDS + 1); a++)//one word too many
+	{
+		table.addExactID(CAN_FILTER_IDE_FLAG | a, 1);
+	}
+	memset(ram, 0xA5, sizeof(ram));
+	CHECK(!table.compile(ram, CAN_AF_RAM_WORDS, layout));
+	CHECK_EQUAL(0xA5A5A5A5, ram[0]);//nothing written when it does not fit
+	table.clear();
+	for(uint32_t a = 0; a < (CAN_AF_RAM_WORDS * 2); a++)//1024 standard IDs pack into exactly 512 words
+	{
+		table.addExactID(a & 0x7FF, (a < 0x800) ? 1 : 2);
+	}
+	CHECK(table.compile(ram, CAN_AF_RAM_WORDS, layout));
+	CHECK_EQUAL(CAN_AF_RAM_WORDS * 4, layout.endOfTable);
+	CHECK(table.addExactID(0x123, 1));//last free slot of the work buffer
+	CHECK(!table.addExactID(0x124, 1));//work buffer full
+}
+
+static void testRandomTables()
+{
+	const uint32_t workSize = 600;
+	static uint64_t work[600];
+	uint32_t ram[CAN_AF_RAM_WORDS];
+	uint32_t mismatches = 0;
+	uint32_t unsorted = 0;
+	for(uint32_t round = 0; round < 300; round++)
+	{
+		CANFilterTable table(work, workSize);
+		std::set<uint64_t> exact;//controller, extended flag and ID
+		std::vector<AFRange> stdRanges;
+		std::vector<AFRange> extRanges;
+		uint32_t entries = (testRandom() % 200);
+		for(uint32_t a = 0; a < entries; a++)
+		{
+			uint8_t ctrl = (testRandom() & 1);
+			bool extended = ((testRandom() & 3) == 0);
+			uint32_t idMask = extended ? 0x3FFF : 0x7FF;//small extended space so ranges and IDs collide
+			uint32_t id = (testRandom() & idMask);
+			if((testRandom() & 7) == 0)
+			{
+				uint32_t end = (id + (testRandom() & 0x3F)) & idMask;
+				table.addRange(id | (extended ? CAN_FILTER_IDE_FLAG : 0), end | (extended ? CAN_FILTER_IDE_FLAG : 0), ctrl + 1);
+				AFRange range = {ctrl, (id < end) ? id : end, (id < end) ? end : id};
+				(extended ? extRanges : stdRanges).push_back(range);
+			}
+			else
+			{
+				table.addExactID(id | (extended ? CAN_FILTER_IDE_FLAG : 0), ctrl + 1);
+				exact.insert(((uint64_t)ctrl << 40) | ((uint64_t)extended << 32) | id);
+			}
+		}
+		CANFilterLayout layout;
+		if(!table.compile(ram, CAN_AF_RAM_WORDS, layout))
+		{
+			continue;
+		}
+		unsorted += !sectionsSorted(ram, layout);
+		for(uint32_t probe = 0; probe < 2000; probe++)
+		{
+			uint8_t ctrl = (testRandom() & 1);
+			bool extended = (testRandom() & 1);
+			uint32_t id = (testRandom() & (extended ? 0x3FFF : 0x7FF));
+			bool expected = (exact.count(((uint64_t)ctrl << 40) | ((uint64_t)extended << 32) | id) != 0);
+			const std::vector<AFRange> &ranges = extended ? extRanges : stdRanges;
+			for(size_t r = 0; r < ranges.size() && !expected; r++)
+			{
+				expected = (ranges[r].ctrl == ctrl && id >= ranges[r].lo && id <= ranges[r].hi);
+			}
+			mismatches += (afAccepts(ram, layout, ctrl, id, extended) != expected);
+		}
+	}
+	CHECK_EQUAL(0, mismatches);
+	CHECK_EQUAL(0, unsorted);
+}
+
+static void benchCompile()
+{
+	static uint64_t work[1024];
+	uint32_t ram[CAN_AF_RAM_WORDS];
+	CANFilterLayout layout;
+	const uint32_t runs = 2000;
+	uint64_t start = testNowNs();
+	for(uint32_t run = 0; run < runs; run++)
+	{
+		CANFilterTable table(work, 1024);
+		for(uint32_t a = 0; a < 500; a++)
+		{
+			table.addExactID((a * 0x3D1) & 0x7FF, 1 + (a & 1));
+		}
+		table.compile(ram, CAN_AF_RAM_WORDS, layout);
+	}
+	printf("compile of 500 standard IDs: %.1f us on the host\n", (double)(testNowNs() - start) / runs / 1000.0);
+}
+
+int main()
+{
+	testLayout();
+	testEmptyAndFull();
+	testRandomTables();
+	benchCompile();
+	return testResult("can_filter_table_test");
+}
@@ -0,0 +1,686 @@
+/*
+* CanBadger Log Codec Test
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Round trips and fuzzing of the v2 log codec, the v1 converter and the LZ block codec. The fuzz cases damage valid
+logs (flipped, inserted and dropped bytes, truncation) and feed random data. The decoders must never run past their
+input or return nonsense, and they must be back in step at the second sync or the next intact block after the damage.
+*/
+
+#include "test_common.h"
+#include "can_log_convert.h"
+#include "can_log_v2.h"
+#include "can_log_lz.h"
+#include <vector>
+
+struct TestFrame
+{
+	uint8_t bus;
+	bool extended;
+	uint32_t id;
+	uint8_t len;
+	uint8_t data[8];
+	uint32_t time;//us on the device, ms for v1 logs
+	uint32_t skipped;
+	uint32_t totalDrops;//drop counter of the producer when the frame was logged
+};
+
+struct Decoded
+{
+	int result;
+	uint32_t offset;
+	CANLogV2Frame frame;
+};
+
+// cyclic traffic as on a car bus: a fixed set of IDs, mostly standard, with a counter and a few slow changing bytes
+static std::vector<TestFrame> makeTraffic(uint32_t count, uint32_t startTime, bool withMarkers)
+{
+	static const uint32_t ids[8] = {0x0C9, 0x1A0, 0x3E9, 0x7FF, 0x000, 0x18DAF110, 0x0CF00400, 0x1FFFFFFF};
+	std::vector<TestFrame> frames;
+	uint32_t time = startTime;
+	uint32_t drops = 0;
+	for(uint32_t a = 0; a < count; a++)
+	{
+		TestFrame frame;
+		uint32_t pick = (testRandom() % 8);
+		frame.bus = (pick & 1) + 1;
+		frame.extended = (pick >= 5);
+		frame.id = ids[pick];
+		frame.len = ((testRandom() % 4) == 0) ? (testRandom() % 9) : 8;
+		for(uint8_t b = 0; b < 8; b++)
+		{
+			frame.data[b] = (b == 0) ? (uint8_t)a : (uint8_t)((pick * 17) + ((a >> 6) & b));
+		}
+		uint32_t gap = ((testRandom() % 500) == 0) ? (testRandom() % 20000000) : (50 + (testRandom() % 400));
+		time += gap;
+		frame.time = time;
+		frame.skipped = (withMarkers == true && (testRandom() % 16) == 0) ? (testRandom() % 70000) : 0;
+		if(withMarkers == true && (testRandom() % 100) == 0)
+		{
+			drops += (1 + (testRandom() % 300));
+		}
+		frame.totalDrops = drops;
+		frames.push_back(frame);
+	}
+	return frames;
+}
+
+static CANLogV2Header makeHeader()
+{
+	CANLogV2Header header;
+	memset(&header, 0, sizeof(header));
+	header.timebase = CAN_LOG_V2_TIMEBASE;
+	header.speed[0] = 500000;
+	header.speed[1] = 125000;
+	header.busFlags[0] = (CAN_LOG_V2_BUS_LOGGED | CAN_LOG_V2_BUS_EXTENDED);
+	header.busFlags[1] = CAN_LOG_V2_BUS_LOGGED;
+	strcpy(header.fwVersion, "2.1.0");
+	return header;
+}
+
+static std::vector<uint8_t> encodeLog(const std::vector<TestFrame> &frames)
+{
+	CANLogV2Encoder encoder;
+	uint8_t record[CAN_LOG_V2_INDEX_SIZE + CAN_LOG_V2_MAX_RECORD_SIZE];
+	std::vector<uint8_t> log;
+	log.insert(log.end(), record, record + encoder.writeHeader(record, makeHeader()));
+	for(uint32_t a = 0; a < frames.size(); a++)
+	{
+		const TestFrame &frame = frames[a];
+		log.insert(log.end(), record, record + encoder.encodeDrops(frame.totalDrops, record));
+		uint32_t size = encoder.encode(frame.bus, frame.extended, frame.id, frame.data, frame.len, frame.time, record, frame.skipped);
+		CHECK(size <= (CAN_LOG_V2_INDEX_SIZE + CAN_LOG_V2_MAX_RECORD_SIZE));
+		log.insert(log.end(), record, record + size);
+	}
+	log.insert(log.end(), record, record + encoder.finish(record));
+	return log;
+}
+
+// decodes everything after the header, stops at the first record that is cut short
+static std::vector<Decoded> decodeLog(const uint8_t *data, uint32_t len)
+{
+	std::vector<Decoded> records;
+	CANLogV2Decoder decoder;
+	CANLogV2Header header;
+	uint32_t pos = decoder.parseHeader(data, len, header);
+	if(!CHECK(pos != 0))
+	{
+		return records;
+	}
+	while(pos < len)
+	{
+		Decoded record;
+		uint32_t consumed;
+		record.result = decoder.decode(&data[pos], (len - pos), record.frame, consumed);
+		record.offset = pos;
+		if(record.result == CAN_LOG_V2_NEED_MORE)
+		{
+			break;
+		}
+		if(!CHECK(consumed > 0 && consumed <= (len - pos)))
+		{
+			break;
+		}
+		if(record.result == CAN_LOG_V2_FRAME)
+		{
+			const CANLogV2Frame &frame = record.frame;
+			CHECK((frame.bus == 1 || frame.bus == 2) && frame.len <= 8 && frame.id <= ((frame.extended != 0) ? 0x1FFFFFFFu : 0x7FFu));
+		}
+		records.push_back(record);
+		pos += consumed;
+	}
+	return records;
+}
+
+static bool sameFrame(const CANLogV2Frame &a, const CANLogV2Frame &b)
+{
+	return (a.timestamp == b.timestamp && a.id == b.id && a.count == b.count && a.bus == b.bus && a.extended == b.extended && a.len == b.len && memcmp(a.data, b.data, a.len) == 0);
+}
+
+static void testV2RoundTrip()
+{
+	std::vector<TestFrame> frames = makeTraffic(10000, 0xFFFFFFFF - 3000000, true);//crosses the 32 bit us wrap
+	std::vector<uint8_t> log = encodeLog(frames);
+	std::vector<Decoded> records = decodeLog(&log[0], log.size());
+	uint32_t next = 0;
+	uint32_t syncs = 0;
+	uint32_t indexFrames = 0;
+	uint32_t previousIndex = 0;
+	uint32_t drops = 0;
+	uint64_t elapsed = 0;
+	for(uint32_t a = 0; a < records.size(); a++)
+	{
+		const Decoded &record = records[a];
+		if(record.result == CAN_LOG_V2_FRAME)
+		{
+			if(!CHECK(next < frames.size()))
+			{
+				break;
+			}
+			const TestFrame &expected = frames[next];
+			if(next > 0)
+			{
+				elapsed += (uint32_t)(expected.time - frames[next - 1].time);
+			}
+			bool ok = (record.frame.bus == expected.bus && (record.frame.extended != 0) == expected.extended && record.frame.id == expected.id);
+			ok = (ok == true && record.frame.len == expected.len && memcmp(record.frame.data, expected.data, expected.len) == 0);
+			ok = (ok == true && record.frame.timestamp == elapsed && record.frame.count == expected.skipped);
+			if(!CHECK(ok))
+			{
+				printf("frame %u differs\n", (unsigned int)next);
+				break;
+			}
+			next++;
+		}
+		else if(record.result == CAN_LOG_V2_SYNC)
+		{
+			CHECK_EQUAL(next, record.frame.count);
+			syncs++;
+		}
+		else if(record.result == CAN_LOG_V2_DROPS)
+		{
+			drops += record.frame.count;
+		}
+		else if(record.result == CAN_LOG_V2_INDEX)
+		{
+			CANLogV2Index index;
+			if(CHECK(CANLogV2Decoder::parseIndex(&log[record.offset], (log.size() - record.offset), index)))
+			{
+				CHECK_EQUAL(record.offset, index.offset);
+				CHECK_EQUAL(previousIndex, index.previousIndex);
+				CHECK_EQUAL(indexFrames, index.firstFrame);
+				CHECK_EQUAL(next, index.firstFrame + index.frames);
+				indexFrames += index.frames;
+				previousIndex = index.offset;
+			}
+		}
+		else
+		{
+			CHECK_EQUAL(CAN_LOG_V2_FRAME, record.result);
+		}
+	}
+	CHECK_EQUAL(frames.size(), next);
+	CHECK_EQUAL((frames.size() + CAN_LOG_V2_SYNC_INTERVAL - 1) / CAN_LOG_V2_SYNC_INTERVAL, syncs);
+	CHECK_EQUAL(frames.back().totalDrops, drops);
+	CHECK_EQUAL(frames.size(), indexFrames);//a cleanly closed log ends with an index covering the last frames
+	CHECK_EQUAL(log.size() - CAN_LOG_V2_INDEX_SIZE, previousIndex);
+
+	//the CRC catches any damage to an index block
+	std::vector<uint8_t> damaged(log.end() - CAN_LOG_V2_INDEX_SIZE, log.end());
+	CANLogV2Index index;
+	CHECK(CANLogV2Decoder::parseIndex(&damaged[0], damaged.size(), index));
+	for(uint32_t a = 4; a < CAN_LOG_V2_INDEX_SIZE; a += 7)
+	{
+		damaged[a] ^= 0x10;
+		CHECK(!CANLogV2Decoder::parseIndex(&damaged[0], damaged.size(), index));
+		damaged[a] ^= 0x10;
+	}
+}
+
+// a decoder fed one more byte at a time has to wait for whole records and come to the same result
+static void testV2Streaming()
+{
+	std::vector<TestFrame> frames = makeTraffic(1200, 1000, true);
+	std::vector<uint8_t> log = encodeLog(frames);
+	std::vector<Decoded> reference = decodeLog(&log[0], log.size());
+	CANLogV2Decoder decoder;
+	CANLogV2Header header;
+	uint32_t pos = decoder.parseHeader(&log[0], log.size(), header);
+	uint32_t avail = (pos + 1);
+	uint32_t next = 0;
+	while(pos < log.size() && next < reference.size())
+	{
+		std::vector<uint8_t> window(log.begin() + pos, log.begin() + avail);//exactly the bytes that arrived so far
+		CANLogV2Frame frame;
+		uint32_t consumed;
+		int result = decoder.decode(&window[0], window.size(), frame, consumed);
+		if(result == CAN_LOG_V2_NEED_MORE)
+		{
+			if(!CHECK(avail < log.size()))
+			{
+				break;
+			}
+			avail++;
+			continue;
+		}
+		const Decoded &expected = reference[next];
+		if(!CHECK(result == expected.result && pos == expected.offset && (result != CAN_LOG_V2_FRAME || sameFrame(frame, expected.frame))))
+		{
+			printf("record %u at %u differs when streamed\n", (unsigned int)next, (unsigned int)pos);
+			break;
+		}
+		next++;
+		pos += consumed;
+		avail = (pos + 1);
+	}
+	CHECK_EQUAL(reference.size(), next);
+}
+
+// v2 frames take about half the bytes of v1 records on typical traffic
+static void testV2Size()
+{
+	std::vector<TestFrame> frames = makeTraffic(20000, 0, false);
+	uint32_t v1Size = 0;
+	for(uint32_t a = 0; a < frames.size(); a++)
+	{
+		v1Size += (14 + frames[a].len);
+	}
+	uint32_t v2Size = encodeLog(frames).size();
+	printf("v2 log: %.2f bytes per frame, v1: %.2f, %.0f%% of the v1 size\n", (double)v2Size / frames.size(), (double)v1Size / frames.size(), (100.0 * v2Size) / v1Size);
+	CHECK(v2Size < ((v1Size * 6) / 10));
+}
+
+static std::vector<uint8_t> makeV1Log(const std::vector<TestFrame> &frames, uint32_t firstTime)
+{
+	std::vector<uint8_t> log;
+	uint8_t raw[22];
+	for(uint32_t a = 0; a < frames.size(); a++)
+	{
+		CANLogV2Frame frame;
+		memset(&frame, 0, sizeof(frame));
+		frame.bus = frames[a].bus;
+		frame.extended = frames[a].extended ? 1 : 0;
+		frame.id = frames[a].id;
+		frame.len = frames[a].len;
+		memcpy(frame.data, frames[a].data, 8);
+		frame.timestamp = ((uint64_t)(frames[a].time - firstTime) * 1000);
+		log.insert(log.end(), raw, raw + CANLogV2Decoder::toRAW(frame, (frame.bus == 1) ? 500000 : 125000, raw));
+	}
+	return log;
+}
+
+static void testConverter()
+{
+	std::vector<TestFrame> frames = makeTraffic(3000, 0, false);
+	for(uint32_t a = 0; a < frames.size(); a++)
+	{
+		frames[a].time = (frames[a].time / 1000) + 123456;//v1 has ms since power up
+	}
+	std::vector<uint8_t> v1 = makeV1Log(frames, 0);
+	std::vector<uint8_t> expected = makeV1Log(frames, frames[0].time);//v2 counts from the start of the log
+
+	std::vector<uint8_t> v2;
+	std::vector<uint8_t> back;
+	CANLogConvertStats stats;
+	CHECK(canLogToV2(&v1[0], v1.size(), v2, stats));
+	CHECK_EQUAL(frames.size(), stats.frames);
+	CHECK_EQUAL(0, stats.errors);
+	CHECK(canLogToV1(&v2[0], v2.size(), back, stats));
+	CHECK_EQUAL(frames.size(), stats.frames);
+	CHECK(!stats.truncated);
+	CHECK(back == expected);
+	printf("converter: %u v1 bytes to %u v2 bytes and back\n", (unsigned int)v1.size(), (unsigned int)v2.size());
+
+	//runs of garbage between v1 records are skipped and counted
+	std::vector<uint8_t> dirty;
+	uint32_t runs = 0;
+	uint32_t garbage = 0;
+	for(uint32_t pos = 0; pos < v1.size(); pos += (14 + v1[pos + 13]))
+	{
+		if((testRandom() % 50) == 0)
+		{
+			uint32_t size = (1 + (testRandom() % 30));
+			dirty.insert(dirty.end(), size, 0x00);
+			runs++;
+			garbage += size;
+		}
+		dirty.insert(dirty.end(), v1.begin() + pos, v1.begin() + pos + 14 + v1[pos + 13]);
+	}
+	CHECK(canLogToV2(&dirty[0], dirty.size(), v2, stats));
+	CHECK_EQUAL(runs, stats.errors);
+	CHECK_EQUAL(garbage, stats.skippedBytes);
+	CHECK(canLogToV1(&v2[0], v2.size(), back, stats));
+	CHECK(back == expected);
+
+	//drop and skipped markers have no v1 equivalent, they are only counted
+	std::vector<TestFrame> marked = makeTraffic(2000, 0, true);
+	uint32_t skipped = 0;
+	for(uint32_t a = 0; a < marked.size(); a++)
+	{
+		skipped += marked[a].skipped;
+	}
+	v2 = encodeLog(marked);
+	CHECK(canLogToV1(&v2[0], v2.size(), back, stats));
+	CHECK_EQUAL(marked.size(), stats.frames);
+	CHECK_EQUAL(marked.back().totalDrops, stats.drops);
+	CHECK_EQUAL(skipped, stats.unchanged);
+
+	//a log cut short converts up to the last whole record
+	CHECK(canLogToV1(&v2[0], v2.size() - CAN_LOG_V2_INDEX_SIZE - 100, back, stats));
+	CHECK(stats.truncated);
+	CHECK(stats.frames < marked.size());
+	CHECK(!canLogToV1(&v1[0], v1.size(), back, stats));
+	std::vector<uint8_t> zeros(100, 0);
+	CHECK(!canLogToV2(&zeros[0], zeros.size(), back, stats));
+}
+
+// damages a log in a few places and checks the decoder is back in step at the second sync after the last damage
+static void testV2Fuzz(uint32_t iterations)
+{
+	std::vector<TestFrame> frames = makeTraffic(6000, 0, true);
+	std::vector<uint8_t> log = encodeLog(frames);
+	std::vector<Decoded> reference = decodeLog(&log[0], log.size());
+	std::vector<CANLogV2Frame> refFrames;
+	std::vector<uint32_t> syncOffsets;
+	std::vector<uint32_t> syncFrames;
+	for(uint32_t a = 0; a < reference.size(); a++)
+	{
+		if(reference[a].result == CAN_LOG_V2_FRAME)
+		{
+			refFrames.push_back(reference[a].frame);
+		}
+		else if(reference[a].result == CAN_LOG_V2_SYNC)
+		{
+			syncOffsets.push_back(reference[a].offset);
+			syncFrames.push_back(reference[a].frame.count);
+		}
+	}
+	uint32_t checked = 0;
+	uint32_t errors = 0;
+	for(uint32_t iteration = 0; iteration < iterations; iteration++)
+	{
+		std::vector<uint8_t> damaged(log);
+		uint32_t lastDamage = 0;
+		uint32_t damages = (1 + (testRandom() % 4));
+		uint32_t first = (CAN_LOG_V2_HEADER_SIZE + (testRandom() % (log.size() - CAN_LOG_V2_HEADER_SIZE - 2000)));
+		for(uint32_t a = 0; a < damages; a++)
+		{
+			uint32_t pos = (first + (testRandom() % 600));
+			uint32_t kind = (testRandom() % 4);
+			if(kind == 0)
+			{
+				damaged.insert(damaged.begin() + pos, 1 + (testRandom() % 20), (uint8_t)testRandom());
+			}
+			else if(kind == 1)
+			{
+				damaged.erase(damaged.begin() + pos, damaged.begin() + pos + 1 + (testRandom() % 20));
+			}
+			else
+			{
+				damaged[pos] ^= (1 << (testRandom() % 8));
+			}
+			lastDamage = (pos > lastDamage) ? pos : lastDamage;
+		}
+		lastDamage += 80;//up to four deletions of 20 bytes move later bytes back, stay clear of them
+		uint32_t sync = 0;
+		while(sync < syncOffsets.size() && syncOffsets[sync] <= lastDamage)
+		{
+			sync++;
+		}
+		sync++;
+		if(iteration % 8 == 0)//now and then the log is cut short as well
+		{
+			damaged.resize(damaged.size() - (testRandom() % 40));
+		}
+		std::vector<Decoded> records = decodeLog(&damaged[0], damaged.size());
+		if(sync >= syncOffsets.size())
+		{
+			continue;
+		}
+		uint32_t a = records.size();//the last match, a damaged sync may carry the same count
+		for(uint32_t b = 0; b < records.size(); b++)
+		{
+			errors += (records[b].result == CAN_LOG_V2_ERROR) ? 1 : 0;
+			if(records[b].result == CAN_LOG_V2_SYNC && records[b].frame.count == syncFrames[sync])
+			{
+				a = b;
+			}
+		}
+		if(!CHECK(a < records.size()))
+		{
+			printf("iteration %u: no resync at frame %u\n", (unsigned int)iteration, (unsigned int)syncFrames[sync]);
+			continue;
+		}
+		uint32_t next = syncFrames[sync];
+		bool ok = true;
+		for(; a < records.size() && ok == true; a++)
+		{
+			if(records[a].result == CAN_LOG_V2_FRAME)
+			{
+				ok = (next < refFrames.size() && sameFrame(records[a].frame, refFrames[next]));
+				next++;
+			}
+			else
+			{
+				ok = (records[a].result != CAN_LOG_V2_ERROR);
+			}
+		}
+		if(!CHECK(ok))
+		{
+			printf("iteration %u: frame %u differs after the resync\n", (unsigned int)iteration, (unsigned int)(next - 1));
+		}
+		CHECK(next <= refFrames.size() && (next + 30) > refFrames.size());//only the frames cut off at the end are missing
+		checked++;
+	}
+	printf("v2 fuzz: %u damaged logs, %u resynced, %u decoder errors reported\n", (unsigned int)iterations, (unsigned int)checked, (unsigned int)errors);
+
+	//random bytes after a valid header: no crash, no frame outside the limits, decodeLog checks those
+	std::vector<uint8_t> noise(log.begin(), log.begin() + CAN_LOG_V2_HEADER_SIZE);
+	for(uint32_t a = 0; a < (iterations * 64); a++)
+	{
+		noise.push_back((uint8_t)testRandom());
+	}
+	decodeLog(&noise[0], noise.size());
+	CANLogV2Index index;
+	CANLogV2Header header;
+	CANLogV2Decoder decoder;
+	for(uint32_t a = 0; a + CAN_LOG_V2_INDEX_SIZE < noise.size(); a += 97)
+	{
+		CHECK(!CANLogV2Decoder::parseIndex(&noise[a], CAN_LOG_V2_INDEX_SIZE, index));
+		CHECK_EQUAL(0, decoder.parseHeader(&noise[a + 1], CAN_LOG_V2_HEADER_SIZE, header));
+	}
+}
+
+// compresses data fed in random sized pieces and returns the block stream
+static std::vector<uint8_t> compress(const std::vector<uint8_t> &plain, uint32_t blockSize, uint32_t &blocks)
+{
+	static CANLogCompressor compressor;//about 6KB, kept off the stack as on the device
+	compressor = CANLogCompressor(blockSize);
+	std::vector<uint8_t> stream;
+	const uint8_t *block;
+	uint32_t pos = 0;
+	while(pos < plain.size())
+	{
+		uint32_t piece = (1 + (testRandom() % 300));
+		piece = ((pos + piece) > plain.size()) ? (plain.size() - pos) : piece;
+		uint32_t taken = compressor.append(&plain[pos], piece);
+		pos += taken;
+		if(taken < piece || compressor.isFull())
+		{
+			uint32_t size = compressor.flush(block);
+			stream.insert(stream.end(), block, block + size);
+		}
+	}
+	uint32_t size = compressor.flush(block);
+	stream.insert(stream.end(), block, block + size);
+	CHECK_EQUAL(plain.size(), compressor.getPlainBytes());
+	CHECK_EQUAL(stream.size(), compressor.getPackedBytes());
+	blocks = compressor.getBlockCount();
+	return stream;
+}
+
+static std::vector<uint8_t> makeCANStream(uint32_t frames)
+{
+	return makeV1Log(makeTraffic(frames, 0, false), 0);
+}
+
+static void testLZRoundTrip()
+{
+	std::vector<uint8_t> inputs[4];
+	inputs[0] = makeCANStream(3000);
+	for(uint32_t a = 0; a < 20000; a++)
+	{
+		inputs[1].push_back((uint8_t)testRandom());//does not compress, stored blocks
+	}
+	inputs[2].assign(9000, 0x55);//long matches with the extra length byte
+	for(uint32_t a = 0; a < 15000; a++)
+	{
+		inputs[3].push_back("0123456789ABCDEF"[testRandom() % ((a & 0x400) ? 16 : 3)]);
+	}
+	static const uint32_t blockSizes[3] = {CAN_LOG_LZ_BLOCK_SIZE, CAN_LOG_LZ_ETHERNET_BLOCK_SIZE, 64};
+	for(uint32_t a = 0; a < 4; a++)
+	{
+		for(uint32_t b = 0; b < 3; b++)
+		{
+			uint32_t blocks;
+			std::vector<uint8_t> stream = compress(inputs[a], blockSizes[b], blocks);
+			std::vector<uint8_t> plain;
+			CANLogConvertStats stats;
+			CHECK(canLogUnpack(&stream[0], stream.size(), plain, stats));
+			CHECK_EQUAL((inputs[a].size() + blockSizes[b] - 1) / blockSizes[b], blocks);
+			CHECK_EQUAL(blocks, stats.frames);
+			CHECK_EQUAL(0, stats.errors);
+			CHECK(!stats.truncated);
+			if(!CHECK(plain == inputs[a]))
+			{
+				printf("input %u with %u byte blocks does not survive the round trip\n", (unsigned int)a, (unsigned int)blockSizes[b]);
+			}
+			if(a == 1)
+			{
+				CHECK_EQUAL(stream.size(), inputs[a].size() + (blocks * CAN_LOG_LZ_HEADER_SIZE));
+				CHECK((stream[5] & 0x80) != 0);
+			}
+			if(a == 0 && b == 0)
+			{
+				printf("LZ on v1 CAN records: %u to %u bytes, %.0f%%\n", (unsigned int)inputs[a].size(), (unsigned int)stream.size(), (100.0 * stream.size()) / inputs[a].size());
+				CHECK(stream.size() < ((inputs[a].size() * 2) / 3));
+			}
+		}
+	}
+}
+
+static void putChecksum(uint8_t *block, uint32_t payloadLen)
+{
+	uint32_t sum1 = 0;
+	uint32_t sum2 = 0;
+	for(uint32_t a = 2; a < (CAN_LOG_LZ_HEADER_SIZE + payloadLen); a++)
+	{
+		if(a == 6 || a == 7)
+		{
+			continue;
+		}
+		sum1 = ((sum1 + block[a]) % 255);
+		sum2 = ((sum2 + sum1) % 255);
+	}
+	block[6] = sum1;
+	block[7] = sum2;
+}
+
+// damages one block of a stream, the blocks before and after it have to come out intact
+static void testLZFuzz(uint32_t iterations)
+{
+	std::vector<uint8_t> plain = makeCANStream(8000);
+	uint32_t blocks;
+	std::vector<uint8_t> stream = compress(plain, CAN_LOG_LZ_BLOCK_SIZE, blocks);
+	std::vector<uint32_t> offsets;//of each block in the stream, and the end
+	uint8_t out[CAN_LOG_LZ_BLOCK_SIZE];
+	for(uint32_t pos = 0; pos < stream.size();)
+	{
+		offsets.push_back(pos);
+		uint32_t consumed;
+		CANLogCompressor::decodeBlock(&stream[pos], (stream.size() - pos), out, consumed);
+		pos += consumed;
+	}
+	offsets.push_back(stream.size());
+	CHECK_EQUAL(blocks, offsets.size() - 1);
+	uint32_t detected = 0;
+	for(uint32_t iteration = 0; iteration < iterations; iteration++)
+	{
+		uint32_t block = (testRandom() % blocks);
+		uint32_t size = (offsets[block + 1] - offsets[block]);
+		std::vector<uint8_t> damaged(stream);
+		for(uint32_t a = (1 + (testRandom() % 3)); a > 0; a--)
+		{
+			damaged[offsets[block] + (testRandom() % size)] ^= (1 + (testRandom() % 255));
+		}
+		std::vector<uint8_t> result;
+		CANLogConvertStats stats;
+		canLogUnpack(&damaged[0], damaged.size(), result, stats);
+		uint32_t before = (block * CAN_LOG_LZ_BLOCK_SIZE);
+		uint32_t after = (plain.size() - before - ((block + 1) < blocks ? CAN_LOG_LZ_BLOCK_SIZE : (plain.size() - before)));
+		bool ok = (result.size() >= (before + after) && memcmp(&result[0], &plain[0], before) == 0);
+		ok = (ok == true && memcmp(&result[result.size() - after], &plain[plain.size() - after], after) == 0);
+		if(!CHECK(ok))
+		{
+			printf("iteration %u: damage to block %u spread to its neighbours\n", (unsigned int)iteration, (unsigned int)block);
+		}
+		detected += (stats.errors > 0) ? 1 : 0;
+	}
+
+	//a stream cut short gives exactly the whole blocks before the cut
+	for(uint32_t iteration = 0; iteration < (iterations / 4); iteration++)
+	{
+		uint32_t cut = (1 + (testRandom() % (stream.size() - 1)));
+		std::vector<uint8_t> result;
+		CANLogConvertStats stats;
+		canLogUnpack(&stream[0], cut, result, stats);
+		uint32_t whole = 0;
+		while(offsets[whole + 1] <= cut)
+		{
+			whole++;
+		}
+		CHECK_EQUAL(whole, stats.frames);
+		CHECK_EQUAL(whole * CAN_LOG_LZ_BLOCK_SIZE, result.size());
+		CHECK(result.empty() || memcmp(&result[0], &plain[0], result.size()) == 0);
+		CHECK(stats.truncated == (offsets[whole] != cut));
+	}
+
+	//random payloads behind a valid header and checksum, so the LZSS decoder itself sees garbage
+	uint8_t data[CAN_LOG_LZ_MAX_BLOCK_SIZE];
+	uint32_t decoded = 0;
+	for(uint32_t iteration = 0; iteration < (iterations * 4); iteration++)
+	{
+		uint32_t plainLen = (1 + (testRandom() % CAN_LOG_LZ_BLOCK_SIZE));
+		uint32_t payloadLen = (1 + (testRandom() % ((iteration & 1) ? 64 : CAN_LOG_LZ_BLOCK_SIZE)));
+		data[0] = CAN_LOG_LZ_MAGIC0;
+		data[1] = CAN_LOG_LZ_MAGIC1;
+		data[2] = plainLen;
+		data[3] = (plainLen >> 8);
+		data[4] = payloadLen;
+		data[5] = (payloadLen >> 8);
+		for(uint32_t a = 0; a < payloadLen; a++)
+		{
+			data[CAN_LOG_LZ_HEADER_SIZE + a] = testRandom();
+		}
+		putChecksum(data, payloadLen);
+		uint32_t consumed = 0;
+		int32_t result = CANLogCompressor::decodeBlock(data, (CAN_LOG_LZ_HEADER_SIZE + payloadLen), out, consumed);
+		CHECK(result == CAN_LOG_LZ_ERROR || (result == (int32_t)plainLen && consumed == (CAN_LOG_LZ_HEADER_SIZE + payloadLen)));
+		decoded += (result > 0) ? 1 : 0;
+	}
+	printf("LZ fuzz: %u damaged streams, damage detected in %u, %u random payloads decoded\n", (unsigned int)iterations, (unsigned int)detected, (unsigned int)decoded);
+	CHECK(CANLogCompressor::findBlock(data, 0) == -1);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t iterations = testBenchMode(argc, argv) ? 20000 : 1000;
+	testV2RoundTrip();
+	testV2Streaming();
+	testV2Size();
+	testConverter();
+	testV2Fuzz(iterations);
+	testLZRoundTrip();
+	testLZFuzz(iterations);
+	return testResult("can_log_codec_test");
+}
@@ -0,0 +1,182 @@
+/*
+* CanBadger Log Converter
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "can_log_convert.h"
+#include "can_log_v2.h"
+#include "can_log_lz.h"
+#include <string.h>
+
+#define RAW_MAX_SIZE 22 //v1 record with 8 data bytes, see can_log_ring.h
+
+bool canLogToV2(const uint8_t *in, uint32_t len, std::vector<uint8_t> &out, CANLogConvertStats &stats)
+{
+	memset(&stats, 0, sizeof(stats));
+	CANLogV2Header header;
+	memset(&header, 0, sizeof(header));
+	header.timebase = CAN_LOG_V2_TIMEBASE;
+	strcpy(header.fwVersion, "v1conv");
+	CANLogV2Frame frame;
+	uint32_t speed;
+	bool found = false;
+	for(uint32_t pos = 0; pos < len;)//first pass for the header
+	{
+		uint32_t size = CANLogV2Decoder::fromRAW(&in[pos], (len - pos), frame, speed);
+		if(size == 0)
+		{
+			pos++;
+			continue;
+		}
+		uint8_t idx = (frame.bus - 1);
+		if((header.busFlags[idx] & CAN_LOG_V2_BUS_LOGGED) == 0)
+		{
+			header.speed[idx] = speed;
+		}
+		header.busFlags[idx] |= CAN_LOG_V2_BUS_LOGGED;
+		if(frame.extended != 0)
+		{
+			header.busFlags[idx] |= CAN_LOG_V2_BUS_EXTENDED;
+		}
+		found = true;
+		pos += size;
+	}
+	if(found == false)
+	{
+		return false;
+	}
+	CANLogV2Encoder encoder;
+	uint8_t record[CAN_LOG_V2_INDEX_SIZE + CAN_LOG_V2_MAX_RECORD_SIZE];
+	out.clear();
+	out.insert(out.end(), record, record + encoder.writeHeader(record, header));
+	bool resyncing = false;
+	uint32_t pos = 0;
+	while(pos < len)
+	{
+		uint32_t size = CANLogV2Decoder::fromRAW(&in[pos], (len - pos), frame, speed);
+		if(size == 0)
+		{
+			if(resyncing == false)
+			{
+				stats.errors++;
+				resyncing = true;
+			}
+			stats.skippedBytes++;
+			pos++;
+			continue;
+		}
+		resyncing = false;
+		pos += size;
+		//ms * 1000 wraps the 32 bit us count every 71 minutes, the encoder only looks at the deltas
+		uint32_t written = encoder.encode(frame.bus, (frame.extended != 0), frame.id, frame.data, frame.len, (uint32_t)frame.timestamp, record);
+		out.insert(out.end(), record, record + written);
+		stats.frames++;
+	}
+	out.insert(out.end(), record, record + encoder.finish(record));
+	return true;
+}
+
+bool canLogToV1(const uint8_t *in, uint32_t len, std::vector<uint8_t> &out, CANLogConvertStats &stats)
+{
+	memset(&stats, 0, sizeof(stats));
+	CANLogV2Decoder decoder;
+	CANLogV2Header header;
+	uint32_t pos = decoder.parseHeader(in, len, header);
+	if(pos == 0)
+	{
+		return false;
+	}
+	out.clear();
+	uint8_t raw[RAW_MAX_SIZE];
+	CANLogV2Frame frame;
+	while(pos < len)
+	{
+		uint32_t consumed;
+		int result = decoder.decode(&in[pos], (len - pos), frame, consumed);
+		if(result == CAN_LOG_V2_NEED_MORE)
+		{
+			stats.truncated = true;
+			stats.skippedBytes += (len - pos);
+			break;
+		}
+		if(result == CAN_LOG_V2_ERROR)
+		{
+			stats.errors++;
+			stats.skippedBytes += consumed;
+		}
+		else if(result == CAN_LOG_V2_FRAME)
+		{
+			out.insert(out.end(), raw, raw + CANLogV2Decoder::toRAW(frame, header.speed[frame.bus - 1], raw));
+			stats.frames++;
+			stats.unchanged += frame.count;
+		}
+		else if(result == CAN_LOG_V2_DROPS)
+		{
+			stats.drops += frame.count;
+		}
+		pos += consumed;
+	}
+	return true;
+}
+
+bool canLogUnpack(const uint8_t *in, uint32_t len, std::vector<uint8_t> &out, CANLogConvertStats &stats)
+{
+	memset(&stats, 0, sizeof(stats));
+	out.clear();
+	uint8_t plain[CAN_LOG_LZ_BLOCK_SIZE];
+	uint32_t pos = 0;
+	while(pos < len)
+	{
+		uint32_t consumed;
+		int32_t result = CANLogCompressor::decodeBlock(&in[pos], (len - pos), plain, consumed);
+		if(result > 0)
+		{
+			if(stats.truncated == true)//what looked like the end of the log was a damaged length field
+			{
+				stats.errors++;
+				stats.truncated = false;
+			}
+			out.insert(out.end(), plain, plain + result);
+			stats.frames++;
+			pos += consumed;
+			continue;
+		}
+		//the whole file is here, so a block cut short is either the end of a truncated log or a damaged length field
+		if(result == CAN_LOG_LZ_NEED_MORE)
+		{
+			stats.truncated = true;
+		}
+		else if(stats.truncated == false)
+		{
+			stats.errors++;
+		}
+		int32_t next = CANLogCompressor::findBlock(&in[pos + 1], (len - pos - 1));
+		uint32_t skip = (next < 0) ? (len - pos) : (uint32_t)(next + 1);
+		stats.skippedBytes += skip;
+		pos += skip;
+	}
+	return (stats.frames > 0);
+}
+
+bool canLogIsCompressed(const uint8_t *in, uint32_t len)
+{
+	return (len >= 2 && in[0] == CAN_LOG_LZ_MAGIC0 && in[1] == CAN_LOG_LZ_MAGIC1);
+}
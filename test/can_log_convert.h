@@ -0,0 +1,68 @@
+/*
+* CanBadger Log Converter
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Host side conversion between the v1 RAW records (see can_log_ring.h) and v2 logs (see can_log_v2.h), and unpacking of
+LZ compressed logs (see can_log_lz.h). Damaged input is skipped rather than rejected: v1 records are resynced byte by
+byte, v2 at the next sync marker and LZ at the next block that passes its checksum. The stats say how much was lost.
+*/
+
+#ifndef __CAN_LOG_CONVERT_H__
+#define __CAN_LOG_CONVERT_H__
+
+#include <stdint.h>
+#include <vector>
+
+struct CANLogConvertStats
+{
+	uint32_t frames;//frames written to the output
+	uint32_t errors;//damaged records or blocks
+	uint32_t skippedBytes;//input bytes thrown away while resyncing
+	uint32_t drops;//frames the device lost, from v2 drop markers
+	uint32_t unchanged;//frames change-only logging left out, from v2 skipped markers
+	bool truncated;//the input ends in the middle of a record or block
+};
+
+/** Converts v1 RAW records to a v2 log. The first record becomes time 0, the bus speeds in the
+	header are taken from the first record of each bus
+
+	@return false if the input holds no valid v1 record
+*/
+bool canLogToV2(const uint8_t *in, uint32_t len, std::vector<uint8_t> &out, CANLogConvertStats &stats);
+
+/** Converts a v2 log to v1 RAW records, with the bus speeds from the header. Timestamps count from the start of the log.
+	v1 has no place for drop and skipped markers, they only end up in the stats
+
+	@return false if the input has no v2 header
+*/
+bool canLogToV1(const uint8_t *in, uint32_t len, std::vector<uint8_t> &out, CANLogConvertStats &stats);
+
+/** Decompresses an LZ block stream, frames counts the good blocks
+
+	@return false if no block could be decoded
+*/
+bool canLogUnpack(const uint8_t *in, uint32_t len, std::vector<uint8_t> &out, CANLogConvertStats &stats);
+
+bool canLogIsCompressed(const uint8_t *in, uint32_t len);
+
+#endif
@@ -0,0 +1,128 @@
+/*
+* CanBadger Log Converter
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Command line front end for can_log_convert.h:
+	can_log_convert to-v2 <v1 log> <v2 log>
+	can_log_convert to-v1 <v2 log> <v1 log>, an LZ compressed v2 log is unpacked first
+	can_log_convert unpack <compressed log> <plain log>
+*/
+
+#include "can_log_convert.h"
+#include <stdio.h>
+#include <string.h>
+
+static bool readFile(const char *name, std::vector<uint8_t> &data)
+{
+	FILE *file = fopen(name, "rb");
+	if(file == NULL)
+	{
+		return false;
+	}
+	uint8_t buffer[4096];
+	size_t size;
+	while((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+	{
+		data.insert(data.end(), buffer, buffer + size);
+	}
+	bool ok = (ferror(file) == 0);
+	fclose(file);
+	return ok;
+}
+
+static bool writeFile(const char *name, const std::vector<uint8_t> &data)
+{
+	FILE *file = fopen(name, "wb");
+	if(file == NULL)
+	{
+		return false;
+	}
+	bool ok = (data.empty() || fwrite(&data[0], 1, data.size(), file) == data.size());
+	return (fclose(file) == 0 && ok);
+}
+
+static void printStats(const char *what, const CANLogConvertStats &stats)
+{
+	fprintf(stderr, "%s: %u %s, %u damaged, %u bytes skipped%s\n", what, (unsigned int)stats.frames, (strcmp(what, "unpack") == 0) ? "blocks" : "frames",
+		(unsigned int)stats.errors, (unsigned int)stats.skippedBytes, (stats.truncated == true) ? ", truncated" : "");
+	if(stats.drops != 0 || stats.unchanged != 0)
+	{
+		fprintf(stderr, "%s: %u frames lost on the device, %u unchanged frames left out by change-only logging\n", what, (unsigned int)stats.drops, (unsigned int)stats.unchanged);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if(argc != 4 || (strcmp(argv[1], "to-v2") != 0 && strcmp(argv[1], "to-v1") != 0 && strcmp(argv[1], "unpack") != 0))
+	{
+		fprintf(stderr, "usage: %s to-v2|to-v1|unpack <input> <output>\n", argv[0]);
+		return 2;
+	}
+	std::vector<uint8_t> in;
+	if(readFile(argv[2], in) == false)
+	{
+		fprintf(stderr, "cannot read %s\n", argv[2]);
+		return 1;
+	}
+	std::vector<uint8_t> out;
+	CANLogConvertStats stats;
+	bool ok;
+	const uint8_t *data = in.empty() ? NULL : &in[0];
+	if(strcmp(argv[1], "to-v2") == 0)
+	{
+		ok = canLogToV2(data, in.size(), out, stats);
+		printStats("to-v2", stats);
+	}
+	else
+	{
+		ok = true;
+		if(canLogIsCompressed(data, in.size()) == true || strcmp(argv[1], "unpack") == 0)
+		{
+			std::vector<uint8_t> plain;
+			ok = canLogUnpack(data, in.size(), plain, stats);
+			printStats("unpack", stats);
+			in.swap(plain);
+			data = in.empty() ? NULL : &in[0];
+		}
+		if(strcmp(argv[1], "unpack") == 0)
+		{
+			out.swap(in);
+		}
+		else if(ok == true)
+		{
+			ok = canLogToV1(data, in.size(), out, stats);
+			printStats("to-v1", stats);
+		}
+	}
+	if(ok == false)
+	{
+		fprintf(stderr, "%s does not hold a log in the expected format\n", argv[2]);
+		return 1;
+	}
+	if(writeFile(argv[3], out) == false)
+	{
+		fprintf(stderr, "cannot write %s\n", argv[3]);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,303 @@
+/*
+* CanBadger Log Reader Test
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Checks the answers CANLogV2Reader gives through the index blocks against a linear pass over the same log, for time
+windows and for ID queries, on closed logs and on logs that were cut off before the last index. Then compares how
+many bytes both ways read from storage on a large synthetic log, which is what they cost over the SPI SD.
+*/
+
+#include "test_common.h"
+#include "can_log_v2.h"
+#include <vector>
+
+#define TEST_IDS 40
+#define RARE_ID 0x7E8 //diagnostic response, only shows up in a few bursts
+#define RARE_BURSTS 3
+#define RARE_BURST_FRAMES 20
+#define SD_READ_MBS 1.2 //SD read rate of the device with CMD18 and the read-ahead, see sd_read_test
+
+// storage in memory that counts what the reader asks for
+class MemoryLogReader : public CANLogV2Reader
+{
+	public:
+		MemoryLogReader(const std::vector<uint8_t> &log, uint32_t size) : _log(log), _size(size) { bytesRead = 0; }
+		uint64_t bytesRead;
+
+	protected:
+		uint32_t readAt(uint32_t offset, uint8_t *data, uint32_t len)
+		{
+			if(offset >= _size)
+			{
+				return 0;
+			}
+			len = ((offset + len) > _size) ? (_size - offset) : len;
+			memcpy(data, &_log[offset], len);
+			bytesRead += len;
+			return len;
+		}
+
+		uint32_t getSize() { return _size; }
+
+	private:
+		const std::vector<uint8_t> &_log;
+		uint32_t _size;
+};
+
+struct TestLog
+{
+	std::vector<uint8_t> data;
+	uint32_t frames;
+	uint32_t finished;//size without the closing index block, as left by a log that was not closed
+};
+
+static void makeLog(TestLog &log, uint32_t frames)
+{
+	uint32_t ids[TEST_IDS];
+	for(uint32_t a = 0; a < TEST_IDS; a++)
+	{
+		ids[a] = (a < 30) ? (0x100 + (a * 13)) : (0x18FF0000 + a);
+	}
+	CANLogV2Header header;
+	memset(&header, 0, sizeof(header));
+	header.timebase = CAN_LOG_V2_TIMEBASE;
+	header.speed[0] = 500000;
+	header.speed[1] = 500000;
+	header.busFlags[0] = CAN_LOG_V2_BUS_LOGGED;
+	header.busFlags[1] = (CAN_LOG_V2_BUS_LOGGED | CAN_LOG_V2_BUS_EXTENDED);
+	CANLogV2Encoder encoder;
+	uint8_t record[CAN_LOG_V2_INDEX_SIZE + CAN_LOG_V2_MAX_RECORD_SIZE];
+	log.data.clear();
+	log.data.reserve(frames * 14);
+	log.data.insert(log.data.end(), record, record + encoder.writeHeader(record, header));
+	uint32_t time = 0;
+	uint8_t data[8] = {0};
+	for(uint32_t a = 0; a < frames; a++)
+	{
+		uint32_t id = ids[testRandom() % TEST_IDS];
+		uint32_t burst = ((a * RARE_BURSTS) / frames);
+		if((a % (frames / RARE_BURSTS)) < RARE_BURST_FRAMES && (a & 1) && burst < RARE_BURSTS)
+		{
+			id = RARE_ID;
+		}
+		bool extended = (id > 0x7FF);
+		data[0] = a;
+		data[1] = (a >> 8);
+		time += (100 + (testRandom() % 300));
+		uint32_t size = encoder.encode(extended ? 2 : 1, extended, id, data, 8, time, record);
+		log.data.insert(log.data.end(), record, record + size);
+	}
+	log.finished = log.data.size();
+	log.data.insert(log.data.end(), record, record + encoder.finish(record));
+	log.frames = frames;
+}
+
+static bool sameFrame(const CANLogV2Frame &a, const CANLogV2Frame &b)
+{
+	return (a.timestamp == b.timestamp && a.id == b.id && a.bus == b.bus && a.extended == b.extended && a.len == b.len && memcmp(a.data, b.data, a.len) == 0);
+}
+
+static bool sameFrames(const std::vector<CANLogV2Frame> &a, const std::vector<CANLogV2Frame> &b)
+{
+	if(a.size() != b.size())
+	{
+		return false;
+	}
+	for(uint32_t c = 0; c < a.size(); c++)
+	{
+		if(sameFrame(a[c], b[c]) == false)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// decodes from offset up to end, keeping the frames that match. Stops early once the frames pass maxTime
+static void scan(CANLogV2Reader &reader, uint32_t offset, uint32_t end, uint64_t minTime, uint64_t maxTime, uint32_t id, std::vector<CANLogV2Frame> &frames)
+{
+	CANLogV2Frame frame;
+	while(offset < end)
+	{
+		int result = reader.readRecord(offset, frame);
+		if(result == CAN_LOG_V2_NEED_MORE || result == CAN_LOG_V2_ERROR)
+		{
+			break;
+		}
+		if(result != CAN_LOG_V2_FRAME)
+		{
+			continue;
+		}
+		if(frame.timestamp > maxTime)
+		{
+			break;
+		}
+		if(frame.timestamp >= minTime && (id == 0xFFFFFFFF || frame.id == id))
+		{
+			frames.push_back(frame);
+		}
+	}
+}
+
+static void linearQuery(CANLogV2Reader &reader, uint64_t minTime, uint64_t maxTime, uint32_t id, std::vector<CANLogV2Frame> &frames)
+{
+	scan(reader, CAN_LOG_V2_HEADER_SIZE, 0xFFFFFFFF, minTime, maxTime, id, frames);
+}
+
+static void indexedTimeQuery(CANLogV2Reader &reader, uint64_t minTime, uint64_t maxTime, std::vector<CANLogV2Frame> &frames)
+{
+	scan(reader, reader.seekTime(minTime), 0xFFFFFFFF, minTime, maxTime, 0xFFFFFFFF, frames);
+}
+
+// walks the index chain back and only decodes the segments that may hold the ID, plus whatever follows the last index
+static void indexedIDQuery(CANLogV2Reader &reader, uint8_t bus, bool extended, uint32_t id, std::vector<CANLogV2Frame> &frames)
+{
+	CANLogV2Index index;
+	if(reader.getLastIndex(index) == false)
+	{
+		linearQuery(reader, 0, UINT64_MAX, id, frames);
+		return;
+	}
+	std::vector<uint32_t> segments;//start and end of each segment to decode, last one first
+	segments.push_back(index.offset + CAN_LOG_V2_INDEX_SIZE);
+	segments.push_back(0xFFFFFFFF);
+	bool more = true;
+	while(more == true)
+	{
+		if(CANLogV2Reader::mayContain(index, bus, extended, id) == true)
+		{
+			segments.push_back(index.segmentOffset);
+			segments.push_back(index.offset);
+		}
+		CANLogV2Index previous;
+		more = reader.getPreviousIndex(index, previous);
+		index = previous;
+	}
+	for(uint32_t a = segments.size(); a > 0; a -= 2)
+	{
+		scan(reader, segments[a - 2], segments[a - 1], 0, UINT64_MAX, id, frames);
+	}
+}
+
+static void testQueries(const TestLog &log, uint32_t size)
+{
+	MemoryLogReader reader(log.data, size);
+	if(!CHECK(reader.open()))
+	{
+		return;
+	}
+	std::vector<CANLogV2Frame> all;
+	linearQuery(reader, 0, UINT64_MAX, 0xFFFFFFFF, all);
+	CHECK(all.size() == log.frames || (size < log.finished && all.size() < log.frames));
+	uint64_t end = all.back().timestamp;
+	for(uint32_t a = 0; a < 50; a++)
+	{
+		uint64_t start = (a == 0) ? 0 : ((a == 1) ? end : (((uint64_t)testRandom() * end) >> 32));
+		uint64_t stop = (start + 1 + (testRandom() % 200000));
+		std::vector<CANLogV2Frame> expected;
+		std::vector<CANLogV2Frame> found;
+		linearQuery(reader, start, stop, 0xFFFFFFFF, expected);
+		indexedTimeQuery(reader, start, stop, found);
+		if(!CHECK(sameFrames(expected, found)))
+		{
+			printf("time window %llu-%llu: %u frames through the index, %u expected\n", (unsigned long long)start, (unsigned long long)stop, (unsigned int)found.size(), (unsigned int)expected.size());
+		}
+	}
+	if(size == log.data.size())
+	{
+		CHECK_EQUAL(size, reader.seekTime(end + 1));//nothing follows the closing index
+	}
+	static const uint32_t ids[3] = {RARE_ID, 0x100, 0x18FF0021};
+	for(uint32_t a = 0; a < 3; a++)
+	{
+		std::vector<CANLogV2Frame> expected;
+		std::vector<CANLogV2Frame> found;
+		linearQuery(reader, 0, UINT64_MAX, ids[a], expected);
+		indexedIDQuery(reader, (ids[a] > 0x7FF) ? 2 : 1, (ids[a] > 0x7FF), ids[a], found);
+		CHECK(!expected.empty());
+		if(!CHECK(sameFrames(expected, found)))
+		{
+			printf("ID 0x%X: %u frames through the index, %u expected\n", (unsigned int)ids[a], (unsigned int)found.size(), (unsigned int)expected.size());
+		}
+	}
+	std::vector<CANLogV2Frame> none;
+	indexedIDQuery(reader, 1, false, 0x7DF, none);
+	CHECK(none.empty());
+}
+
+static void benchQueries(const TestLog &log)
+{
+	MemoryLogReader reader(log.data, log.data.size());
+	reader.open();
+	std::vector<CANLogV2Frame> frames;
+	uint64_t start = testNowNs();
+	reader.bytesRead = 0;
+	linearQuery(reader, 0, UINT64_MAX, RARE_ID, frames);
+	uint64_t linearBytes = reader.bytesRead;
+	uint64_t linearNs = (testNowNs() - start);
+	frames.clear();
+	start = testNowNs();
+	reader.bytesRead = 0;
+	indexedIDQuery(reader, 1, false, RARE_ID, frames);
+	uint64_t indexedBytes = reader.bytesRead;
+	uint64_t indexedNs = (testNowNs() - start);
+	printf("ID 0x%X in a %u frame log of %.1f MB: linear pass reads %.2f MB (%.1f s on the device, %.1f ms here), index %.2f MB (%.2f s, %.1f ms)\n",
+		RARE_ID, (unsigned int)log.frames, log.data.size() / 1e6, linearBytes / 1e6, linearBytes / (SD_READ_MBS * 1e6), linearNs / 1e6,
+		indexedBytes / 1e6, indexedBytes / (SD_READ_MBS * 1e6), indexedNs / 1e6);
+	CHECK(indexedBytes < (linearBytes / 10));
+
+	//100 ms windows at random times
+	CANLogV2Frame last;
+	uint32_t offset = reader.seekTime(UINT64_MAX - 1);
+	CHECK(reader.readRecord(offset, last) == CAN_LOG_V2_NEED_MORE);
+	uint64_t end = ((uint64_t)log.frames * 250);
+	linearBytes = 0;
+	indexedBytes = 0;
+	uint32_t queries = 20;
+	for(uint32_t a = 0; a < queries; a++)
+	{
+		uint64_t from = (((uint64_t)testRandom() * end) >> 32);
+		frames.clear();
+		reader.bytesRead = 0;
+		linearQuery(reader, from, from + 100000, 0xFFFFFFFF, frames);
+		linearBytes += reader.bytesRead;
+		frames.clear();
+		reader.bytesRead = 0;
+		indexedTimeQuery(reader, from, from + 100000, frames);
+		indexedBytes += reader.bytesRead;
+	}
+	printf("100 ms window: linear pass reads %.2f MB on average, index %.1f KB\n", linearBytes / (queries * 1e6), indexedBytes / (queries * 1e3));
+	CHECK(indexedBytes < (linearBytes / 50));
+}
+
+int main(int argc, char **argv)
+{
+	TestLog log;
+	makeLog(log, 30000);
+	testQueries(log, log.data.size());
+	testQueries(log, log.finished);//cut off before the closing index, the frames after the last one are found by scanning
+	testQueries(log, log.finished - 1000);
+	makeLog(log, testBenchMode(argc, argv) ? 2000000 : 300000);
+	benchQueries(log);
+	return testResult("can_log_reader_test");
+}
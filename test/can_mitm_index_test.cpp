@@ -0,0 +1,164 @@
+/*
+* CanBadger MITM Index Test
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Checks CANMITMIndex against the ID list CAN_MITM walked before: 7 byte entries of a big endian ID and XRAM offset in
+the first 0x800 bytes of the IRAM buffer, ended by 0xFFFFFFFF. Both are filled with the same IDs, standard and extended,
+up to the last block, and then looked up with a busy bus trace where most IDs have no rules, the case where the list
+was walked to its end for every frame. make bench replays a longer trace and times both.
+*/
+
+#include "test_common.h"
+#include "can_mitm_index.h"
+#include <vector>
+
+#define LIST_SIZE 0x800
+#define BUS_IDS 250 //IDs seen on the bus, the ones with rules among them
+
+// the old allocRAM, entry by entry
+static void listAdd(uint8_t *list, uint32_t entry, uint32_t id)
+{
+	uint32_t offset = (entry * 7);
+	uint32_t maddr = (entry * CAN_MITM_RULE_BLOCK);
+	uint8_t data[7] = {(uint8_t)(id >> 24), (uint8_t)(id >> 16), (uint8_t)(id >> 8), (uint8_t)id, (uint8_t)(maddr >> 16), (uint8_t)(maddr >> 8), (uint8_t)maddr};
+	memcpy(&list[offset], data, 7);
+}
+
+// the old tableLookUp
+static uint32_t listLookUp(const uint8_t *list, uint32_t canID)
+{
+	uint32_t a = 0;
+	while(a < LIST_SIZE)
+	{
+		uint32_t checkedID = list[a];
+		checkedID = ((checkedID << 8) + list[a + 1]);
+		checkedID = ((checkedID << 8) + list[a + 2]);
+		checkedID = ((checkedID << 8) + list[a + 3]);
+		if(canID == checkedID)
+		{
+			uint32_t b = list[a + 4];
+			b = ((b << 8) + list[a + 5]);
+			b = ((b << 8) + list[a + 6]);
+			return b;
+		}
+		else if(checkedID == 0xFFFFFFFF)
+		{
+			return 0xFFFFFFFF;
+		}
+		a = a + 7;
+	}
+	return 0xFFFFFFFF;
+}
+
+static uint32_t busID(uint32_t n)//every third one extended, spread over the ID range
+{
+	return ((n % 3) == 2) ? (0x18DA0000 + (n * 0x1F3)) : ((n * 0x107) & 0x7FF);
+}
+
+static void fill(CANMITMIndex &index, uint8_t *list, uint32_t *ids)
+{
+	memset(list, 0xFF, LIST_SIZE);
+	for(uint32_t a = 0; a < CAN_MITM_MAX_IDS; a++)
+	{
+		ids[a] = busID((a * 7) % BUS_IDS);//every other bus ID, in no particular order
+		CHECK_EQUAL(a * CAN_MITM_RULE_BLOCK, index.add(ids[a]));
+		listAdd(list, a, ids[a]);
+	}
+}
+
+static void testIndex()
+{
+	uint8_t buffer[CAN_MITM_INDEX_SIZE + 1];
+	CANMITMIndex index(&buffer[1]);//the buffer does not have to be aligned
+	uint8_t list[LIST_SIZE];
+	uint32_t ids[CAN_MITM_MAX_IDS];
+	fill(index, list, ids);
+	CHECK_EQUAL(CAN_MITM_MAX_IDS, index.getCount());
+	for(uint32_t a = 0; a < CAN_MITM_MAX_IDS; a++)
+	{
+		CHECK_EQUAL(a * CAN_MITM_RULE_BLOCK, index.find(ids[a]));
+		CHECK_EQUAL(a * CAN_MITM_RULE_BLOCK, index.add(ids[a]));//known IDs keep their block
+	}
+	CHECK_EQUAL(CAN_MITM_NO_RULES, index.add(busID(BUS_IDS + 1)));//the 126th ID gets none
+	CHECK_EQUAL(CAN_MITM_NO_RULES, index.add(0x1FFFFFFF));
+	CHECK_EQUAL(CAN_MITM_MAX_IDS, index.getCount());
+	CHECK((CAN_MITM_MAX_IDS * CAN_MITM_RULE_BLOCK) <= 0x1F400);//all blocks below RAM_USABLE_SIZE
+	uint32_t mismatches = 0;
+	for(uint32_t n = 0; n < (BUS_IDS * 2); n++)
+	{
+		if(index.find(busID(n)) != listLookUp(list, busID(n)))
+		{
+			mismatches++;
+		}
+	}
+	CHECK_EQUAL(0, mismatches);
+	CHECK_EQUAL(CAN_MITM_NO_RULES, index.find(0xFFFFFFFF));//the end marker of the old list
+	index.clear();
+	CHECK_EQUAL(0, index.getCount());
+	CHECK_EQUAL(CAN_MITM_NO_RULES, index.find(ids[0]));
+	CHECK_EQUAL(CAN_MITM_NO_RULES, index.find(ids[2]));
+	CHECK_EQUAL(0, index.add(ids[2]));
+}
+
+// a frame for every bus ID per round, in a different order each time, as periodic senders drift against each other
+static void benchTrace(uint32_t frames)
+{
+	uint8_t buffer[CAN_MITM_INDEX_SIZE];
+	CANMITMIndex index(buffer);
+	uint8_t list[LIST_SIZE];
+	uint32_t ids[CAN_MITM_MAX_IDS];
+	fill(index, list, ids);
+	std::vector<uint32_t> trace(frames);
+	for(uint32_t a = 0; a < frames; a++)
+	{
+		trace[a] = busID(testRandom() % BUS_IDS);
+	}
+	uint64_t start = testNowNs();
+	uint32_t listHits = 0;
+	for(uint32_t a = 0; a < frames; a++)
+	{
+		listHits += (listLookUp(list, trace[a]) != 0xFFFFFFFF);
+	}
+	uint64_t listNs = (testNowNs() - start);
+	start = testNowNs();
+	uint32_t indexHits = 0;
+	for(uint32_t a = 0; a < frames; a++)
+	{
+		indexHits += (index.find(trace[a]) != CAN_MITM_NO_RULES);
+	}
+	uint64_t indexNs = (testNowNs() - start);
+	CHECK_EQUAL(listHits, indexHits);
+	CHECK(indexNs < listNs);
+	printf("MITM lookup of %u frames, %u IDs with rules, %u with none: ID list %.1f ns/frame, index %.1f ns/frame\n", frames,
+		CAN_MITM_MAX_IDS, BUS_IDS - CAN_MITM_MAX_IDS, (double)listNs / frames, (double)indexNs / frames);
+}
+
+int main(int argc, char **argv)
+{
+	testIndex();
+	if(testBenchMode(argc, argv))
+	{
+		benchTrace(20000000);
+	}
+	return testResult("can_mitm_index_test");
+}
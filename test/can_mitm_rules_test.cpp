@@ -0,0 +1,538 @@
+/*
+* CanBadger MITM Rule Test
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Differential test of the MITM rule evaluation: CANMITMRuleSet::compileRule, matchRule and applyRule work on the whole
+payload as a 64 bit word (masked XOR, per byte compares and carry-free add and subtract), the reference below is the
+byte by byte loop checkRule and applyRule ran on the XRAM rule before. Hand picked byte edges first, then random rules
+and frames. make bench times both.
+Then the residency CAN_MITM relies on to keep the RX interrupt off the SPI bus: rules loaded from a modelled 23LC1024,
+resident blocks served without a single SPI transfer, the others flagged and served from XRAM to a thread.
+Last the fix-ups of can_mitm_fixup.h: the CRCs against a bitwise reference and their published check values, where the
+data ID goes, the payloads isValid turns down and the rolling counter.
+*/
+
+#include "test_common.h"
+#include "sram_model.h"
+#include "can_mitm_rules.h"
+#include "can_mitm_fixup.h"
+
+enum RefResult
+{
+	REF_END,//the rule ends the list
+	REF_NO_MATCH,
+	REF_SEND,
+	REF_DROP
+};
+
+// the rule in the XRAM layout of CAN_MITM.h, checked and applied byte by byte
+static RefResult referenceRule(const uint8_t *raw, const uint8_t *data, uint8_t leng, uint8_t *toSend)
+{
+	uint8_t condMask = raw[0];
+	uint8_t condType = raw[1];
+	if(condType > 3)
+	{
+		return REF_END;
+	}
+	for(uint8_t a = 0; a < leng; a++)
+	{
+		if(condType != 0 && !(condMask & (1 << a)))
+		{
+			continue;
+		}
+		if((condType <= 1 && data[a] != raw[2 + a]) || (condType == 2 && data[a] <= raw[2 + a]) || (condType == 3 && data[a] >= raw[2 + a]))
+		{
+			return REF_NO_MATCH;
+		}
+	}
+	uint8_t actionMask = raw[10];
+	uint8_t actionType = raw[11];
+	const uint8_t *op = &raw[12];
+	if(actionType == 8)
+	{
+		return REF_DROP;
+	}
+	for(uint8_t a = 0; a < leng; a++)
+	{
+		toSend[a] = data[a];
+		if(actionType == 0)
+		{
+			toSend[a] = op[a];
+		}
+		else if(actionType <= 7 && (actionMask & (1 << a)))
+		{
+			switch (actionType)
+			{
+				case 1: toSend[a] = op[a]; break;
+				case 2: toSend[a] = (data[a] + op[a]); break;
+				case 3: toSend[a] = (data[a] - op[a]); break;
+				case 4: toSend[a] = (data[a] * op[a]); break;
+				case 5: toSend[a] = (op[a] != 0) ? (data[a] / op[a]) : 0; break;//the M3 divider returns 0 on a division by zero
+				case 6: toSend[a] = (data[a] + ((data[a] * op[a]) / 100)); break;
+				default: toSend[a] = (data[a] - ((data[a] * op[a]) / 100)); break;
+			}
+		}
+	}
+	return REF_SEND;//unknown actions send the frame as it is
+}
+
+// the same rule through the compiled path, as checkRule uses it
+static RefResult compiledRule(const uint8_t *raw, const uint8_t *data, uint8_t leng, uint8_t *toSend)
+{
+	CANMITMRule rule;
+	if(!CANMITMRuleSet::compileRule(raw, rule))
+	{
+		return REF_END;
+	}
+	uint64_t frame = 0;
+	for(uint8_t a = 0; a < leng; a++)
+	{
+		frame |= ((uint64_t)data[a] << (a * 8));
+	}
+	uint64_t lenMask = (leng == 8) ? ~(uint64_t)0 : (((uint64_t)1 << (leng * 8)) - 1);
+	if(!CANMITMRuleSet::matchRule(rule, frame, lenMask))
+	{
+		return REF_NO_MATCH;
+	}
+	uint64_t out = frame;
+	if(!CANMITMRuleSet::applyRule(rule, frame, leng, out))
+	{
+		return REF_DROP;
+	}
+	for(uint8_t a = 0; a < leng; a++)
+	{
+		toSend[a] = (out >> (a * 8));
+	}
+	return REF_SEND;
+}
+
+static uint32_t mismatches = 0;
+
+// both paths on one rule and frame, false and a printed case on any difference
+static bool compare(const uint8_t *raw, const uint8_t *data, uint8_t leng)
+{
+	uint8_t expected[8] = {0};
+	uint8_t actual[8] = {0};
+	RefResult ref = referenceRule(raw, data, leng, expected);
+	RefResult got = compiledRule(raw, data, leng, actual);
+	if(ref == got && (ref != REF_SEND || memcmp(expected, actual, leng) == 0))
+	{
+		return true;
+	}
+	if(mismatches++ < 10)
+	{
+		printf("mismatch: condition %u mask %02X, action %u mask %02X, length %u, result %d expected %d, data", raw[1], raw[0], raw[11], raw[10], leng, got, ref);
+		for(uint8_t a = 0; a < leng; a++)
+		{
+			printf(" %02X", data[a]);
+		}
+		printf("\n");
+	}
+	return false;
+}
+
+static void makeRule(uint8_t *raw, uint8_t condMask, uint8_t condition, uint8_t value, uint8_t actionMask, uint8_t action, uint8_t operand)
+{
+	raw[0] = condMask;
+	raw[1] = condition;
+	memset(&raw[2], value, 8);
+	raw[10] = actionMask;
+	raw[11] = action;
+	memset(&raw[12], operand, 8);
+}
+
+// the byte values where a carry, borrow or sign could leak into the next byte
+static void testEdges()
+{
+	static const uint8_t edges[] = {0x00, 0x01, 0x7E, 0x7F, 0x80, 0x81, 0xFE, 0xFF};
+	uint8_t raw[CAN_MITM_RULE_SIZE];
+	uint8_t data[8];
+	uint32_t cases = 0;
+	for(uint8_t condition = 0; condition < 4; condition++)
+	{
+		for(uint8_t action = 0; action < 9; action++)
+		{
+			for(uint8_t x = 0; x < sizeof(edges); x++)
+			{
+				for(uint8_t y = 0; y < sizeof(edges); y++)
+				{
+					makeRule(raw, 0xA5, condition, edges[y], 0x5A | 0x81, action, edges[y]);
+					for(uint8_t a = 0; a < 8; a++)
+					{
+						data[a] = edges[(x + a) % sizeof(edges)];
+					}
+					for(uint8_t leng = 0; leng <= 8; leng++)
+					{
+						CHECK(compare(raw, data, leng));
+						cases++;
+					}
+				}
+			}
+		}
+	}
+	// a few by hand, so the reference itself is checked too
+	uint8_t out[8];
+	uint8_t frame[8] = {0xFF, 0x00, 0x80, 0x7F, 0x10, 0x20, 0x30, 0x40};
+	makeRule(raw, 0x00, 0, 0, 0x0F, 2, 0x01);
+	memcpy(&raw[2], frame, 8);
+	CHECK_EQUAL(REF_SEND, compiledRule(raw, frame, 8, out));
+	CHECK_EQUAL(0x00, out[0]);//0xFF + 1 wraps in its own byte
+	CHECK_EQUAL(0x01, out[1]);
+	CHECK_EQUAL(0x81, out[2]);
+	CHECK_EQUAL(0x80, out[3]);
+	CHECK_EQUAL(0x10, out[4]);//not selected by the action
+	makeRule(raw, 0x03, 3, 0x01, 0x03, 3, 0x01);
+	uint8_t low[2] = {0x00, 0x00};
+	CHECK_EQUAL(REF_SEND, compiledRule(raw, low, 2, out));
+	CHECK_EQUAL(0xFF, out[0]);//0 - 1 borrows from nothing
+	CHECK_EQUAL(0xFF, out[1]);
+	makeRule(raw, 0x01, 2, 0x7F, 0x01, 5, 0x00);
+	uint8_t high[1] = {0x80};
+	CHECK_EQUAL(REF_SEND, compiledRule(raw, high, 1, out));
+	CHECK_EQUAL(0x00, out[0]);//0x80 > 0x7F, then divided by zero
+	makeRule(raw, 0x01, 2, 0x80, 0x01, 8, 0x00);
+	CHECK_EQUAL(REF_NO_MATCH, compiledRule(raw, high, 1, out));//0x80 is not greater than itself
+	makeRule(raw, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF);
+	CHECK_EQUAL(REF_END, compiledRule(raw, high, 1, out));//end marker
+	printf("edges: %u rule and frame pairs\n", cases);
+}
+
+static void testResidency()
+{
+	SRAMModel model;
+	sramAttach(&model);
+	RTOS_SPI spi;
+	spi.attach(&model);
+	Ser23LC1024 ram(&spi, SRAM_TEST_CS, SRAM_TEST_HOLD);
+	const uint32_t blocks = 20;
+	uint32_t counts[blocks];
+	uint8_t raw[CAN_MITM_RULE_SIZE + 2];
+	for(uint32_t block = 0; block < blocks; block++)
+	{
+		counts[block] = (block == (blocks - 1)) ? 12 : (2 + (block % 7));//97 rules for a pool of 64, the last more than a cache slot holds
+		for(uint32_t a = 0; a < counts[block]; a++)
+		{
+			makeRule(raw, 0x01, 1, block, 0x01, 1, a);
+			raw[CAN_MITM_RULE_SIZE] = 0xFF;//end marker after the last rule
+			raw[CAN_MITM_RULE_SIZE + 1] = 0xFF;
+			CHECK(ram.write(((block * CAN_MITM_RULE_BLOCK) + (a * CAN_MITM_RULE_SIZE)), sizeof(raw), raw));
+		}
+	}
+	CANMITMRuleSet rules;
+	CHECK(rules.load(&ram, blocks));
+	uint32_t residentBlocks = 0;
+	uint32_t residentRules = 0;
+	for(uint32_t block = 0; block < blocks; block++)
+	{
+		const CANMITMRule *compiled = NULL;
+		uint32_t count = 0;
+		spi.clearStats();
+		if(rules.isResident(block))
+		{
+			residentBlocks++;
+			residentRules += counts[block];
+			stubRunISR([&]() { count = rules.getRules(block, compiled); });
+			CHECK_EQUAL(0, spi.stats().loopBytes + spi.stats().dmaBytes);//not a byte over SPI from the interrupt
+		}
+		else if(counts[block] <= CAN_MITM_CACHE_RULES)
+		{
+			count = rules.getRules(block, compiled);
+			CHECK(spi.stats().loopBytes != 0);//filled from XRAM
+			spi.clearStats();
+			CHECK_EQUAL(count, rules.getRules(block, compiled));
+			CHECK_EQUAL(0, spi.stats().loopBytes + spi.stats().dmaBytes);//now in the cache
+		}
+		else
+		{
+			CHECK_EQUAL(CAN_MITM_RULES_IN_XRAM, rules.getRules(block, compiled));
+			CANMITMRule rule;
+			CHECK(rules.readRule(block, counts[block] - 1, rule));
+			CHECK_EQUAL(counts[block] - 1, rule.operand & 0xFF);
+			CHECK(!rules.readRule(block, counts[block], rule));
+			continue;
+		}
+		if(!CHECK_EQUAL(counts[block], count) || compiled == NULL)
+		{
+			continue;
+		}
+		for(uint32_t a = 0; a < count; a++)
+		{
+			CHECK_EQUAL(block * 0x0101010101010101ULL, compiled[a].value);
+			CHECK_EQUAL(a * 0x0101010101010101ULL, compiled[a].operand);
+		}
+	}
+	CHECK(residentBlocks != 0 && residentBlocks < blocks);
+	CHECK_EQUAL(residentRules, rules.getResidentRules());
+	CHECK_EQUAL(blocks - residentBlocks, rules.getOverflowBlocks());
+	CHECK(!rules.isResident(blocks));
+	rules.release();
+	sramAttach(NULL);
+	printf("residency: %u of %u blocks resident with %u rules, the rest served to the thread from XRAM\n", residentBlocks, blocks, residentRules);
+}
+
+// CRC8 one bit at a time, to check the tables against
+static uint8_t referenceCRC8(uint8_t poly, uint8_t start, uint8_t finalXOR, const uint8_t *data, uint32_t len)
+{
+	uint8_t crc = start;
+	for(uint32_t a = 0; a < len; a++)
+	{
+		crc ^= data[a];
+		for(uint8_t bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x80) ? ((crc << 1) ^ poly) : (crc << 1);
+		}
+	}
+	return (crc ^ finalXOR);
+}
+
+static CANMITMRule fixupRule(uint8_t action, uint8_t actionMask, const uint8_t *payload)
+{
+	uint8_t raw[CAN_MITM_RULE_SIZE];
+	makeRule(raw, 0x00, 1, 0, actionMask, action, 0);//condition 1 with no bytes selected, always runs
+	memcpy(&raw[12], payload, 8);
+	CANMITMRule rule;
+	CHECK(CANMITMRuleSet::compileRule(raw, rule));
+	CHECK(CANMITMFixup::isValid(((uint32_t)actionMask << 8) | action, payload));
+	return rule;
+}
+
+static uint64_t toFrame(const uint8_t *data, uint8_t leng)
+{
+	uint64_t frame = 0;
+	for(uint8_t a = 0; a < leng; a++)
+	{
+		frame |= ((uint64_t)data[a] << (a * 8));
+	}
+	return frame;
+}
+
+static void testChecksums()
+{
+	const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+	CHECK_EQUAL(0x4B, referenceCRC8(0x1D, 0xFF, 0xFF, check, sizeof(check)));//SAE J1850
+	CHECK_EQUAL(0xDF, referenceCRC8(0x2F, 0xFF, 0xFF, check, sizeof(check)));//AUTOSAR CRC8H2F
+	// profile 1: "12" as data ID before "3456789", the checksum in byte 0 left out of its own coverage
+	uint8_t payload[8] = {0, 0xFF, 0xFF, '1', '2', CAN_MITM_DATA_ID_BEFORE, 0, 0};
+	uint8_t data[8] = {0xAA, '3', '4', '5', '6', '7', '8', '9'};
+	CANMITMFixup fixup;
+	CANMITMRule crc = fixupRule(CAN_MITM_ACTION_CRC8, 0xFF, payload);
+	CHECK_EQUAL(0x4B, CANMITMFixup::checksum(crc, toFrame(data, 8), 8));
+	CANMITMRule h2f = fixupRule(CAN_MITM_ACTION_CRC8H2F, 0xFF, payload);
+	CHECK_EQUAL(0xDF, CANMITMFixup::checksum(h2f, toFrame(data, 8), 8));
+	uint64_t out = fixup.apply(h2f, 0, toFrame(data, 8), 8);
+	CHECK_EQUAL(0xDF, out & 0xFF);
+	CHECK_EQUAL(toFrame(data, 8) >> 8, out >> 8);//the covered bytes stay as they are
+	data[0] = 0x55;//the old checksum does not change the new one
+	CHECK_EQUAL(0x4B, CANMITMFixup::checksum(crc, toFrame(data, 8), 8));
+	// profile 2: only the low byte of the data ID, after the covered bytes
+	payload[0] = 7;
+	payload[5] = CAN_MITM_DATA_ID_AFTER;
+	const uint8_t frame2[8] = {0x10, 0x21, 0x32, 0x43, 0x54, 0x65, 0x76, 0x00};
+	const uint8_t order2[] = {0x10, 0x21, 0x32, 0x43, 0x54, 0x65, 0x76, '1'};
+	const uint8_t order1[] = {'1', '2', 0x10, 0x21, 0x32, 0x43, 0x54, 0x65, 0x76};
+	crc = fixupRule(CAN_MITM_ACTION_CRC8, 0x7F, payload);
+	CHECK_EQUAL(referenceCRC8(0x1D, 0xFF, 0xFF, order2, sizeof(order2)), CANMITMFixup::checksum(crc, toFrame(frame2, 8), 8));
+	h2f = fixupRule(CAN_MITM_ACTION_CRC8H2F, 0x7F, payload);
+	CHECK_EQUAL(referenceCRC8(0x2F, 0xFF, 0xFF, order2, sizeof(order2)), CANMITMFixup::checksum(h2f, toFrame(frame2, 8), 8));
+	payload[5] = CAN_MITM_DATA_ID_BEFORE;
+	crc = fixupRule(CAN_MITM_ACTION_CRC8, 0x7F, payload);
+	CHECK_EQUAL(referenceCRC8(0x1D, 0xFF, 0xFF, order1, sizeof(order1)), CANMITMFixup::checksum(crc, toFrame(frame2, 8), 8));
+	payload[5] = CAN_MITM_DATA_ID_NONE;
+	crc = fixupRule(CAN_MITM_ACTION_CRC8, 0x7F, payload);
+	CHECK_EQUAL(referenceCRC8(0x1D, 0xFF, 0xFF, frame2, 7), CANMITMFixup::checksum(crc, toFrame(frame2, 8), 8));
+	// bytes past the DLC are not covered, and a checksum byte past it is not written
+	CHECK_EQUAL(referenceCRC8(0x1D, 0xFF, 0xFF, frame2, 4), CANMITMFixup::checksum(crc, toFrame(frame2, 8), 4));
+	CHECK_EQUAL(toFrame(frame2, 4), fixup.apply(crc, 0, toFrame(frame2, 4), 4));
+	// XOR and SUM with a start value and a final XOR
+	uint8_t plain[8] = {2, 0x10, 0x0C, 0, 0, CAN_MITM_DATA_ID_NONE, 0, 0};
+	const uint8_t frame3[4] = {0x81, 0x92, 0x00, 0xF3};
+	CANMITMRule sum = fixupRule(CAN_MITM_ACTION_SUM, 0x0B, plain);
+	CHECK_EQUAL((uint8_t)((0x10 + 0x81 + 0x92 + 0xF3) ^ 0x0C), CANMITMFixup::checksum(sum, toFrame(frame3, 4), 4));
+	CANMITMRule xorRule = fixupRule(CAN_MITM_ACTION_XOR, 0x0B, plain);
+	CHECK_EQUAL((uint8_t)(0x10 ^ 0x81 ^ 0x92 ^ 0xF3 ^ 0x0C), CANMITMFixup::checksum(xorRule, toFrame(frame3, 4), 4));
+	CHECK_EQUAL(toFrame(frame3, 4) | ((uint64_t)(0x10 ^ 0x81 ^ 0x92 ^ 0xF3 ^ 0x0C) << 16), fixup.apply(xorRule, 0, toFrame(frame3, 4), 4));
+}
+
+static void testFixupValidation()
+{
+	uint8_t payload[8] = {0, 0, 15, 0, 0, CAN_MITM_DATA_ID_AFTER, 0, 0};
+	for(uint8_t action = CAN_MITM_ACTION_XOR; action <= CAN_MITM_ACTION_COUNTER; action++)
+	{
+		CHECK(CANMITMFixup::isFixup(action));
+		CHECK(CANMITMFixup::isValid(0xFF00 | action, payload));
+		payload[0] = 8;//outside the frame
+		CHECK(!CANMITMFixup::isValid(0xFF00 | action, payload));
+		payload[0] = 0;
+	}
+	CHECK(!CANMITMFixup::isFixup(CAN_MITM_ACTION_FIXUP - 1));
+	CHECK(!CANMITMFixup::isFixup(CAN_MITM_ACTION_COUNTER + 1));
+	payload[5] = CAN_MITM_DATA_ID_AFTER + 1;
+	CHECK(!CANMITMFixup::isValid(CAN_MITM_ACTION_CRC8, payload));
+	CHECK(CANMITMFixup::isValid(CAN_MITM_ACTION_COUNTER, payload));//the counter does not look at it
+	payload[1] = 2;//neither nibble
+	CHECK(!CANMITMFixup::isValid(CAN_MITM_ACTION_COUNTER, payload));
+	payload[1] = 1;
+	payload[2] = 0;
+	CHECK(!CANMITMFixup::isValid(CAN_MITM_ACTION_COUNTER, payload));
+	payload[2] = 16;
+	CHECK(!CANMITMFixup::isValid(CAN_MITM_ACTION_COUNTER, payload));
+	payload[0] = 0xFF;
+	CHECK(CANMITMFixup::isValid(CAN_MITM_ACTION_FIXUP - 1, payload));//other actions are not checked
+}
+
+static void testCounter()
+{
+	CANMITMFixup fixup;
+	const uint8_t payload[8] = {1, 1, 14, 0, 0, 0, 0, 0};//high nibble of byte 1, wraps after 14 as in profile 1
+	CANMITMRule counter = fixupRule(CAN_MITM_ACTION_COUNTER, 0x02, payload);
+	const uint64_t frame = 0x112233445566C7A5ULL;//sender at 12, low nibble 7
+	static const uint8_t expected[] = {12, 13, 14, 0, 1, 2};
+	for(uint8_t a = 0; a < sizeof(expected); a++)
+	{
+		uint64_t out = fixup.apply(counter, 3, frame, 8);
+		CHECK_EQUAL(expected[a], (out >> 12) & 0x0F);
+		CHECK_EQUAL(frame & ~(uint64_t)0xF000, out & ~(uint64_t)0xF000);//nothing else changes
+	}
+	CHECK_EQUAL(5, (fixup.apply(counter, 4, 0x5000, 8) >> 12) & 0x0F);//another ID has its own counter
+	CHECK_EQUAL(3, (fixup.apply(counter, 3, frame, 8) >> 12) & 0x0F);
+	CHECK_EQUAL(0x5000, fixup.apply(counter, 4, 0x5000, 1));//too short to hold it, and the counter does not move
+	CHECK_EQUAL(6, (fixup.apply(counter, 4, 0x5000, 8) >> 12) & 0x0F);
+	fixup.reset();
+	CHECK_EQUAL(0, (fixup.apply(counter, 3, 0xF000, 8) >> 12) & 0x0F);//takes over 15, above highest, as 0
+	CHECK_EQUAL(1, (fixup.apply(counter, 3, 0xF000, 8) >> 12) & 0x0F);
+	const uint8_t low[8] = {0, 0, 15, 0, 0, 0, 0, 0};
+	counter = fixupRule(CAN_MITM_ACTION_COUNTER, 0x01, low);
+	CHECK_EQUAL(0x0E, fixup.apply(counter, 7, 0x0E, 1));
+	CHECK_EQUAL(0x0F, fixup.apply(counter, 7, 0x0E, 1));
+	CHECK_EQUAL(0x00, fixup.apply(counter, 7, 0x0E, 1));//wraps after 15
+	CHECK_EQUAL(0x1234, fixup.apply(counter, CAN_MITM_MAX_IDS, 0x1234, 2));//no such block
+}
+
+// random rules and frames. Half of the condition bytes are copied from the frame, so equality rules match too
+static void randomCase(uint8_t *raw, uint8_t *data, uint8_t &leng)
+{
+	leng = (testRandom() % 9);
+	for(uint8_t a = 0; a < 8; a++)
+	{
+		data[a] = testRandom();
+	}
+	for(uint8_t a = 0; a < CAN_MITM_RULE_SIZE; a++)
+	{
+		raw[a] = testRandom();
+	}
+	raw[1] = (testRandom() % 5);//4 ends the list
+	raw[11] = (testRandom() % 10);//9 is unknown
+	uint32_t copy = testRandom();
+	for(uint8_t a = 0; a < 8; a++)
+	{
+		if(copy & (1 << a))
+		{
+			raw[2 + a] = data[a];
+		}
+	}
+}
+
+static void testRandomRules(uint32_t runs)
+{
+	uint8_t raw[CAN_MITM_RULE_SIZE];
+	uint8_t data[8];
+	uint8_t leng;
+	uint32_t matched = 0;
+	mismatches = 0;
+	for(uint32_t run = 0; run < runs; run++)
+	{
+		randomCase(raw, data, leng);
+		uint8_t out[8];
+		if(compiledRule(raw, data, leng, out) >= REF_SEND)
+		{
+			matched++;
+		}
+		compare(raw, data, leng);
+	}
+	CHECK_EQUAL(0, mismatches);
+	CHECK(matched > (runs / 10));//the match and action paths were really taken
+	printf("random: %u rules and frames, %u matched, %u mismatches\n", runs, matched, mismatches);
+}
+
+// both paths on the same cases, the rule compiled once like when MITM starts
+static void benchRules()
+{
+	const uint32_t cases = 4096;
+	const uint32_t runs = 500;
+	static uint8_t raws[cases][CAN_MITM_RULE_SIZE];
+	static uint8_t datas[cases][8];
+	static uint8_t lengs[cases];
+	static CANMITMRule rules[cases];
+	for(uint32_t a = 0; a < cases; a++)
+	{
+		randomCase(raws[a], datas[a], lengs[a]);
+		raws[a][1] &= 3;
+		CANMITMRuleSet::compileRule(raws[a], rules[a]);
+	}
+	uint32_t sum = 0;
+	uint8_t out[8];
+	uint64_t start = testNowNs();
+	for(uint32_t run = 0; run < runs; run++)
+	{
+		for(uint32_t a = 0; a < cases; a++)
+		{
+			sum += referenceRule(raws[a], datas[a], lengs[a], out) + out[0];
+		}
+	}
+	uint64_t byteTime = (testNowNs() - start);
+	start = testNowNs();
+	for(uint32_t run = 0; run < runs; run++)
+	{
+		for(uint32_t a = 0; a < cases; a++)
+		{
+			uint64_t frame;
+			memcpy(&frame, datas[a], 8);
+			uint64_t lenMask = (lengs[a] == 8) ? ~(uint64_t)0 : (((uint64_t)1 << (lengs[a] * 8)) - 1);
+			uint64_t toSend = frame;
+			if(CANMITMRuleSet::matchRule(rules[a], frame, lenMask))
+			{
+				sum += CANMITMRuleSet::applyRule(rules[a], frame, lengs[a], toSend);
+			}
+			sum += (uint8_t)toSend;
+		}
+	}
+	uint64_t wordTime = (testNowNs() - start);
+	double total = (double)cases * runs;
+	printf("rule check and action: byte by byte %.1f ns, 64 bit %.1f ns on the host (%u)\n", byteTime / total, wordTime / total, sum & 1);
+}
+
+int main(int argc, char **argv)
+{
+	bool bench = testBenchMode(argc, argv);
+	testEdges();
+	testResidency();
+	testChecksums();
+	testFixupValidation();
+	testCounter();
+	testRandomRules(bench ? 20000000 : 1000000);
+	if(bench)
+	{
+		benchRules();
+	}
+	return testResult("can_mitm_rules_test");
+}
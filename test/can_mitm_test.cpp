@@ -0,0 +1,168 @@
+/*
+* CanBadger MITM Test
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Runs CAN_MITM on the stub controllers with its rules in a modelled 23LC1024, more of them than fit in IRAM. Every chip
+select of the XRAM is watched: none may come from interrupt context, and the thread side may only reach it while it
+holds the XRAM lock of the EthernetManager. Frames of resident IDs are changed and queued in the RX interrupt, frames of
+the others wait for the thread and come out changed the same way.
+*/
+
+#include "test_common.h"
+#include "sram_model.h"
+#include "canbadger.h"
+#include "CAN_MITM.h"
+
+#define MITM_IDS 20
+#define MITM_RULES_PER_ID 5 //100 rules for a pool of CAN_MITM_IRAM_RULES
+#define SR_TBS_ALL ((1U << 2) | (1U << 10) | (1U << 18))
+
+static EthernetManager *ethernet = NULL;
+static uint32_t selectsFromISR = 0;
+static uint32_t selectsUnlocked = 0;
+static uint32_t selects = 0;
+
+// the chip select of the XRAM, checked before it goes to the model
+static void watchedSelect(PinName pin, int value)
+{
+	if(pin == SRAM_TEST_CS && value == 0)
+	{
+		selects++;
+		if(__get_IPSR() != 0)
+		{
+			selectsFromISR++;
+		}
+		else if(ethernet->lockDepth <= 0)
+		{
+			selectsUnlocked++;
+		}
+	}
+	sramSelect(pin, value);
+}
+
+// byte 0 is looked for in rule after rule, the last one adds 1 to it
+static void addRules(CAN_MITM &mitm)
+{
+	uint8_t cond[8] = {0};
+	uint8_t action[8] = {1, 0, 0, 0, 0, 0, 0, 0};
+	for(uint32_t id = 0; id < MITM_IDS; id++)
+	{
+		uint32_t offset = mitm.allocRAM(0x100 + id);
+		CHECK(offset != CAN_MITM_NO_RULES);
+		for(uint8_t a = 0; a < MITM_RULES_PER_ID; a++)
+		{
+			cond[0] = (0x10 + a);
+			CHECK(mitm.addRule(offset, 0x0101, cond, 0x0102, action));//byte 0 equal, add to byte 0
+		}
+	}
+}
+
+// one frame through the RX interrupt of CAN1. true if it went out on CAN2 right there, with byte 0 as expected
+static bool sendFrame(CAN &can1, uint32_t id, uint8_t expected)
+{
+	LPC_CAN2->TDA1 = 0;
+	CANMessage msg;
+	msg.id = id;
+	msg.len = 8;
+	memset(msg.data, 0, 8);
+	msg.data[0] = (0x10 + MITM_RULES_PER_ID - 1);
+	can1.inject(msg);
+	can1.fire(CAN::RxIrq);
+	return (LPC_CAN2->TID1 == id && (LPC_CAN2->TDA1 & 0xFF) == expected);
+}
+
+static void testInterruptStaysOffXRAM()
+{
+	SRAMModel model;
+	memset(&model.memory[0], 0xFF, model.memory.size());//as clearRAM leaves it, every rule list empty
+	RTOS_SPI spi;
+	spi.attach(&model);
+	Ser23LC1024 ram(&spi, SRAM_TEST_CS, SRAM_TEST_HOLD);
+	sramAttach(&model);
+	stubDigitalOutHook = watchedSelect;
+	CANbadger canbadger;
+	EthernetManager ethMan;
+	ethernet = &ethMan;
+	canbadger.ethernet_manager = &ethMan;
+	CAN can1(LPC_CAN1);
+	CAN can2(LPC_CAN2);
+	LPC_CAN1->GSR = 4;
+	LPC_CAN2->GSR = 4;
+	LPC_CAN1->SR = SR_TBS_ALL;//the test never takes the TX buffers, every push goes straight to buffer 1
+	LPC_CAN2->SR = SR_TBS_ALL;
+	DigitalIn back(NC);
+	static uint8_t index[CAN_MITM_INDEX_SIZE];
+	CAN_MITM *mitm = new CAN_MITM(&canbadger, &can1, &can2, CANStandard, index, &ram, &back);
+	ethMan.lockRam();//rules are written from a thread too
+	addRules(*mitm);
+	ethMan.unlockRam();
+	selects = 0;
+	selectsUnlocked = 0;
+	ethMan.lockRam();
+	mitm->start();
+	ethMan.unlockRam();
+	CHECK_EQUAL(1, ethMan.logs);//told how many IDs take the thread path
+	CHECK(selects != 0);//compiled from XRAM
+	uint32_t resident = 0;
+	uint32_t queued = 0;
+	for(uint32_t id = 0; id < MITM_IDS; id++)
+	{
+		uint32_t modifiedBefore = mitm->getModifiedCount();
+		if(sendFrame(can1, 0x100 + id, 0x10 + MITM_RULES_PER_ID))
+		{
+			resident++;
+			CHECK_EQUAL(modifiedBefore + 1, mitm->getModifiedCount());
+		}
+		else
+		{
+			queued++;
+			CHECK_EQUAL(modifiedBefore, mitm->getModifiedCount());//left for the thread
+		}
+	}
+	CHECK(sendFrame(can1, 0x700, 0x10 + MITM_RULES_PER_ID - 1));//no rules, forwarded as it came in
+	CHECK_EQUAL((CAN_MITM_IRAM_RULES / MITM_RULES_PER_ID), resident);
+	CHECK_EQUAL(0, mitm->getThreadCount());
+	CHECK_EQUAL(0, selectsFromISR);
+	uint32_t modifiedBefore = mitm->getModifiedCount();
+	selects = 0;
+	mitm->stop();//runs what the interrupt queued
+	CHECK_EQUAL(queued, mitm->getThreadCount());
+	CHECK_EQUAL(modifiedBefore + queued, mitm->getModifiedCount());
+	CHECK((LPC_CAN2->TDA1 & 0xFF) == (0x10 + MITM_RULES_PER_ID));//the last one queued, changed by the thread
+	CHECK(selects != 0);//its rules came from XRAM
+	CHECK_EQUAL(0, selectsFromISR);
+	CHECK_EQUAL(0, selectsUnlocked);
+	CHECK_EQUAL(0, ethMan.lockDepth);
+	CHECK_EQUAL(0, mitm->getDroppedCount());
+	printf("MITM: %u IDs handled in the RX interrupt, %u by the thread, %u XRAM selects from an interrupt\n", resident, queued, selectsFromISR);
+	delete mitm;
+	CANTxQueue::getQueue(&can1)->stop();
+	CANTxQueue::getQueue(&can2)->stop();
+	sramAttach(NULL);
+}
+
+int main()
+{
+	testInterruptStaysOffXRAM();
+	return testResult("can_mitm_test");
+}
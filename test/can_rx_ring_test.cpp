@@ -0,0 +1,225 @@
+/*
+* CanBadger CAN RX Ring Test
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Drives CANRxRing from a simulated RX interrupt on its own thread while the main thread consumes, with pop and with the
+blocking waitFrame, sometimes stalling long enough to overrun the ring. Every frame carries a sequence number, so the
+consumer can tell exactly which frames it got and which ones the ring reported as dropped.
+*/
+
+#include "test_common.h"
+#include "can_rx_ring.h"
+#include "timebase.h"
+#include "us_ticker_api.h"
+#include <thread>
+
+#define STRESS_FRAMES 300000
+
+static void makeFrame(uint32_t seq, CANMessage &msg)
+{
+	msg.id = (seq & 0x7FF);
+	msg.format = CANStandard;
+	msg.type = CANData;
+	msg.len = 8;
+	for(uint8_t a = 0; a < 4; a++)
+	{
+		msg.data[a] = (seq >> (a * 8));
+		msg.data[4 + a] = ~msg.data[a];
+	}
+}
+
+static uint32_t frameSeq(const CANRxFrame &frame)
+{
+	return (frame.data[0] | (frame.data[1] << 8) | (frame.data[2] << 16) | ((uint32_t)frame.data[3] << 24));
+}
+
+static void testStress(CAN &can, CANRxRing *ring)
+{
+	ring->clearStats();
+	CHECK(ring->start());
+	std::atomic<bool> done(false);
+	std::atomic<uint32_t> hwDrops(0);
+	std::thread producer([&]() {
+		CANMessage msg;
+		for(uint32_t seq = 0; seq < STRESS_FRAMES; seq++)
+		{
+			makeFrame(seq, msg);
+			if(!can.inject(msg))
+			{
+				hwDrops++;
+			}
+			if(((seq * 2654435761U) >> 30) != 0)//sometimes a few frames pile up in the controller before the interrupt runs
+			{
+				can.fire(CAN::RxIrq);
+			}
+			if((seq & 15) == 15)//bus pace, about half the ring per slice so the consumer can keep up unless it stalls
+			{
+				can.fire(CAN::RxIrq);
+				std::this_thread::sleep_for(std::chrono::microseconds(20));
+			}
+		}
+		can.fire(CAN::RxIrq);
+		done = true;
+	});
+	uint32_t consumed = 0;
+	uint32_t missing = 0;
+	uint32_t expected = 0;
+	uint64_t lastTime = 0;
+	bool inOrder = true;
+	bool intact = true;
+	bool timeOrdered = true;
+	CANRxFrame frame;
+	while(!done || ring->pending() > 0)
+	{
+		uint32_t r = testRandom();
+		bool got;
+		if(r & 1)
+		{
+			got = ring->pop(frame);
+		}
+		else
+		{
+			got = ring->waitFrame(frame, 2);
+		}
+		if(!got)
+		{
+			continue;
+		}
+		uint32_t seq = frameSeq(frame);
+		if(seq < expected)
+		{
+			inOrder = false;
+		}
+		missing += (seq - expected);
+		expected = (seq + 1);
+		consumed++;
+		for(uint8_t a = 0; a < 4; a++)
+		{
+			intact &= (frame.data[4 + a] == (uint8_t)~frame.data[a]);
+		}
+		intact &= (frame.id == (seq & 0x7FF) && frame.len == 8);
+		timeOrdered &= (frame.timestamp >= lastTime);
+		lastTime = frame.timestamp;
+		if((r & 0xFFF) == 0)//stall now and then so the ring fills up
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds(300));
+		}
+	}
+	producer.join();
+	missing += (STRESS_FRAMES - expected);
+	CHECK(inOrder);
+	CHECK(intact);
+	CHECK(timeOrdered);
+	CHECK_EQUAL(0, ring->pending());
+	CHECK_EQUAL(consumed, ring->getReceivedCount());
+	CHECK_EQUAL(missing, ring->getOverrunCount() + hwDrops);//every gap is accounted for
+	CHECK(ring->getOverrunCount() > 0);//the stalls have to have exercised the full ring
+	CHECK(ring->getHighWater() <= CAN_RX_RING_SIZE);
+	CHECK_EQUAL(CAN_RX_RING_SIZE, ring->getHighWater());
+	printf("stress: %u frames, %u consumed, %u ring overruns, %u controller overruns\n", (unsigned int)STRESS_FRAMES,
+			(unsigned int)consumed, (unsigned int)ring->getOverrunCount(), (unsigned int)hwDrops);
+	ring->stop();
+}
+
+static void testWakeup(CAN &can, CANRxRing *ring)
+{
+	CHECK(ring->start());
+	std::thread producer([&]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		CANMessage msg;
+		makeFrame(42, msg);
+		can.inject(msg);
+		can.fire(CAN::RxIrq);
+	});
+	CANRxFrame frame;
+	uint32_t start = us_ticker_read();
+	CHECK(ring->waitFrame(frame, 1000));//blocks on the signal until the interrupt wakes it
+	uint32_t elapsed = (us_ticker_read() - start);
+	CHECK_EQUAL(42, frameSeq(frame));
+	CHECK(elapsed >= 15000 && elapsed < 500000);
+	producer.join();
+	start = us_ticker_read();
+	CHECK(!ring->waitFrame(frame, 30));//times out
+	elapsed = (us_ticker_read() - start);
+	CHECK(elapsed >= 25000);
+	ring->stop();
+}
+
+static void testInterruptContext(CAN &can, CANRxRing *ring)
+{
+	CHECK(ring->start());
+	CANMessage msg;
+	makeFrame(7, msg);
+	can.inject(msg);//left in the controller, as if the RX interrupt were masked
+	bool got = true;
+	uint32_t elapsed = 0;
+	stubRunISR([&]() {
+		CANRxFrame frame;
+		uint32_t start = us_ticker_read();
+		got = ring->waitFrame(frame, 100);
+		elapsed = (us_ticker_read() - start);
+	});
+	CHECK(!got);//rejected, not waited out
+	CHECK(elapsed < 10000);
+	ring->stop();
+	CANMessage leftover;
+	can.read(leftover);
+}
+
+static void testDrainKeepsPRIMASK(CAN &can, CANRxRing *ring)
+{
+	CHECK(ring->start());
+	CANMessage msg;
+	makeFrame(1, msg);
+	can.inject(msg);
+	__disable_irq();
+	ring->drain();
+	CHECK_EQUAL(1, __get_PRIMASK());//still masked for the caller
+	__enable_irq();
+	makeFrame(2, msg);
+	can.inject(msg);
+	ring->drain();
+	CHECK_EQUAL(0, __get_PRIMASK());
+	CHECK_EQUAL(2, ring->pending());
+	CANRxFrame frame;
+	CHECK(ring->pop(frame) && frameSeq(frame) == 1);
+	CHECK(ring->pop(frame) && frameSeq(frame) == 2);
+	ring->stop();
+}
+
+int main()
+{
+	CAN can(LPC_CAN1);
+	CANRxRing *ring = CANRxRing::getRing(&can);
+	CHECK(ring != NULL);
+	if(ring == NULL)
+	{
+		return testResult("can_rx_ring_test");
+	}
+	CHECK(CANRxRing::getRing((uint8_t)1) == ring);
+	testDrainKeepsPRIMASK(can, ring);
+	testInterruptContext(can, ring);
+	testWakeup(can, ring);
+	testStress(can, ring);
+	return testResult("can_rx_ring_test");
+}
@@ -0,0 +1,133 @@
+/*
+* CanBadger Stream Receiver
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "can_stream_receiver.h"
+#include "ethernet_stream.hpp"
+#include "can_log_v2.h"
+#include <string.h>
+
+CANStreamReceiver::CANStreamReceiver()
+{
+	clearStats();
+}
+
+void CANStreamReceiver::clearStats()
+{
+	memset(&_stats, 0, sizeof(_stats));
+	_started = false;
+	_next = 0;
+	_seen = 0;
+}
+
+const CANStreamStats& CANStreamReceiver::getStats()
+{
+	return _stats;
+}
+
+bool CANStreamReceiver::receive(const uint8_t *data, uint32_t len)
+{
+	if(len <= ETHERNET_STREAM_HEADER_SIZE || data[0] != ETHERNET_STREAM_MAGIC0 || data[1] != ETHERNET_STREAM_MAGIC1)
+	{
+		_stats.invalid++;
+		return false;
+	}
+	if(countPayload(data[2], &data[ETHERNET_STREAM_HEADER_SIZE], (len - ETHERNET_STREAM_HEADER_SIZE)) == false)
+	{
+		_stats.invalid++;
+		return false;
+	}
+	uint32_t seq = (data[4] | (data[5] << 8) | (data[6] << 16) | ((uint32_t)data[7] << 24));
+	uint64_t time = 0;
+	for(uint8_t a = 0; a < 8; a++)
+	{
+		time |= ((uint64_t)data[8 + a] << (a * 8));
+	}
+	_stats.datagrams++;
+	_stats.bytes += len;
+	if(_started == false || (seq == 0 && _next > CAN_STREAM_WINDOW))//first datagram, or the device started a new stream
+	{
+		_started = true;
+		_stats.streams++;
+		_stats.lost += seq;//numbering starts at 0, whatever came before we missed
+		_stats.firstTime = (_stats.streams == 1) ? time : _stats.firstTime;
+		_next = seq;
+		_seen = 0;
+	}
+	if(seq >= _next)
+	{
+		uint32_t gap = (seq - _next);
+		_stats.lost += gap;
+		_seen = (gap >= (CAN_STREAM_WINDOW - 1)) ? 0 : (_seen << (gap + 1));
+		_seen |= 1;
+		_next = (seq + 1);
+		_stats.lastTime = time;
+		return true;
+	}
+	uint32_t age = (_next - 1 - seq);
+	if(age < CAN_STREAM_WINDOW && (_seen & ((uint64_t)1 << age)) != 0)
+	{
+		_stats.repeated++;
+		return true;
+	}
+	if(age < CAN_STREAM_WINDOW)
+	{
+		_seen |= ((uint64_t)1 << age);
+	}
+	_stats.late++;
+	if(_stats.lost > 0)
+	{
+		_stats.lost--;
+	}
+	return true;
+}
+
+bool CANStreamReceiver::countPayload(uint8_t flags, const uint8_t *payload, uint32_t len)
+{
+	if(flags & ETHERNET_STREAM_COMPRESSED)
+	{
+		uint32_t consumed;
+		int32_t plainLen = CANLogCompressor::decodeBlock(payload, len, _plain, consumed);
+		if(plainLen <= 0 || consumed != len)
+		{
+			return false;
+		}
+		payload = _plain;
+		len = plainLen;
+	}
+	uint32_t frames = 0;
+	for(uint32_t pos = 0; pos < len;)
+	{
+		CANLogV2Frame frame;
+		uint32_t speed;
+		uint32_t size = CANLogV2Decoder::fromRAW(&payload[pos], (len - pos), frame, speed);
+		if(size == 0)
+		{
+			return false;
+		}
+		pos += size;
+		frames++;
+	}
+	_stats.frames += frames;
+	_stats.blocks += (flags & ETHERNET_STREAM_COMPRESSED) ? 1 : 0;
+	return true;
+}
@@ -0,0 +1,79 @@
+/*
+* CanBadger Stream Receiver
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Host side of the UDP capture stream (see ethernet_stream.hpp). Takes the datagrams as they arrive and keeps count of
+loss, late and repeated datagrams and of the frames in the payloads, RAW records or compressed blocks.
+*/
+
+#ifndef __CAN_STREAM_RECEIVER_H__
+#define __CAN_STREAM_RECEIVER_H__
+
+#include <stdint.h>
+#include "can_log_lz.h"
+
+#define CAN_STREAM_WINDOW 64 //datagrams back a late one can still be told from a repeated one
+
+struct CANStreamStats
+{
+	uint32_t datagrams;//valid stream datagrams, repeated ones included
+	uint64_t bytes;//of those, headers included
+	uint32_t frames;
+	uint32_t blocks;//compressed payloads
+	uint32_t lost;//sequence numbers never seen, also counts the ones before the first datagram
+	uint32_t late;//arrived after a later one, no longer counted as lost
+	uint32_t repeated;
+	uint32_t invalid;//not a stream datagram, or the payload does not decode
+	uint32_t streams;//sequence restarts at 0, one per LOG_RAW_CAN_TRAFFIC session
+	uint64_t firstTime;//device time of the first record of the first and the last datagram
+	uint64_t lastTime;
+};
+
+class CANStreamReceiver
+{
+	public:
+
+		CANStreamReceiver();
+
+		/** Counts one datagram
+
+			@return false if it is not a valid stream datagram
+		*/
+		bool receive(const uint8_t *data, uint32_t len);
+
+		const CANStreamStats& getStats();
+
+		void clearStats();//also forgets the sequence numbers seen so far
+
+	private:
+
+		bool countPayload(uint8_t flags, const uint8_t *payload, uint32_t len);
+
+		CANStreamStats _stats;
+		bool _started;
+		uint32_t _next;//sequence number expected next
+		uint64_t _seen;//bit n set if _next - 1 - n arrived
+		uint8_t _plain[CAN_LOG_LZ_BLOCK_SIZE];
+};
+
+#endif
@@ -0,0 +1,133 @@
+/*
+* CanBadger Stream Receiver
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Listens for the UDP capture stream and prints loss and throughput once a second:
+	can_stream_receiver <port> [seconds]
+Point the logger at it with the port in data[8-9] of LOG_RAW_CAN_TRAFFIC. Stops after the given time or on Ctrl-C.
+*/
+
+#include "can_stream_receiver.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <time.h>
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onSignal(int)
+{
+	stopRequested = 1;
+}
+
+static double nowSeconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec + (now.tv_nsec / 1e9));
+}
+
+static void printStats(const CANStreamStats &stats, double seconds, const char *what)
+{
+	uint32_t expected = (stats.datagrams - stats.repeated + stats.lost);
+	printf("%s %u datagrams, %u frames (%.0f/s), %.1f KB/s, %u lost (%.2f%%), %u late, %u repeated, %u invalid, %u streams\n", what,
+		(unsigned int)stats.datagrams, (unsigned int)stats.frames, (seconds > 0) ? (stats.frames / seconds) : 0.0,
+		(seconds > 0) ? (stats.bytes / (seconds * 1000)) : 0.0, (unsigned int)stats.lost, (expected > 0) ? ((100.0 * stats.lost) / expected) : 0.0,
+		(unsigned int)stats.late, (unsigned int)stats.repeated, (unsigned int)stats.invalid, (unsigned int)stats.streams);
+	fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+	int port = (argc > 1) ? atoi(argv[1]) : 0;
+	double limit = (argc > 2) ? atof(argv[2]) : 0;
+	if(argc < 2 || argc > 3 || port <= 0 || port > 65535)
+	{
+		fprintf(stderr, "usage: %s <port> [seconds]\n", argv[0]);
+		return 2;
+	}
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	if(sock < 0 || bind(sock, (struct sockaddr*)&address, sizeof(address)) != 0)
+	{
+		perror("cannot listen");
+		return 1;
+	}
+	int bufferSize = (4 * 1024 * 1024);//bursts after a stall on the bus side should not be lost here
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+	struct timeval timeout = {0, 100000};
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+
+	static CANStreamReceiver receiver;
+	static uint8_t datagram[65536];
+	double start = 0;
+	double lastPrint = nowSeconds();
+	CANStreamStats last;
+	memset(&last, 0, sizeof(last));
+	printf("listening on UDP port %d\n", port);
+	while(stopRequested == 0)
+	{
+		ssize_t len = recv(sock, datagram, sizeof(datagram), 0);
+		double now = nowSeconds();
+		if(len > 0)
+		{
+			if(start == 0)
+			{
+				start = now;
+			}
+			receiver.receive(datagram, len);
+		}
+		if((now - lastPrint) >= 1.0 && start != 0)
+		{
+			CANStreamStats stats = receiver.getStats();
+			CANStreamStats window = stats;//just the last second
+			window.datagrams -= last.datagrams;
+			window.bytes -= last.bytes;
+			window.frames -= last.frames;
+			window.lost = (stats.lost > last.lost) ? (stats.lost - last.lost) : 0;//late datagrams take back loss counted before
+			window.late -= last.late;
+			window.repeated -= last.repeated;
+			window.invalid -= last.invalid;
+			printStats(window, (now - lastPrint), "last second:");
+			last = stats;
+			lastPrint = now;
+		}
+		if(limit > 0 && start != 0 && (now - start) >= limit)
+		{
+			break;
+		}
+	}
+	close(sock);
+	printStats(receiver.getStats(), (start != 0) ? (nowSeconds() - start) : 0, "total:");
+	return 0;
+}
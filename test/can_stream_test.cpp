@@ -0,0 +1,241 @@
+/*
+* CanBadger Stream Test
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Checks the loss accounting of the stream receiver on hand made sequences, then runs it over loopback against a local
+stand-in for the logger. The stand-in builds datagrams the way EthernetManager::sendStreamDatagram does and skips a
+sequence number now and then, like a send that failed on the device. The receiver has to report exactly that loss.
+*/
+
+#include "test_common.h"
+#include "can_stream_receiver.h"
+#include "ethernet_stream.hpp"
+#include "can_log_v2.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define STREAM_MAX_PAYLOAD 1400 //ETHERNET_MAX_SEND_DATA
+#define STREAM_SKIP_EVERY 50 //the stand-in loses one datagram in this many
+#define STREAM_IN_FLIGHT 64 //datagrams the stand-in lets get ahead of the receiver, so loopback itself never drops
+
+static uint32_t makeDatagram(uint8_t *out, uint8_t flags, uint32_t seq, uint64_t firstTime, const uint8_t *payload, uint32_t len)
+{
+	out[0] = ETHERNET_STREAM_MAGIC0;
+	out[1] = ETHERNET_STREAM_MAGIC1;
+	out[2] = flags;
+	out[3] = 0;
+	for(uint8_t a = 0; a < 4; a++)
+	{
+		out[4 + a] = (seq >> (a * 8));
+	}
+	for(uint8_t a = 0; a < 8; a++)
+	{
+		out[8 + a] = (firstTime >> (a * 8));
+	}
+	memcpy(&out[ETHERNET_STREAM_HEADER_SIZE], payload, len);
+	return (ETHERNET_STREAM_HEADER_SIZE + len);
+}
+
+// RAW records as the logger batches them, as many as fit
+static uint32_t makeBatch(uint8_t *out, uint32_t maxLen, uint32_t &frameNumber, uint32_t maxFrames)
+{
+	uint32_t len = 0;
+	uint8_t raw[22];
+	for(uint32_t a = 0; a < maxFrames && (len + sizeof(raw)) <= maxLen; a++)
+	{
+		CANLogV2Frame frame;
+		memset(&frame, 0, sizeof(frame));
+		frame.bus = ((frameNumber & 1) + 1);
+		frame.id = (0x100 + (frameNumber % 40));
+		frame.len = 8;
+		frame.data[0] = frameNumber;
+		frame.timestamp = ((uint64_t)frameNumber * 250000);
+		uint32_t size = CANLogV2Decoder::toRAW(frame, 500000, raw);
+		memcpy(&out[len], raw, size);
+		len += size;
+		frameNumber++;
+	}
+	return len;
+}
+
+static void testSequences()
+{
+	CANStreamReceiver receiver;
+	uint8_t payload[STREAM_MAX_PAYLOAD];
+	uint8_t datagram[ETHERNET_STREAM_HEADER_SIZE + STREAM_MAX_PAYLOAD];
+	uint32_t frameNumber = 0;
+	uint32_t payloadLen = makeBatch(payload, sizeof(payload), frameNumber, 3);
+	static const uint32_t seqs[9] = {0, 1, 2, 5, 3, 3, 4, 6, 6};
+	for(uint32_t a = 0; a < 9; a++)
+	{
+		CHECK(receiver.receive(datagram, makeDatagram(datagram, 0, seqs[a], (a * 1000), payload, payloadLen)));
+	}
+	const CANStreamStats &stats = receiver.getStats();
+	CHECK_EQUAL(9, stats.datagrams);
+	CHECK_EQUAL(27, stats.frames);
+	CHECK_EQUAL(0, stats.lost);//3 and 4 came late
+	CHECK_EQUAL(2, stats.late);
+	CHECK_EQUAL(2, stats.repeated);
+	CHECK_EQUAL(1, stats.streams);
+	CHECK_EQUAL(0, stats.firstTime);
+	CHECK_EQUAL(7000, stats.lastTime);//of the highest sequence number
+
+	//a gap is loss until the missing datagram turns up, even from further back than the window
+	CHECK(receiver.receive(datagram, makeDatagram(datagram, 0, 200, 0, payload, payloadLen)));
+	CHECK_EQUAL(193, stats.lost);
+	CHECK(receiver.receive(datagram, makeDatagram(datagram, 0, 100, 0, payload, payloadLen)));
+	CHECK_EQUAL(192, stats.lost);
+	CHECK_EQUAL(3, stats.late);
+
+	//the logger starts every stream at 0
+	CHECK(receiver.receive(datagram, makeDatagram(datagram, 0, 0, 0, payload, payloadLen)));
+	CHECK(receiver.receive(datagram, makeDatagram(datagram, 0, 2, 0, payload, payloadLen)));
+	CHECK_EQUAL(2, stats.streams);
+	CHECK_EQUAL(193, stats.lost);
+
+	//anything that is not a stream datagram, or whose payload is cut or damaged, is counted apart
+	uint32_t len = makeDatagram(datagram, 0, 3, 0, payload, payloadLen);
+	CHECK(!receiver.receive(datagram, (len - 5)));
+	datagram[ETHERNET_STREAM_HEADER_SIZE] = 0x99;
+	CHECK(!receiver.receive(datagram, len));
+	datagram[0] = 0;
+	CHECK(!receiver.receive(datagram, len));
+	CHECK(!receiver.receive(datagram, ETHERNET_STREAM_HEADER_SIZE));
+	CHECK(!receiver.receive(datagram, makeDatagram(datagram, ETHERNET_STREAM_COMPRESSED, 3, 0, payload, payloadLen)));
+	CHECK_EQUAL(5, stats.invalid);
+	CHECK_EQUAL(13, stats.datagrams);
+
+	//a compressed block is unpacked and its records counted
+	receiver.clearStats();
+	static CANLogCompressor compressor(1024);
+	frameNumber = 0;
+	payloadLen = makeBatch(payload, 1024, frameNumber, 100);
+	compressor.append(payload, payloadLen);
+	const uint8_t *block;
+	uint32_t blockLen = compressor.flush(block);
+	CHECK(receiver.receive(datagram, makeDatagram(datagram, ETHERNET_STREAM_COMPRESSED, 0, 0, block, blockLen)));
+	CHECK_EQUAL(frameNumber, stats.frames);
+	CHECK_EQUAL(1, stats.blocks);
+	CHECK_EQUAL(0, stats.lost);
+
+	//joining a stream late counts what came before as lost
+	receiver.clearStats();
+	CHECK(receiver.receive(datagram, makeDatagram(datagram, ETHERNET_STREAM_COMPRESSED, 10, 0, block, blockLen)));
+	CHECK_EQUAL(10, stats.lost);
+}
+
+static void testLoopback(uint32_t datagrams)
+{
+	int receiveSocket = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addressLen = sizeof(address);
+	if(!CHECK(receiveSocket >= 0 && bind(receiveSocket, (struct sockaddr*)&address, sizeof(address)) == 0))
+	{
+		return;
+	}
+	getsockname(receiveSocket, (struct sockaddr*)&address, &addressLen);
+	struct timeval timeout = {0, 200000};
+	setsockopt(receiveSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	int bufferSize = (1024 * 1024);//room for everything in flight, whatever the system default is
+	setsockopt(receiveSocket, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+	std::atomic<uint32_t> received(0);
+	std::atomic<bool> done(false);
+	uint32_t skipped = 0;
+	uint32_t framesSent = 0;
+	std::thread standIn([&]()
+	{
+		int sendSocket = socket(AF_INET, SOCK_DGRAM, 0);
+		uint8_t payload[STREAM_MAX_PAYLOAD];
+		uint8_t datagram[ETHERNET_STREAM_HEADER_SIZE + STREAM_MAX_PAYLOAD];
+		uint32_t frameNumber = 0;
+		uint32_t sent = 0;
+		for(uint32_t seq = 0; seq < datagrams; seq++)
+		{
+			uint64_t firstTime = ((uint64_t)frameNumber * 250000);
+			uint32_t len = makeBatch(payload, sizeof(payload), frameNumber, 0xFFFFFFFF);
+			if((seq % STREAM_SKIP_EVERY) == (STREAM_SKIP_EVERY - 1) && seq != (datagrams - 1))//failed send, the number is used up
+			{
+				skipped++;
+				continue;
+			}
+			framesSent += (len / 22);
+			while((sent - received.load()) > STREAM_IN_FLIGHT)
+			{
+				std::this_thread::yield();
+			}
+			len = makeDatagram(datagram, 0, seq, firstTime, payload, len);
+			sendto(sendSocket, datagram, len, 0, (struct sockaddr*)&address, sizeof(address));
+			sent++;
+		}
+		close(sendSocket);
+		done = true;
+	});
+
+	CANStreamReceiver receiver;
+	static uint8_t datagram[65536];
+	uint64_t start = testNowNs();
+	uint64_t end = start;
+	while(true)
+	{
+		ssize_t len = recv(receiveSocket, datagram, sizeof(datagram), 0);
+		if(len <= 0)
+		{
+			if(done == true)
+			{
+				break;//the stand-in is through and nothing came for a while
+			}
+			continue;
+		}
+		receiver.receive(datagram, len);
+		received++;
+		end = testNowNs();
+	}
+	standIn.join();
+	close(receiveSocket);
+	const CANStreamStats &stats = receiver.getStats();
+	CHECK_EQUAL(datagrams - skipped, stats.datagrams);
+	CHECK_EQUAL(skipped, stats.lost);
+	CHECK_EQUAL(0, stats.late);
+	CHECK_EQUAL(0, stats.repeated);
+	CHECK_EQUAL(0, stats.invalid);
+	CHECK_EQUAL(framesSent, stats.frames);
+	double seconds = ((end - start) / 1e9);
+	printf("loopback: %u datagrams, %u frames, %u lost (%.1f%%) in %.2f s, %.1f MB/s, %.0f frames/s\n", (unsigned int)stats.datagrams, (unsigned int)stats.frames,
+		(unsigned int)stats.lost, (100.0 * stats.lost) / datagrams, seconds, stats.bytes / (seconds * 1e6), stats.frames / seconds);
+}
+
+int main(int argc, char **argv)
+{
+	testSequences();
+	testLoopback(testBenchMode(argc, argv) ? 200000 : 5000);
+	return testResult("can_stream_test");
+}
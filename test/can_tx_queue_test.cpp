@@ -0,0 +1,136 @@
+/*
+* CanBadger CAN TX Queue Test
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Drives CANTxQueue against the TX registers of the stub controller. The test plays the hardware: it clears the TBS bit of
+every buffer the queue loads and sets it again when the frame is out, then fires TI1. Checks the batch layout (the last
+frame in buffer 1 with the lowest local priority), that a batch is retired on TI1 even while a direct CAN::write holds
+buffer 2 or 3, that the next batch leaves such a buffer alone, and that a push from an interrupt never starts the queue.
+*/
+
+#include "test_common.h"
+#include "can_tx_queue.h"
+
+#define SR_TBS1 (1U << 2)
+#define SR_TBS2 (1U << 10)
+#define SR_TBS3 (1U << 18)
+#define SR_TBS_ALL (SR_TBS1 | SR_TBS2 | SR_TBS3)
+#define CMR_STB(x) (1U << (5 + (x)))
+
+static const uint8_t payload[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+
+// what the controller does on a transmission request: the buffers it was asked to send are no longer released
+static void loadedByHardware(LPC_CAN_TypeDef *controller)
+{
+	uint32_t cmr = controller->CMR;
+	static const uint32_t tbs[3] = {SR_TBS1, SR_TBS2, SR_TBS3};
+	for(uint8_t a = 0; a < 3; a++)
+	{
+		if(cmr & CMR_STB(a))
+		{
+			controller->SR &= ~tbs[a];
+		}
+	}
+	controller->CMR = 0;
+}
+
+static void testBatches(CAN &can, CANTxQueue *queue)
+{
+	LPC_CAN_TypeDef *controller = LPC_CAN1;
+	controller->GSR = 4;//transmission complete, start does not have to wait
+	controller->SR = SR_TBS_ALL;
+	CHECK(queue->start());
+	CHECK((controller->IER & ((1U << 9) | (1U << 10))) == 0);//only TI1 is used
+	uint32_t first = queue->push(0x300, payload, 8);
+	CHECK(first != 0);
+	CHECK_EQUAL(0x300, controller->TID1);//idle controller, loaded right away
+	CHECK_EQUAL(CMR_STB(0) | 1, controller->CMR);
+	loadedByHardware(controller);
+	uint32_t tokens[3];
+	tokens[0] = queue->push(0x100, payload, 8);
+	tokens[1] = queue->push(0x200, payload, 8);
+	tokens[2] = queue->push(0x050, payload, 8);
+	CHECK_EQUAL(3, queue->getDepth());//buffer 1 busy, nothing loaded
+	CHECK(!queue->isComplete(first));
+	controller->SR = SR_TBS_ALL;
+	CHECK(can.fire(CAN::TxIrq));
+	CHECK(queue->isComplete(first));
+	CHECK_EQUAL(0, queue->getDepth());
+	CHECK_EQUAL(0x050, controller->TID2);//ID order, the last one in buffer 1
+	CHECK_EQUAL(0x100, controller->TID3);
+	CHECK_EQUAL(0x200, controller->TID1);
+	CHECK_EQUAL(0, controller->TFI2 & 0xFF);
+	CHECK_EQUAL(1, controller->TFI3 & 0xFF);
+	CHECK_EQUAL(2, controller->TFI1 & 0xFF);//lowest local priority, goes out last
+	loadedByHardware(controller);
+	uint32_t later[2];
+	later[0] = queue->push(0x020, payload, 8);
+	later[1] = queue->push(0x010, payload, 8);
+	// the batch is out, but a direct CAN::write took buffer 2 meanwhile. TIE2 is off, so only TI1 tells us
+	controller->SR = (SR_TBS1 | SR_TBS3);
+	CHECK(can.fire(CAN::TxIrq));
+	for(uint8_t a = 0; a < 3; a++)
+	{
+		CHECK(queue->isComplete(tokens[a]));
+		CHECK(queue->waitComplete(tokens[a], 0));//returns at once, it does not wait for buffer 2
+	}
+	CHECK_EQUAL(0, controller->CMR & CMR_STB(1));//buffer 2 left alone
+	CHECK_EQUAL(0x010, controller->TID3);
+	CHECK_EQUAL(0x020, controller->TID1);
+	loadedByHardware(controller);
+	controller->SR = (SR_TBS1 | SR_TBS2 | SR_TBS3);
+	CHECK(can.fire(CAN::TxIrq));
+	CHECK(queue->isComplete(later[0]) && queue->isComplete(later[1]));
+	CHECK_EQUAL(6, queue->getSentCount());
+	queue->stop();
+}
+
+static void testStartFromInterrupt(CAN &can, CANTxQueue *queue)
+{
+	LPC_CAN_TypeDef *controller = LPC_CAN2;
+	controller->GSR = 4;
+	controller->SR = SR_TBS_ALL;
+	uint32_t token = 1;
+	stubRunISR([&]() { token = queue->push(0x123, payload, 8); });
+	CHECK_EQUAL(0, token);//dropped, starting would spin in reset mode inside the interrupt
+	CHECK(!queue->isRunning());
+	CHECK_EQUAL(1, queue->getDropCount());
+	CHECK(queue->push(0x123, payload, 8) != 0);//a thread starts it
+	CHECK(queue->isRunning());
+	loadedByHardware(controller);
+	stubRunISR([&]() { token = queue->push(0x124, payload, 8); });
+	CHECK(token != 0);//running now, so interrupts may push
+	controller->SR = SR_TBS_ALL;
+	CHECK(can.fire(CAN::TxIrq));
+	CHECK(queue->waitComplete(token, 10));
+	queue->stop();
+}
+
+int main()
+{
+	CAN can1(LPC_CAN1);
+	CAN can2(LPC_CAN2);
+	testBatches(can1, CANTxQueue::getQueue(&can1));
+	testStartFromInterrupt(can2, CANTxQueue::getQueue(&can2));
+	return testResult("can_tx_queue_test");
+}
@@ -0,0 +1,432 @@
+/*
+* CanBadger SD Card Model
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "sd_card_model.h"
+
+#define SD_MODEL_R1_IDLE 0x01
+#define SD_MODEL_R1_ILLEGAL 0x04
+#define SD_MODEL_R1_ADDRESS 0x20
+#define SD_MODEL_R1_PARAMETER 0x40
+#define SD_MODEL_TOKEN_ERROR_ECC 0x04
+#define SD_MODEL_TOKEN_ERROR_RANGE 0x08
+#define SD_MODEL_RESPONSE_ACCEPTED 0x05
+#define SD_MODEL_RESPONSE_WRITE_ERROR 0x0D
+
+static SDCardModel *selectedCard = NULL;
+
+static void chipSelectHook(PinName pin, int value)
+{
+	if(selectedCard != NULL && pin == selectedCard->csPin)
+	{
+		selectedCard->select(value == 0);
+	}
+}
+
+void sdModelAttach(SDCardModel *card)
+{
+	selectedCard = card;
+	stubDigitalOutHook = chipSelectHook;
+	stubSPIDefaultDevice = card;
+}
+
+double sdModelMBs(uint64_t payloadBytes, uint64_t busBytes)
+{
+	return ((double)payloadBytes / (((double)busBytes * 8.0) / SD_MODEL_BUS_HZ)) / 1000000.0;
+}
+
+static uint32_t usToBytes(uint32_t us)
+{
+	return (uint32_t)(((uint64_t)us * SD_MODEL_BUS_HZ) / 8000000);
+}
+
+SDCardModel::SDCardModel(uint32_t blocks) : storage((size_t)blocks * 512, 0)
+{
+	csPin = SD_MODEL_CS;
+	acceptCMD25 = true;
+	acceptCMD18 = true;
+	acceptACMD23 = true;
+	failWriteBlock = -1;
+	failReadBlock = -1;
+	//a class 10 card more or less, the point is the ratio between the paths, not the exact figures
+	timing.singleProgramUs = 800;
+	timing.multiProgramUs = 250;
+	timing.preErasedProgramUs = 120;
+	timing.stopTranUs = 400;
+	timing.accessUs = 250;
+	timing.nextBlockUs = 20;
+	memset(commands, 0, sizeof(commands));
+	memset(appCommands, 0, sizeof(appCommands));
+	lastPreErase = 0;
+	protocolErrors = 0;
+	busBytes = 0;
+	_state = SD_IDLE;
+	_selected = false;
+	_appCmd = false;
+	_idle = true;
+	_streamFirst = false;
+	_streamStopped = true;
+	_cmdLen = 0;
+	_busy = 0;
+	_block = 0;
+	_rxCount = -1;
+	_preErase = 0;
+	_preErasedLeft = 0;
+}
+
+void SDCardModel::select(bool selected)
+{
+	_selected = selected;
+}
+
+uint8_t SDCardModel::exchange(uint8_t mosi)
+{
+	busBytes++;
+	if(!_selected)//time goes on, but the card does not drive the bus
+	{
+		if(_busy != 0 && _out.empty())
+		{
+			_busy--;
+		}
+		return 0xFF;
+	}
+	uint8_t miso = 0xFF;
+	if(_state == SD_READ_MULTI && _out.empty() && !_streamStopped)
+	{
+		queueReadBlock();
+	}
+	if(!_out.empty())
+	{
+		miso = _out.front();
+		_out.pop_front();
+	}
+	else if(_busy != 0)
+	{
+		_busy--;
+		miso = 0x00;
+	}
+	input(mosi);
+	return miso;
+}
+
+void SDCardModel::input(uint8_t mosi)
+{
+	if(_rxCount >= 0)
+	{
+		_rx[_rxCount++] = mosi;
+		if(_rxCount == 514)
+		{
+			finishWriteBlock();
+		}
+		return;
+	}
+	if(_cmdLen != 0)
+	{
+		_cmd[_cmdLen++] = mosi;
+		if(_cmdLen == 6)
+		{
+			_cmdLen = 0;
+			command();
+		}
+		return;
+	}
+	if(_state == SD_WRITE_SINGLE && mosi == 0xFE)
+	{
+		_rxCount = 0;
+		return;
+	}
+	if(_state == SD_WRITE_MULTI)
+	{
+		if(mosi == 0xFC)
+		{
+			_rxCount = 0;
+			return;
+		}
+		if(mosi == 0xFD)//STOP_TRAN, busy starts one byte later
+		{
+			_state = SD_IDLE;
+			_preErasedLeft = 0;
+			_out.push_back(0xFF);
+			_busy = usToBytes(timing.stopTranUs);
+			return;
+		}
+		if(mosi != 0xFF)//only tokens are taken until STOP_TRAN, a command here is lost
+		{
+			protocolErrors++;
+		}
+		return;
+	}
+	if((mosi & 0xC0) == 0x40)
+	{
+		_cmd[0] = mosi;
+		_cmdLen = 1;
+	}
+}
+
+void SDCardModel::queueLatency(uint32_t us)
+{
+	for(uint32_t a = usToBytes(us); a > 0; a--)
+	{
+		_out.push_back(0xFF);
+	}
+}
+
+void SDCardModel::queueBlock(uint32_t block)
+{
+	_out.push_back(0xFE);
+	_out.insert(_out.end(), storage.begin() + ((size_t)block * 512), storage.begin() + ((size_t)block * 512) + 512);
+	_out.push_back(0xFF);//no CRC in SPI mode
+	_out.push_back(0xFF);
+}
+
+void SDCardModel::queueReadBlock()
+{
+	if(_block >= (storage.size() / 512))
+	{
+		_out.push_back(SD_MODEL_TOKEN_ERROR_RANGE);
+		_streamStopped = true;
+		return;
+	}
+	queueLatency(_streamFirst ? timing.accessUs : timing.nextBlockUs);
+	_streamFirst = false;
+	if((int64_t)_block == failReadBlock)
+	{
+		failReadBlock = -1;
+		_out.push_back(SD_MODEL_TOKEN_ERROR_ECC);
+		_streamStopped = true;
+		return;
+	}
+	queueBlock(_block++);
+}
+
+void SDCardModel::finishWriteBlock()
+{
+	_rxCount = -1;
+	if((int64_t)_block == failWriteBlock)
+	{
+		failWriteBlock = -1;
+		_out.push_back(SD_MODEL_RESPONSE_WRITE_ERROR);
+	}
+	else
+	{
+		memcpy(&storage[(size_t)_block * 512], _rx, 512);
+		_out.push_back(SD_MODEL_RESPONSE_ACCEPTED);
+	}
+	if(_state == SD_WRITE_SINGLE)
+	{
+		_busy = usToBytes(timing.singleProgramUs);
+		_state = SD_IDLE;
+		return;
+	}
+	_busy = usToBytes((_preErasedLeft != 0) ? timing.preErasedProgramUs : timing.multiProgramUs);
+	if(_preErasedLeft != 0)
+	{
+		_preErasedLeft--;
+	}
+	_block++;
+}
+
+void SDCardModel::command()
+{
+	uint8_t cmd = (_cmd[0] & 0x3F);
+	uint32_t arg = (((uint32_t)_cmd[1] << 24) | ((uint32_t)_cmd[2] << 16) | ((uint32_t)_cmd[3] << 8) | _cmd[4]);
+	uint32_t blocks = (storage.size() / 512);
+	bool app = _appCmd;
+	_appCmd = false;
+	if(cmd == 12 && !app)//the block being streamed is cut off, a stuff byte, R1 and a short busy follow
+	{
+		commands[12]++;
+		_out.clear();
+		_out.push_back(0xFF);
+		_out.push_back(0x00);
+		_busy = 4;
+		_state = SD_IDLE;
+		_streamStopped = true;
+		return;
+	}
+	_out.push_back(0xFF);//one byte before the response
+	uint8_t r1 = (_idle ? SD_MODEL_R1_IDLE : 0);
+	if(app)
+	{
+		appCommands[cmd]++;
+		if(cmd == 41)
+		{
+			_idle = false;
+			r1 = 0;
+		}
+		else if(cmd == 23 && acceptACMD23)
+		{
+			_preErase = (arg & 0x7FFFFF);
+			lastPreErase = _preErase;
+		}
+		else
+		{
+			r1 |= SD_MODEL_R1_ILLEGAL;
+		}
+		_out.push_back(r1);
+		return;
+	}
+	commands[cmd]++;
+	switch(cmd)
+	{
+		case 0:
+		{
+			_idle = true;
+			_state = SD_IDLE;
+			_out.push_back(SD_MODEL_R1_IDLE);
+			return;
+		}
+		case 8:
+		{
+			uint8_t r7[5] = {r1, 0x00, 0x00, 0x01, 0xAA};
+			_out.insert(_out.end(), r7, r7 + 5);
+			return;
+		}
+		case 9:
+		{
+			uint8_t csd[16];
+			memset(csd, 0, sizeof(csd));
+			csd[0] = 0x40;//CSD version 2
+			csd[8] = (((blocks / 1024) - 1) >> 8);//C_SIZE, in 512 KB
+			csd[9] = (((blocks / 1024) - 1) & 0xFF);
+			_out.push_back(r1);
+			_out.push_back(0xFF);
+			_out.push_back(0xFE);
+			_out.insert(_out.end(), csd, csd + 16);
+			_out.push_back(0xFF);
+			_out.push_back(0xFF);
+			return;
+		}
+		case 55:
+		{
+			_appCmd = true;
+			break;
+		}
+		case 58:
+		{
+			uint8_t r3[5] = {r1, 0xC0, 0xFF, 0x80, 0x00};//powered up, high capacity
+			_out.insert(_out.end(), r3, r3 + 5);
+			return;
+		}
+		case 16:
+		{
+			break;
+		}
+		case 17:
+		{
+			if(arg >= blocks)
+			{
+				r1 |= SD_MODEL_R1_PARAMETER;
+				break;
+			}
+			_out.push_back(r1);
+			queueLatency(timing.accessUs);
+			if((int64_t)arg == failReadBlock)
+			{
+				failReadBlock = -1;
+				_out.push_back(SD_MODEL_TOKEN_ERROR_ECC);
+				return;
+			}
+			queueBlock(arg);
+			return;
+		}
+		case 18:
+		{
+			if(!acceptCMD18)
+			{
+				r1 |= SD_MODEL_R1_ILLEGAL;
+				break;
+			}
+			if(arg >= blocks)
+			{
+				r1 |= SD_MODEL_R1_PARAMETER;
+				break;
+			}
+			_state = SD_READ_MULTI;
+			_block = arg;
+			_streamFirst = true;
+			_streamStopped = false;
+			break;
+		}
+		case 24:
+		{
+			if(arg >= blocks)
+			{
+				r1 |= SD_MODEL_R1_ADDRESS;
+				break;
+			}
+			_state = SD_WRITE_SINGLE;
+			_block = arg;
+			break;
+		}
+		case 25:
+		{
+			if(!acceptCMD25)
+			{
+				r1 |= SD_MODEL_R1_ILLEGAL;
+				break;
+			}
+			if(arg >= blocks)
+			{
+				r1 |= SD_MODEL_R1_ADDRESS;
+				break;
+			}
+			_state = SD_WRITE_MULTI;
+			_block = arg;
+			_preErasedLeft = _preErase;
+			_preErase = 0;
+			break;
+		}
+		default:
+		{
+			r1 |= SD_MODEL_R1_ILLEGAL;
+			break;
+		}
+	}
+	if(cmd != 55)//the pre-erase count only holds for the next write
+	{
+		_preErase = 0;
+	}
+	_out.push_back(r1);
+}
+
+SDTestRig::SDTestRig(uint32_t blocks) : card(blocks), sd(&spi, SD_MODEL_CS, "sd")
+{
+	spi.attach(&card);
+	sdModelAttach(&card);
+}
+
+SDTestRig::~SDTestRig()
+{
+	if(selectedCard == &card)
+	{
+		selectedCard = NULL;
+		stubSPIDefaultDevice = NULL;
+	}
+}
+
+bool SDTestRig::init()
+{
+	bool ok = (sd.disk_initialize() == 0);
+	spi.clearStats();
+	return ok;
+}
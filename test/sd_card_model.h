@@ -0,0 +1,120 @@
+/*
+* CanBadger SD Card Model
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+An SD card in SPI mode, on the bus of the RTOS_SPI stub, for the SDFileSystem tests. It answers the commands the driver
+uses (CMD0/8/9/12/16/17/18/24/25/55/58, ACMD23/41) from a RAM image and can be told to reject CMD25, CMD18 or ACMD23 or
+to fail one block, like the cards the driver has to fall back for.
+Time is modelled in bus bytes: a card that is programming returns 0x00 and one that is still looking for data returns
+0xFF for as many bytes as the configured time takes at the bus clock, so the bus time the SPI stub adds up is the time
+the transfer would take on that card.
+*/
+
+#ifndef __SD_CARD_MODEL_H__
+#define __SD_CARD_MODEL_H__
+
+#include "mbed.h"
+#include "RTOS_SPI.h"
+#include "SDFileSystem.h"
+#include <deque>
+#include <vector>
+
+#define SD_MODEL_CS 12 //chip select pin of the card in the test rig
+#define SD_MODEL_BUS_HZ 12000000 //transfer clock SDFileSystem sets
+
+struct SDModelTiming//all in us
+{
+	uint32_t singleProgramUs;//CMD24, the card erases and programs the block on its own
+	uint32_t multiProgramUs;//per block of a CMD25 transfer
+	uint32_t preErasedProgramUs;//per block of a CMD25 transfer the card could erase ahead after ACMD23
+	uint32_t stopTranUs;//busy after STOP_TRAN
+	uint32_t accessUs;//from a read command to its first data token
+	uint32_t nextBlockUs;//between the blocks of a CMD18 transfer
+};
+
+class SDCardModel : public StubSPIDevice
+{
+	public:
+		SDCardModel(uint32_t blocks);
+		uint8_t exchange(uint8_t mosi);
+		void select(bool selected);
+
+		PinName csPin;
+		bool acceptCMD25;
+		bool acceptCMD18;
+		bool acceptACMD23;
+		int64_t failWriteBlock;//this block gets a write error data response, once
+		int64_t failReadBlock;//this block is answered with an error token, once
+		SDModelTiming timing;
+		std::vector<uint8_t> storage;
+		uint32_t commands[64];//commands seen, by number
+		uint32_t appCommands[64];
+		uint32_t lastPreErase;//block count of the last ACMD23
+		uint32_t protocolErrors;//bytes the card did not expect in the state it was in
+		uint64_t busBytes;//bytes clocked while the card was attached, selected or not
+
+	private:
+		enum State { SD_IDLE, SD_WRITE_SINGLE, SD_WRITE_MULTI, SD_READ_MULTI };
+
+		void input(uint8_t mosi);
+		void command();
+		void queueLatency(uint32_t us);
+		void queueBlock(uint32_t block);
+		void queueReadBlock();
+		void finishWriteBlock();
+
+		State _state;
+		bool _selected;
+		bool _appCmd;
+		bool _idle;
+		bool _streamFirst;
+		bool _streamStopped;
+		uint8_t _cmd[6];
+		uint8_t _cmdLen;
+		std::deque<uint8_t> _out;
+		uint32_t _busy;
+		uint32_t _block;
+		int32_t _rxCount;//data bytes of the block being written, -1 while waiting for the start token
+		uint8_t _rx[514];
+		uint32_t _preErase;
+		uint32_t _preErasedLeft;
+};
+
+void sdModelAttach(SDCardModel *card);//makes card the one on the bus: it sees its chip select and new SPI masters talk to it
+
+double sdModelMBs(uint64_t payloadBytes, uint64_t busBytes);//throughput over the bus time at SD_MODEL_BUS_HZ
+
+// a card, the SPI it sits on and the driver, initialized
+class SDTestRig
+{
+	public:
+		SDTestRig(uint32_t blocks = 16384);
+		~SDTestRig();
+		bool init();
+
+		RTOS_SPI spi;
+		SDCardModel card;
+		SDFileSystem sd;
+};
+
+#endif
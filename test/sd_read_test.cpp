@@ -0,0 +1,223 @@
+/*
+* CanBadger SD Read Test
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Runs SDFileSystem::disk_read against the SD card model: CMD18 with CMD12 for runs of blocks, the CMD17 fallback for cards
+that reject CMD18 and for the rest of a run after an error token. Then FileHandler with its read-ahead window on FatFs:
+mixed reads and seeks have to see the same bytes as without the window, and a write after buffered reads has to land
+where the caller thinks the file is.
+The benchmark reads a log file the way DOWNLOAD_FILE (200 byte packets) and the UDS ID scan (14 byte headers) do,
+before (CMD17, no window) and after, and reports MB/s over the bus time of the model.
+*/
+
+#include "test_common.h"
+#include "sd_card_model.h"
+#include "fileHandler.h"
+
+#define READ_TEST_FILE_SIZE (256 * 1024)
+
+static void fillRandom(uint8_t *data, size_t length)
+{
+	for(size_t a = 0; a < length; a++)
+	{
+		data[a] = (uint8_t)testRandom();
+	}
+}
+
+static void testMultiBlock()
+{
+	SDTestRig rig;
+	CHECK(rig.init());
+	fillRandom(&rig.card.storage[0], rig.card.storage.size());
+	std::vector<uint8_t> data(16 * 512);
+	CHECK_EQUAL(0, rig.sd.disk_read(&data[0], 500, 16));
+	CHECK(memcmp(&data[0], &rig.card.storage[500 * 512], data.size()) == 0);
+	CHECK_EQUAL(1, rig.card.commands[18]);
+	CHECK_EQUAL(1, rig.card.commands[12]);
+	CHECK_EQUAL(0, rig.card.commands[17]);
+	CHECK_EQUAL(1, rig.sd.read_stats().multi_reads);
+	CHECK_EQUAL(16, rig.sd.read_stats().blocks);
+	CHECK_EQUAL(0, rig.sd.disk_read(&data[0], 9, 1));//a single block still goes with CMD17
+	CHECK(memcmp(&data[0], &rig.card.storage[9 * 512], 512) == 0);
+	CHECK_EQUAL(1, rig.card.commands[17]);
+	CHECK_EQUAL(0, rig.sd.disk_read(&data[0], 1000, 16));//and the card takes commands again after CMD12
+	CHECK(memcmp(&data[0], &rig.card.storage[1000 * 512], data.size()) == 0);
+	rig.sd.set_dma(false);
+	CHECK_EQUAL(0, rig.sd.disk_read(&data[0], 2000, 16));
+	CHECK(memcmp(&data[0], &rig.card.storage[2000 * 512], data.size()) == 0);
+	CHECK_EQUAL(0, rig.card.protocolErrors);
+}
+
+static void testNoCMD18()
+{
+	SDTestRig rig;
+	rig.card.acceptCMD18 = false;
+	CHECK(rig.init());
+	fillRandom(&rig.card.storage[0], rig.card.storage.size());
+	std::vector<uint8_t> data(4 * 512);
+	CHECK_EQUAL(0, rig.sd.disk_read(&data[0], 30, 4));
+	CHECK(memcmp(&data[0], &rig.card.storage[30 * 512], data.size()) == 0);
+	CHECK_EQUAL(0, rig.sd.disk_read(&data[0], 34, 4));
+	CHECK(memcmp(&data[0], &rig.card.storage[34 * 512], data.size()) == 0);
+	CHECK_EQUAL(1, rig.card.commands[18]);//not asked again
+	CHECK_EQUAL(8, rig.card.commands[17]);
+	CHECK_EQUAL(1, rig.sd.read_stats().fallbacks);
+}
+
+static void testErrorToken()
+{
+	SDTestRig rig;
+	CHECK(rig.init());
+	fillRandom(&rig.card.storage[0], rig.card.storage.size());
+	std::vector<uint8_t> data(8 * 512);
+	rig.card.failReadBlock = 105;
+	CHECK_EQUAL(0, rig.sd.disk_read(&data[0], 100, 8));
+	CHECK(memcmp(&data[0], &rig.card.storage[100 * 512], data.size()) == 0);
+	CHECK_EQUAL(3, rig.card.commands[17]);//105 to 107 again, one at a time
+	CHECK_EQUAL(1, rig.sd.read_stats().fallbacks);
+	rig.card.failReadBlock = 7;//and a single block read that fails is reported
+	CHECK_EQUAL(1, rig.sd.disk_read(&data[0], 7, 1));
+	CHECK_EQUAL(0, rig.card.protocolErrors);
+}
+
+// a FileHandler on a formatted card with one file of random data, the way a log file sits on the SD
+struct FileRig
+{
+	FileRig(bool acceptCMD18) : card(32768)
+	{
+		card.csPin = SD_SS;
+		card.acceptCMD18 = acceptCMD18;
+		sdModelAttach(&card);
+		handler = new FileHandler();
+		//cards come formatted from a PC with 32 KB clusters, formatSD uses 512 bytes, which keeps FatFs at one sector per read
+		f_mkfs("0:", 0, 32768);
+		contents.resize(READ_TEST_FILE_SIZE);
+		fillRandom(&contents[0], contents.size());
+		handler->openFile("log.bin", O_WRONLY | O_CREAT | O_TRUNC, 1);
+		for(uint32_t a = 0; a < contents.size(); a += 4096)
+		{
+			handler->write((char*)&contents[a], 4096, 1);
+		}
+		handler->closeFile(1);
+	}
+	~FileRig()
+	{
+		delete handler;
+	}
+
+	SDCardModel card;
+	FileHandler *handler;
+	std::vector<uint8_t> contents;
+};
+
+static void testReadAhead()
+{
+	FileRig rig(true);
+	CHECK(rig.handler->openFile("log.bin", O_RDONLY, 1));
+	CHECK(rig.handler->setReadAhead(true));
+	std::vector<uint8_t> buffer(8192);
+	uint32_t position = 0;
+	uint32_t mismatches = 0;
+	for(uint32_t step = 0; step < 3000; step++)
+	{
+		uint32_t what = (testRandom() % 10);
+		if(what == 0)
+		{
+			position = (testRandom() % READ_TEST_FILE_SIZE);
+			CHECK(rig.handler->lseekFile(position, SEEK_SET));
+		}
+		else if(what == 1)
+		{
+			uint32_t skip = (testRandom() % 3000);
+			if(position + skip < READ_TEST_FILE_SIZE)
+			{
+				CHECK(rig.handler->lseekFile(skip, SEEK_CUR));
+				position += skip;
+			}
+		}
+		else
+		{
+			uint32_t length = (what == 2) ? (testRandom() % 8192) : (1 + (testRandom() % 300));
+			uint32_t expected = ((READ_TEST_FILE_SIZE - position) < length) ? (READ_TEST_FILE_SIZE - position) : length;
+			uint32_t got = rig.handler->read((char*)&buffer[0], length, 1);
+			mismatches += (got != expected || memcmp(&buffer[0], &rig.contents[position], got) != 0);
+			position += got;
+		}
+		mismatches += (rig.handler->getFilePosition() != position);
+	}
+	CHECK_EQUAL(0, mismatches);
+	CHECK(rig.handler->setReadAhead(false));
+	CHECK(rig.handler->closeFile(1));
+
+	CHECK(rig.handler->openFile("log.bin", O_RDWR, 1));//a write right after buffered reads
+	CHECK(rig.handler->setReadAhead(true));
+	CHECK_EQUAL(100, rig.handler->read((char*)&buffer[0], 100, 1));
+	memset(&buffer[0], 0xEE, 10);
+	CHECK(rig.handler->write((char*)&buffer[0], 10, 1));
+	CHECK(rig.handler->setReadAhead(false));
+	CHECK(rig.handler->closeFile(1));
+	memset(&rig.contents[100], 0xEE, 10);
+	CHECK(rig.handler->openFile("log.bin", O_RDONLY, 1));
+	CHECK_EQUAL(4096, rig.handler->read((char*)&buffer[0], 4096, 1));
+	CHECK(memcmp(&buffer[0], &rig.contents[0], 4096) == 0);
+	CHECK(rig.handler->closeFile(1));
+	CHECK_EQUAL(0, rig.card.protocolErrors);
+}
+
+// reads the whole file in chunks of the given size, returns MB/s over the bus time
+static double readMBs(bool after, uint32_t chunk, uint32_t rounds)
+{
+	FileRig rig(after);
+	std::vector<uint8_t> buffer(chunk);
+	uint64_t startBytes = rig.card.busBytes;
+	for(uint32_t round = 0; round < rounds; round++)
+	{
+		rig.handler->openFile("log.bin", O_RDONLY, 1);
+		rig.handler->setReadAhead(after);
+		while(rig.handler->read((char*)&buffer[0], chunk, 1) == chunk)
+		{
+		}
+		rig.handler->setReadAhead(false);
+		rig.handler->closeFile(1);
+	}
+	return sdModelMBs((uint64_t)READ_TEST_FILE_SIZE * rounds, rig.card.busBytes - startBytes);
+}
+
+int main(int argc, char **argv)
+{
+	testMultiBlock();
+	testNoCMD18();
+	testErrorToken();
+	testReadAhead();
+	uint32_t rounds = testBenchMode(argc, argv) ? 16 : 1;
+	double downloadBefore = readMBs(false, 200, rounds);
+	double downloadAfter = readMBs(true, 200, rounds);
+	double scanBefore = readMBs(false, 14, rounds);
+	double scanAfter = readMBs(true, 14, rounds);
+	printf("SD read, %u KB at 12 MHz (card model), CMD17 without window -> CMD18 with %u byte window:\n", (unsigned int)((READ_TEST_FILE_SIZE / 1024) * rounds), FILE_READ_AHEAD_SIZE);
+	printf("  200 byte reads (DOWNLOAD_FILE): %.2f -> %.2f MB/s\n", downloadBefore, downloadAfter);
+	printf("  14 byte reads (UDS ID scan): %.2f -> %.2f MB/s\n", scanBefore, scanAfter);
+	CHECK(downloadAfter > downloadBefore);
+	CHECK(scanAfter > scanBefore);
+	return testResult("sd_read_test");
+}
@@ -0,0 +1,157 @@
+/*
+* CanBadger SD Write Test
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Runs SDFileSystem::disk_write against the SD card model: CMD25 with ACMD23 pre-erase for runs of blocks, CMD24 for
+single ones, and the fallbacks for cards that reject CMD25 or ACMD23 or fail a block in the middle of a transfer.
+The benchmark writes cluster sized runs the way FatFs does and reports MB/s over the bus time of the model.
+*/
+
+#include "test_common.h"
+#include "sd_card_model.h"
+
+static void fillRandom(std::vector<uint8_t> &data)
+{
+	for(size_t a = 0; a < data.size(); a++)
+	{
+		data[a] = (uint8_t)testRandom();
+	}
+}
+
+static bool stored(SDTestRig &rig, const std::vector<uint8_t> &data, uint32_t block)
+{
+	return (memcmp(&rig.card.storage[(size_t)block * 512], &data[0], data.size()) == 0);
+}
+
+static void testMultiBlock()
+{
+	SDTestRig rig;
+	CHECK(rig.init());
+	std::vector<uint8_t> data(8 * 512);
+	fillRandom(data);
+	CHECK_EQUAL(0, rig.sd.disk_write(&data[0], 100, 8));
+	CHECK(stored(rig, data, 100));
+	CHECK_EQUAL(1, rig.card.commands[25]);
+	CHECK_EQUAL(0, rig.card.commands[24]);
+	CHECK_EQUAL(1, rig.card.appCommands[23]);
+	CHECK_EQUAL(8, rig.card.lastPreErase);
+	CHECK_EQUAL(8, rig.sd.write_stats().blocks);
+	CHECK_EQUAL(1, rig.sd.write_stats().multi_writes);
+	CHECK_EQUAL(0, rig.sd.write_stats().fallbacks);
+	CHECK_EQUAL(0, rig.sd.disk_write(&data[0], 7, 1));//a single block still goes with CMD24
+	CHECK(memcmp(&rig.card.storage[7 * 512], &data[0], 512) == 0);
+	CHECK_EQUAL(1, rig.card.commands[24]);
+	CHECK_EQUAL(1, rig.sd.write_stats().single_writes);
+	rig.sd.set_dma(false);//the byte loop has to put the same bytes on the bus
+	fillRandom(data);
+	CHECK_EQUAL(0, rig.sd.disk_write(&data[0], 300, 8));
+	CHECK(stored(rig, data, 300));
+	CHECK_EQUAL(0, rig.card.protocolErrors);
+}
+
+static void testNoCMD25()
+{
+	SDTestRig rig;
+	rig.card.acceptCMD25 = false;
+	CHECK(rig.init());
+	std::vector<uint8_t> data(4 * 512);
+	fillRandom(data);
+	CHECK_EQUAL(0, rig.sd.disk_write(&data[0], 40, 4));
+	CHECK(stored(rig, data, 40));
+	CHECK_EQUAL(4, rig.card.commands[24]);
+	CHECK_EQUAL(1, rig.sd.write_stats().fallbacks);
+	fillRandom(data);
+	CHECK_EQUAL(0, rig.sd.disk_write(&data[0], 44, 4));
+	CHECK(stored(rig, data, 44));
+	CHECK_EQUAL(1, rig.card.commands[25]);//not asked again until the card is initialized again
+	CHECK_EQUAL(8, rig.sd.write_stats().single_writes);
+	CHECK(rig.sd.disk_initialize() == 0);
+	CHECK_EQUAL(0, rig.sd.disk_write(&data[0], 44, 4));
+	CHECK_EQUAL(2, rig.card.commands[25]);
+	CHECK_EQUAL(0, rig.card.protocolErrors);
+}
+
+static void testNoACMD23()
+{
+	SDTestRig rig;
+	rig.card.acceptACMD23 = false;
+	CHECK(rig.init());
+	std::vector<uint8_t> data(16 * 512);
+	fillRandom(data);
+	CHECK_EQUAL(0, rig.sd.disk_write(&data[0], 0, 16));
+	CHECK_EQUAL(0, rig.sd.disk_write(&data[0], 16, 16));
+	CHECK(stored(rig, data, 0));
+	CHECK(stored(rig, data, 16));
+	CHECK_EQUAL(2, rig.card.commands[25]);//still multi block, just without the pre-erase
+	CHECK_EQUAL(1, rig.card.appCommands[23]);//and the hint is not sent again
+	CHECK_EQUAL(0, rig.sd.write_stats().fallbacks);
+	CHECK_EQUAL(0, rig.card.protocolErrors);
+}
+
+static void testFailedBlock()
+{
+	SDTestRig rig;
+	CHECK(rig.init());
+	std::vector<uint8_t> data(8 * 512);
+	fillRandom(data);
+	rig.card.failWriteBlock = 203;
+	CHECK_EQUAL(0, rig.sd.disk_write(&data[0], 200, 8));
+	CHECK(stored(rig, data, 200));
+	CHECK_EQUAL(1, rig.card.commands[25]);
+	CHECK_EQUAL(5, rig.card.commands[24]);//the failed block and the ones after it, one at a time
+	CHECK_EQUAL(1, rig.sd.write_stats().fallbacks);
+	CHECK_EQUAL(8, rig.sd.write_stats().blocks);
+	CHECK_EQUAL(0, rig.sd.disk_write(&data[0], 200, 8));//the card still does CMD25 after that
+	CHECK_EQUAL(2, rig.card.commands[25]);
+	rig.card.failWriteBlock = 50;//a single block write that fails is reported
+	CHECK_EQUAL(1, rig.sd.disk_write(&data[0], 50, 1));
+	CHECK_EQUAL(0, rig.card.protocolErrors);
+}
+
+static double writeMBs(bool multiBlock, uint32_t clusters)
+{
+	SDTestRig rig(clusters * 8 + 1024);
+	rig.card.acceptCMD25 = multiBlock;
+	rig.init();
+	std::vector<uint8_t> data(8 * 512);
+	fillRandom(data);
+	for(uint32_t a = 0; a < clusters; a++)//4 KB clusters, FatFs writes them in one disk_write
+	{
+		rig.sd.disk_write(&data[0], 1024 + (a * 8), 8);
+	}
+	return (((double)clusters * 8 * 512) / ((double)rig.spi.stats().busNs / 1000000000.0)) / 1000000.0;
+}
+
+int main(int argc, char **argv)
+{
+	testMultiBlock();
+	testNoCMD25();
+	testNoACMD23();
+	testFailedBlock();
+	uint32_t clusters = testBenchMode(argc, argv) ? 4096 : 256;
+	double single = writeMBs(false, clusters);
+	double multi = writeMBs(true, clusters);
+	printf("SD write, %u KB in 4 KB clusters at 12 MHz: CMD24 %.2f MB/s, CMD25+ACMD23 %.2f MB/s (card model)\n", (unsigned int)(clusters * 4), single, multi);
+	CHECK(multi > (single * 1.5));
+	return testResult("sd_write_test");
+}
@@ -0,0 +1,145 @@
+/*
+* CanBadger SPI DMA Test
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Checks which transfers SDFileSystem and Ser23LC1024 hand to GPDMA: data blocks and long XRAM reads from a thread,
+never anything from interrupt context, and that both paths put the same bytes on the bus. Then compares the CPU
+cycles a 512 byte SD block costs with the byte loop and with DMA. The host cannot count Cortex-M3 cycles, so the
+figures come from a cost model (below) applied to the transfers the driver really made. On the device the same
+comparison can be made with set_dma and the DWT cycle counter.
+*/
+
+#include "test_common.h"
+#include "sd_card_model.h"
+#include "sram_model.h"
+
+// cost model, LPC1768 at 96 MHz with the SD SPI at 12 MHz
+#define CYCLES_PER_SPI_BYTE 64 //8 bit times of 8 core clocks each, the byte loop waits them out
+#define CYCLES_SPI_WRITE_CALL 22 //SPI::write around that: lock, FIFO status polls, DR write and read
+#define CYCLES_DMA_SETUP 160 //both channels programmed and started, DMACR set and cleared
+#define CYCLES_THREAD_SWITCH 250 //RTX switching away while the block is in flight and back on completion
+#define CYCLES_DMA_IRQ 90 //completion interrupt setting the thread signal
+
+static uint64_t cpuCycles(const StubSPIStats &stats)
+{
+	return (((uint64_t)stats.loopBytes * (CYCLES_PER_SPI_BYTE + CYCLES_SPI_WRITE_CALL)) + ((uint64_t)stats.dmaTransfers * (CYCLES_DMA_SETUP + (2 * CYCLES_THREAD_SWITCH) + CYCLES_DMA_IRQ)));
+}
+
+static void testSDTransfers()
+{
+	SDTestRig rig;
+	CHECK(rig.init());
+	std::vector<uint8_t> data(8 * 512);
+	std::vector<uint8_t> back(8 * 512);
+	for(size_t a = 0; a < data.size(); a++)
+	{
+		data[a] = (uint8_t)testRandom();
+	}
+	CHECK_EQUAL(0, rig.sd.disk_write(&data[0], 64, 8));
+	CHECK_EQUAL(0, rig.sd.disk_read(&back[0], 64, 8));
+	CHECK(memcmp(&data[0], &back[0], data.size()) == 0);
+	CHECK_EQUAL(16, rig.spi.stats().dmaTransfers);//one per data block, commands and tokens stay in the loop
+	CHECK_EQUAL(16 * 512, rig.spi.stats().dmaBytes);
+	rig.spi.clearStats();
+	rig.sd.set_dma(false);
+	memset(&back[0], 0, back.size());
+	CHECK_EQUAL(0, rig.sd.disk_read(&back[0], 64, 8));
+	CHECK(memcmp(&data[0], &back[0], data.size()) == 0);
+	CHECK_EQUAL(0, rig.spi.stats().dmaTransfers);
+	rig.sd.set_dma(true);
+	rig.spi.clearStats();
+	memset(&back[0], 0, back.size());
+	int result = -1;
+	stubRunISR([&]() { result = rig.sd.disk_read(&back[0], 64, 8); });//a thread signal cannot be waited for in an ISR
+	CHECK_EQUAL(0, result);
+	CHECK(memcmp(&data[0], &back[0], data.size()) == 0);
+	CHECK_EQUAL(0, rig.spi.stats().dmaTransfers);
+	CHECK_EQUAL(0, rig.spi.stats().dmaFromISR);
+}
+
+static void testSRAMTransfers()
+{
+	SRAMModel model;
+	sramAttach(&model);
+	RTOS_SPI spi;
+	spi.attach(&model);
+	Ser23LC1024 ram(&spi, SRAM_TEST_CS, SRAM_TEST_HOLD);
+	uint8_t data[300];
+	uint8_t back[300];
+	for(uint32_t a = 0; a < sizeof(data); a++)
+	{
+		data[a] = (uint8_t)testRandom();
+	}
+	CHECK(ram.write(0x1000, sizeof(data), data));
+	CHECK_EQUAL(0, spi.stats().dmaTransfers);//writes are split in 32 byte pages and stay in the loop
+	CHECK(ram.read(0x1000, sizeof(data), back));
+	CHECK(memcmp(data, back, sizeof(data)) == 0);
+	CHECK_EQUAL(1, spi.stats().dmaTransfers);
+	CHECK(ram.read(0x1000, RAM_DMA_MIN_LENGTH - 1, back));//short reads are not worth the setup
+	CHECK_EQUAL(1, spi.stats().dmaTransfers);
+	memset(back, 0, sizeof(back));
+	bool ok = false;
+	stubRunISR([&]() { ok = ram.read(0x1000, sizeof(data), back); });
+	CHECK(ok);
+	CHECK(memcmp(data, back, sizeof(data)) == 0);
+	CHECK_EQUAL(1, spi.stats().dmaTransfers);
+	CHECK_EQUAL(0, spi.stats().dmaFromISR);
+	CHECK(ram.write((RAM_USABLE_SIZE - sizeof(data)), sizeof(data), data));//the last usable bytes
+	CHECK(ram.read((RAM_USABLE_SIZE - sizeof(data)), sizeof(data), back));
+	CHECK(memcmp(data, back, sizeof(data)) == 0);
+	CHECK(!ram.write((RAM_USABLE_SIZE - sizeof(data) + 1), sizeof(data), data));
+	CHECK(!ram.read((RAM_USABLE_SIZE - sizeof(data) + 1), sizeof(data), back));
+	sramAttach(NULL);
+}
+
+static void compareCycles(uint32_t blocks)
+{
+	SDTestRig rig(blocks + 1024);
+	rig.init();
+	std::vector<uint8_t> data(8 * 512);
+	uint64_t cycles[2];
+	uint64_t wire = 0;
+	for(uint8_t dma = 0; dma < 2; dma++)
+	{
+		rig.sd.set_dma(dma != 0);
+		rig.spi.clearStats();
+		for(uint32_t a = 0; a < blocks; a += 8)
+		{
+			rig.sd.disk_read(&data[0], a, 8);
+			rig.sd.disk_write(&data[0], a, 8);
+		}
+		cycles[dma] = (cpuCycles(rig.spi.stats()) / (blocks * 2));
+		wire = ((uint64_t)rig.spi.stats().dmaBytes * CYCLES_PER_SPI_BYTE) / (blocks * 2);
+	}
+	//what is left with DMA is mostly polling for the data token and for the card to finish programming
+	printf("CPU cycles per 512 byte SD block (cost model, %u blocks read and written): byte loop %u, DMA %u, the DMA path leaves %u free for other threads\n", (unsigned int)blocks, (unsigned int)cycles[0], (unsigned int)cycles[1], (unsigned int)wire);
+	CHECK(cycles[1] < (cycles[0] / 3));
+}
+
+int main(int argc, char **argv)
+{
+	testSDTransfers();
+	testSRAMTransfers();
+	compareCycles(testBenchMode(argc, argv) ? 8192 : 512);
+	return testResult("spi_dma_test");
+}
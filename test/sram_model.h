@@ -0,0 +1,99 @@
+/*
+* CanBadger 23LC1024 Model
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+A 23LC1024 on the bus of the RTOS_SPI stub, for the tests that go through Ser23LC1024: sequential reads and writes
+from and to a RAM image. sramAttach hooks the chip select of SRAM_TEST_CS up to the model.
+*/
+
+#ifndef __SRAM_MODEL_H__
+#define __SRAM_MODEL_H__
+
+#include <vector>
+#include "mbed.h"
+#include "RTOS_SPI.h"
+#include "SER23LC1024.h"
+
+#define SRAM_TEST_CS 40
+#define SRAM_TEST_HOLD 41
+
+// just the sequential read and write of a 23LC1024
+class SRAMModel : public StubSPIDevice
+{
+	public:
+		SRAMModel() : memory(0x20000, 0) { _selected = false; _count = 0; _command = 0; _address = 0; }
+		void select(bool selected) { _selected = selected; _count = 0; }
+		uint8_t exchange(uint8_t mosi)
+		{
+			if(!_selected)
+			{
+				return 0xFF;
+			}
+			uint8_t miso = 0xFF;
+			if(_count == 0)
+			{
+				_command = mosi;
+				_address = 0;
+			}
+			else if(_count < 4)
+			{
+				_address = ((_address << 8) | mosi);
+			}
+			else if(_command == RAM_CMD_READ)
+			{
+				miso = memory[_address++ & 0x1FFFF];
+			}
+			else if(_command == RAM_CMD_WRITE)
+			{
+				memory[_address++ & 0x1FFFF] = mosi;
+			}
+			_count++;
+			return miso;
+		}
+
+		std::vector<uint8_t> memory;
+
+	private:
+		bool _selected;
+		uint32_t _count;
+		uint8_t _command;
+		uint32_t _address;
+};
+
+static SRAMModel *sram = NULL;//the model behind SRAM_TEST_CS, NULL if none
+
+static void sramSelect(PinName pin, int value)
+{
+	if(pin == SRAM_TEST_CS && sram != NULL)
+	{
+		sram->select(value == 0);
+	}
+}
+
+static void sramAttach(SRAMModel *model)
+{
+	sram = model;
+	stubDigitalOutHook = (model != NULL) ? sramSelect : NULL;
+}
+
+#endif
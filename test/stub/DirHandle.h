@@ -0,0 +1,45 @@
+/*
+* CanBadger Host Test Stubs
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef __STUB_DIRHANDLE_H__
+#define __STUB_DIRHANDLE_H__
+
+#include <dirent.h>
+#include "FileHandle.h"
+
+namespace mbed {
+
+class DirHandle
+{
+	public:
+		virtual ~DirHandle() {}
+		virtual int closedir() = 0;
+		virtual struct dirent *readdir() = 0;
+		virtual void rewinddir() = 0;
+		virtual off_t telldir() = 0;
+		virtual void seekdir(off_t location) = 0;
+};
+
+}
+
+#endif
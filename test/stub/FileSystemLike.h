@@ -0,0 +1,51 @@
+/*
+* CanBadger Host Test Stubs
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef __STUB_FILESYSTEMLIKE_H__
+#define __STUB_FILESYSTEMLIKE_H__
+
+#include <sys/stat.h>
+#include "FileHandle.h"
+#include "DirHandle.h"
+
+namespace mbed {
+
+class FileSystemLike
+{
+	public:
+		FileSystemLike(const char *name) { _name = name; }
+		virtual ~FileSystemLike() {}
+		const char *getName() { return _name; }
+		virtual FileHandle *open(const char *filename, int flags) = 0;
+		virtual int remove(const char *) { return -1; }
+		virtual int rename(const char *, const char *) { return -1; }
+		virtual DirHandle *opendir(const char *) { return NULL; }
+		virtual int mkdir(const char *, mode_t) { return -1; }
+
+	private:
+		const char *_name;
+};
+
+}
+
+#endif
@@ -0,0 +1,77 @@
+/*
+* CanBadger Host Test Stubs
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+The SPI master the SD card driver talks to. Every byte, from the byte loop or from a "DMA" transfer, goes through the
+attached StubSPIDevice, so a device model sees exactly what the real bus would carry. The master keeps count of the
+bus time at the programmed clock and of the bytes the CPU moved itself, so tests can put numbers on a transfer.
+*/
+
+#ifndef __STUB_RTOS_SPI_H__
+#define __STUB_RTOS_SPI_H__
+
+#include "mbed.h"
+
+class StubSPIDevice
+{
+	public:
+		virtual ~StubSPIDevice() {}
+		virtual uint8_t exchange(uint8_t mosi) = 0;//one byte each way
+};
+
+extern StubSPIDevice *stubSPIDefaultDevice;//for SPI masters the test cannot reach, like the one FileHandler makes
+
+struct StubSPIStats
+{
+	uint64_t busNs;//time the bus was clocking, at the programmed frequency
+	uint32_t loopBytes;//bytes moved one write() at a time
+	uint32_t dmaBytes;//bytes moved by bulk transfers
+	uint32_t dmaTransfers;
+	uint32_t dmaFromISR;//bulk transfers started in interrupt context, which the real driver cannot do
+};
+
+class RTOS_SPI
+{
+	public:
+		RTOS_SPI(PinName mosi = NC, PinName miso = NC, PinName sclk = NC, PinName unused = NC);
+		void frequency(int hz) { _hz = hz; }
+		int getFrequency() { return _hz; }
+		void format(int, int = 0) {}
+		int write(int value);
+		void bulkWrite(uint8_t *write_data, int length, bool array = true);
+		void bulkReadWrite(uint8_t *read_data, uint8_t *write_data, int length, bool array = true);
+
+		// test side
+		void attach(StubSPIDevice *device) { _device = device; }
+		StubSPIStats& stats() { return _stats; }
+		void clearStats();
+
+	private:
+		uint8_t clock(uint8_t mosi);
+
+		StubSPIDevice *_device;
+		StubSPIStats _stats;
+		int _hz;
+};
+
+#endif
@@ -0,0 +1,72 @@
+/*
+* CanBadger Host Test Stubs
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Stands in for canbadger.h, which pulls in every driver of the board, so CAN_MITM builds on the host. Only what
+CAN_MITM uses of CANbadger, EthernetManager and CanbadgerSettings is here, with a few counters for the tests.
+*/
+
+#ifndef __CANBADGER_H__
+#define __CANBADGER_H__
+
+#include "mbed.h"
+#include "rtos.h"
+#include "can_tx_queue.h"
+
+#define CAN_BRIDGE_ENABLED 11
+
+class EthernetManager
+{
+	public:
+		EthernetManager() { runs = 0; logs = 0; lockDepth = 0; }
+		void run() { runs++; }
+		int debugLog(char *) { logs++; return 0; }
+		void lockRam() { lockDepth++; }
+		void unlockRam() { lockDepth--; }
+
+		// test side
+		uint32_t runs;
+		uint32_t logs;
+		int lockDepth;//above 0 while the XRAM lock is held
+};
+
+struct CanbadgerSettings
+{
+	bool currentActionIsRunning;
+};
+
+class CANbadger
+{
+	public:
+		CANbadger() { ethernet_manager = NULL; settings.currentActionIsRunning = false; bridge = false; }
+		EthernetManager* getEthernetManager() { return ethernet_manager; }
+		CanbadgerSettings* getCanbadgerSettings() { return &settings; }
+		bool getCANBadgerStatus(uint8_t statusType) { return (statusType == CAN_BRIDGE_ENABLED) ? bridge : false; }
+		bool CANBridge(bool enable) { bridge = enable; return true; }
+
+		EthernetManager *ethernet_manager;
+		CanbadgerSettings settings;
+		bool bridge;
+};
+
+#endif
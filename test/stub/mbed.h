@@ -0,0 +1,238 @@
+/*
+* CanBadger Host Test Stubs
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Just enough of mbed 2 to build the hardware independent firmware modules on a host, for the tests in this directory.
+Interrupts are simulated: stubRunISR runs a handler with a global lock held, and __disable_irq takes the same lock, so
+code that masks interrupts really keeps a simulated ISR running on another thread out. PRIMASK and IPSR are per thread.
+The CAN class models the controller with a 3 frame RX FIFO that test code fills with inject() before firing RxIrq.
+*/
+
+#ifndef __STUB_MBED_H__
+#define __STUB_MBED_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+using namespace std;//like the real one
+
+#define STUB_CAN_HW_FIFO 3 //frames the controller buffers before it overruns
+
+typedef struct { volatile uint32_t MOD, CMR, GSR, ICR, IER, BTR, EWL, SR, RFS, RID, RDA, RDB, TFI1, TID1, TDA1, TDB1, TFI2, TID2, TDA2, TDB2, TFI3, TID3, TDA3, TDB3; } LPC_CAN_TypeDef;
+typedef struct { volatile uint32_t AFMR, SFF_sa, SFF_GRP_sa, EFF_sa, EFF_GRP_sa, ENDofTable, LUTerrAd, LUTerr, FCANIE, FCANIC0, FCANIC1; } LPC_CANAF_TypeDef;
+typedef struct { volatile uint32_t mask[512]; } LPC_CANAF_RAM_TypeDef;
+typedef struct { volatile uint32_t CANTxSR, CANRxSR, CANMSR; } LPC_CANCR_TypeDef;
+
+extern LPC_CAN_TypeDef stubCAN1;
+extern LPC_CAN_TypeDef stubCAN2;
+extern LPC_CANAF_TypeDef stubCANAF;
+extern LPC_CANAF_RAM_TypeDef stubCANAFRAM;
+extern LPC_CANCR_TypeDef stubCANCR;
+#define LPC_CAN1 (&stubCAN1)
+#define LPC_CAN2 (&stubCAN2)
+#define LPC_CANAF (&stubCANAF)
+#define LPC_CANAF_RAM (&stubCANAFRAM)
+#define LPC_CANCR (&stubCANCR)
+
+typedef int IRQn_Type;
+enum { CAN_IRQn = 25 };
+inline void NVIC_DisableIRQ(IRQn_Type) {}
+inline void NVIC_EnableIRQ(IRQn_Type) {}
+inline void NVIC_SetPriority(IRQn_Type, uint32_t) {}
+#define SystemCoreClock 96000000
+
+extern std::recursive_mutex stubIRQLock;
+extern thread_local uint32_t stubPRIMASK;
+extern thread_local uint32_t stubIPSR;
+
+inline void __DMB() { std::atomic_thread_fence(std::memory_order_seq_cst); }
+inline uint32_t __get_IPSR() { return stubIPSR; }
+inline uint32_t __get_PRIMASK() { return stubPRIMASK; }
+inline void __disable_irq()
+{
+	if(stubPRIMASK == 0)
+	{
+		stubIRQLock.lock();
+		stubPRIMASK = 1;
+	}
+}
+inline void __enable_irq()
+{
+	if(stubPRIMASK != 0)
+	{
+		stubPRIMASK = 0;
+		stubIRQLock.unlock();
+	}
+}
+inline void __set_PRIMASK(uint32_t primask)
+{
+	if(primask != 0)
+	{
+		__disable_irq();
+	}
+	else
+	{
+		__enable_irq();
+	}
+}
+inline uint32_t __CLZ(uint32_t value) { return (value != 0) ? __builtin_clz(value) : 32; }
+
+void stubRunISR(const std::function<void()> &handler);//runs handler the way the NVIC would, with IPSR set and other ISRs locked out
+
+void wait(float s);
+void wait_ms(int ms);
+void wait_us(int us);
+
+enum CANFormat { CANStandard = 0, CANExtended = 1, CANAny = 2 };
+enum CANType { CANData = 0, CANRemote = 1 };
+
+struct CAN_Message
+{
+	unsigned int id;
+	unsigned char data[8];
+	unsigned char len;
+	CANFormat format;
+	CANType type;
+};
+
+class CANMessage : public CAN_Message
+{
+	public:
+		CANMessage() { id = 0; len = 8; format = CANStandard; type = CANData; memset(data, 0, 8); }
+		CANMessage(unsigned int _id, const char *_data, char _len = 8, CANType _type = CANData, CANFormat _format = CANStandard)
+		{
+			id = _id; len = (_len & 0xF); format = _format; type = _type; memset(data, 0, 8); memcpy(data, _data, (len > 8) ? 8 : len);
+		}
+		CANMessage(unsigned int _id, CANFormat _format = CANStandard) { id = _id; len = 0; format = _format; type = CANRemote; memset(data, 0, 8); }
+};
+
+struct can_s { LPC_CAN_TypeDef *dev; int index; };
+typedef struct can_s can_t;
+
+class CAN
+{
+	public:
+		enum IrqType { RxIrq = 0, TxIrq, EwIrq, DoIrq, WuIrq, EpIrq, AlIrq, BeIrq, IdIrq };
+		enum Mode { Reset = 0, Normal, Silent, LocalTest, GlobalTest, SilentTest };
+
+		CAN(LPC_CAN_TypeDef *controller = LPC_CAN1);
+		int frequency(int hz) { _frequency = hz; return 1; }
+		int write(CANMessage msg);
+		int read(CANMessage &msg, int handle = 0);
+		void reset() {}
+		void monitor(bool silent) { _silent = silent; }
+		int mode(Mode) { return 1; }
+		unsigned char rderror() { return 0; }
+		unsigned char tderror() { return 0; }
+		void attach(void (*fptr)(void), IrqType type = RxIrq);
+		template<typename T> void attach(T *object, void (T::*member)(void), IrqType type = RxIrq)
+		{
+			std::lock_guard<std::mutex> guard(_lock);
+			_irq[type] = [object, member]() { (object->*member)(); };
+		}
+
+		// test side of the model
+		bool inject(const CANMessage &msg);//puts a frame in the RX FIFO, false and a data overrun if it is full
+		bool fire(IrqType type);//runs the attached handler as an interrupt, false if nothing is attached
+		uint32_t rxPending();
+		std::vector<CANMessage> takeSent();
+
+		can_t _can;//public here so the firmware can find the controller without the access trick
+
+	private:
+		std::mutex _lock;
+		std::function<void()> _irq[9];
+		std::deque<CANMessage> _rxFifo;
+		std::vector<CANMessage> _sent;
+		int _frequency;
+		bool _silent;
+};
+
+class Ticker
+{
+	public:
+		void attach(void (*)(void), float) {}
+		template<typename T> void attach(T *, void (T::*)(void), float) {}
+		void attach_us(void (*)(void), uint32_t) {}
+		template<typename T> void attach_us(T *, void (T::*)(void), uint32_t) {}
+		void detach() {}
+};
+
+class Timer
+{
+	public:
+		Timer() { _start = 0; _running = false; }
+		void start();
+		void stop() { _running = false; }
+		void reset();
+		int read_ms();
+		int read_us();
+		float read() { return (read_us() / 1000000.0f); }
+	private:
+		uint32_t _start;
+		bool _running;
+};
+
+typedef int PinName;
+static const PinName NC = -1;
+enum { P0_0 = 0, P0_1, P0_2, P0_3, P0_4, P0_5, P0_6, P0_7, P0_8, P0_9, P0_10, P0_11, P0_15 = 15, P0_16, P0_17, P0_18, P0_19, P0_20, P0_21, P0_22, P0_23, P0_24, P0_25, P0_26, P0_27, P0_28, P0_29, P0_30 };
+enum { P1_0 = 32, P1_1, P1_4 = 36, P1_8 = 40, P1_9, P1_10, P1_14 = 46, P1_15, P1_16, P1_17, P1_18, P1_19, P1_20, P1_21, P1_22, P1_23, P1_24, P1_25, P1_26, P1_27, P1_28, P1_29, P1_30, P1_31 };
+enum { P2_0 = 64, P2_1, P2_2, P2_3, P2_4, P2_5, P2_6, P2_7, P2_8, P2_9, P2_10, P2_11, P2_12, P2_13 };
+enum { P3_25 = 121, P3_26, P4_28 = 156, P4_29 };
+
+void error(const char *format, ...);//prints and aborts, like the mbed one halts
+
+class DigitalIn
+{
+	public:
+		DigitalIn(PinName) {}
+		int read() { return 0; }
+		operator int() { return 0; }
+};
+
+extern void (*stubDigitalOutHook)(PinName pin, int value);//lets a device model see its chip select
+
+class DigitalOut
+{
+	public:
+		DigitalOut(PinName pin, int value = 0) { _pin = pin; _value = value; }
+		void write(int value) { _value = value; if(stubDigitalOutHook != NULL) { stubDigitalOutHook(_pin, value); } }
+		int read() { return _value; }
+		DigitalOut& operator=(int value) { write(value); return *this; }
+		operator int() { return _value; }
+	private:
+		PinName _pin;
+		int _value;
+};
+
+#endif
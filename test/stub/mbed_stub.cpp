@@ -0,0 +1,239 @@
+/*
+* CanBadger Host Test Stubs
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "mbed.h"
+#include "rtos.h"
+#include "us_ticker_api.h"
+#include <chrono>
+#include <thread>
+
+LPC_CAN_TypeDef stubCAN1;
+LPC_CAN_TypeDef stubCAN2;
+LPC_CANAF_TypeDef stubCANAF;
+LPC_CANAF_RAM_TypeDef stubCANAFRAM;
+LPC_CANCR_TypeDef stubCANCR;
+
+void (*stubDigitalOutHook)(PinName pin, int value) = NULL;
+
+std::recursive_mutex stubIRQLock;
+thread_local uint32_t stubPRIMASK = 0;
+thread_local uint32_t stubIPSR = 0;
+
+static const std::chrono::steady_clock::time_point stubEpoch = std::chrono::steady_clock::now();
+
+uint32_t us_ticker_read()
+{
+	return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - stubEpoch).count();
+}
+
+void stubRunISR(const std::function<void()> &handler)
+{
+	std::lock_guard<std::recursive_mutex> guard(stubIRQLock);
+	uint32_t ipsr = stubIPSR;
+	stubIPSR = (CAN_IRQn + 16);
+	handler();
+	stubIPSR = ipsr;
+}
+
+void error(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	abort();
+}
+
+void wait(float s)
+{
+	std::this_thread::sleep_for(std::chrono::microseconds((int64_t)(s * 1000000)));
+}
+
+void wait_ms(int ms)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void wait_us(int us)
+{
+	std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+CAN::CAN(LPC_CAN_TypeDef *controller)
+{
+	_can.dev = controller;
+	_can.index = (controller == LPC_CAN2) ? 1 : 0;
+	_frequency = 500000;
+	_silent = false;
+}
+
+int CAN::write(CANMessage msg)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	_sent.push_back(msg);
+	return 1;
+}
+
+int CAN::read(CANMessage &msg, int)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	if(_rxFifo.empty())
+	{
+		return 0;
+	}
+	CANFormat wanted = msg.format;
+	msg = _rxFifo.front();
+	_rxFifo.pop_front();
+	if(wanted != CANAny && wanted != msg.format)//mbed drops frames of the other format
+	{
+		return 0;
+	}
+	return 1;
+}
+
+void CAN::attach(void (*fptr)(void), IrqType type)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	if(fptr == NULL)
+	{
+		_irq[type] = std::function<void()>();
+	}
+	else
+	{
+		_irq[type] = fptr;
+	}
+}
+
+bool CAN::inject(const CANMessage &msg)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	if(_rxFifo.size() >= STUB_CAN_HW_FIFO)
+	{
+		return false;
+	}
+	_rxFifo.push_back(msg);
+	return true;
+}
+
+bool CAN::fire(IrqType type)
+{
+	std::function<void()> handler;
+	{
+		std::lock_guard<std::mutex> guard(_lock);
+		handler = _irq[type];
+	}
+	if(!handler)
+	{
+		return false;
+	}
+	stubRunISR(handler);
+	return true;
+}
+
+uint32_t CAN::rxPending()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	return _rxFifo.size();
+}
+
+std::vector<CANMessage> CAN::takeSent()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	std::vector<CANMessage> sent;
+	sent.swap(_sent);
+	return sent;
+}
+
+void Timer::start()
+{
+	if(!_running)
+	{
+		_start = us_ticker_read();
+		_running = true;
+	}
+}
+
+void Timer::reset()
+{
+	_start = us_ticker_read();
+}
+
+int Timer::read_us()
+{
+	return (int)(us_ticker_read() - _start);
+}
+
+int Timer::read_ms()
+{
+	return (read_us() / 1000);
+}
+
+osThreadId osThreadGetId()
+{
+	static thread_local StubThreadState state;
+	return &state;
+}
+
+int32_t osSignalSet(osThreadId thread, int32_t signals)
+{
+	std::lock_guard<std::mutex> guard(thread->lock);
+	int32_t previous = thread->signals;
+	thread->signals |= signals;
+	thread->wake.notify_all();
+	return previous;
+}
+
+osEvent Thread::signal_wait(int32_t signals, uint32_t millisec)
+{
+	osThreadId self = osThreadGetId();
+	std::unique_lock<std::mutex> guard(self->lock);
+	osEvent event;
+	auto ready = [self, signals]() { return ((self->signals & signals) == signals); };
+	bool got;
+	if(millisec == osWaitForever)
+	{
+		self->wake.wait(guard, ready);
+		got = true;
+	}
+	else
+	{
+		got = self->wake.wait_for(guard, std::chrono::milliseconds(millisec), ready);
+	}
+	event.status = got ? 0x08 : 0x40;//osEventSignal, osEventTimeout
+	event.value.signals = self->signals;
+	if(got)
+	{
+		self->signals &= ~signals;
+	}
+	return event;
+}
+
+void Thread::wait(uint32_t millisec)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(millisec));
+}
+
+void Thread::yield()
+{
+	std::this_thread::yield();
+}
@@ -0,0 +1,68 @@
+/*
+* CanBadger Host Test Stubs
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Thread signals of CMSIS-RTOS RTX on top of std::thread, so consumers that block on a signal can be tested against a
+producer running on another host thread.
+*/
+
+#ifndef __STUB_RTOS_H__
+#define __STUB_RTOS_H__
+
+#include "mbed.h"
+#include <condition_variable>
+
+#define osWaitForever 0xFFFFFFFF
+
+struct StubThreadState
+{
+	std::mutex lock;
+	std::condition_variable wake;
+	int32_t signals;
+};
+
+typedef StubThreadState* osThreadId;
+
+struct osEvent
+{
+	uint32_t status;
+	union
+	{
+		int32_t signals;
+		void *p;
+	} value;
+};
+
+osThreadId osThreadGetId();
+
+int32_t osSignalSet(osThreadId thread, int32_t signals);
+
+class Thread
+{
+	public:
+		static osEvent signal_wait(int32_t signals, uint32_t millisec = osWaitForever);
+		static void wait(uint32_t millisec);
+		static void yield();
+};
+
+#endif
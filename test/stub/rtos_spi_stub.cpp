@@ -0,0 +1,72 @@
+/*
+* CanBadger Host Test Stubs
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "RTOS_SPI.h"
+
+StubSPIDevice *stubSPIDefaultDevice = NULL;
+
+RTOS_SPI::RTOS_SPI(PinName, PinName, PinName, PinName)
+{
+	_device = stubSPIDefaultDevice;
+	_hz = 1000000;
+	clearStats();
+}
+
+void RTOS_SPI::clearStats()
+{
+	memset(&_stats, 0, sizeof(_stats));
+}
+
+uint8_t RTOS_SPI::clock(uint8_t mosi)
+{
+	_stats.busNs += (8000000000ULL / (uint64_t)_hz);
+	return (_device != NULL) ? _device->exchange(mosi) : 0xFF;
+}
+
+int RTOS_SPI::write(int value)
+{
+	_stats.loopBytes++;
+	return clock((uint8_t)value);
+}
+
+void RTOS_SPI::bulkWrite(uint8_t *write_data, int length, bool array)
+{
+	_stats.dmaTransfers++;
+	_stats.dmaFromISR += (__get_IPSR() != 0);
+	for(int a = 0; a < length; a++)
+	{
+		clock(array ? write_data[a] : write_data[0]);
+	}
+	_stats.dmaBytes += length;
+}
+
+void RTOS_SPI::bulkReadWrite(uint8_t *read_data, uint8_t *write_data, int length, bool array)
+{
+	_stats.dmaTransfers++;
+	_stats.dmaFromISR += (__get_IPSR() != 0);
+	for(int a = 0; a < length; a++)
+	{
+		read_data[a] = clock(array ? write_data[a] : write_data[0]);
+	}
+	_stats.dmaBytes += length;
+}
@@ -0,0 +1,94 @@
+/*
+* CanBadger Host Tests
+* Copyright (c) 2021 Noelscher Consulting GmbH
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+Shared bits of the host tests. Each test is its own program: it runs its cases, prints a line per failed check and one
+summary line, and exits non-zero if anything failed, so make check stops at the first broken module.
+*/
+
+#ifndef __TEST_COMMON_H__
+#define __TEST_COMMON_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+static int testChecks = 0;
+static int testFailures = 0;
+
+#define CHECK(cond) testCheck((cond), #cond, __FILE__, __LINE__)
+#define CHECK_EQUAL(expected, actual) testCheckEqual((uint64_t)(expected), (uint64_t)(actual), #actual, __FILE__, __LINE__)
+
+static inline bool testCheck(bool ok, const char *what, const char *file, int line)
+{
+	testChecks++;
+	if(!ok)
+	{
+		testFailures++;
+		printf("FAIL %s:%d: %s\n", file, line, what);
+	}
+	return ok;
+}
+
+static inline bool testCheckEqual(uint64_t expected, uint64_t actual, const char *what, const char *file, int line)
+{
+	testChecks++;
+	if(expected != actual)
+	{
+		testFailures++;
+		printf("FAIL %s:%d: %s is 0x%llX, expected 0x%llX\n", file, line, what, (unsigned long long)actual, (unsigned long long)expected);
+		return false;
+	}
+	return true;
+}
+
+static inline int testResult(const char *name)
+{
+	printf("%s: %d checks, %d failed\n", name, testChecks, testFailures);
+	return (testFailures != 0) ? 1 : 0;
+}
+
+// make bench passes "bench", tests then run their benchmarks with bigger workloads
+static inline bool testBenchMode(int argc, char **argv)
+{
+	return (argc > 1 && strcmp(argv[1], "bench") == 0);
+}
+
+// wall clock in ns, for the benchmarks
+static inline uint64_t testNowNs()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// xorshift, so every run sees the same "random" data
+static inline uint32_t testRandom()
+{
+	static uint32_t state = 0x12345678;
+	state ^= (state << 13);
+	state ^= (state >> 17);
+	state ^= (state << 5);
+	return state;
+}
+
+#endif